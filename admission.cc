@@ -0,0 +1,120 @@
+#include "admission.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+
+#include "bcrypt.h"
+
+namespace bcrypt {
+namespace {
+// Weight of the last job in the running estimate of the cost unit.
+constexpr double kCostUnitAlpha = 0.05;
+
+// Returns the nanoseconds of CPU time per HashCost unit, timing a few hashes
+// with the fewest rounds.
+double
+MeasureCostUnit()
+{
+  constexpr std::uint32_t kRounds = 4;
+  constexpr int kHashes = 4;
+  const Salt salt{};
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kHashes; ++i)
+    GenHash("password", salt, kRounds);
+  const std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / (kHashes * HashCost(kRounds));
+}
+} // namespace
+
+///////////////////////////////////////////////////////////////////////////////
+// AdmissionController::Ticket
+///////////////////////////////////////////////////////////////////////////////
+
+AdmissionController::Ticket::Ticket(Ticket&& other) noexcept
+  : controller_(std::exchange(other.controller_, nullptr)),
+    cost_(other.cost_),
+    start_(other.start_)
+{}
+
+AdmissionController::Ticket::~Ticket()
+{
+  if (not controller_) return;
+  std::optional<std::chrono::nanoseconds> elapsed;
+  if (start_) elapsed = Clock::now() - *start_;
+  controller_->Release(cost_, elapsed);
+}
+
+void
+AdmissionController::Ticket::Start() noexcept
+{
+  start_ = Clock::now();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// AdmissionController
+///////////////////////////////////////////////////////////////////////////////
+
+AdmissionController::AdmissionController(AdmissionOptions options)
+  : max_inflight_(
+        std::chrono::nanoseconds(options.max_inflight).count()),
+    max_queue_delay_(
+        std::chrono::nanoseconds(options.max_queue_delay).count()),
+    workers_(options.workers
+        ? options.workers
+        : std::max(1u, std::thread::hardware_concurrency())),
+    cost_unit_(options.cost_unit.count() > 0 ? options.cost_unit.count()
+                                             : MeasureCostUnit())
+{}
+
+std::optional<AdmissionController::Ticket>
+AdmissionController::TryAdmit(std::uint32_t rounds)
+{
+  const auto cost = HashCost(rounds);
+  std::lock_guard lock(mutex_);
+  if (inflight_ > 0) {
+    const auto inflight = (inflight_ + cost) * cost_unit_;
+    const auto queue_delay = inflight_ * cost_unit_ / workers_;
+    if (inflight > max_inflight_ or queue_delay > max_queue_delay_) {
+      ++rejected_;
+      return std::nullopt;
+    }
+  }
+  inflight_ += cost;
+  ++admitted_;
+  return Ticket(this, cost);
+}
+
+AdmissionStats
+AdmissionController::Stats() const
+{
+  std::lock_guard lock(mutex_);
+  AdmissionStats stats;
+  stats.admitted = admitted_;
+  stats.rejected = rejected_;
+  stats.inflight = std::chrono::nanoseconds(
+      static_cast<std::int64_t>(inflight_ * cost_unit_));
+  stats.cost_unit =
+      std::chrono::nanoseconds(static_cast<std::int64_t>(cost_unit_));
+  return stats;
+}
+
+void
+AdmissionController::Release(
+    double cost, std::optional<std::chrono::nanoseconds> elapsed)
+{
+  std::lock_guard lock(mutex_);
+  inflight_ = std::max(0.0, inflight_ - cost);
+  if (elapsed) {
+    const auto unit = elapsed->count() / cost;
+    cost_unit_ += kCostUnitAlpha * (unit - cost_unit_);
+  }
+}
+
+} // namespace bcrypt
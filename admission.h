@@ -0,0 +1,108 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+
+#include "bcrypt.h"
+
+namespace bcrypt {
+
+struct AdmissionOptions {
+  // Most CPU time that the admitted jobs may still need. Jobs that would go
+  // over it are rejected.
+  std::chrono::milliseconds max_inflight{500};
+
+  // Most time a new job should expect to wait before a worker picks it up.
+  // The wait is estimated as the CPU time in flight over the workers.
+  std::chrono::milliseconds max_queue_delay{100};
+
+  // Number of threads that run the admitted jobs, or one per core if 0.
+  std::size_t workers = 0;
+
+  // CPU time of one HashCost unit to start with, or measured with GenHash if
+  // 0. The estimate follows the run time of the jobs that report it.
+  std::chrono::nanoseconds cost_unit{0};
+};
+
+struct AdmissionStats {
+  std::uint64_t admitted = 0;
+  std::uint64_t rejected = 0;
+
+  // Estimated CPU time that the admitted jobs still need.
+  std::chrono::nanoseconds inflight{0};
+
+  // Current estimate of the CPU time of one HashCost unit.
+  std::chrono::nanoseconds cost_unit{0};
+};
+
+// Sheds hashing jobs under overload, so that a flood of logins is rejected
+// quickly instead of queueing until every login times out. Each job is
+// charged its estimated CPU time, HashCost(rounds) times the cost unit, while
+// it is in flight. A job is rejected if it would put the CPU time in flight
+// over max_inflight, or the expected queue delay over max_queue_delay. A job
+// is always admitted when nothing is in flight, so no cost is too large to
+// ever run.
+class AdmissionController {
+public:
+  // Holds the CPU time of an admitted job until it is destroyed.
+  class Ticket {
+  public:
+    Ticket(Ticket&& other) noexcept;
+    Ticket& operator=(Ticket&&) = delete;
+
+    // Releases the CPU time of the job.
+    ~Ticket();
+
+    // Marks the start of the job. When the ticket is destroyed, the time
+    // since then refines the cost unit.
+    void
+    Start() noexcept;
+
+  private:
+    friend class AdmissionController;
+
+    using Clock = std::chrono::steady_clock;
+
+    Ticket(AdmissionController* controller, double cost) noexcept
+      : controller_(controller), cost_(cost)
+    {}
+
+    AdmissionController* controller_;
+    double cost_;
+    std::optional<Clock::time_point> start_;
+  };
+
+  explicit AdmissionController(AdmissionOptions options = {});
+
+  AdmissionController(const AdmissionController&) = delete;
+  AdmissionController& operator=(const AdmissionController&) = delete;
+
+  // Returns a ticket if a job with the given number of rounds is admitted.
+  std::optional<Ticket>
+  TryAdmit(std::uint32_t rounds);
+
+  AdmissionStats
+  Stats() const;
+
+private:
+  // Releases the cost of a job, which ran for elapsed if it is set.
+  void
+  Release(double cost, std::optional<std::chrono::nanoseconds> elapsed);
+
+  const double max_inflight_;
+  const double max_queue_delay_;
+  const std::size_t workers_;
+
+  mutable std::mutex mutex_;
+  // Nanoseconds of CPU time per HashCost unit.
+  double cost_unit_;
+  // Sum of the HashCost of the admitted jobs.
+  double inflight_ = 0;
+  std::uint64_t admitted_ = 0;
+  std::uint64_t rejected_ = 0;
+};
+
+} // namespace bcrypt
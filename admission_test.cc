@@ -0,0 +1,102 @@
+#include "admission.h"
+
+#include <chrono>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "bcrypt.h"
+#include "gmock/gmock.h"
+
+namespace bcrypt {
+namespace {
+
+using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
+
+// With a cost unit of 1ms, a job with 4 rounds needs 9ms of CPU time.
+AdmissionOptions
+Options(milliseconds max_inflight, milliseconds max_queue_delay,
+        std::size_t workers = 1)
+{
+  return {.max_inflight = max_inflight,
+          .max_queue_delay = max_queue_delay,
+          .workers = workers,
+          .cost_unit = milliseconds(1)};
+}
+
+TEST(AdmissionControllerTest, AdmitsJobsWithinBudget) {
+  AdmissionController admission(Options(milliseconds(20), milliseconds(100)));
+  auto first = admission.TryAdmit(4);
+  auto second = admission.TryAdmit(4);
+  EXPECT_TRUE(first);
+  EXPECT_TRUE(second);
+  EXPECT_EQ(admission.Stats().inflight, milliseconds(18));
+}
+
+TEST(AdmissionControllerTest, RejectsJobsOverBudget) {
+  AdmissionController admission(Options(milliseconds(20), milliseconds(100)));
+  auto first = admission.TryAdmit(4);
+  auto second = admission.TryAdmit(4);
+  EXPECT_FALSE(admission.TryAdmit(4));
+
+  const auto stats = admission.Stats();
+  EXPECT_EQ(stats.admitted, 2);
+  EXPECT_EQ(stats.rejected, 1);
+}
+
+TEST(AdmissionControllerTest, RejectsJobsOverQueueDelay) {
+  // 2 jobs in flight over 2 workers is a 9ms wait.
+  AdmissionController admission(
+      Options(milliseconds(100), milliseconds(5), 2));
+  std::vector<AdmissionController::Ticket> tickets;
+  tickets.push_back(*admission.TryAdmit(4));
+  EXPECT_TRUE(admission.TryAdmit(4));
+  tickets.push_back(*admission.TryAdmit(4));
+  EXPECT_FALSE(admission.TryAdmit(4));
+}
+
+TEST(AdmissionControllerTest, ReleasesCostWhenTicketIsDestroyed) {
+  AdmissionController admission(Options(milliseconds(10), milliseconds(100)));
+  {
+    auto ticket = admission.TryAdmit(4);
+    ASSERT_TRUE(ticket);
+    EXPECT_FALSE(admission.TryAdmit(4));
+  }
+  EXPECT_EQ(admission.Stats().inflight, nanoseconds(0));
+  EXPECT_TRUE(admission.TryAdmit(4));
+}
+
+TEST(AdmissionControllerTest, MovedFromTicketDoesNotRelease) {
+  AdmissionController admission(Options(milliseconds(10), milliseconds(100)));
+  auto ticket = admission.TryAdmit(4);
+  {
+    auto moved = std::move(*ticket);
+    ticket.reset();
+    EXPECT_EQ(admission.Stats().inflight, milliseconds(9));
+  }
+  EXPECT_EQ(admission.Stats().inflight, nanoseconds(0));
+}
+
+TEST(AdmissionControllerTest, AdmitsAnyJobWhenIdle) {
+  AdmissionController admission(Options(milliseconds(1), milliseconds(1)));
+  EXPECT_TRUE(admission.TryAdmit(31));
+}
+
+TEST(AdmissionControllerTest, CostUnitFollowsRunTime) {
+  AdmissionController admission(Options(milliseconds(10), milliseconds(100)));
+  // A job that takes no time lowers the estimate.
+  {
+    auto ticket = admission.TryAdmit(4);
+    ticket->Start();
+  }
+  EXPECT_LT(admission.Stats().cost_unit, milliseconds(1));
+}
+
+TEST(AdmissionControllerTest, MeasuresCostUnitIfNotSet) {
+  AdmissionController admission;
+  EXPECT_GT(admission.Stats().cost_unit, nanoseconds(0));
+}
+
+} // namespace
+} // namespace bcrypt
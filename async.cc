@@ -0,0 +1,206 @@
+#include "async.h"
+
+#include <algorithm>
+#include <coroutine>
+#include <functional>
+#include <future>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "admission.h"
+#include "bcrypt.h"
+#include "kernel.h"
+#include "metrics.h"
+#include "thread_pool.h"
+#include "tracing.h"
+
+namespace bcrypt {
+namespace {
+// Clears the password before releasing it, including what is left in the
+// small string buffer after it was moved out, and empties pwd.
+void
+ClearPwd(std::string* pwd) noexcept
+{
+  pwd->resize(pwd->capacity());
+  std::fill(pwd->begin(), pwd->end(), 0);
+  pwd->clear();
+}
+
+// Copy of a password captured by a task. The task is moved into the executor
+// and may be copied by std::function, so each copy clears its password, and
+// a move clears the source.
+struct PwdCopy {
+  explicit PwdCopy(std::string_view pwd) : str(pwd) {}
+  PwdCopy(const PwdCopy&) = default;
+  PwdCopy(PwdCopy&& other) noexcept : str(std::move(other.str))
+  {
+    ClearPwd(&other.str);
+  }
+  ~PwdCopy() { ClearPwd(&str); }
+
+  std::string str;
+};
+
+// Returns the HashCost of verifying against arr.
+double
+VerifyCost(const BcryptArr& arr) noexcept
+{
+  const auto params = DecodeParams(arr);
+  return params ? HashCost(params->rounds) : 0;
+}
+} // namespace
+
+Executor&
+DefaultExecutor()
+{
+  static ThreadPool pool;
+  return pool;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// VerifyAwaitable
+///////////////////////////////////////////////////////////////////////////////
+
+VerifyAwaitable::VerifyAwaitable(
+    const PwdHasher& pwd_hasher,
+    Executor& executor,
+    std::string_view pwd,
+    const BcryptArr& arr)
+  : pwd_hasher_(pwd_hasher), executor_(executor), pwd_(pwd), arr_(arr)
+{}
+
+VerifyAwaitable::VerifyAwaitable(VerifyAwaitable&& other) noexcept
+  : pwd_hasher_(other.pwd_hasher_),
+    executor_(other.executor_),
+    resume_executor_(other.resume_executor_),
+    pwd_(std::move(other.pwd_)),
+    arr_(other.arr_),
+    result_(other.result_)
+{
+  ClearPwd(&other.pwd_);
+}
+
+VerifyAwaitable::~VerifyAwaitable()
+{
+  ClearPwd(&pwd_);
+}
+
+VerifyAwaitable
+VerifyAwaitable::ResumeOn(Executor& executor) && noexcept
+{
+  resume_executor_ = &executor;
+  return std::move(*this);
+}
+
+void
+VerifyAwaitable::await_suspend(std::coroutine_handle<> handle)
+{
+  // The awaitable lives in the coroutine frame until it is resumed.
+  executor_.SubmitWithCost([this, handle, queued = TraceStart()] {
+    TraceEnd("queue", queued);
+    result_ = pwd_hasher_.IsSamePwd(pwd_, arr_);
+    ClearPwd(&pwd_);
+    if (resume_executor_)
+      resume_executor_->Submit(handle);
+    else
+      handle.resume();
+  }, VerifyCost(arr_));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// AsyncPwdHasher
+///////////////////////////////////////////////////////////////////////////////
+
+AsyncPwdHasher::AsyncPwdHasher()
+  : AsyncPwdHasher(PwdHasher(), DefaultExecutor())
+{}
+
+AsyncPwdHasher::AsyncPwdHasher(PwdHasher pwd_hasher, Executor& executor)
+  : pwd_hasher_(std::move(pwd_hasher)), executor_(executor)
+{}
+
+std::future<bool>
+AsyncPwdHasher::IsSamePwd(std::string_view pwd, const BcryptArr& arr) const
+{
+  auto promise = std::make_shared<std::promise<bool>>();
+  auto future = promise->get_future();
+  IsSamePwd(pwd, arr, [promise](bool same) { promise->set_value(same); });
+  return future;
+}
+
+void
+AsyncPwdHasher::IsSamePwd(
+    std::string_view pwd,
+    const BcryptArr& arr,
+    std::function<void(bool)> done) const
+{
+  executor_.SubmitWithCost(
+      [this, pwd = PwdCopy(pwd), arr, done = std::move(done),
+       queued = TraceStart()]() mutable {
+        TraceEnd("queue", queued);
+        const auto same = pwd_hasher_.IsSamePwd(pwd.str, arr);
+        ClearPwd(&pwd.str);
+        done(same);
+      },
+      VerifyCost(arr));
+}
+
+std::future<VerifyStatus>
+AsyncPwdHasher::Verify(
+    std::string_view pwd,
+    const BcryptArr& arr,
+    AdmissionController& admission) const
+{
+  auto promise = std::make_shared<std::promise<VerifyStatus>>();
+  auto future = promise->get_future();
+  Verify(pwd, arr, admission,
+         [promise](VerifyStatus status) { promise->set_value(status); });
+  return future;
+}
+
+void
+AsyncPwdHasher::Verify(
+    std::string_view pwd,
+    const BcryptArr& arr,
+    AdmissionController& admission,
+    std::function<void(VerifyStatus)> done) const
+{
+  const auto params = pwd.empty() ? std::nullopt : DecodeBcrypt(arr);
+  if (not params) {
+    RecordVerify(VerifyStatus::kInvalidHash);
+    done(VerifyStatus::kInvalidHash);
+    return;
+  }
+  auto ticket = admission.TryAdmit(params->rounds);
+  if (not ticket) {
+    RecordVerify(VerifyStatus::kOverloaded);
+    done(VerifyStatus::kOverloaded);
+    return;
+  }
+
+  // std::function needs a copyable callable, so the ticket is shared.
+  executor_.SubmitWithCost(
+      [this, pwd = PwdCopy(pwd), arr, done = std::move(done),
+       ticket = std::make_shared<AdmissionController::Ticket>(
+           std::move(*ticket)),
+       queued = TraceStart()]() mutable {
+        TraceEnd("queue", queued);
+        ticket->Start();
+        const auto status = pwd_hasher_.Verify(pwd.str, arr);
+        ClearPwd(&pwd.str);
+        ticket.reset();
+        done(status);
+      },
+      HashCost(params->rounds));
+}
+
+VerifyAwaitable
+AsyncPwdHasher::AwaitIsSamePwd(std::string_view pwd, const BcryptArr& arr) const
+{
+  return VerifyAwaitable(pwd_hasher_, executor_, pwd, arr);
+}
+
+} // namespace bcrypt
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <coroutine>
+#include <functional>
+#include <future>
+#include <string>
+#include <string_view>
+
+#include "admission.h"
+#include "bcrypt.h"
+#include "thread_pool.h"
+
+namespace bcrypt {
+
+// Returns the executor that AsyncPwdHasher uses unless it is given another
+// one: a ThreadPool with one worker per core, started on first use.
+Executor&
+DefaultExecutor();
+
+// Awaitable result of AsyncPwdHasher::AwaitIsSamePwd. The awaiting coroutine
+// is suspended while the password is hashed on the executor. It is resumed on
+// the executor's thread, or on the executor given to ResumeOn, e.g. one that
+// posts to the caller's event loop.
+class [[nodiscard]] VerifyAwaitable {
+public:
+  VerifyAwaitable(
+      const PwdHasher& pwd_hasher,
+      Executor& executor,
+      std::string_view pwd,
+      const BcryptArr& arr);
+
+  // Clears the copy of the password.
+  ~VerifyAwaitable();
+
+  // Clears the password left in other, e.g. by ResumeOn.
+  VerifyAwaitable(VerifyAwaitable&& other) noexcept;
+  VerifyAwaitable& operator=(VerifyAwaitable&&) = delete;
+
+  // Resumes the awaiting coroutine on executor once the hash is done.
+  VerifyAwaitable
+  ResumeOn(Executor& executor) && noexcept;
+
+  bool
+  await_ready() const noexcept { return false; }
+
+  void
+  await_suspend(std::coroutine_handle<> handle);
+
+  bool
+  await_resume() const noexcept { return result_; }
+
+private:
+  const PwdHasher& pwd_hasher_;
+  Executor& executor_;
+  Executor* resume_executor_ = nullptr;
+  std::string pwd_;
+  BcryptArr arr_;
+  bool result_ = false;
+};
+
+// Runs PwdHasher::IsSamePwd on an executor, so that the calling thread, e.g.
+// an event loop, is not blocked while the password is hashed. The password is
+// copied, so it only has to be valid for the duration of the call. The
+// AsyncPwdHasher must outlive the calls that are in flight.
+class AsyncPwdHasher {
+public:
+  // Hashes with a default PwdHasher on DefaultExecutor().
+  AsyncPwdHasher();
+
+  // Hashes with pwd_hasher on executor, which must outlive this object.
+  AsyncPwdHasher(PwdHasher pwd_hasher, Executor& executor);
+
+  // Returns a future for IsSamePwd(pwd, arr).
+  std::future<bool>
+  IsSamePwd(std::string_view pwd, const BcryptArr& arr) const;
+
+  // Calls done with IsSamePwd(pwd, arr) on the executor's thread.
+  void
+  IsSamePwd(
+      std::string_view pwd,
+      const BcryptArr& arr,
+      std::function<void(bool)> done) const;
+
+  // Returns a future for PwdHasher::Verify(pwd, arr) if admission admits the
+  // job. Otherwise the future is ready right away with kOverloaded, or with
+  // kInvalidHash if the hash cannot be decoded.
+  std::future<VerifyStatus>
+  Verify(
+      std::string_view pwd,
+      const BcryptArr& arr,
+      AdmissionController& admission) const;
+
+  // Like the above, but calls done with the status. done is called on the
+  // calling thread if the job is not admitted, and on the executor's thread
+  // otherwise.
+  void
+  Verify(
+      std::string_view pwd,
+      const BcryptArr& arr,
+      AdmissionController& admission,
+      std::function<void(VerifyStatus)> done) const;
+
+  // Returns an awaitable for IsSamePwd(pwd, arr), for use with co_await.
+  VerifyAwaitable
+  AwaitIsSamePwd(std::string_view pwd, const BcryptArr& arr) const;
+
+private:
+  PwdHasher pwd_hasher_;
+  Executor& executor_;
+};
+
+} // namespace bcrypt
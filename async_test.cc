@@ -0,0 +1,128 @@
+#include "async.h"
+
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <future>
+#include <thread>
+
+#include "admission.h"
+#include "bcrypt.h"
+#include "gmock/gmock.h"
+#include "thread_pool.h"
+
+namespace bcrypt {
+namespace {
+
+// A coroutine that starts right away and runs to completion on its own.
+struct Detached {
+  struct promise_type {
+    Detached get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+Detached
+AwaitIsSamePwd(const AsyncPwdHasher& hasher, const BcryptArr& arr,
+               std::promise<bool>* result)
+{
+  result->set_value(co_await hasher.AwaitIsSamePwd("password", arr));
+}
+
+Detached
+AwaitIsSamePwdOn(const AsyncPwdHasher& hasher, const BcryptArr& arr,
+                 Executor& executor, std::promise<std::thread::id>* thread)
+{
+  co_await hasher.AwaitIsSamePwd("password", arr).ResumeOn(executor);
+  thread->set_value(std::this_thread::get_id());
+}
+
+class AsyncPwdHasherTest : public testing::Test {
+protected:
+  AsyncPwdHasherTest()
+    : async_hasher_(PwdHasher(), pool_),
+      arr_(PwdHasher().Generate("password", 4))
+  {}
+
+  ThreadPool pool_{2};
+  AsyncPwdHasher async_hasher_;
+  BcryptArr arr_;
+};
+
+TEST_F(AsyncPwdHasherTest, FutureHasResult) {
+  EXPECT_TRUE(async_hasher_.IsSamePwd("password", arr_).get());
+  EXPECT_FALSE(async_hasher_.IsSamePwd("wrong", arr_).get());
+}
+
+TEST_F(AsyncPwdHasherTest, CallbackIsCalledWithResult) {
+  std::promise<bool> result;
+  async_hasher_.IsSamePwd("password", arr_,
+                          [&](bool same) { result.set_value(same); });
+  EXPECT_TRUE(result.get_future().get());
+}
+
+TEST_F(AsyncPwdHasherTest, PasswordOnlyNeedsToLiveForTheCall) {
+  std::future<bool> future;
+  {
+    std::string pwd = "password";
+    future = async_hasher_.IsSamePwd(pwd, arr_);
+    pwd = "changed!";
+  }
+  EXPECT_TRUE(future.get());
+}
+
+TEST_F(AsyncPwdHasherTest, CoroutineGetsResult) {
+  std::promise<bool> result;
+  AwaitIsSamePwd(async_hasher_, arr_, &result);
+  EXPECT_TRUE(result.get_future().get());
+}
+
+TEST_F(AsyncPwdHasherTest, CoroutineResumesOnGivenExecutor) {
+  ThreadPool loop(1);
+  std::promise<std::thread::id> loop_thread;
+  loop.Submit([&] { loop_thread.set_value(std::this_thread::get_id()); });
+
+  std::promise<std::thread::id> thread;
+  AwaitIsSamePwdOn(async_hasher_, arr_, loop, &thread);
+  EXPECT_EQ(thread.get_future().get(), loop_thread.get_future().get());
+}
+
+TEST_F(AsyncPwdHasherTest, VerifyWithAdmissionHasStatus) {
+  AdmissionController admission;
+  EXPECT_EQ(async_hasher_.Verify("password", arr_, admission).get(),
+            VerifyStatus::kMatch);
+  EXPECT_EQ(async_hasher_.Verify("wrong", arr_, admission).get(),
+            VerifyStatus::kMismatch);
+  EXPECT_EQ(async_hasher_.Verify("password", BcryptArr{}, admission).get(),
+            VerifyStatus::kInvalidHash);
+  EXPECT_EQ(admission.Stats().admitted, 2);
+}
+
+TEST_F(AsyncPwdHasherTest, VerifyIsShedWhenOverloaded) {
+  AdmissionController admission({.max_inflight = std::chrono::milliseconds(1),
+                                 .cost_unit = std::chrono::milliseconds(1)});
+  // Keep the first job in flight while the second one is submitted.
+  ThreadPool blocked(1);
+  std::promise<void> release;
+  blocked.Submit([&] { release.get_future().wait(); });
+  AsyncPwdHasher async_hasher(PwdHasher(), blocked);
+
+  auto first = async_hasher.Verify("password", arr_, admission);
+  auto second = async_hasher.Verify("password", arr_, admission);
+  EXPECT_EQ(second.get(), VerifyStatus::kOverloaded);
+  release.set_value();
+  EXPECT_EQ(first.get(), VerifyStatus::kMatch);
+  EXPECT_EQ(admission.Stats().rejected, 1);
+}
+
+TEST(DefaultExecutorTest, RunsTasks) {
+  std::promise<int> result;
+  DefaultExecutor().Submit([&] { result.set_value(1); });
+  EXPECT_EQ(result.get_future().get(), 1);
+}
+
+} // namespace
+} // namespace bcrypt
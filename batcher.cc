@@ -0,0 +1,199 @@
+#include "batcher.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "bcrypt.h"
+#include "metrics.h"
+#include "thread_pool.h"
+
+namespace bcrypt {
+namespace {
+// Clears the password, including what is left in the small string buffer
+// after it was moved out, and empties pwd.
+void
+ClearPwd(std::string* pwd) noexcept
+{
+  pwd->resize(pwd->capacity());
+  std::fill(pwd->begin(), pwd->end(), 0);
+  pwd->clear();
+}
+} // namespace
+
+MicroBatcher::MicroBatcher(
+    PwdHasher pwd_hasher, Executor& executor, BatcherOptions options)
+  : pwd_hasher_(std::move(pwd_hasher)),
+    executor_(executor),
+    max_wait_(options.max_wait),
+    batch_size_(options.batch_size ? options.batch_size
+                                   : KernelLanes(ActiveKernel())),
+    dispatcher_([this] { Run(); })
+{}
+
+MicroBatcher::~MicroBatcher()
+{
+  {
+    std::lock_guard lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_one();
+  dispatcher_.join();
+}
+
+std::future<BcryptArr>
+MicroBatcher::Generate(std::string_view pwd, std::uint32_t rounds)
+{
+  if (pwd.empty())
+    throw std::invalid_argument("Password cannot be empty.");
+  if (rounds < 4 or rounds > 31)
+    throw std::invalid_argument("rounds should be in the range [4, 31].");
+
+  auto promise = std::make_shared<std::promise<BcryptArr>>();
+  auto future = promise->get_future();
+  Job job{HashOp::kGenerate, std::string(pwd), {}, {}, {}};
+  job.done = [promise, rounds](const PwdHash& hash, const Salt& salt) {
+    promise->set_value(EncodeBcrypt(hash, salt, rounds));
+  };
+  Enqueue(rounds, std::move(job), true);
+  ClearPwd(&job.pwd);
+  return future;
+}
+
+std::future<bool>
+MicroBatcher::IsSamePwd(std::string_view pwd, const BcryptArr& arr)
+{
+  auto promise = std::make_shared<std::promise<bool>>();
+  auto future = promise->get_future();
+  const auto params = pwd.empty() ? std::nullopt : DecodeBcrypt(arr);
+  if (not params) {
+    RecordVerify(VerifyStatus::kInvalidHash);
+    promise->set_value(false);
+    return future;
+  }
+
+  Job job{HashOp::kVerify, std::string(pwd), params->salt, {}, {}};
+  job.done = [promise, expected = params->pwd_hash](const PwdHash& hash,
+                                                    const Salt&) {
+    const auto match = hash == expected;
+    RecordVerify(match ? VerifyStatus::kMatch : VerifyStatus::kMismatch);
+    promise->set_value(match);
+  };
+  Enqueue(params->rounds, std::move(job), false);
+  ClearPwd(&job.pwd);
+  return future;
+}
+
+BatcherStats
+MicroBatcher::Stats() const
+{
+  std::lock_guard lock(mutex_);
+  BatcherStats stats;
+  stats.jobs = jobs_;
+  stats.batches = batches_;
+  if (batches_ > 0) {
+    stats.fill_ratio = static_cast<double>(jobs_) / (batches_ * batch_size_);
+    stats.mean_queue_delay = total_delay_ / jobs_;
+  }
+  stats.max_queue_delay = max_delay_;
+  return stats;
+}
+
+void
+MicroBatcher::Enqueue(std::uint32_t rounds, Job job, bool gen_salt)
+{
+  {
+    std::lock_guard lock(mutex_);
+    // The salt is generated under the lock, so calls to GenSalt cannot
+    // overlap if the hasher was given its own generator.
+    if (gen_salt)
+      job.salt = pwd_hasher_.GenSalt();
+    job.queued = Clock::now();
+    groups_[rounds].push_back(std::move(job));
+  }
+  ClearPwd(&job.pwd);
+  cond_.notify_one();
+}
+
+void
+MicroBatcher::Dispatch(
+    std::uint32_t rounds, std::deque<Job>* group, Clock::time_point now)
+{
+  const auto size = std::min(batch_size_, group->size());
+  auto jobs = std::make_shared<std::vector<Job>>();
+  jobs->reserve(size);
+  for (std::size_t i = 0; i < size; ++i) {
+    auto& job = group->front();
+    const auto delay = now - job.queued;
+    total_delay_ += delay;
+    max_delay_ = std::max(max_delay_, delay);
+    jobs->push_back(std::move(job));
+    ClearPwd(&job.pwd);
+    group->pop_front();
+  }
+  jobs_ += size;
+  ++batches_;
+
+  executor_.SubmitWithCost([jobs, rounds] {
+    const auto size = jobs->size();
+    std::vector<std::string_view> pwds(size);
+    std::vector<Salt> salts(size);
+    std::vector<PwdHash> hashes(size);
+    std::uint64_t verifications = 0;
+    for (std::size_t i = 0; i < size; ++i) {
+      pwds[i] = (*jobs)[i].pwd;
+      salts[i] = (*jobs)[i].salt;
+      verifications += (*jobs)[i].op == HashOp::kVerify;
+    }
+    GenHashN(pwds, salts, rounds, hashes);
+    RecordHashes(HashOp::kGenerate, rounds, size - verifications);
+    RecordHashes(HashOp::kVerify, rounds, verifications);
+    for (std::size_t i = 0; i < size; ++i) {
+      auto& job = (*jobs)[i];
+      ClearPwd(&job.pwd);
+      job.done(hashes[i], job.salt);
+    }
+  }, HashCost(rounds) * size);
+}
+
+void
+MicroBatcher::Run()
+{
+  std::unique_lock lock(mutex_);
+  for (;;) {
+    const auto now = Clock::now();
+    auto deadline = Clock::time_point::max();
+    for (auto it = groups_.begin(); it != groups_.end();) {
+      auto& [rounds, group] = *it;
+      while (not group.empty()
+          and (stop_ or group.size() >= batch_size_
+               or now - group.front().queued >= max_wait_))
+        Dispatch(rounds, &group, now);
+      if (group.empty()) {
+        it = groups_.erase(it);
+        continue;
+      }
+      deadline = std::min(deadline, group.front().queued + max_wait_);
+      ++it;
+    }
+    if (stop_) return;
+    if (deadline == Clock::time_point::max())
+      cond_.wait(lock);
+    else
+      cond_.wait_until(lock, deadline);
+  }
+}
+
+} // namespace bcrypt
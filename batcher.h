@@ -0,0 +1,122 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "bcrypt.h"
+#include "metrics.h"
+#include "thread_pool.h"
+
+namespace bcrypt {
+
+struct BatcherOptions {
+  // The longest a job waits for its group to fill up before the group is
+  // dispatched anyway.
+  std::chrono::microseconds max_wait{200};
+
+  // Number of jobs in a full group, or the lanes of the active kernel if 0.
+  std::size_t batch_size = 0;
+};
+
+// Counters to tune BatcherOptions against the latency budget.
+struct BatcherStats {
+  // Number of jobs and groups dispatched so far.
+  std::uint64_t jobs = 0;
+  std::uint64_t batches = 0;
+
+  // Mean number of jobs per group over the batch size, in [0, 1].
+  double fill_ratio = 0;
+
+  // Time that jobs spent queued before their group was dispatched.
+  std::chrono::nanoseconds mean_queue_delay{0};
+  std::chrono::nanoseconds max_queue_delay{0};
+};
+
+// Collects single Generate and IsSamePwd calls into groups that fill the
+// lanes of the hash kernel. Jobs are grouped by their number of rounds so the
+// lanes of a group finish together. A group is handed to the executor once it
+// has batch_size jobs or its oldest job has waited max_wait, whichever comes
+// first.
+class MicroBatcher {
+public:
+  // Hashes with pwd_hasher on executor, which must outlive this object.
+  MicroBatcher(
+      PwdHasher pwd_hasher, Executor& executor, BatcherOptions options = {});
+
+  // Dispatches the jobs that are still queued.
+  ~MicroBatcher();
+
+  MicroBatcher(const MicroBatcher&) = delete;
+  MicroBatcher& operator=(const MicroBatcher&) = delete;
+
+  // Queues PwdHasher::Generate. Throws std::invalid_argument right away if
+  // the password is empty or rounds is not in the range [4, 31].
+  std::future<BcryptArr>
+  Generate(std::string_view pwd, std::uint32_t rounds = 10);
+
+  // Queues PwdHasher::IsSamePwd. Empty passwords and hashes that cannot be
+  // decoded are answered right away.
+  std::future<bool>
+  IsSamePwd(std::string_view pwd, const BcryptArr& arr);
+
+  // Returns the number of jobs in a full group.
+  std::size_t
+  BatchSize() const noexcept { return batch_size_; }
+
+  BatcherStats
+  Stats() const;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Job {
+    // What the hash is for, to count it in the metrics.
+    HashOp op;
+    std::string pwd;
+    Salt salt;
+    Clock::time_point queued;
+    // Called with the hash of the password once the group is done.
+    std::function<void(const PwdHash&, const Salt&)> done;
+  };
+
+  // Queues the job, first giving it a new salt if gen_salt is true.
+  void
+  Enqueue(std::uint32_t rounds, Job job, bool gen_salt);
+
+  // Hands up to batch_size_ jobs of the group to the executor.
+  void
+  Dispatch(std::uint32_t rounds, std::deque<Job>* group, Clock::time_point now);
+
+  void
+  Run();
+
+  PwdHasher pwd_hasher_;
+  Executor& executor_;
+  const Clock::duration max_wait_;
+  const std::size_t batch_size_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable cond_;
+  // Queued jobs by number of rounds.
+  std::map<std::uint32_t, std::deque<Job>> groups_;
+  bool stop_ = false;
+
+  std::uint64_t jobs_ = 0;
+  std::uint64_t batches_ = 0;
+  Clock::duration total_delay_{0};
+  Clock::duration max_delay_{0};
+
+  std::thread dispatcher_;
+};
+
+} // namespace bcrypt
@@ -0,0 +1,107 @@
+#include "batcher.h"
+
+#include <chrono>
+#include <future>
+#include <vector>
+
+#include "bcrypt.h"
+#include "gmock/gmock.h"
+#include "thread_pool.h"
+
+namespace bcrypt {
+namespace {
+
+using namespace std::chrono_literals;
+
+class MicroBatcherTest : public testing::Test {
+protected:
+  ThreadPool pool_{2};
+  PwdHasher pwd_hasher_;
+};
+
+TEST_F(MicroBatcherTest, DefaultBatchSizeIsKernelLanes) {
+  MicroBatcher batcher(pwd_hasher_, pool_);
+  EXPECT_EQ(batcher.BatchSize(), KernelLanes(ActiveKernel()));
+}
+
+TEST_F(MicroBatcherTest, GeneratedHashesAreVerified) {
+  MicroBatcher batcher(pwd_hasher_, pool_, {.max_wait = 1ms, .batch_size = 4});
+  std::vector<std::future<BcryptArr>> arrs;
+  for (int i = 0; i < 6; ++i)
+    arrs.push_back(batcher.Generate("password", 4));
+
+  std::vector<std::future<bool>> same;
+  for (auto& arr : arrs) {
+    const auto a = arr.get();
+    EXPECT_TRUE(pwd_hasher_.IsSamePwd("password", a));
+    same.push_back(batcher.IsSamePwd("password", a));
+    same.push_back(batcher.IsSamePwd("wrong", a));
+  }
+  for (std::size_t i = 0; i < same.size(); ++i)
+    EXPECT_EQ(same[i].get(), i % 2 == 0);
+}
+
+TEST_F(MicroBatcherTest, FullGroupDoesNotWaitForDeadline) {
+  MicroBatcher batcher(pwd_hasher_, pool_, {.max_wait = 1h, .batch_size = 2});
+  const auto arr = pwd_hasher_.Generate("password", 4);
+  auto a = batcher.IsSamePwd("password", arr);
+  auto b = batcher.IsSamePwd("password", arr);
+  EXPECT_TRUE(a.get());
+  EXPECT_TRUE(b.get());
+
+  const auto stats = batcher.Stats();
+  EXPECT_EQ(stats.jobs, 2);
+  EXPECT_EQ(stats.batches, 1);
+  EXPECT_DOUBLE_EQ(stats.fill_ratio, 1.0);
+}
+
+TEST_F(MicroBatcherTest, GroupsByRounds) {
+  MicroBatcher batcher(pwd_hasher_, pool_, {.max_wait = 1h, .batch_size = 2});
+  const auto arr4 = pwd_hasher_.Generate("password", 4);
+  const auto arr5 = pwd_hasher_.Generate("password", 5);
+  std::vector<std::future<bool>> same;
+  same.push_back(batcher.IsSamePwd("password", arr4));
+  same.push_back(batcher.IsSamePwd("password", arr5));
+  same.push_back(batcher.IsSamePwd("password", arr5));
+  same.push_back(batcher.IsSamePwd("password", arr4));
+  for (auto& s : same)
+    EXPECT_TRUE(s.get());
+  EXPECT_EQ(batcher.Stats().batches, 2);
+}
+
+TEST_F(MicroBatcherTest, PartialGroupIsDispatchedAfterMaxWait) {
+  MicroBatcher batcher(pwd_hasher_, pool_, {.max_wait = 1ms, .batch_size = 8});
+  const auto arr = pwd_hasher_.Generate("password", 4);
+  EXPECT_TRUE(batcher.IsSamePwd("password", arr).get());
+
+  const auto stats = batcher.Stats();
+  EXPECT_DOUBLE_EQ(stats.fill_ratio, 1.0 / 8);
+  EXPECT_GE(stats.max_queue_delay, 1ms);
+}
+
+TEST_F(MicroBatcherTest, InvalidHashIsAnsweredRightAway) {
+  MicroBatcher batcher(pwd_hasher_, pool_, {.max_wait = 1h, .batch_size = 8});
+  BcryptArr arr{};
+  EXPECT_FALSE(batcher.IsSamePwd("password", arr).get());
+  EXPECT_FALSE(batcher.IsSamePwd("", pwd_hasher_.Generate("a", 4)).get());
+  EXPECT_EQ(batcher.Stats().jobs, 0);
+}
+
+TEST_F(MicroBatcherTest, GenerateThrowsWithInvalidArguments) {
+  MicroBatcher batcher(pwd_hasher_, pool_);
+  EXPECT_THROW(batcher.Generate("", 10), std::invalid_argument);
+  EXPECT_THROW(batcher.Generate("password", 3), std::invalid_argument);
+}
+
+TEST_F(MicroBatcherTest, DestructorDispatchesQueuedJobs) {
+  std::future<bool> same;
+  const auto arr = pwd_hasher_.Generate("password", 4);
+  {
+    MicroBatcher batcher(pwd_hasher_, pool_, {.max_wait = 1h, .batch_size = 8});
+    same = batcher.IsSamePwd("password", arr);
+  }
+  EXPECT_TRUE(same.get());
+}
+
+} // namespace
+} // namespace bcrypt
@@ -2,84 +2,227 @@
 
 #include <algorithm>
 #include <charconv>
+#include <cstddef>
 #include <cstdint>
 #include <functional>
 #include <optional>
-#include <random>
+#include <span>
+#include <stop_token>
 #include <stdexcept>
+#include <string>
 #include <string_view>
 #include <utility>
+#include <vector>
 
 #include <fmt/core.h>
 #include <fmt/format.h>
 
 #include "base64.h"
 #include "blowfish.h"
+#include "kernel.h"
+#include "metrics.h"
+#include "random.h"
+#include "thread_pool.h"
+#include "tracing.h"
 
 namespace bcrypt {
 namespace {
-// Ciphertext blocks.
-constexpr std::uint8_t kBcryptBlocks = 6;
-
-// The maximum size of the password that can be used by the algorithm.
-constexpr std::uint32_t kMaxPwdSize = 72;
-
 // The maximum number of bytes for the encoded password hash.
 constexpr std::uint32_t kEncodedHashSize = 31;
 
 // The maximum number of bytes for the base 64 encoded salt.
 constexpr std::uint32_t kEncodedSaltSize = 22;
 
-// Computes the hash of the password, i.e. the BCrypt algorithm.
-PwdHash
-GenHash(std::string_view pwd, const Salt& salt, std::uint32_t rounds) noexcept
+// Hashes the passwords in groups of num_lanes with kernel_fn, for as long as
+// at least min_lanes passwords are left. Returns the number of passwords
+// hashed.
+template <typename KernelFn>
+std::size_t
+GenHashLanes(
+    std::span<const std::string_view> pwds,
+    std::span<const Salt> salts,
+    std::uint32_t rounds,
+    std::span<PwdHash> out,
+    std::size_t num_lanes,
+    std::size_t min_lanes,
+    KernelFn kernel_fn) noexcept
 {
-  // Cap number of password bytes to 72.
-  if (pwd.size() > kMaxPwdSize)
-    pwd.remove_suffix(pwd.size()-kMaxPwdSize);
-
-  // Setting up S-Boxes and Subkeys
-  Context ctx;
-  Blowfish_initstate(&ctx);
-  Blowfish_expandstate(&ctx, salt.data(), salt.size(),
-      reinterpret_cast<const std::uint8_t*>(pwd.data()), pwd.size());
-  for (std::uint32_t k = 0; k < rounds; ++k) {
-    Blowfish_expand0state(&ctx,
-        reinterpret_cast<const std::uint8_t*>(pwd.data()), pwd.size());
-    Blowfish_expand0state(&ctx, salt.data(), salt.size());
+  KeySchedule ks[kAvx512Lanes];
+  std::size_t i = 0;
+  while (pwds.size() - i >= min_lanes) {
+    const auto lanes = std::min(num_lanes, pwds.size() - i);
+    for (std::size_t n = 0; n < lanes; ++n)
+      ExpandKey(pwds[i+n], salts[i+n], &ks[n]);
+    kernel_fn(ks, lanes, rounds, &out[i]);
+    i += lanes;
   }
+  std::fill_n(reinterpret_cast<char*>(ks), sizeof(ks), 0);
+  return i;
+}
+
+// The most passwords that a batch hands to GenHashN at once.
+constexpr std::size_t kMaxChunkSize = kAvx512Lanes;
 
-  // This can be precomputed later.
-  std::uint32_t cdata[kBcryptBlocks];
-  std::uint8_t ciphertext[4*kBcryptBlocks+1] = "OrpheanBeholderScryDoubt";
-  std::uint16_t j = 0;
-  for (std::uint8_t i = 0; i < kBcryptBlocks; ++i)
-    cdata[i] = Blowfish_stream2word(ciphertext, 4 * kBcryptBlocks, &j);
-
-  // Now do the encryption.
-  for (int k = 0; k < 64; ++k)
-    blf_enc(&ctx, cdata, kBcryptBlocks / 2);
-
-  for (std::uint8_t i = 0; i < kBcryptBlocks; ++i) {
-    const auto chr = cdata[i];
-    const auto k = i * 4;
-    ciphertext[k+3] = chr & 0xff;
-    ciphertext[k+2] = (chr >> 8) & 0xff;
-    ciphertext[k+1] = (chr >> 16) & 0xff;
-    ciphertext[k+0] = (chr >> 24) & 0xff;
+// Returns the number of passwords that a batch hands to GenHashN at once, i.e.
+// the lanes of the active kernel.
+std::size_t
+ChunkSize() noexcept
+{
+  return std::min(KernelLanes(ActiveKernel()), kMaxChunkSize);
+}
+
+// VerifyBatch for at most kMaxChunkSize passwords. Passwords whose hashes
+// have the same number of rounds are hashed together.
+void
+VerifyChunk(
+    std::span<const std::string_view> pwds,
+    std::span<const BcryptArr> arrs,
+    std::span<bool> out) noexcept
+{
+  BcryptParams params[kMaxChunkSize];
+  std::size_t order[kMaxChunkSize];
+  std::size_t num_valid = 0;
+  for (std::size_t i = 0; i < pwds.size(); ++i) {
+    out[i] = false;
+    const auto p = pwds[i].empty() ? std::nullopt : DecodeBcrypt(arrs[i]);
+    if (not p) {
+      RecordVerify(VerifyStatus::kInvalidHash);
+      continue;
+    }
+    params[i] = *p;
+    order[num_valid++] = i;
+  }
+  std::sort(order, order + num_valid, [&](std::size_t a, std::size_t b) {
+    return params[a].rounds < params[b].rounds;
+  });
+
+  std::string_view group_pwds[kMaxChunkSize];
+  Salt group_salts[kMaxChunkSize];
+  PwdHash group_hashes[kMaxChunkSize];
+  for (std::size_t first = 0; first < num_valid;) {
+    const auto rounds = params[order[first]].rounds;
+    std::size_t last = first;
+    for (; last < num_valid and params[order[last]].rounds == rounds; ++last) {
+      group_pwds[last-first] = pwds[order[last]];
+      group_salts[last-first] = params[order[last]].salt;
+    }
+    const auto size = last - first;
+    GenHashN({group_pwds, size}, {group_salts, size}, rounds,
+             {group_hashes, size});
+    RecordHashes(HashOp::kVerify, rounds, size);
+    for (std::size_t n = 0; n < size; ++n) {
+      const auto i = order[first+n];
+      out[i] = params[i].pwd_hash == group_hashes[n];
+      RecordVerify(out[i] ? VerifyStatus::kMatch : VerifyStatus::kMismatch);
+    }
+    first = last;
   }
 
+  // Clear memory.
+  std::fill_n(reinterpret_cast<char*>(group_hashes), sizeof(group_hashes), 0);
+}
+
+// Throws std::invalid_argument if the policy cannot be used to rehash.
+void
+CheckRehashPolicy(const RehashPolicy& policy)
+{
+  if (policy.target_rounds < 4 or policy.target_rounds > 31)
+    throw std::invalid_argument("target_rounds should be in the range [4, 31].");
+  // With max_rounds below target_rounds, every upgraded hash would be past
+  // max_rounds again, and be rehashed on every login.
+  if (policy.max_rounds < policy.target_rounds or policy.max_rounds > 31)
+    throw std::invalid_argument(
+        "max_rounds should be in the range [target_rounds, 31].");
+}
+} // namespace
+
+bool
+NeedsRehash(const BcryptArr& arr, const RehashPolicy& policy) noexcept
+{
+  const auto params = DecodeBcrypt(arr);
+  return params and (params->rounds < policy.target_rounds
+                     or params->rounds > policy.max_rounds);
+}
+
+PwdHash
+GenHash(std::string_view pwd, const Salt& salt, std::uint32_t rounds) noexcept
+{
+  const TraceSpan span("GenHash");
+  KeySchedule ks;
+  ExpandKey(pwd, salt, &ks);
   PwdHash pwd_hash;
-  std::copy_n(ciphertext, pwd_hash.size(), pwd_hash.data());
+  GenHashScalar(ks, rounds, &pwd_hash);
 
   // Clear memory.
-  std::fill_n(reinterpret_cast<char*>(&ctx), sizeof(ctx), 0);
-  std::fill_n(ciphertext, 4*kBcryptBlocks+1, 0);
-  std::fill_n(cdata, kBcryptBlocks, 0);
+  std::fill_n(reinterpret_cast<char*>(&ks), sizeof(ks), 0);
 
   return pwd_hash;
 }
-} // namespace
+
+std::optional<PwdHash>
+GenHash(
+    std::string_view pwd,
+    const Salt& salt,
+    std::uint32_t rounds,
+    std::stop_token stop,
+    Deadline deadline) noexcept
+{
+  const TraceSpan span("GenHash");
+  const CancelCheck cancel{std::move(stop), deadline};
+  KeySchedule ks;
+  ExpandKey(pwd, salt, &ks);
+  PwdHash pwd_hash;
+  const auto done = GenHashScalar(ks, rounds, &pwd_hash, &cancel);
+
+  // Clear memory.
+  std::fill_n(reinterpret_cast<char*>(&ks), sizeof(ks), 0);
+
+  if (not done) return std::nullopt;
+  return pwd_hash;
+}
+
+void
+GenHashWith(
+    Kernel kernel,
+    std::span<const std::string_view> pwds,
+    std::span<const Salt> salts,
+    std::uint32_t rounds,
+    std::span<PwdHash> out) noexcept
+{
+  if (kernel == Kernel::kScalar) {
+    for (std::size_t i = 0; i < pwds.size(); ++i)
+      out[i] = GenHash(pwds[i], salts[i], rounds);
+    return;
+  }
+
+  // A SIMD kernel costs about the same with a few lanes as with all of them,
+  // so it only takes groups that fill more than half of its lanes. The rest
+  // goes to a narrower kernel, down to the interleaved scalar one.
+  std::size_t i = 0;
+  if (kernel == Kernel::kAvx512)
+    i += GenHashLanes(pwds.subspan(i), salts.subspan(i), rounds,
+                      out.subspan(i), kAvx512Lanes, kAvx512Lanes / 2 + 1,
+                      GenHashAvx512);
+  if (kernel == Kernel::kAvx2 or (kernel == Kernel::kAvx512 and HasAvx2()))
+    i += GenHashLanes(pwds.subspan(i), salts.subspan(i), rounds,
+                      out.subspan(i), kAvx2Lanes, kAvx2Lanes / 2 + 1,
+                      GenHashAvx2);
+  GenHashLanes(pwds.subspan(i), salts.subspan(i), rounds, out.subspan(i),
+               InterleavedLanes(), 1, GenHashInterleaved);
+}
+
+void
+GenHashN(
+    std::span<const std::string_view> pwds,
+    std::span<const Salt> salts,
+    std::uint32_t rounds,
+    std::span<PwdHash> out)
+{
+  const TraceSpan span("GenHashN");
+  if (pwds.size() != salts.size() or pwds.size() != out.size())
+    throw std::invalid_argument("pwds, salts and out should have the same size.");
+  GenHashWith(ActiveKernel(), pwds, salts, rounds, out);
+}
 
 // Returns the parameters if they are decoded correctly.
 // $--$--$-----------------------------------------------------
@@ -87,7 +230,7 @@ GenHash(std::string_view pwd, const Salt& salt, std::uint32_t rounds) noexcept
 //        |                     |
 //        Salt begins here      Password hash begins here
 std::optional<BcryptParams>
-DecodeBcrypt(const BcryptArr& arr) noexcept {
+DecodeParams(const BcryptArr& arr) noexcept {
   if (arr[0] != '$') return std::nullopt;
   if (arr[1] != '2') return std::nullopt;
   if (arr[2] != 'b') return std::nullopt;
@@ -108,6 +251,13 @@ DecodeBcrypt(const BcryptArr& arr) noexcept {
   return params;
 }
 
+std::optional<BcryptParams>
+DecodeBcrypt(const BcryptArr& arr) noexcept {
+  auto params = DecodeParams(arr);
+  if (not params) RecordDecodeFailure();
+  return params;
+}
+
 BcryptArr
 EncodeBcrypt(const PwdHash& hsh, const Salt& salt, std::uint32_t rounds) noexcept
 {
@@ -121,7 +271,7 @@ EncodeBcrypt(const PwdHash& hsh, const Salt& salt, std::uint32_t rounds) noexcep
 
   BcryptArr bcrypt_arr;
   fmt::format_to_n(bcrypt_arr.begin(), bcrypt_arr.size(),
-      FMT_STRING("$2b${:>0}${}{}"), rounds, b64_salt, b64_hash);
+      FMT_STRING("$2b${:02}${}{}"), rounds, b64_salt, b64_hash);
 
   return bcrypt_arr;
 }
@@ -130,13 +280,7 @@ EncodeBcrypt(const PwdHash& hsh, const Salt& salt, std::uint32_t rounds) noexcep
 // PwdHasher
 ///////////////////////////////////////////////////////////////////////////////
 
-PwdHasher::PwdHasher() noexcept 
-{
-  std::random_device rd;
-  std::mt19937 generator(rd());
-  std::uniform_int_distribution<std::uint8_t> dist;
-  random_fn_ = std::bind_front(dist, generator);
-}
+PwdHasher::PwdHasher() noexcept = default;
 
 PwdHasher::PwdHasher(std::function<char()> random_fn)
   : random_fn_(std::move(random_fn))
@@ -147,11 +291,19 @@ PwdHasher::PwdHasher(std::function<char()> random_fn)
 
 Salt
 PwdHasher::GenSalt() const noexcept {
+  if (not random_fn_) return RandomSalt();
   Salt salt;
   for (auto& c : salt) c = random_fn_();
   return salt;
 }
 
+void
+PwdHasher::GenSalts(std::span<Salt> out) const noexcept
+{
+  if (not random_fn_) return RandomSalts(out);
+  for (auto& salt : out) salt = GenSalt();
+}
+
 BcryptArr
 PwdHasher::Generate(std::string_view pwd, std::uint32_t rounds) const
 {
@@ -159,20 +311,178 @@ PwdHasher::Generate(std::string_view pwd, std::uint32_t rounds) const
     throw std::invalid_argument("Password cannot be empty.");
   if (rounds < 4 or rounds > 31)
     throw std::invalid_argument("rounds should be in the range [4, 31].");
-  const auto salt = GenSalt();
+  const TraceSpan span("PwdHasher::Generate");
+  const HashTimer timer(HashOp::kGenerate, rounds);
+  Salt salt;
+  {
+    const TraceSpan salt_span("GenSalt");
+    salt = GenSalt();
+  }
   const auto pwd_hash = GenHash(pwd, salt, rounds);
+  const TraceSpan encode_span("EncodeBcrypt");
   return EncodeBcrypt(pwd_hash, salt, rounds);
 }
 
 bool
 PwdHasher::IsSamePwd(std::string_view pwd, const BcryptArr& arr) const noexcept
 {
-  if (pwd.empty()) return false;
+  return Verify(pwd, arr) == VerifyStatus::kMatch;
+}
 
-  const auto params = DecodeBcrypt(arr);
-  if (not params) return false;
+VerifyStatus
+PwdHasher::Verify(std::string_view pwd, const BcryptArr& arr) const noexcept
+{
+  const TraceSpan span("PwdHasher::Verify");
+  const auto params = pwd.empty() ? std::nullopt : DecodeBcrypt(arr);
+  if (not params) {
+    RecordVerify(VerifyStatus::kInvalidHash);
+    return VerifyStatus::kInvalidHash;
+  }
+
+  PwdHash pwd_hash;
+  {
+    const HashTimer timer(HashOp::kVerify, params->rounds);
+    pwd_hash = GenHash(pwd, params->salt, params->rounds);
+  }
+  const auto status = params->pwd_hash == pwd_hash ? VerifyStatus::kMatch
+                                                   : VerifyStatus::kMismatch;
+  RecordVerify(status);
+  return status;
+}
 
-  const auto pwd_hash = GenHash(pwd, params->salt, params->rounds);
-  return params->pwd_hash == pwd_hash;
+VerifyStatus
+PwdHasher::Verify(
+    std::string_view pwd,
+    const BcryptArr& arr,
+    std::stop_token stop,
+    Deadline deadline) const noexcept
+{
+  const TraceSpan span("PwdHasher::Verify");
+  const auto params = pwd.empty() ? std::nullopt : DecodeBcrypt(arr);
+  if (not params) {
+    RecordVerify(VerifyStatus::kInvalidHash);
+    return VerifyStatus::kInvalidHash;
+  }
+
+  std::optional<PwdHash> pwd_hash;
+  {
+    // A cancelled hash is only counted as a kCancelled verification.
+    HashTimer timer(HashOp::kVerify, params->rounds);
+    pwd_hash =
+        GenHash(pwd, params->salt, params->rounds, std::move(stop), deadline);
+    if (not pwd_hash) timer.Cancel();
+  }
+  auto status = VerifyStatus::kCancelled;
+  if (pwd_hash)
+    status = params->pwd_hash == *pwd_hash ? VerifyStatus::kMatch
+                                           : VerifyStatus::kMismatch;
+  RecordVerify(status);
+  return status;
+}
+
+UpgradeResult
+PwdHasher::VerifyAndUpgrade(
+    std::string_view pwd,
+    const BcryptArr& arr,
+    const RehashPolicy& policy) const
+{
+  const TraceSpan span("PwdHasher::VerifyAndUpgrade");
+  CheckRehashPolicy(policy);
+  UpgradeResult result;
+  result.status = Verify(pwd, arr);
+  if (result.status == VerifyStatus::kMatch and NeedsRehash(arr, policy))
+    result.rehashed = Generate(pwd, policy.target_rounds);
+  return result;
+}
+
+VerifyStatus
+PwdHasher::VerifyAndUpgrade(
+    std::string_view pwd,
+    const BcryptArr& arr,
+    const RehashPolicy& policy,
+    Executor& executor,
+    std::function<void(const BcryptArr&)> store) const
+{
+  const TraceSpan span("PwdHasher::VerifyAndUpgrade");
+  CheckRehashPolicy(policy);
+  const auto status = Verify(pwd, arr);
+  if (status != VerifyStatus::kMatch or not NeedsRehash(arr, policy))
+    return status;
+
+  const auto rounds = policy.target_rounds;
+  executor.SubmitWithCost(
+      [pwd = std::string(pwd), salt = GenSalt(), rounds,
+       store = std::move(store)]() mutable {
+        const auto pwd_hash = GenHash(pwd, salt, rounds);
+        std::fill(pwd.begin(), pwd.end(), 0);
+        store(EncodeBcrypt(pwd_hash, salt, rounds));
+      },
+      HashCost(rounds));
+  return status;
+}
+
+void
+PwdHasher::GenerateBatch(
+    std::span<const std::string_view> pwds,
+    std::uint32_t rounds,
+    std::span<BcryptArr> out,
+    Executor& executor) const
+{
+  const TraceSpan span("PwdHasher::GenerateBatch");
+  if (pwds.size() != out.size())
+    throw std::invalid_argument("pwds and out should have the same size.");
+  if (std::any_of(pwds.begin(), pwds.end(), [](auto p) { return p.empty(); }))
+    throw std::invalid_argument("Password cannot be empty.");
+  if (rounds < 4 or rounds > 31)
+    throw std::invalid_argument("rounds should be in the range [4, 31].");
+
+  // A random generator given to the constructor is not thread safe, so the
+  // salts are made up front.
+  std::vector<Salt> salts(pwds.size());
+  GenSalts(salts);
+
+  const auto chunk_size = ChunkSize();
+  const auto num_chunks = (pwds.size() + chunk_size - 1) / chunk_size;
+  // Each helper is charged for one chunk, though it may run more.
+  const auto cost = HashCost(rounds) * chunk_size;
+  ParallelFor(executor, num_chunks, cost, [&](std::size_t c) {
+    const auto first = c * chunk_size;
+    const auto size = std::min(chunk_size, pwds.size() - first);
+    PwdHash hashes[kMaxChunkSize];
+    GenHashN(pwds.subspan(first, size), std::span(salts).subspan(first, size),
+             rounds, {hashes, size});
+    for (std::size_t i = 0; i < size; ++i)
+      out[first+i] = EncodeBcrypt(hashes[i], salts[first+i], rounds);
+    RecordHashes(HashOp::kGenerate, rounds, size);
+  });
+}
+
+void
+PwdHasher::VerifyBatch(
+    std::span<const std::string_view> pwds,
+    std::span<const BcryptArr> arrs,
+    std::span<bool> out,
+    Executor& executor) const
+{
+  const TraceSpan span("PwdHasher::VerifyBatch");
+  if (pwds.size() != arrs.size() or pwds.size() != out.size())
+    throw std::invalid_argument("pwds, arrs and out should have the same size.");
+
+  // The hashes may have different rounds, so each helper is charged for a
+  // chunk at their mean cost.
+  double total_cost = 0;
+  for (const auto& arr : arrs) {
+    if (const auto params = DecodeParams(arr))
+      total_cost += HashCost(params->rounds);
+  }
+  const auto chunk_size = ChunkSize();
+  const auto num_chunks = (pwds.size() + chunk_size - 1) / chunk_size;
+  const auto cost = pwds.empty() ? 0 : total_cost / pwds.size() * chunk_size;
+  ParallelFor(executor, num_chunks, cost, [&](std::size_t c) {
+    const auto first = c * chunk_size;
+    const auto size = std::min(chunk_size, pwds.size() - first);
+    VerifyChunk(pwds.subspan(first, size), arrs.subspan(first, size),
+                out.subspan(first, size));
+  });
 }
 } // namespace bcrypt
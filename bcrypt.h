@@ -1,11 +1,19 @@
+#pragma once
+
 #include <array>
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
 #include <functional>
 #include <optional>
 #include <random>
+#include <span>
+#include <stop_token>
 #include <string_view>
 
 namespace bcrypt {
+class Executor;
+
 // Format is $2b$Cost$SaltHash and contains a total of 60 bytes.
 // The dollar signs are part of the format:
 // - 2b: the version of the algorithm.
@@ -38,6 +46,52 @@ ToStringView(const BcryptArr& arr)
       reinterpret_cast<const char*>(arr.data()), arr.size());
 };
 
+// Outcome of verifying a password against a bcrypt hash.
+enum class VerifyStatus {
+  kMatch,
+  kMismatch,
+  // The password is empty or the hash cannot be decoded.
+  kInvalidHash,
+  // The password was not hashed because the server is overloaded. Only
+  // returned when verification goes through an AdmissionController.
+  kOverloaded,
+  // Hashing was abandoned because stop was requested or the deadline passed.
+  kCancelled,
+};
+
+// Point in time after which a hash is no longer wanted.
+using Deadline = std::chrono::steady_clock::time_point;
+
+// Returns the relative amount of work to hash a password with the given number
+// of rounds, in Blowfish key expansions: one to set up the state and two for
+// each iteration of the cost loop. Used to compare and schedule jobs.
+constexpr double
+HashCost(std::uint32_t rounds) noexcept
+{
+  return 2.0 * rounds + 1;
+}
+
+// When a stored hash should be replaced by one with another cost.
+struct RehashPolicy {
+  // Number of rounds that new hashes get. Hashes with fewer rounds are
+  // upgraded to it.
+  std::uint32_t target_rounds = 10;
+
+  // Hashes with more rounds are brought down to target_rounds, e.g. after a
+  // cost turned out to put verification over the latency budget. Must be at
+  // least target_rounds.
+  std::uint32_t max_rounds = 31;
+};
+
+// Outcome of PwdHasher::VerifyAndUpgrade.
+struct UpgradeResult {
+  VerifyStatus status = VerifyStatus::kInvalidHash;
+
+  // The password hashed with the target rounds of the policy, if it matched
+  // and the policy asked for a rehash. It should replace the stored hash.
+  std::optional<BcryptArr> rehashed;
+};
+
 // Returns the parameters if they are decoded correctly.
 // $--$--$-----------------------------------------------------
 // 012345678901234567890123456789012345678901234567890123456789
@@ -49,16 +103,98 @@ DecodeBcrypt(const BcryptArr& arr) noexcept;
 BcryptArr
 EncodeBcrypt(const PwdHash& hsh, const Salt& salt, std::uint32_t rounds) noexcept;
 
+// Returns true if the policy asks to replace the hash, i.e. its rounds are
+// not in [policy.target_rounds, policy.max_rounds]. Returns false if the hash
+// cannot be decoded, since it cannot be verified either.
+bool
+NeedsRehash(const BcryptArr& arr, const RehashPolicy& policy) noexcept;
+
+// Computes the hash of the password with the given salt and number of rounds,
+// i.e. the bcrypt algorithm for a single password. Only the first 72 bytes of
+// the password are used. An empty password is hashed as a single NUL byte,
+// like other bcrypt implementations do, so it has the same hash as "\0".
+PwdHash
+GenHash(std::string_view pwd, const Salt& salt, std::uint32_t rounds) noexcept;
+
+// Like GenHash, but gives up and returns std::nullopt once stop is requested
+// or the deadline passes, e.g. when the client waiting for the hash has timed
+// out. Both are checked between iterations of the cost loop.
+std::optional<PwdHash>
+GenHash(
+    std::string_view pwd,
+    const Salt& salt,
+    std::uint32_t rounds,
+    std::stop_token stop,
+    Deadline deadline = Deadline::max()) noexcept;
+
+// The EksBlowfish kernels that GenHashN can use. All of them are built into
+// the library and produce the same hashes; they only differ in speed.
+enum class Kernel {
+  // GenHash, one password at a time.
+  kScalar,
+  // Scalar code that runs 2 to 4 passwords round by round.
+  kInterleaved,
+  // 8 passwords in the lanes of AVX2 vectors.
+  kAvx2,
+  // 16 passwords in the lanes of AVX-512 vectors.
+  kAvx512,
+};
+
+// Returns the name of the kernel, e.g. "avx2".
+std::string_view
+KernelName(Kernel kernel) noexcept;
+
+// Returns the number of passwords the kernel hashes at once.
+std::size_t
+KernelLanes(Kernel kernel) noexcept;
+
+// Returns true if the CPU can run the kernel.
+bool
+IsKernelSupported(Kernel kernel) noexcept;
+
+// Returns the kernel used by GenHashN. Unless one was set before, the first
+// call picks the widest kernel that the CPU supports.
+Kernel
+ActiveKernel() noexcept;
+
+// Makes GenHashN use the kernel. Throws std::invalid_argument if the CPU does
+// not support it.
+void
+SetActiveKernel(Kernel kernel);
+
+// Times each supported kernel for a few milliseconds, makes the fastest one
+// active and returns it. Gathers are slow on some CPUs that support them, so
+// this can pick a better kernel than the CPU features alone.
+Kernel
+AutotuneKernel();
+
+// Computes the hashes of several passwords at once. pwds[i] is hashed with
+// salts[i] and written to out[i], with the same result as GenHash. Passwords
+// are run through the active kernel, so throughput is best when the batch
+// holds a multiple of its lane count. Empty passwords are hashed as in
+// GenHash. Throws std::invalid_argument if the spans do not have the same
+// size.
+void
+GenHashN(
+    std::span<const std::string_view> pwds,
+    std::span<const Salt> salts,
+    std::uint32_t rounds,
+    std::span<PwdHash> out);
+
 // Uses the bcrypt algorithm to hash and verify passwords. There are different
 // versions of the bcrypt algorithm, e.g. 2a vs 2b, but PwdHasher always uses
 // version 2b since there is no reason to use an older version.
 class PwdHasher {
 public:
-  // Initializes the password hasher with a uniform random generator.
+  // Initializes the password hasher to make salts with RandomSalt, which has
+  // a ChaCha20 generator per thread. The hasher can then be shared by any
+  // number of threads.
   PwdHasher() noexcept;
 
-  // Initializes the password hasher with a uniform random generator.
-  // If random_char_fn is not set, then it throws an exception.
+  // Initializes the password hasher with a uniform random generator, e.g. a
+  // seeded one for tests. Calls to GenSalt, and to the methods that make
+  // salts, must not overlap since they share the generator. If
+  // random_char_fn is not set, then it throws an exception.
   explicit PwdHasher(std::function<char()> random_char_fn);
 
   // Generates the hashed password and bcrypt metadata. Returns an error if the
@@ -70,12 +206,79 @@ public:
   bool
   IsSamePwd(std::string_view pwd, const BcryptArr& arr) const noexcept;
 
-private:
+  // Like IsSamePwd, but tells a wrong password from a hash that cannot be
+  // decoded.
+  VerifyStatus
+  Verify(std::string_view pwd, const BcryptArr& arr) const noexcept;
+
+  // Like the above, but returns kCancelled if stop is requested or the
+  // deadline passes before the hash is done.
+  VerifyStatus
+  Verify(
+      std::string_view pwd,
+      const BcryptArr& arr,
+      std::stop_token stop,
+      Deadline deadline = Deadline::max()) const noexcept;
+
+  // Verifies the password and, only if it matches and NeedsRehash(arr,
+  // policy), also hashes it with the target rounds of the policy, so stored
+  // hashes move to a new cost as users log in. Throws std::invalid_argument
+  // if the target rounds are not in the range [4, 31], or the max rounds are
+  // not in the range [target_rounds, 31].
+  UpgradeResult
+  VerifyAndUpgrade(
+      std::string_view pwd,
+      const BcryptArr& arr,
+      const RehashPolicy& policy) const;
+
+  // Like the above, but returns as soon as the password is verified, and
+  // computes the new hash on executor, which calls store with it. The login
+  // is thus not delayed by the second hash. The salt is made before this
+  // returns, so a generator given to the constructor is only used by the
+  // calling thread.
+  VerifyStatus
+  VerifyAndUpgrade(
+      std::string_view pwd,
+      const BcryptArr& arr,
+      const RehashPolicy& policy,
+      Executor& executor,
+      std::function<void(const BcryptArr&)> store) const;
+
+  // Generates a hash for each password, like Generate, and writes it to
+  // out[i]. The hashing is spread over the calling thread and tasks
+  // submitted to the executor, e.g. a ThreadPool or a TenantExecutor, with
+  // the HashCost of the hashes they run. Throws std::invalid_argument if the
+  // spans do not have the same size, a password is empty or rounds is not in
+  // the range [4, 31].
+  void
+  GenerateBatch(
+      std::span<const std::string_view> pwds,
+      std::uint32_t rounds,
+      std::span<BcryptArr> out,
+      Executor& executor) const;
+
+  // Writes IsSamePwd(pwds[i], arrs[i]) to out[i] for each password. The
+  // hashing is spread over the calling thread and tasks submitted to the
+  // executor, like GenerateBatch. Throws std::invalid_argument if the spans
+  // do not have the same size.
+  void
+  VerifyBatch(
+      std::span<const std::string_view> pwds,
+      std::span<const BcryptArr> arrs,
+      std::span<bool> out,
+      Executor& executor) const;
+
   // Generates a salt with 16 random bytes.
   Salt
   GenSalt() const noexcept;
 
-  // Random char generator. Used to generate salts.
+  // Fills out with salts, like GenSalt.
+  void
+  GenSalts(std::span<Salt> out) const noexcept;
+
+private:
+  // Random char generator given to the constructor, or unset to use
+  // RandomSalt.
   std::function<std::uint8_t()> random_fn_;
 };
 
@@ -0,0 +1,561 @@
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <fmt/core.h>
+
+#include "base64.h"
+#include "bcrypt.h"
+#include "bench_baseline.h"
+#include "blowfish.h"
+#include "kernel.h"
+#include "thread_pool.h"
+
+namespace bcrypt {
+namespace {
+
+constexpr std::uint32_t kRounds = 10;
+
+// Passwords and salts for a batch of num hashes.
+struct Batch {
+  explicit Batch(std::size_t num)
+    : pwd_strs(num), salts(num), ks(num), hashes(num)
+  {
+    for (std::size_t i = 0; i < num; ++i) {
+      pwd_strs[i] = "password" + std::to_string(i);
+      for (std::size_t j = 0; j < salts[i].size(); ++j)
+        salts[i][j] = static_cast<std::uint8_t>(i * 31 + j);
+      ExpandKey(pwd_strs[i], salts[i], &ks[i]);
+    }
+    pwds.assign(pwd_strs.begin(), pwd_strs.end());
+  }
+
+  std::vector<std::string> pwd_strs;
+  std::vector<std::string_view> pwds;
+  std::vector<Salt> salts;
+  std::vector<KeySchedule> ks;
+  std::vector<PwdHash> hashes;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Building blocks
+///////////////////////////////////////////////////////////////////////////////
+
+// A Blowfish state set up with a 72 byte key and a 16 byte salt, as in a hash.
+struct Blowfish {
+  Blowfish()
+  {
+    for (std::size_t i = 0; i < key.size(); ++i)
+      key[i] = static_cast<std::uint8_t>(i * 7 + 1);
+    for (std::size_t i = 0; i < salt.size(); ++i)
+      salt[i] = static_cast<std::uint8_t>(i * 13 + 5);
+    Blowfish_initstate(&ctx);
+  }
+
+  Context ctx;
+  std::array<std::uint8_t, kMaxPwdSize> key;
+  Salt salt;
+};
+
+void
+BM_BlowfishEncipher(benchmark::State& state)
+{
+  Blowfish bf;
+  std::uint32_t l = 0;
+  std::uint32_t r = 0;
+  for (auto _ : state) {
+    Blowfish_encipher(&bf.ctx, &l, &r);
+    benchmark::DoNotOptimize(l);
+    benchmark::DoNotOptimize(r);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_BlowfishEncipher);
+
+// One key expansion of the cost loop.
+void
+BM_BlowfishExpand0State(benchmark::State& state)
+{
+  Blowfish bf;
+  for (auto _ : state) {
+    Blowfish_expand0state(&bf.ctx, bf.key.data(), bf.key.size());
+    benchmark::DoNotOptimize(bf.ctx.S[0][0]);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_BlowfishExpand0State);
+
+// The salted key expansion that sets up a hash.
+void
+BM_BlowfishExpandState(benchmark::State& state)
+{
+  Blowfish bf;
+  for (auto _ : state) {
+    Blowfish_expandstate(&bf.ctx, bf.salt.data(), bf.salt.size(),
+                         bf.key.data(), bf.key.size());
+    benchmark::DoNotOptimize(bf.ctx.S[0][0]);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_BlowfishExpandState);
+
+void
+BM_EncodeBcrypt(benchmark::State& state)
+{
+  Batch batch(1);
+  const auto hash = GenHash(batch.pwds[0], batch.salts[0], 4);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(EncodeBcrypt(hash, batch.salts[0], kRounds));
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_EncodeBcrypt);
+
+void
+BM_DecodeBcrypt(benchmark::State& state)
+{
+  const auto arr = PwdHasher().Generate("password", 4);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(DecodeBcrypt(arr));
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_DecodeBcrypt);
+
+// Encodes state.range(0) bytes, e.g. 16 for a salt and 23 for a hash.
+void
+BM_ToBase64(benchmark::State& state)
+{
+  const std::uint32_t size = state.range(0);
+  std::vector<std::uint8_t> from(size, 0xa5);
+  std::vector<std::uint8_t> to(ToSize(size));
+  for (auto _ : state) {
+    ToBase64(from.data(), size, to.data());
+    benchmark::DoNotOptimize(to.data());
+  }
+  state.SetBytesProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_ToBase64)->Arg(16)->Arg(23);
+
+// Decodes the encoding of state.range(0) bytes.
+void
+BM_FromBase64(benchmark::State& state)
+{
+  const std::uint32_t size = state.range(0);
+  std::vector<std::uint8_t> bytes(size, 0xa5);
+  std::vector<std::uint8_t> encoded(ToSize(size));
+  ToBase64(bytes.data(), size, encoded.data());
+  for (auto _ : state) {
+    FromBase64(encoded.data(), encoded.size(), bytes.data());
+    benchmark::DoNotOptimize(bytes.data());
+  }
+  state.SetBytesProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_FromBase64)->Arg(16)->Arg(23);
+
+///////////////////////////////////////////////////////////////////////////////
+// Hashing
+///////////////////////////////////////////////////////////////////////////////
+
+// GenHash with state.range(0) rounds.
+void
+BM_GenHashCost(benchmark::State& state)
+{
+  const std::uint32_t rounds = state.range(0);
+  Batch batch(1);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(GenHash(batch.pwds[0], batch.salts[0], rounds));
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GenHashCost)->DenseRange(4, 16);
+
+void
+BM_GenHash(benchmark::State& state)
+{
+  Batch batch(1);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(GenHash(batch.pwds[0], batch.salts[0], kRounds));
+  state.SetItemsProcessed(state.iterations());
+  state.counters["lanes"] = 1;
+}
+BENCHMARK(BM_GenHash);
+
+// The interleaved scalar kernel with state.range(0) lanes.
+void
+BM_KernelInterleaved(benchmark::State& state)
+{
+  const std::size_t lanes = state.range(0);
+  Batch batch(lanes);
+  for (auto _ : state) {
+    GenHashInterleaved(batch.ks.data(), lanes, kRounds, batch.hashes.data());
+    benchmark::DoNotOptimize(batch.hashes.data());
+  }
+  state.SetItemsProcessed(state.iterations() * lanes);
+  state.counters["lanes"] = lanes;
+}
+BENCHMARK(BM_KernelInterleaved)->DenseRange(1, kMaxInterleavedLanes);
+
+// Hashes one full group of lanes per iteration, so items/s is hashes/s at the
+// kernel's lane count.
+template <std::size_t kLanes, auto kKernelFn, auto kHasIsaFn>
+void
+BM_Kernel(benchmark::State& state)
+{
+  if (not kHasIsaFn()) {
+    state.SkipWithError("not supported by this CPU");
+    return;
+  }
+  Batch batch(kLanes);
+  for (auto _ : state) {
+    kKernelFn(batch.ks.data(), kLanes, kRounds, batch.hashes.data());
+    benchmark::DoNotOptimize(batch.hashes.data());
+  }
+  state.SetItemsProcessed(state.iterations() * kLanes);
+  state.counters["lanes"] = kLanes;
+}
+BENCHMARK(BM_Kernel<kAvx2Lanes, GenHashAvx2, HasAvx2>)->Name("BM_KernelAvx2");
+BENCHMARK(BM_Kernel<kAvx512Lanes, GenHashAvx512, HasAvx512>)
+  ->Name("BM_KernelAvx512");
+
+// GenHashN with a batch of state.range(0) passwords.
+void
+BM_GenHashN(benchmark::State& state)
+{
+  Batch batch(state.range(0));
+  for (auto _ : state) {
+    GenHashN(batch.pwds, batch.salts, kRounds, batch.hashes);
+    benchmark::DoNotOptimize(batch.hashes.data());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_GenHashN)->RangeMultiplier(2)->Range(1, 32);
+
+// GenHashN with each kernel, on a batch of 32 passwords.
+void
+BM_GenHashNKernel(benchmark::State& state)
+{
+  const auto kernel = static_cast<Kernel>(state.range(0));
+  if (not IsKernelSupported(kernel)) {
+    state.SkipWithError("not supported by this CPU");
+    return;
+  }
+  state.SetLabel(std::string(KernelName(kernel)));
+  const auto active = ActiveKernel();
+  SetActiveKernel(kernel);
+  Batch batch(32);
+  for (auto _ : state) {
+    GenHashN(batch.pwds, batch.salts, kRounds, batch.hashes);
+    benchmark::DoNotOptimize(batch.hashes.data());
+  }
+  SetActiveKernel(active);
+  state.SetItemsProcessed(state.iterations() * batch.pwds.size());
+}
+BENCHMARK(BM_GenHashNKernel)->DenseRange(
+    static_cast<int>(Kernel::kScalar), static_cast<int>(Kernel::kAvx512));
+
+// VerifyBatch on 64 hashes with a pool of state.range(0) threads. Items/s
+// against the number of threads gives the scaling curve.
+void
+BM_VerifyBatch(benchmark::State& state)
+{
+  constexpr std::size_t kBatchSize = 64;
+  PwdHasher pwd_hasher;
+  ThreadPool pool(state.range(0));
+  Batch batch(kBatchSize);
+  std::vector<BcryptArr> arrs(kBatchSize);
+  pwd_hasher.GenerateBatch(batch.pwds, kRounds, arrs, pool);
+  std::unique_ptr<bool[]> results(new bool[kBatchSize]);
+  for (auto _ : state) {
+    pwd_hasher.VerifyBatch(batch.pwds, arrs, {results.get(), kBatchSize}, pool);
+    benchmark::DoNotOptimize(results.get());
+  }
+  state.SetItemsProcessed(state.iterations() * kBatchSize);
+  state.counters["threads"] = state.range(0);
+}
+BENCHMARK(BM_VerifyBatch)->RangeMultiplier(2)->Range(1, 16)->UseRealTime();
+
+///////////////////////////////////////////////////////////////////////////////
+// End to end
+///////////////////////////////////////////////////////////////////////////////
+
+// Returns a password of the given size.
+std::string
+Password(std::size_t size)
+{
+  std::string pwd(size, ' ');
+  for (std::size_t i = 0; i < size; ++i)
+    pwd[i] = static_cast<char>('a' + i % 26);
+  return pwd;
+}
+
+// PwdHasher::Generate with a password of state.range(0) bytes, on one
+// hasher shared by the benchmark's threads.
+void
+BM_Generate(benchmark::State& state)
+{
+  static const PwdHasher pwd_hasher;
+  const auto pwd = Password(state.range(0));
+  for (auto _ : state)
+    benchmark::DoNotOptimize(pwd_hasher.Generate(pwd, kRounds));
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Generate)
+  ->Arg(8)->Arg(32)->Arg(72)->ThreadRange(1, 4)->UseRealTime();
+
+// PwdHasher::IsSamePwd with a password of state.range(0) bytes.
+void
+BM_IsSamePwd(benchmark::State& state)
+{
+  static const PwdHasher pwd_hasher;
+  const auto pwd = Password(state.range(0));
+  const auto arr = pwd_hasher.Generate(pwd, kRounds);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(pwd_hasher.IsSamePwd(pwd, arr));
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_IsSamePwd)
+  ->Arg(8)->Arg(32)->Arg(72)->ThreadRange(1, 4)->UseRealTime();
+
+///////////////////////////////////////////////////////////////////////////////
+// Regression gate
+///////////////////////////////////////////////////////////////////////////////
+
+// Repetitions of each benchmark when none are given, enough for a stable
+// median and MAD.
+constexpr int kGateRepetitions = 10;
+
+// Prints the runs as usual, and keeps the time per iteration of each
+// repetition: the real time of benchmarks that use it, otherwise the CPU
+// time, as in the items per second.
+class GateReporter : public benchmark::ConsoleReporter {
+public:
+  void
+  ReportRuns(const std::vector<Run>& runs) override
+  {
+    ConsoleReporter::ReportRuns(runs);
+    for (const auto& run : runs) {
+      if (run.run_type != Run::RT_Iteration or run.error_occurred
+          or run.iterations == 0)
+        continue;
+      auto& times = times_[run.benchmark_name()];
+      if (times.empty()) names_.push_back(run.benchmark_name());
+      const auto time = run.benchmark_name().find("/real_time") != npos
+          ? run.real_accumulated_time : run.cpu_accumulated_time;
+      times.push_back(time * 1e9 / run.iterations);
+    }
+  }
+
+  std::vector<BenchStats>
+  Stats() const
+  {
+    std::vector<BenchStats> stats;
+    for (const auto& name : names_)
+      stats.push_back(Summarize(name, times_.at(name)));
+    return stats;
+  }
+
+private:
+  static constexpr auto npos = std::string::npos;
+
+  std::vector<std::string> names_;
+  std::map<std::string, std::vector<double>> times_;
+};
+
+// Returns a filter that matches exactly the benchmarks of the baseline.
+std::string
+BaselineFilter(const std::vector<BenchStats>& baseline)
+{
+  constexpr std::string_view kSpecial = "\\^$.|?*+()[]{}";
+  std::string filter = "^(";
+  for (std::size_t i = 0; i < baseline.size(); ++i) {
+    if (i) filter += '|';
+    for (const char c : baseline[i].name) {
+      if (kSpecial.find(c) != std::string_view::npos)
+        filter += '\\';
+      filter += c;
+    }
+  }
+  return filter + ")$";
+}
+
+std::string_view
+VerdictName(GateVerdict verdict)
+{
+  switch (verdict) {
+    case GateVerdict::kOk: return "ok";
+    case GateVerdict::kRegression: return "REGRESSION";
+    case GateVerdict::kMissing: return "missing";
+    case GateVerdict::kNew: return "new";
+  }
+  return "";
+}
+
+std::string
+FormatNs(std::optional<double> ns)
+{
+  return ns ? fmt::format("{:.1f}", *ns) : "-";
+}
+
+// Prints the comparison and returns the number of regressions.
+int
+PrintGate(const std::vector<GateResult>& results)
+{
+  int regressions = 0;
+  fmt::print("\n{:<48} {:>14} {:>14} {:>8}  {}\n",
+             "benchmark", "baseline (ns)", "current (ns)", "change", "verdict");
+  for (const auto& r : results) {
+    fmt::print("{:<48} {:>14} {:>14} {:>8}  {}\n", r.name,
+               FormatNs(r.baseline_ns), FormatNs(r.current_ns),
+               r.change ? fmt::format("{:+.1f}%", 100 * *r.change) : "-",
+               VerdictName(r.verdict));
+    if (r.verdict == GateVerdict::kRegression) ++regressions;
+  }
+  fmt::print("\n{} regression(s) in {} benchmark(s)\n", regressions,
+             results.size());
+  return regressions;
+}
+
+// Returns the value of --name=value in arg, or nullptr.
+const char*
+Flag(std::string_view arg, std::string_view name)
+{
+  if (arg.size() <= name.size() + 3 or arg.substr(0, 2) != "--"
+      or arg.substr(2, name.size()) != name or arg[name.size() + 2] != '=')
+    return nullptr;
+  return arg.data() + name.size() + 3;
+}
+
+} // namespace
+} // namespace bcrypt
+
+// Besides the usual benchmark flags, takes:
+//
+//   --save_baseline=FILE  writes the median and MAD of each benchmark to FILE
+//   --baseline=FILE       compares to the baseline in FILE, and exits with 1
+//                         if any benchmark regressed
+//   --update_baseline=FILE  reruns the benchmarks of the baseline in FILE and
+//                         rewrites it, keeping the tolerances set by hand
+//   --tolerance=X         slowdown allowed for benchmarks without their own
+//                         tolerance in the baseline, e.g. 0.05 for 5%
+//   --min_z=X             slowdown, in standard errors of the difference of
+//                         the medians, that noise may explain
+//
+// In either mode, each benchmark runs 10 times unless
+// --benchmark_repetitions is given, and with --baseline only the benchmarks
+// of the baseline run unless --benchmark_filter is given.
+int
+main(int argc, char** argv)
+{
+  using namespace bcrypt;
+
+  std::string save_path;
+  std::string baseline_path;
+  bool update = false;
+  GateOptions options;
+  bool has_repetitions = false;
+  bool has_filter = false;
+  std::vector<std::string> args;
+  for (int i = 0; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    if (const auto v = Flag(arg, "save_baseline")) {
+      save_path = v;
+    } else if (const auto v = Flag(arg, "baseline")) {
+      baseline_path = v;
+    } else if (const auto v = Flag(arg, "update_baseline")) {
+      save_path = baseline_path = v;
+      update = true;
+    } else if (const auto v = Flag(arg, "tolerance")) {
+      options.tolerance = std::strtod(v, nullptr);
+    } else if (const auto v = Flag(arg, "min_z")) {
+      options.min_z = std::strtod(v, nullptr);
+    } else {
+      has_repetitions = has_repetitions
+          or Flag(arg, "benchmark_repetitions") != nullptr;
+      has_filter = has_filter or Flag(arg, "benchmark_filter") != nullptr;
+      args.emplace_back(arg);
+    }
+  }
+  const bool gate = not save_path.empty() or not baseline_path.empty();
+
+  std::vector<BenchStats> baseline;
+  if (not baseline_path.empty()) {
+    std::ifstream in(baseline_path);
+    std::stringstream json;
+    json << in.rdbuf();
+    if (not in) {
+      std::cerr << "Cannot read " << baseline_path << ".\n";
+      return 2;
+    }
+    try {
+      baseline = ReadBaseline(json.str());
+    } catch (const std::invalid_argument& e) {
+      std::cerr << baseline_path << ": " << e.what() << "\n";
+      return 2;
+    }
+    if (not has_filter)
+      args.push_back("--benchmark_filter=" + BaselineFilter(baseline));
+  }
+  if (gate and not has_repetitions)
+    args.push_back(fmt::format("--benchmark_repetitions={}",
+                               kGateRepetitions));
+
+  std::vector<char*> new_argv;
+  for (auto& arg : args)
+    new_argv.push_back(arg.data());
+  new_argv.push_back(nullptr);
+  int new_argc = static_cast<int>(args.size());
+  benchmark::Initialize(&new_argc, new_argv.data());
+  if (benchmark::ReportUnrecognizedArguments(new_argc, new_argv.data()))
+    return 1;
+
+  if (not gate) {
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+  }
+
+  GateReporter reporter;
+  benchmark::RunSpecifiedBenchmarks(&reporter);
+  benchmark::Shutdown();
+  auto stats = reporter.Stats();
+
+  int status = 0;
+  if (not baseline.empty()) {
+    // Tolerances set by hand in the baseline carry over when it is rewritten.
+    for (auto& s : stats) {
+      for (const auto& base : baseline)
+        if (base.name == s.name) s.tolerance = base.tolerance;
+    }
+    if (PrintGate(CompareToBaseline(baseline, stats, options)) > 0
+        and not update)
+      status = 1;
+  }
+  if (update) {
+    // Benchmarks of the baseline that were filtered out keep their stats.
+    for (const auto& base : baseline) {
+      if (std::none_of(stats.begin(), stats.end(),
+                       [&](const auto& s) { return s.name == base.name; }))
+        stats.push_back(base);
+    }
+  }
+  if (not save_path.empty()) {
+    std::ofstream out(save_path);
+    out << WriteBaseline(stats);
+    if (not out) {
+      std::cerr << "Cannot write " << save_path << ".\n";
+      return 2;
+    }
+  }
+  return status;
+}
@@ -0,0 +1,85 @@
+// Prints cost factor vs. latency vs. throughput on this host, to size nodes
+// for a given load. Usage:
+//
+//   bcrypt_capacity [--cores=N] [--qps=Q] [--samples=S]
+//
+// For each cost factor, the table has two sets of columns. The single
+// columns time one hash with GenHash, the path that PwdHasher::Verify takes.
+// The batched columns time a full batch of the active kernel, the path of
+// VerifyBatch, MicroBatcher and bcryptd, whose latency is that of the whole
+// batch. Each set has the p50 and p99 latency, the most verifications per
+// second that the given number of cores can sustain, and the utilization of
+// those cores at the target QPS. Over 100% utilization, that path cannot
+// serve the target QPS.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string_view>
+#include <thread>
+
+#include <fmt/core.h>
+
+#include "bcrypt.h"
+#include "calibrate.h"
+
+namespace {
+// Returns the value of --name=value in arg, or nullptr.
+const char*
+Flag(std::string_view arg, std::string_view name)
+{
+  if (arg.size() <= name.size() + 3 or arg.substr(0, 2) != "--"
+      or arg.substr(2, name.size()) != name or arg[name.size() + 2] != '=')
+    return nullptr;
+  return arg.data() + name.size() + 3;
+}
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+  std::size_t cores = std::thread::hardware_concurrency();
+  double qps = 0;
+  std::size_t samples = 50;
+  for (int i = 1; i < argc; ++i) {
+    if (const auto v = Flag(argv[i], "cores")) {
+      cores = std::strtoul(v, nullptr, 10);
+    } else if (const auto v = Flag(argv[i], "qps")) {
+      qps = std::strtod(v, nullptr);
+    } else if (const auto v = Flag(argv[i], "samples")) {
+      samples = std::strtoul(v, nullptr, 10);
+    } else {
+      std::cerr << "usage: " << argv[0]
+                << " [--cores=N] [--qps=Q] [--samples=S]\n";
+      return 2;
+    }
+  }
+  if (cores == 0 or samples == 0) {
+    std::cerr << "--cores and --samples should be positive.\n";
+    return 2;
+  }
+
+  const auto kernel = bcrypt::ActiveKernel();
+  fmt::print("kernel {} ({} lanes), {} cores, target {} verifications/s\n\n",
+             bcrypt::KernelName(kernel), bcrypt::KernelLanes(kernel), cores,
+             qps);
+  fmt::print("{:>5} | {:^49} | {:^49}\n", "", "single", "batched");
+  fmt::print("{:>5} | {:>10} {:>10} {:>14} {:>12} | {:>10} {:>10} {:>14} "
+             "{:>12}\n",
+             "cost", "p50 (ms)", "p99 (ms)", "max verify/s", "utilization",
+             "p50 (ms)", "p99 (ms)", "max verify/s", "utilization");
+  for (std::uint32_t rounds = 4; rounds <= 31; ++rounds) {
+    fmt::print("{:>5}", rounds);
+    for (const auto path :
+         {bcrypt::HashPath::kSingle, bcrypt::HashPath::kBatched}) {
+      const auto profile = bcrypt::ProfileCost(rounds, samples, 0.99, path);
+      const auto max_qps = profile.HashesPerSecond() * cores;
+      fmt::print(" | {:>10.3f} {:>10.3f} {:>14.0f} {:>11.0f}%",
+                 profile.p50.count() / 1e6, profile.p99.count() / 1e6,
+                 max_qps, 100 * qps / max_qps);
+    }
+    fmt::print("\n");
+  }
+  return 0;
+}
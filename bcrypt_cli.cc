@@ -0,0 +1,147 @@
+// Hashes or verifies a stream of records on every core, e.g. to migrate a
+// table of passwords or to check a list of leaked ones against our hashes.
+// Usage:
+//
+//   bcrypt_cli hash|verify [--rounds=R] [--format=lines|binary]
+//              [--input=FILE] [--output=FILE] [--threads=N] [--chunk=N]
+//              [--max_chunks=N] [--progress=S]
+//
+// Records are read from --input, or stdin, and a result per record is
+// written to --output, or stdout, in the order of the records; see bulk.h
+// for the formats. Progress is reported to stderr every --progress seconds,
+// or never if 0, and a summary at the end.
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+#include <fmt/core.h>
+
+#include "bulk.h"
+#include "thread_pool.h"
+
+namespace bcrypt {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Returns the value of --name=value in arg, or nullptr.
+const char*
+Flag(std::string_view arg, std::string_view name)
+{
+  if (arg.size() <= name.size() + 3 or arg.substr(0, 2) != "--"
+      or arg.substr(2, name.size()) != name or arg[name.size() + 2] != '=')
+    return nullptr;
+  return arg.data() + name.size() + 3;
+}
+
+void
+PrintStats(const BulkStats& stats, std::chrono::duration<double> elapsed)
+{
+  fmt::print(stderr, "{} records in {:.1f}s ({:.1f}/s): {} ok, {} mismatched, "
+                     "{} invalid\n",
+             stats.records, elapsed.count(), stats.records / elapsed.count(),
+             stats.ok, stats.mismatched, stats.invalid);
+}
+
+} // namespace
+} // namespace bcrypt
+
+int
+main(int argc, char** argv)
+{
+  using namespace bcrypt;
+
+  BulkOptions options;
+  std::string input;
+  std::string output;
+  std::size_t threads = 0;
+  double progress_interval = 1;
+  bool ok = argc >= 2;
+  if (ok) {
+    const std::string_view mode = argv[1];
+    options.mode = mode == "verify" ? BulkMode::kVerify : BulkMode::kHash;
+    ok = mode == "hash" or mode == "verify";
+  }
+  for (int i = 2; i < argc and ok; ++i) {
+    if (const auto v = Flag(argv[i], "rounds")) {
+      options.rounds = std::strtoul(v, nullptr, 10);
+    } else if (const auto v = Flag(argv[i], "format")) {
+      const std::string_view format = v;
+      options.format =
+          format == "binary" ? RecordFormat::kBinary : RecordFormat::kLines;
+      ok = format == "binary" or format == "lines";
+    } else if (const auto v = Flag(argv[i], "input")) {
+      input = v;
+    } else if (const auto v = Flag(argv[i], "output")) {
+      output = v;
+    } else if (const auto v = Flag(argv[i], "threads")) {
+      threads = std::strtoul(v, nullptr, 10);
+    } else if (const auto v = Flag(argv[i], "chunk")) {
+      options.chunk_size = std::strtoul(v, nullptr, 10);
+    } else if (const auto v = Flag(argv[i], "max_chunks")) {
+      options.max_chunks = std::strtoul(v, nullptr, 10);
+    } else if (const auto v = Flag(argv[i], "progress")) {
+      progress_interval = std::strtod(v, nullptr);
+    } else {
+      ok = false;
+    }
+  }
+  if (not ok) {
+    std::cerr << "usage: " << argv[0]
+              << " hash|verify [--rounds=R] [--format=lines|binary]"
+                 " [--input=FILE] [--output=FILE] [--threads=N] [--chunk=N]"
+                 " [--max_chunks=N] [--progress=S]\n";
+    return 2;
+  }
+
+  std::ios::sync_with_stdio(false);
+  std::ifstream in_file;
+  std::ofstream out_file;
+  if (not input.empty()) {
+    in_file.open(input, std::ios::binary);
+    if (not in_file) {
+      std::cerr << "Cannot open " << input << "\n";
+      return 1;
+    }
+  }
+  if (not output.empty()) {
+    out_file.open(output, std::ios::binary | std::ios::trunc);
+    if (not out_file) {
+      std::cerr << "Cannot open " << output << "\n";
+      return 1;
+    }
+  }
+  std::istream& in = input.empty() ? std::cin : in_file;
+  std::ostream& out = output.empty() ? std::cout : out_file;
+
+  ThreadPool pool(threads);
+  const auto start = Clock::now();
+  auto next_report = start + std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(progress_interval));
+  const auto progress = [&](const BulkStats& stats) {
+    if (progress_interval <= 0) return;
+    const auto now = Clock::now();
+    if (now < next_report) return;
+    PrintStats(stats, now - start);
+    next_report = now + std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(progress_interval));
+  };
+
+  try {
+    const auto stats = RunBulk(options, in, out, pool, progress);
+    PrintStats(stats, Clock::now() - start);
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,403 @@
+// Replays synthetic login traffic against the library and reports the
+// latency distribution and the throughput achieved. Usage:
+//
+//   bcrypt_loadgen [--rate=R] [--duration=S] [--arrivals=poisson|bursty]
+//                  [--burst_factor=F] [--burst_ms=M] [--users=N] [--zipf=S]
+//                  [--rounds=10:0.9,12:0.1] [--pwd_sizes=8:1,16:1]
+//                  [--generate=F] [--wrong=F] [--threads=N] [--seed=N]
+//                  [--frontend=pool|cache|single_flight|admission]
+//
+// The traffic is open loop: requests arrive at the times the model draws,
+// whether or not earlier ones are done, and the latency of a request runs
+// from its arrival, so a backlog shows up in the tail instead of slowing
+// the arrivals down. Verifications run on a pool of --threads workers:
+//
+//   pool           PwdHasher::Verify
+//   cache          LruVerifyCache::Verify
+//   single_flight  SingleFlight::Verify
+//   admission      AsyncPwdHasher::Verify, shedding load with the default
+//                  AdmissionController
+//
+// Generate requests always run PwdHasher::Generate on the pool.
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "admission.h"
+#include "async.h"
+#include "bcrypt.h"
+#include "single_flight.h"
+#include "thread_pool.h"
+#include "traffic.h"
+#include "verify_cache.h"
+
+namespace bcrypt {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+enum class Frontend { kPool, kCache, kSingleFlight, kAdmission };
+
+struct Options {
+  TrafficOptions traffic;
+  std::chrono::duration<double> duration{10};
+  // Workers, or one per core if 0.
+  std::size_t threads = 0;
+  Frontend frontend = Frontend::kPool;
+};
+
+// Returns the value of --name=value in arg, or nullptr.
+const char*
+Flag(std::string_view arg, std::string_view name)
+{
+  if (arg.size() <= name.size() + 3 or arg.substr(0, 2) != "--"
+      or arg.substr(2, name.size()) != name or arg[name.size() + 2] != '=')
+    return nullptr;
+  return arg.data() + name.size() + 3;
+}
+
+// Parses a mix like "10:0.9,12:0.1", where a missing weight is 1.
+template <typename T>
+std::optional<std::vector<std::pair<T, double>>>
+ParseMix(std::string_view s)
+{
+  std::vector<std::pair<T, double>> mix;
+  while (not s.empty()) {
+    const auto end = std::min(s.find(','), s.size());
+    const std::string item(s.substr(0, end));
+    char* rest = nullptr;
+    const auto value = std::strtoul(item.c_str(), &rest, 10);
+    double weight = 1;
+    if (*rest == ':') weight = std::strtod(rest + 1, &rest);
+    if (rest == item.c_str() or *rest != '\0') return std::nullopt;
+    mix.emplace_back(static_cast<T>(value), weight);
+    s.remove_prefix(std::min(end + 1, s.size()));
+  }
+  return mix;
+}
+
+// Returns the password of the user, or a wrong one of the same size.
+std::string
+Password(std::size_t user, std::size_t size, bool wrong)
+{
+  const auto id = fmt::format("user{}:", user);
+  std::string pwd(size, '.');
+  for (std::size_t i = 0; i < size; ++i)
+    pwd[i] = id[i % id.size()];
+  if (wrong) pwd.back() ^= 1;
+  return pwd;
+}
+
+struct Sample {
+  std::uint32_t rounds = 0;
+  std::chrono::nanoseconds latency{0};
+};
+
+// Collects the outcomes of the requests and waits for the last one.
+class Recorder {
+public:
+  void
+  Sent()
+  {
+    std::lock_guard lock(mutex_);
+    ++outstanding_;
+  }
+
+  // Records a request that arrived at the given time and completed now, with
+  // the expected outcome if ok.
+  void
+  Done(std::uint32_t rounds, Clock::time_point arrival, bool ok)
+  {
+    const auto now = Clock::now();
+    std::lock_guard lock(mutex_);
+    samples_.push_back({rounds, now - arrival});
+    if (not ok) ++errors_;
+    last_ = std::max(last_, now);
+    if (--outstanding_ == 0) cond_.notify_all();
+  }
+
+  // Records a request that the front end rejected.
+  void
+  Rejected()
+  {
+    std::lock_guard lock(mutex_);
+    ++rejected_;
+    if (--outstanding_ == 0) cond_.notify_all();
+  }
+
+  void
+  Wait()
+  {
+    std::unique_lock lock(mutex_);
+    cond_.wait(lock, [this] { return outstanding_ == 0; });
+  }
+
+  // Only valid after Wait.
+  std::vector<Sample>&
+  Samples() { return samples_; }
+  std::size_t
+  Errors() const { return errors_; }
+  std::size_t
+  RejectedCount() const { return rejected_; }
+  Clock::time_point
+  Last() const { return last_; }
+
+private:
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::size_t outstanding_ = 0;
+  std::vector<Sample> samples_;
+  std::size_t errors_ = 0;
+  std::size_t rejected_ = 0;
+  Clock::time_point last_;
+};
+
+std::chrono::nanoseconds
+Percentile(const std::vector<std::chrono::nanoseconds>& sorted, double p)
+{
+  if (sorted.empty()) return std::chrono::nanoseconds(0);
+  const auto rank = static_cast<std::size_t>(p * sorted.size());
+  return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+void
+PrintLatency(std::string_view name, std::vector<std::chrono::nanoseconds> ls)
+{
+  std::sort(ls.begin(), ls.end());
+  const auto ms = [&](double p) { return Percentile(ls, p).count() / 1e6; };
+  fmt::print("{:<8} {:>9} {:>10.3f} {:>10.3f} {:>10.3f} {:>10.3f}\n",
+             name, ls.size(), ms(0.5), ms(0.99), ms(0.999), ms(1));
+}
+
+int
+Run(const Options& options)
+{
+  TrafficModel model(options.traffic);
+  std::vector<TrafficRequest> requests;
+  for (;;) {
+    const auto request = model.Next();
+    if (request.at > options.duration) break;
+    requests.push_back(request);
+  }
+  const auto& users = model.Users();
+
+  // Hashes the password of every user that is verified, up front.
+  std::vector<std::size_t> verified;
+  for (const auto& r : requests)
+    if (not r.generate) verified.push_back(r.user);
+  std::sort(verified.begin(), verified.end());
+  verified.erase(std::unique(verified.begin(), verified.end()),
+                 verified.end());
+  fmt::print("hashing the passwords of {} users\n", verified.size());
+
+  // Everything the tasks use is declared before the pool, so it outlives the
+  // tasks that are still finishing when the last request is recorded.
+  const auto threads = options.threads
+      ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+  const PwdHasher pwd_hasher;
+  std::map<std::size_t, BcryptArr> arrs;
+  LruVerifyCache cache;
+  SingleFlight single_flight(pwd_hasher);
+  AdmissionController admission({.workers = threads});
+  Recorder recorder;
+  ThreadPool pool(threads);
+  AsyncPwdHasher async_hasher(pwd_hasher, pool);
+
+  for (const auto user : verified)
+    arrs[user];
+  pool.ParallelFor(verified.size(), [&](std::size_t i) {
+    const auto& u = users[verified[i]];
+    arrs.at(verified[i]) = pwd_hasher.Generate(
+        Password(verified[i], u.pwd_size, false), u.rounds);
+  });
+
+  fmt::print("sending {} requests over {:.1f}s ({:.1f}/s) to {} threads\n\n",
+             requests.size(), options.duration.count(),
+             requests.size() / options.duration.count(), pool.Size());
+  const auto start = Clock::now();
+  for (const auto& r : requests) {
+    const auto arrival =
+        start + std::chrono::duration_cast<Clock::duration>(r.at);
+    std::this_thread::sleep_until(arrival);
+    const auto rounds = users[r.user].rounds;
+    auto pwd = Password(r.user, users[r.user].pwd_size, r.wrong);
+    recorder.Sent();
+
+    if (r.generate) {
+      pool.Submit([&, pwd = std::move(pwd), rounds, arrival] {
+        pwd_hasher.Generate(pwd, rounds);
+        recorder.Done(rounds, arrival, true);
+      });
+      continue;
+    }
+    const auto& arr = arrs.at(r.user);
+    const auto expected =
+        r.wrong ? VerifyStatus::kMismatch : VerifyStatus::kMatch;
+    const auto done = [&recorder, rounds, arrival, expected](VerifyStatus s) {
+      if (s == VerifyStatus::kOverloaded)
+        recorder.Rejected();
+      else
+        recorder.Done(rounds, arrival, s == expected);
+    };
+    switch (options.frontend) {
+      case Frontend::kPool:
+        pool.Submit([&, pwd = std::move(pwd), done] {
+          done(pwd_hasher.Verify(pwd, arr));
+        });
+        break;
+      case Frontend::kCache:
+        pool.Submit([&, pwd = std::move(pwd), done] {
+          done(cache.Verify(pwd_hasher, pwd, arr));
+        });
+        break;
+      case Frontend::kSingleFlight:
+        pool.Submit([&, pwd = std::move(pwd), done] {
+          done(single_flight.Verify(pwd, arr));
+        });
+        break;
+      case Frontend::kAdmission:
+        async_hasher.Verify(pwd, arr, admission, done);
+        break;
+    }
+  }
+  recorder.Wait();
+
+  auto& samples = recorder.Samples();
+  const std::chrono::duration<double> elapsed = recorder.Last() - start;
+  fmt::print("completed {}, rejected {}, wrong outcomes {}\n",
+             samples.size(), recorder.RejectedCount(), recorder.Errors());
+  fmt::print("throughput {:.1f}/s over {:.2f}s\n\n",
+             samples.size() / elapsed.count(), elapsed.count());
+
+  fmt::print("{:<8} {:>9} {:>10} {:>10} {:>10} {:>10}\n",
+             "rounds", "requests", "p50 (ms)", "p99 (ms)", "p999 (ms)",
+             "max (ms)");
+  std::map<std::uint32_t, std::vector<std::chrono::nanoseconds>> by_rounds;
+  std::vector<std::chrono::nanoseconds> all;
+  for (const auto& s : samples) {
+    by_rounds[s.rounds].push_back(s.latency);
+    all.push_back(s.latency);
+  }
+  for (auto& [rounds, latencies] : by_rounds)
+    PrintLatency(std::to_string(rounds), std::move(latencies));
+  PrintLatency("all", std::move(all));
+
+  switch (options.frontend) {
+    case Frontend::kCache: {
+      const auto stats = cache.Stats();
+      fmt::print("\ncache hits {}, misses {}, evictions {}\n",
+                 stats.hits, stats.misses, stats.evictions);
+      break;
+    }
+    case Frontend::kSingleFlight: {
+      const auto stats = single_flight.Stats();
+      fmt::print("\nsingle flight computations {}, coalesced {}\n",
+                 stats.computations, stats.coalesced);
+      break;
+    }
+    case Frontend::kAdmission: {
+      const auto stats = admission.Stats();
+      fmt::print("\nadmitted {}, rejected {}\n",
+                 stats.admitted, stats.rejected);
+      break;
+    }
+    case Frontend::kPool:
+      break;
+  }
+  return recorder.Errors() == 0 ? 0 : 1;
+}
+
+} // namespace
+} // namespace bcrypt
+
+int
+main(int argc, char** argv)
+{
+  using namespace bcrypt;
+
+  Options options;
+  bool ok = true;
+  for (int i = 1; i < argc and ok; ++i) {
+    const std::string_view arg = argv[i];
+    auto& traffic = options.traffic;
+    if (const auto v = Flag(arg, "rate")) {
+      traffic.rate = std::strtod(v, nullptr);
+    } else if (const auto v = Flag(arg, "duration")) {
+      options.duration = std::chrono::duration<double>(std::strtod(v, nullptr));
+    } else if (const auto v = Flag(arg, "arrivals")) {
+      const std::string_view arrivals = v;
+      traffic.arrivals =
+          arrivals == "bursty" ? Arrivals::kBursty : Arrivals::kPoisson;
+      ok = arrivals == "bursty" or arrivals == "poisson";
+    } else if (const auto v = Flag(arg, "burst_factor")) {
+      traffic.burst_factor = std::strtod(v, nullptr);
+    } else if (const auto v = Flag(arg, "burst_ms")) {
+      traffic.burst_length = std::chrono::milliseconds(std::atoll(v));
+    } else if (const auto v = Flag(arg, "users")) {
+      traffic.users = std::strtoul(v, nullptr, 10);
+    } else if (const auto v = Flag(arg, "zipf")) {
+      traffic.zipf_s = std::strtod(v, nullptr);
+    } else if (const auto v = Flag(arg, "rounds")) {
+      const auto mix = ParseMix<std::uint32_t>(v);
+      if (mix) traffic.rounds = *mix;
+      ok = mix.has_value();
+    } else if (const auto v = Flag(arg, "pwd_sizes")) {
+      const auto mix = ParseMix<std::size_t>(v);
+      if (mix) traffic.pwd_sizes = *mix;
+      ok = mix.has_value();
+    } else if (const auto v = Flag(arg, "generate")) {
+      traffic.generate_fraction = std::strtod(v, nullptr);
+    } else if (const auto v = Flag(arg, "wrong")) {
+      traffic.wrong_fraction = std::strtod(v, nullptr);
+    } else if (const auto v = Flag(arg, "seed")) {
+      traffic.seed = std::strtoull(v, nullptr, 10);
+    } else if (const auto v = Flag(arg, "threads")) {
+      options.threads = std::strtoul(v, nullptr, 10);
+    } else if (const auto v = Flag(arg, "frontend")) {
+      const std::string_view frontend = v;
+      if (frontend == "pool")
+        options.frontend = Frontend::kPool;
+      else if (frontend == "cache")
+        options.frontend = Frontend::kCache;
+      else if (frontend == "single_flight")
+        options.frontend = Frontend::kSingleFlight;
+      else if (frontend == "admission")
+        options.frontend = Frontend::kAdmission;
+      else
+        ok = false;
+    } else {
+      ok = false;
+    }
+  }
+  if (not ok or not (options.duration.count() > 0)) {
+    std::cerr << "usage: " << argv[0]
+              << " [--rate=R] [--duration=S] [--arrivals=poisson|bursty]"
+                 " [--burst_factor=F] [--burst_ms=M] [--users=N] [--zipf=S]"
+                 " [--rounds=10:0.9,12:0.1] [--pwd_sizes=8:1,16:1]"
+                 " [--generate=F] [--wrong=F] [--threads=N] [--seed=N]"
+                 " [--frontend=pool|cache|single_flight|admission]\n";
+    return 2;
+  }
+  try {
+    return Run(options);
+  } catch (const std::invalid_argument& e) {
+    std::cerr << e.what() << "\n";
+    return 2;
+  }
+}
@@ -0,0 +1,158 @@
+// Reports hardware counters for the Blowfish core, to see why one kernel
+// beats another: cycles, instructions, IPC, L1D misses and branch misses per
+// Blowfish_encipher call, and per iteration of the cost loop for GenHash and
+// for each kernel. Kernel rows are per lane, so they compare directly with
+// GenHash. Usage:
+//
+//   bcrypt_perf [--repetitions=N]
+//
+// Counters that perf_event_open cannot open, e.g. in a VM or container, are
+// shown as "-" and only the time is reported.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "bcrypt.h"
+#include "blowfish.h"
+#include "kernel.h"
+#include "perf_counters.h"
+
+namespace bcrypt {
+namespace {
+
+// Rounds of the two hashes whose difference is the cost of the cost loop,
+// without the setup and the final encryption.
+constexpr std::uint32_t kLowRounds = 4;
+constexpr std::uint32_t kHighRounds = 12;
+
+// Returns the sample of the fastest of repetitions runs of fn.
+PerfSample
+Measure(PerfCounters& counters, int repetitions, const std::function<void()>& fn)
+{
+  std::optional<PerfSample> best;
+  for (int i = 0; i < repetitions; ++i) {
+    counters.Start();
+    fn();
+    const auto sample = counters.Stop();
+    if (not best or sample.time < best->time) best = sample;
+  }
+  return *best;
+}
+
+std::string
+Format(std::optional<double> value, int precision = 1)
+{
+  return value ? fmt::format("{:.{}f}", *value, precision) : "-";
+}
+
+void
+PrintRow(std::string_view name, const PerfSample& sample)
+{
+  fmt::print("{:<24} {:>10.1f} {:>12} {:>12} {:>6} {:>12} {:>14}\n",
+             name, static_cast<double>(sample.time.count()),
+             Format(sample.Count(PerfEvent::kCycles)),
+             Format(sample.Count(PerfEvent::kInstructions)),
+             Format(sample.Ipc(), 2),
+             Format(sample.Count(PerfEvent::kL1dMisses)),
+             Format(sample.Count(PerfEvent::kBranchMisses)));
+}
+
+// Measures one iteration of the cost loop for one lane of the kernel.
+PerfSample
+MeasureIteration(PerfCounters& counters, int repetitions, Kernel kernel)
+{
+  const auto lanes = KernelLanes(kernel);
+  std::vector<std::string> pwd_strs(lanes);
+  std::vector<std::string_view> pwds(lanes);
+  std::vector<Salt> salts(lanes);
+  std::vector<PwdHash> hashes(lanes);
+  for (std::size_t i = 0; i < lanes; ++i) {
+    pwd_strs[i] = "password" + std::to_string(i);
+    pwds[i] = pwd_strs[i];
+    salts[i].fill(static_cast<std::uint8_t>(i));
+  }
+  const auto hash = [&](std::uint32_t rounds) {
+    return Measure(counters, repetitions, [&] {
+      if (kernel == Kernel::kScalar)
+        hashes[0] = GenHash(pwds[0], salts[0], rounds);
+      else
+        GenHashWith(kernel, pwds, salts, rounds, hashes);
+    });
+  };
+  const auto low = hash(kLowRounds);
+  const auto high = hash(kHighRounds);
+  return (high - low).Per((kHighRounds - kLowRounds) * lanes);
+}
+
+int
+Run(int repetitions)
+{
+  PerfCounters counters;
+  if (not counters.Available()) {
+    fmt::print("hardware counters unavailable ({}), reporting time only\n\n",
+               counters.Error());
+  } else if (not counters.Error().empty()) {
+    fmt::print("some hardware counters unavailable ({})\n\n",
+               counters.Error());
+  }
+
+  fmt::print("{:<24} {:>10} {:>12} {:>12} {:>6} {:>12} {:>14}\n",
+             "per", "ns", "cycles", "instructions", "IPC", "L1D misses",
+             "branch misses");
+
+  constexpr int kCalls = 1 << 20;
+  Context ctx;
+  Blowfish_initstate(&ctx);
+  std::uint32_t l = 0;
+  std::uint32_t r = 0;
+  const auto encipher = Measure(counters, repetitions, [&] {
+    for (int i = 0; i < kCalls; ++i)
+      Blowfish_encipher(&ctx, &l, &r);
+  });
+  PrintRow("Blowfish_encipher", encipher.Per(kCalls));
+
+  PrintRow("GenHash iteration",
+           MeasureIteration(counters, repetitions, Kernel::kScalar));
+  for (const auto kernel : {Kernel::kInterleaved, Kernel::kAvx2,
+                            Kernel::kAvx512}) {
+    if (not IsKernelSupported(kernel)) continue;
+    PrintRow(fmt::format("{} iteration/lane", KernelName(kernel)),
+             MeasureIteration(counters, repetitions, kernel));
+  }
+  // Keeps the encipher loop from being optimized out.
+  return (l ^ r) == 0x12345678 ? 1 : 0;
+}
+
+} // namespace
+} // namespace bcrypt
+
+int
+main(int argc, char** argv)
+{
+  int repetitions = 5;
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    constexpr std::string_view kFlag = "--repetitions=";
+    if (arg.starts_with(kFlag)) {
+      repetitions = std::atoi(arg.data() + kFlag.size());
+    } else {
+      std::cerr << "usage: " << argv[0] << " [--repetitions=N]\n";
+      return 2;
+    }
+  }
+  if (repetitions <= 0) {
+    std::cerr << "--repetitions should be positive.\n";
+    return 2;
+  }
+  return bcrypt::Run(repetitions);
+}
@@ -2,12 +2,20 @@
 
 #include <algorithm>
 #include <array>
+#include <chrono>
 #include <functional>
+#include <future>
+#include <memory>
 #include <random>
 #include <stdexcept>
+#include <stop_token>
+#include <string>
 #include <string_view>
+#include <thread>
+#include <vector>
 
 #include "gmock/gmock.h"
+#include "thread_pool.h"
 
 namespace bcrypt {
 namespace {
@@ -32,6 +40,92 @@ TEST(FormattingDecodingTest, WorksCorrectly) {
                     Field("salt", &BcryptParams::salt, Eq(salt)))));
 }
 
+TEST(GenHashNTest, IsSameAsGenHash) {
+  auto random_fn = std::bind_front(
+      std::uniform_int_distribution<std::uint8_t>(), std::mt19937(0));
+
+  std::vector<std::string> pwd_strs;
+  std::vector<Salt> salts;
+  for (int i = 1; i < 40; ++i) {
+    std::string pwd;
+    for (int j = 0; j < i; ++j)
+      pwd.push_back(random_fn());
+    pwd_strs.push_back(std::move(pwd));
+    Salt salt;
+    for (auto& c : salt) c = random_fn();
+    salts.push_back(salt);
+  }
+  std::vector<std::string_view> pwds(pwd_strs.begin(), pwd_strs.end());
+
+  std::vector<PwdHash> hashes(pwds.size());
+  GenHashN(pwds, salts, 5, hashes);
+  for (std::size_t i = 0; i < pwds.size(); ++i)
+    EXPECT_EQ(hashes[i], GenHash(pwds[i], salts[i], 5));
+}
+
+TEST(GenHashTest, HashesEmptyPasswordAsNulByte) {
+  const Salt salt{};
+  EXPECT_EQ(GenHash("", salt, 4), GenHash(std::string_view("\0", 1), salt, 4));
+  EXPECT_NE(GenHash("", salt, 4), GenHash("a", salt, 4));
+}
+
+TEST(GenHashNTest, HashesEmptyPasswordAsGenHash) {
+  std::vector<std::string_view> pwds(3, "");
+  pwds[1] = "password";
+  std::vector<Salt> salts(3);
+  std::vector<PwdHash> hashes(3);
+  GenHashN(pwds, salts, 4, hashes);
+  for (std::size_t i = 0; i < pwds.size(); ++i)
+    EXPECT_EQ(hashes[i], GenHash(pwds[i], salts[i], 4));
+}
+
+TEST(GenHashNTest, ThrowsIfSizesDiffer) {
+  std::vector<std::string_view> pwds = {"password", "secret"};
+  std::vector<Salt> salts(2);
+  std::vector<PwdHash> hashes(1);
+  EXPECT_THROW(GenHashN(pwds, salts, 4, hashes), std::invalid_argument);
+}
+
+TEST(GenHashTest, WithoutCancellationIsSameAsGenHash) {
+  const Salt salt{1, 2, 3};
+  std::stop_source source;
+  EXPECT_EQ(GenHash("password", salt, 5, source.get_token()),
+            GenHash("password", salt, 5));
+  EXPECT_EQ(GenHash("password", salt, 5, {},
+                    std::chrono::steady_clock::now() + std::chrono::hours(1)),
+            GenHash("password", salt, 5));
+}
+
+TEST(GenHashTest, ReturnsNulloptWhenStopIsRequested) {
+  std::stop_source source;
+  source.request_stop();
+  EXPECT_FALSE(GenHash("password", Salt{}, 5, source.get_token()));
+}
+
+TEST(GenHashTest, ReturnsNulloptAfterDeadline) {
+  EXPECT_FALSE(GenHash("password", Salt{}, 5, {},
+                       std::chrono::steady_clock::now()));
+}
+
+TEST(GenHashTest, StopsWhileHashing) {
+  std::stop_source source;
+  std::jthread stopper([&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    source.request_stop();
+  });
+  // Far more rounds than can run before the stop is requested.
+  EXPECT_FALSE(GenHash("password", Salt{}, 1u << 20, source.get_token()));
+}
+
+TEST(FormattingDecodingTest, PadsRoundsToTwoDigits) {
+  PwdHash pwd_hash{};
+  Salt salt{};
+  auto arr = EncodeBcrypt(pwd_hash, salt, 5);
+  EXPECT_EQ(ToStringView(arr).substr(0, 7), "$2b$05$");
+  EXPECT_THAT(DecodeBcrypt(arr),
+              Optional(Field("rounds", &BcryptParams::rounds, Eq(5u))));
+}
+
 class PwdHasherTest : public testing::Test {
 protected:
   PwdHasher pwd_hasher_;
@@ -53,6 +147,82 @@ TEST_F(PwdHasherTest, GenerateThrowsWhenRoundsIsMoreThan31) {
   EXPECT_THROW(pwd_hasher_.Generate("password", 32), std::invalid_argument);
 }
 
+TEST_F(PwdHasherTest, VerifyTellsMismatchFromInvalidHash) {
+  const auto arr = pwd_hasher_.Generate("password", 4);
+  EXPECT_EQ(pwd_hasher_.Verify("password", arr), VerifyStatus::kMatch);
+  EXPECT_EQ(pwd_hasher_.Verify("wrong", arr), VerifyStatus::kMismatch);
+  EXPECT_EQ(pwd_hasher_.Verify("", arr), VerifyStatus::kInvalidHash);
+  EXPECT_EQ(pwd_hasher_.Verify("password", BcryptArr{}),
+            VerifyStatus::kInvalidHash);
+}
+
+TEST_F(PwdHasherTest, VerifyReturnsCancelled) {
+  const auto arr = pwd_hasher_.Generate("password", 4);
+  std::stop_source source;
+  EXPECT_EQ(pwd_hasher_.Verify("password", arr, source.get_token()),
+            VerifyStatus::kMatch);
+  source.request_stop();
+  EXPECT_EQ(pwd_hasher_.Verify("password", arr, source.get_token()),
+            VerifyStatus::kCancelled);
+  EXPECT_EQ(pwd_hasher_.Verify("password", BcryptArr{}, source.get_token()),
+            VerifyStatus::kInvalidHash);
+}
+
+TEST_F(PwdHasherTest, NeedsRehashOutsideOfPolicyRounds) {
+  const RehashPolicy policy{.target_rounds = 5, .max_rounds = 6};
+  EXPECT_TRUE(NeedsRehash(pwd_hasher_.Generate("password", 4), policy));
+  EXPECT_FALSE(NeedsRehash(pwd_hasher_.Generate("password", 5), policy));
+  EXPECT_FALSE(NeedsRehash(pwd_hasher_.Generate("password", 6), policy));
+  EXPECT_TRUE(NeedsRehash(pwd_hasher_.Generate("password", 7), policy));
+  EXPECT_FALSE(NeedsRehash(BcryptArr{}, policy));
+}
+
+TEST_F(PwdHasherTest, VerifyAndUpgradeRehashesOnlyOnMatch) {
+  const RehashPolicy policy{.target_rounds = 5};
+  const auto arr = pwd_hasher_.Generate("password", 4);
+
+  auto result = pwd_hasher_.VerifyAndUpgrade("wrong", arr, policy);
+  EXPECT_EQ(result.status, VerifyStatus::kMismatch);
+  EXPECT_FALSE(result.rehashed);
+
+  result = pwd_hasher_.VerifyAndUpgrade("password", arr, policy);
+  EXPECT_EQ(result.status, VerifyStatus::kMatch);
+  ASSERT_TRUE(result.rehashed);
+  EXPECT_EQ(DecodeBcrypt(*result.rehashed)->rounds, 5);
+  EXPECT_TRUE(pwd_hasher_.IsSamePwd("password", *result.rehashed));
+
+  result = pwd_hasher_.VerifyAndUpgrade("password", *result.rehashed, policy);
+  EXPECT_EQ(result.status, VerifyStatus::kMatch);
+  EXPECT_FALSE(result.rehashed);
+}
+
+TEST_F(PwdHasherTest, VerifyAndUpgradeThrowsWithBadPolicy) {
+  const auto arr = pwd_hasher_.Generate("password", 4);
+  EXPECT_THROW(pwd_hasher_.VerifyAndUpgrade("password", arr,
+                                            {.target_rounds = 3}),
+               std::invalid_argument);
+  EXPECT_THROW(pwd_hasher_.VerifyAndUpgrade(
+                   "password", arr, {.target_rounds = 12, .max_rounds = 10}),
+               std::invalid_argument);
+  EXPECT_THROW(pwd_hasher_.VerifyAndUpgrade("password", arr,
+                                            {.max_rounds = 32}),
+               std::invalid_argument);
+}
+
+TEST_F(PwdHasherTest, VerifyAndUpgradeCanRehashOnExecutor) {
+  ThreadPool pool(1);
+  const auto arr = pwd_hasher_.Generate("password", 4);
+  std::promise<BcryptArr> rehashed;
+  const auto status = pwd_hasher_.VerifyAndUpgrade(
+      "password", arr, {.target_rounds = 5}, pool,
+      [&](const BcryptArr& arr) { rehashed.set_value(arr); });
+  EXPECT_EQ(status, VerifyStatus::kMatch);
+
+  const auto new_arr = rehashed.get_future().get();
+  EXPECT_EQ(DecodeBcrypt(new_arr)->rounds, 5);
+  EXPECT_TRUE(pwd_hasher_.IsSamePwd("password", new_arr));
+}
+
 TEST_F(PwdHasherTest, IsSamePwdReturnsTrueForGeneratedPassword) {
   std::mt19937 gen(0);
   std::uniform_int_distribution<std::uint8_t> dist;
@@ -70,5 +240,54 @@ TEST_F(PwdHasherTest, IsSamePwdReturnsTrueForGeneratedPassword) {
   }
 }
 
+TEST_F(PwdHasherTest, GenerateBatchHashesAreVerified) {
+  ThreadPool pool(3);
+  std::vector<std::string> pwd_strs;
+  for (int i = 1; i < 40; ++i)
+    pwd_strs.push_back(std::string(i, 'a' + i % 26));
+  std::vector<std::string_view> pwds(pwd_strs.begin(), pwd_strs.end());
+
+  std::vector<BcryptArr> arrs(pwds.size());
+  pwd_hasher_.GenerateBatch(pwds, 5, arrs, pool);
+  for (std::size_t i = 0; i < pwds.size(); ++i)
+    EXPECT_TRUE(pwd_hasher_.IsSamePwd(pwds[i], arrs[i]));
+}
+
+TEST_F(PwdHasherTest, GenerateBatchThrowsWithEmptyPassword) {
+  ThreadPool pool(1);
+  std::vector<std::string_view> pwds = {"password", ""};
+  std::vector<BcryptArr> arrs(pwds.size());
+  EXPECT_THROW(pwd_hasher_.GenerateBatch(pwds, 5, arrs, pool),
+               std::invalid_argument);
+}
+
+TEST_F(PwdHasherTest, VerifyBatchIsSameAsIsSamePwd) {
+  ThreadPool pool(3);
+  std::vector<std::string_view> pwds;
+  std::vector<BcryptArr> arrs;
+  // Mixed rounds, wrong passwords, empty passwords and invalid hashes.
+  for (int i = 0; i < 30; ++i) {
+    arrs.push_back(pwd_hasher_.Generate("password", 4 + i % 3));
+    pwds.push_back(i % 4 == 0 ? "wrong" : "password");
+  }
+  pwds[5] = "";
+  arrs[7][0] = 'x';
+
+  std::unique_ptr<bool[]> results(new bool[pwds.size()]);
+  pwd_hasher_.VerifyBatch(pwds, arrs, {results.get(), pwds.size()}, pool);
+  for (std::size_t i = 0; i < pwds.size(); ++i)
+    EXPECT_EQ(results[i], pwd_hasher_.IsSamePwd(pwds[i], arrs[i]))
+      << "for index " << i;
+}
+
+TEST_F(PwdHasherTest, VerifyBatchThrowsIfSizesDiffer) {
+  ThreadPool pool(1);
+  std::vector<std::string_view> pwds = {"password"};
+  std::vector<BcryptArr> arrs(2);
+  bool results[1];
+  EXPECT_THROW(pwd_hasher_.VerifyBatch(pwds, arrs, results, pool),
+               std::invalid_argument);
+}
+
 } // namespace
 } // namespace bcrypt
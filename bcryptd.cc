@@ -0,0 +1,155 @@
+// Serves bcrypt hashing to the processes of a host over a Unix domain
+// socket, so they do not spend their own cores on it. Usage:
+//
+//   bcryptd [--socket=PATH] [--threads=N] [--cpus=LIST] [--max_pending=N]
+//           [--batch_size=N] [--max_output=BYTES]
+//
+// --cpus pins the daemon to a list of CPUs like "2-5,8", and --threads
+// defaults to one worker per CPU it may run on. Clients talk to it with
+// BcryptClient, see protocol.h for the wire format. SIGINT or SIGTERM stop
+// it after printing its stats, and it exits with an error if its event loop
+// fails.
+
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include <fmt/core.h>
+
+#include "bcrypt.h"
+#include "server.h"
+
+namespace bcrypt {
+namespace {
+
+// Returns the value of --name=value in arg, or nullptr.
+const char*
+Flag(std::string_view arg, std::string_view name)
+{
+  if (arg.size() <= name.size() + 3 or arg.substr(0, 2) != "--"
+      or arg.substr(2, name.size()) != name or arg[name.size() + 2] != '=')
+    return nullptr;
+  return arg.data() + name.size() + 3;
+}
+
+// Parses a CPU list like "0-3,6".
+std::optional<cpu_set_t>
+ParseCpus(std::string_view s)
+{
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  while (not s.empty()) {
+    const auto comma = s.find(',');
+    const auto item = s.substr(0, comma);
+    s = comma == std::string_view::npos ? "" : s.substr(comma + 1);
+    const auto dash = item.find('-');
+    const std::string first(item.substr(0, dash));
+    const std::string last(
+        dash == std::string_view::npos ? first : item.substr(dash + 1));
+    char* end;
+    const auto lo = std::strtoul(first.c_str(), &end, 10);
+    if (first.empty() or *end) return std::nullopt;
+    const auto hi = std::strtoul(last.c_str(), &end, 10);
+    if (last.empty() or *end or hi < lo or hi >= CPU_SETSIZE)
+      return std::nullopt;
+    for (auto cpu = lo; cpu <= hi; ++cpu)
+      CPU_SET(cpu, &cpus);
+  }
+  if (CPU_COUNT(&cpus) == 0) return std::nullopt;
+  return cpus;
+}
+
+int
+Run(int argc, char** argv)
+{
+  std::string path = "/tmp/bcryptd.sock";
+  std::optional<cpu_set_t> cpus;
+  ServerOptions options;
+  for (int i = 1; i < argc; ++i) {
+    if (const auto v = Flag(argv[i], "socket")) {
+      path = v;
+    } else if (const auto v = Flag(argv[i], "threads")) {
+      options.threads = std::strtoul(v, nullptr, 10);
+    } else if (const auto v = Flag(argv[i], "cpus")) {
+      cpus = ParseCpus(v);
+      if (not cpus) {
+        std::cerr << "--cpus should be a list like 0-3,6.\n";
+        return 2;
+      }
+    } else if (const auto v = Flag(argv[i], "max_pending")) {
+      options.max_pending = std::strtoul(v, nullptr, 10);
+    } else if (const auto v = Flag(argv[i], "batch_size")) {
+      options.batch_size = std::strtoul(v, nullptr, 10);
+    } else if (const auto v = Flag(argv[i], "max_output")) {
+      options.max_output = std::strtoul(v, nullptr, 10);
+    } else {
+      std::cerr << "usage: " << argv[0]
+                << " [--socket=PATH] [--threads=N] [--cpus=LIST]"
+                   " [--max_pending=N] [--batch_size=N]"
+                   " [--max_output=BYTES]\n";
+      return 2;
+    }
+  }
+
+  // The workers inherit the affinity and the blocked signals of this
+  // thread, so both are set before the server starts them.
+  if (cpus) {
+    if (sched_setaffinity(0, sizeof(*cpus), &*cpus) < 0) {
+      std::perror("sched_setaffinity");
+      return 1;
+    }
+    if (options.threads == 0)
+      options.threads = static_cast<std::size_t>(CPU_COUNT(&*cpus));
+  }
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  AutotuneKernel();
+  BcryptServer server(path, options);
+  fmt::print("bcryptd listening on {} with the {} kernel\n", server.Path(),
+             KernelName(ActiveKernel()));
+  std::fflush(stdout);
+
+  // Waits for a signal, checking every second that the loop still runs.
+  const timespec interval{1, 0};
+  while (sigtimedwait(&signals, nullptr, &interval) < 0) {
+    if (const auto error = server.Error()) {
+      std::cerr << "bcryptd: " << error.message() << '\n';
+      return 1;
+    }
+  }
+  const auto stats = server.Stats();
+  fmt::print("stopping: {} connections, {} requests, {} hashes in {} batches, "
+             "{} overloaded, {} bad requests, {} protocol errors, "
+             "{} output overflows\n",
+             stats.accepted, stats.requests, stats.hashes, stats.batches,
+             stats.overloaded, stats.bad_requests, stats.protocol_errors,
+             stats.output_overflows);
+  return 0;
+}
+
+} // namespace
+} // namespace bcrypt
+
+int
+main(int argc, char** argv)
+{
+  try {
+    return bcrypt::Run(argc, argv);
+  } catch (const std::exception& e) {
+    std::cerr << "bcryptd: " << e.what() << '\n';
+    return 1;
+  }
+}
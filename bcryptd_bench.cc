@@ -0,0 +1,203 @@
+// Measures the throughput of bcryptd as the number of client connections
+// grows. Usage:
+//
+//   bcryptd_bench [--socket=PATH] [--threads=N] [--connections=1,2,4,8]
+//                 [--depth=D] [--rounds=R] [--duration=S]
+//
+// Each connection runs on its own thread and keeps --depth verifications of
+// cost --rounds pipelined for --duration seconds. Without --socket, the
+// benchmark starts a server in the process with --threads workers, and also
+// reports the mean number of passwords the server hashed per batch.
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "bcrypt.h"
+#include "client.h"
+#include "server.h"
+
+namespace bcrypt {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Returns the value of --name=value in arg, or nullptr.
+const char*
+Flag(std::string_view arg, std::string_view name)
+{
+  if (arg.size() <= name.size() + 3 or arg.substr(0, 2) != "--"
+      or arg.substr(2, name.size()) != name or arg[name.size() + 2] != '=')
+    return nullptr;
+  return arg.data() + name.size() + 3;
+}
+
+// Parses a list like "1,2,4,8" of positive numbers.
+std::vector<std::size_t>
+ParseList(std::string_view s)
+{
+  std::vector<std::size_t> list;
+  while (not s.empty()) {
+    const auto comma = s.find(',');
+    const std::string item(s.substr(0, comma));
+    s = comma == std::string_view::npos ? "" : s.substr(comma + 1);
+    const auto n = std::strtoul(item.c_str(), nullptr, 10);
+    if (n == 0) return {};
+    list.push_back(n);
+  }
+  return list;
+}
+
+struct Result {
+  std::size_t completed = 0;
+  std::size_t errors = 0;
+  std::vector<std::chrono::nanoseconds> latencies;
+};
+
+// Keeps depth verifications in flight on one connection until the deadline.
+Result
+RunConnection(
+    const std::string& path,
+    const BcryptArr& arr,
+    std::size_t depth,
+    Clock::time_point deadline)
+{
+  Result result;
+  BcryptClient client(path);
+  std::unordered_map<std::uint32_t, Clock::time_point> sent;
+  const auto send = [&] {
+    sent[client.SendVerify("password", arr)] = Clock::now();
+  };
+  for (std::size_t i = 0; i < depth; ++i)
+    send();
+  while (not sent.empty()) {
+    const auto response = client.Receive();
+    const auto now = Clock::now();
+    const auto it = sent.find(response.id);
+    if (response.status == Status::kMatch) {
+      ++result.completed;
+      result.latencies.push_back(now - it->second);
+    } else {
+      ++result.errors;
+    }
+    sent.erase(it);
+    if (now < deadline) send();
+  }
+  return result;
+}
+
+} // namespace
+} // namespace bcrypt
+
+int
+main(int argc, char** argv)
+{
+  using namespace bcrypt;
+
+  std::string socket;
+  std::size_t threads = 0;
+  std::vector<std::size_t> connections = {1, 2, 4, 8, 16};
+  std::size_t depth = 8;
+  std::uint32_t rounds = 4;
+  double duration = 2;
+  bool ok = true;
+  for (int i = 1; i < argc and ok; ++i) {
+    if (const auto v = Flag(argv[i], "socket")) {
+      socket = v;
+    } else if (const auto v = Flag(argv[i], "threads")) {
+      threads = std::strtoul(v, nullptr, 10);
+    } else if (const auto v = Flag(argv[i], "connections")) {
+      connections = ParseList(v);
+      ok = not connections.empty();
+    } else if (const auto v = Flag(argv[i], "depth")) {
+      depth = std::strtoul(v, nullptr, 10);
+      ok = depth > 0;
+    } else if (const auto v = Flag(argv[i], "rounds")) {
+      rounds = std::strtoul(v, nullptr, 10);
+      ok = rounds >= 4 and rounds <= 31;
+    } else if (const auto v = Flag(argv[i], "duration")) {
+      duration = std::strtod(v, nullptr);
+      ok = duration > 0;
+    } else {
+      ok = false;
+    }
+  }
+  if (not ok) {
+    std::cerr << "usage: " << argv[0]
+              << " [--socket=PATH] [--threads=N] [--connections=1,2,4,8]"
+                 " [--depth=D] [--rounds=R] [--duration=S]\n";
+    return 2;
+  }
+
+  std::unique_ptr<BcryptServer> server;
+  if (socket.empty()) {
+    ServerOptions options;
+    options.threads = threads;
+    socket = "/tmp/bcryptd_bench_" + std::to_string(::getpid()) + ".sock";
+    server = std::make_unique<BcryptServer>(socket, options);
+    fmt::print("in-process server with the {} kernel\n",
+               KernelName(ActiveKernel()));
+  }
+  const auto arr = PwdHasher().Generate("password", rounds);
+
+  fmt::print("{:>11} {:>12} {:>10} {:>10} {:>10}\n", "connections",
+             "requests/s", "p50 ms", "p99 ms", "batch");
+  for (const auto n : connections) {
+    const auto before = server ? server->Stats() : ServerStats{};
+    const auto start = Clock::now();
+    const auto deadline = start + std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(duration));
+    std::vector<Result> results(n);
+    {
+      std::vector<std::jthread> clients;
+      for (std::size_t c = 0; c < n; ++c) {
+        clients.emplace_back([&, c] {
+          results[c] = RunConnection(socket, arr, depth, deadline);
+        });
+      }
+    }
+    const std::chrono::duration<double> elapsed = Clock::now() - start;
+
+    Result total;
+    for (auto& result : results) {
+      total.completed += result.completed;
+      total.errors += result.errors;
+      total.latencies.insert(total.latencies.end(), result.latencies.begin(),
+                             result.latencies.end());
+    }
+    std::sort(total.latencies.begin(), total.latencies.end());
+    const auto ms = [&](double p) {
+      if (total.latencies.empty()) return 0.0;
+      const auto rank = std::min(
+          static_cast<std::size_t>(p * total.latencies.size()),
+          total.latencies.size() - 1);
+      return total.latencies[rank].count() / 1e6;
+    };
+    std::string batch = "-";
+    if (server) {
+      const auto after = server->Stats();
+      const auto batches = after.batches - before.batches;
+      if (batches > 0)
+        batch = fmt::format("{:.2f}", static_cast<double>(
+            after.hashes - before.hashes) / batches);
+    }
+    fmt::print("{:>11} {:>12.1f} {:>10.3f} {:>10.3f} {:>10}\n", n,
+               total.completed / elapsed.count(), ms(0.5), ms(0.99), batch);
+    if (total.errors > 0)
+      fmt::print("{:>11} {} requests failed or were shed\n", "", total.errors);
+  }
+  return 0;
+}
@@ -0,0 +1,326 @@
+#include "bench_baseline.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <fmt/core.h>
+
+namespace bcrypt {
+namespace {
+
+// Scales the MAD to the standard deviation for normally distributed noise.
+constexpr double kMadScale = 1.4826;
+
+// Standard error of the median of n samples over the standard deviation,
+// times sqrt(n), for normally distributed noise.
+constexpr double kMedianError = 1.2533;
+
+// Returns the variance of the median of the benchmark's repetitions.
+double
+MedianVariance(const BenchStats& stats)
+{
+  const auto sd = kMedianError * kMadScale * stats.mad_ns;
+  return sd * sd / std::max<std::size_t>(stats.repetitions, 1);
+}
+
+double
+Median(std::vector<double>* values)
+{
+  auto& v = *values;
+  const auto mid = v.size() / 2;
+  std::nth_element(v.begin(), v.begin() + mid, v.end());
+  const auto upper = v[mid];
+  if (v.size() % 2) return upper;
+  const auto lower = *std::max_element(v.begin(), v.begin() + mid);
+  return (lower + upper) / 2;
+}
+
+std::string
+Quote(std::string_view s)
+{
+  std::string quoted = "\"";
+  for (const char c : s) {
+    if (c == '"' or c == '\\') {
+      quoted += '\\';
+      quoted += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      quoted += fmt::format("\\u{:04x}", static_cast<int>(c));
+    } else {
+      quoted += c;
+    }
+  }
+  return quoted + '"';
+}
+
+// Parses just enough JSON for a baseline: the values of the keys it reads
+// must be strings and numbers, and everything else is skipped.
+class JsonReader {
+public:
+  explicit JsonReader(std::string_view json) : json_(json) {}
+
+  std::vector<BenchStats>
+  ReadBaseline()
+  {
+    std::vector<BenchStats> stats;
+    ReadObject([&](const std::string& key) {
+      if (key != "benchmarks") return Skip();
+      ReadArray([&] { stats.push_back(ReadBenchmark()); });
+    });
+    SkipSpace();
+    if (pos_ != json_.size()) Fail("trailing characters");
+    return stats;
+  }
+
+private:
+  BenchStats
+  ReadBenchmark()
+  {
+    BenchStats stats;
+    bool has_median = false;
+    ReadObject([&](const std::string& key) {
+      if (key == "name") {
+        stats.name = ReadString();
+      } else if (key == "repetitions") {
+        stats.repetitions = static_cast<std::size_t>(ReadNumber());
+      } else if (key == "median_ns") {
+        stats.median_ns = ReadNumber();
+        has_median = true;
+      } else if (key == "mad_ns") {
+        stats.mad_ns = ReadNumber();
+      } else if (key == "tolerance") {
+        stats.tolerance = ReadNumber();
+      } else {
+        Skip();
+      }
+    });
+    if (stats.name.empty() or not has_median)
+      Fail("benchmark without a name or median_ns");
+    return stats;
+  }
+
+  template <typename Fn>
+  void
+  ReadObject(Fn&& read_value)
+  {
+    Expect('{');
+    if (Consume('}')) return;
+    do {
+      const auto key = ReadString();
+      Expect(':');
+      read_value(key);
+    } while (Consume(','));
+    Expect('}');
+  }
+
+  template <typename Fn>
+  void
+  ReadArray(Fn&& read_value)
+  {
+    Expect('[');
+    if (Consume(']')) return;
+    do {
+      read_value();
+    } while (Consume(','));
+    Expect(']');
+  }
+
+  std::string
+  ReadString()
+  {
+    Expect('"');
+    std::string s;
+    for (;;) {
+      if (pos_ == json_.size()) Fail("unterminated string");
+      const auto c = json_[pos_++];
+      if (c == '"') return s;
+      if (c != '\\') {
+        s += c;
+        continue;
+      }
+      if (pos_ == json_.size()) Fail("unterminated string");
+      switch (const auto e = json_[pos_++]) {
+        case '"': case '\\': case '/': s += e; break;
+        case 'b': s += '\b'; break;
+        case 'f': s += '\f'; break;
+        case 'n': s += '\n'; break;
+        case 'r': s += '\r'; break;
+        case 't': s += '\t'; break;
+        case 'u': {
+          // Benchmark names are ASCII, so only those escapes are decoded.
+          if (json_.size() - pos_ < 4) Fail("bad \\u escape");
+          const std::string hex(json_.substr(pos_, 4));
+          char* end = nullptr;
+          const auto code = std::strtoul(hex.c_str(), &end, 16);
+          if (end != hex.c_str() + 4 or code > 0x7f) Fail("bad \\u escape");
+          s += static_cast<char>(code);
+          pos_ += 4;
+          break;
+        }
+        default: Fail("bad escape");
+      }
+    }
+  }
+
+  double
+  ReadNumber()
+  {
+    SkipSpace();
+    const auto end = json_.find_first_not_of("+-0123456789.eE", pos_);
+    const std::string number(json_.substr(pos_, end - pos_));
+    char* parsed = nullptr;
+    const auto value = std::strtod(number.c_str(), &parsed);
+    if (number.empty() or parsed != number.c_str() + number.size())
+      Fail("bad number");
+    pos_ += number.size();
+    return value;
+  }
+
+  // Skips any value.
+  void
+  Skip()
+  {
+    SkipSpace();
+    if (pos_ == json_.size()) Fail("missing value");
+    switch (json_[pos_]) {
+      case '{': return ReadObject([&](const std::string&) { Skip(); });
+      case '[': return ReadArray([&] { Skip(); });
+      case '"': ReadString(); return;
+    }
+    for (const std::string_view literal : {"true", "false", "null"}) {
+      if (json_.substr(pos_, literal.size()) == literal) {
+        pos_ += literal.size();
+        return;
+      }
+    }
+    ReadNumber();
+  }
+
+  void
+  SkipSpace()
+  {
+    while (pos_ < json_.size()
+        and (json_[pos_] == ' ' or json_[pos_] == '\n' or json_[pos_] == '\t'
+             or json_[pos_] == '\r'))
+      ++pos_;
+  }
+
+  bool
+  Consume(char c)
+  {
+    SkipSpace();
+    if (pos_ == json_.size() or json_[pos_] != c) return false;
+    ++pos_;
+    return true;
+  }
+
+  void
+  Expect(char c)
+  {
+    if (not Consume(c)) Fail(fmt::format("expected '{}'", c));
+  }
+
+  [[noreturn]] void
+  Fail(std::string_view what) const
+  {
+    throw std::invalid_argument(
+        fmt::format("Bad baseline at offset {}: {}.", pos_, what));
+  }
+
+  std::string_view json_;
+  std::size_t pos_ = 0;
+};
+
+} // namespace
+
+BenchStats
+Summarize(std::string name, std::vector<double> times_ns)
+{
+  if (times_ns.empty())
+    throw std::invalid_argument("times_ns cannot be empty.");
+  BenchStats stats;
+  stats.name = std::move(name);
+  stats.repetitions = times_ns.size();
+  stats.median_ns = Median(&times_ns);
+  for (auto& t : times_ns)
+    t = std::abs(t - stats.median_ns);
+  stats.mad_ns = Median(&times_ns);
+  return stats;
+}
+
+std::string
+WriteBaseline(const std::vector<BenchStats>& stats)
+{
+  std::string json = "{\n  \"benchmarks\": [";
+  for (std::size_t i = 0; i < stats.size(); ++i) {
+    const auto& s = stats[i];
+    json += fmt::format(
+        "{}\n    {{\"name\": {}, \"repetitions\": {}, \"median_ns\": {:.6g}, "
+        "\"mad_ns\": {:.6g}", i ? "," : "", Quote(s.name), s.repetitions,
+        s.median_ns, s.mad_ns);
+    if (s.tolerance)
+      json += fmt::format(", \"tolerance\": {}", *s.tolerance);
+    json += "}";
+  }
+  return json + "\n  ]\n}\n";
+}
+
+std::vector<BenchStats>
+ReadBaseline(std::string_view json)
+{
+  return JsonReader(json).ReadBaseline();
+}
+
+std::vector<GateResult>
+CompareToBaseline(const std::vector<BenchStats>& baseline,
+                  const std::vector<BenchStats>& current,
+                  const GateOptions& options)
+{
+  std::map<std::string_view, const BenchStats*> by_name;
+  for (const auto& s : current)
+    by_name[s.name] = &s;
+
+  std::vector<GateResult> results;
+  for (const auto& base : baseline) {
+    GateResult result;
+    result.name = base.name;
+    result.baseline_ns = base.median_ns;
+    const auto it = by_name.find(base.name);
+    if (it == by_name.end()) {
+      result.verdict = GateVerdict::kMissing;
+      results.push_back(std::move(result));
+      continue;
+    }
+    const auto& cur = *it->second;
+    by_name.erase(it);
+    result.current_ns = cur.median_ns;
+    result.change = cur.median_ns / base.median_ns - 1;
+
+    const auto tolerance = base.tolerance.value_or(options.tolerance);
+    const auto error = std::sqrt(MedianVariance(base) + MedianVariance(cur));
+    if (*result.change > tolerance
+        and cur.median_ns - base.median_ns > options.min_z * error)
+      result.verdict = GateVerdict::kRegression;
+    results.push_back(std::move(result));
+  }
+
+  for (const auto& s : current) {
+    if (not by_name.contains(s.name)) continue;
+    GateResult result;
+    result.name = s.name;
+    result.verdict = GateVerdict::kNew;
+    result.current_ns = s.median_ns;
+    results.push_back(std::move(result));
+  }
+  return results;
+}
+
+} // namespace bcrypt
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bcrypt {
+
+// Robust statistics of the repetitions of one benchmark.
+struct BenchStats {
+  std::string name;
+  std::size_t repetitions = 0;
+  // Median and median absolute deviation of the time per iteration.
+  double median_ns = 0;
+  double mad_ns = 0;
+  // Largest relative slowdown that is not a regression, e.g. 0.1 for 10%, or
+  // unset for GateOptions::tolerance. Only read from baselines.
+  std::optional<double> tolerance;
+};
+
+// Returns the stats of the given times per iteration. Throws
+// std::invalid_argument if there are none.
+BenchStats
+Summarize(std::string name, std::vector<double> times_ns);
+
+// Returns the stats as a baseline in JSON, e.g.
+//
+//   {
+//     "benchmarks": [
+//       {"name": "BM_GenHash", "repetitions": 10, "median_ns": 870512.3,
+//        "mad_ns": 2101.7, "tolerance": 0.1}
+//     ]
+//   }
+//
+// tolerance is only written if it is set.
+std::string
+WriteBaseline(const std::vector<BenchStats>& stats);
+
+// Parses a baseline written by WriteBaseline, possibly edited by hand, e.g. to
+// give a noisy benchmark a larger tolerance. Unknown keys are ignored. Throws
+// std::invalid_argument if the JSON is malformed or a benchmark lacks a name
+// or a median.
+std::vector<BenchStats>
+ReadBaseline(std::string_view json);
+
+struct GateOptions {
+  // Largest relative slowdown of the median that is not a regression, for
+  // benchmarks without their own tolerance.
+  double tolerance = 0.05;
+
+  // A slowdown is only a regression if it is also more than this many
+  // standard errors of the difference of the medians, estimated from the
+  // MADs, so noise alone does not fail the gate.
+  double min_z = 3;
+};
+
+enum class GateVerdict {
+  kOk,
+  kRegression,
+  // In the baseline but not in the current run, e.g. filtered out.
+  kMissing,
+  // In the current run but not in the baseline.
+  kNew,
+};
+
+struct GateResult {
+  std::string name;
+  GateVerdict verdict = GateVerdict::kOk;
+  // Unset if the benchmark is missing from that side.
+  std::optional<double> baseline_ns;
+  std::optional<double> current_ns;
+  // current_ns / baseline_ns - 1, if both are set.
+  std::optional<double> change;
+};
+
+// Compares the current run to the baseline, in the order of the baseline
+// followed by the new benchmarks.
+std::vector<GateResult>
+CompareToBaseline(const std::vector<BenchStats>& baseline,
+                  const std::vector<BenchStats>& current,
+                  const GateOptions& options = {});
+
+} // namespace bcrypt
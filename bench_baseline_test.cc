@@ -0,0 +1,120 @@
+#include "bench_baseline.h"
+
+#include <stdexcept>
+#include <vector>
+
+#include "gmock/gmock.h"
+
+namespace bcrypt {
+namespace {
+
+BenchStats
+Stats(std::string name, double median_ns, double mad_ns)
+{
+  BenchStats stats;
+  stats.name = std::move(name);
+  stats.repetitions = 10;
+  stats.median_ns = median_ns;
+  stats.mad_ns = mad_ns;
+  return stats;
+}
+
+TEST(SummarizeTest, MedianAndMad) {
+  const auto odd = Summarize("a", {5, 1, 100, 3, 4});
+  EXPECT_EQ(odd.name, "a");
+  EXPECT_EQ(odd.repetitions, 5);
+  EXPECT_DOUBLE_EQ(odd.median_ns, 4);
+  // Deviations 1, 3, 96, 1, 0.
+  EXPECT_DOUBLE_EQ(odd.mad_ns, 1);
+
+  const auto even = Summarize("b", {1, 2, 4, 10});
+  EXPECT_DOUBLE_EQ(even.median_ns, 3);
+  // Deviations 2, 1, 1, 7.
+  EXPECT_DOUBLE_EQ(even.mad_ns, 1.5);
+
+  EXPECT_THROW(Summarize("c", {}), std::invalid_argument);
+}
+
+TEST(BaselineTest, WriteThenRead) {
+  auto with_tolerance = Stats("BM_Generate/8/real_time/threads:2", 12.5, 0.25);
+  with_tolerance.tolerance = 0.2;
+  const std::vector<BenchStats> stats = {
+      Stats("BM_GenHash", 870512, 2101.5), with_tolerance,
+      Stats("quote\"back\\slash", 1, 0)};
+
+  const auto read = ReadBaseline(WriteBaseline(stats));
+  ASSERT_EQ(read.size(), stats.size());
+  for (std::size_t i = 0; i < stats.size(); ++i) {
+    EXPECT_EQ(read[i].name, stats[i].name);
+    EXPECT_EQ(read[i].repetitions, stats[i].repetitions);
+    EXPECT_DOUBLE_EQ(read[i].median_ns, stats[i].median_ns);
+    EXPECT_DOUBLE_EQ(read[i].mad_ns, stats[i].mad_ns);
+    EXPECT_EQ(read[i].tolerance, stats[i].tolerance);
+  }
+}
+
+TEST(BaselineTest, ReadIgnoresUnknownKeys) {
+  const auto read = ReadBaseline(R"({
+    "context": {"host": "ci", "cpus": [1, 2], "debug": false, "x": null},
+    "benchmarks": [
+      {"name": "BM_GenHash", "median_ns": 1e3, "unit": "ns", "runs": [1, 2]}
+    ]
+  })");
+  ASSERT_EQ(read.size(), 1);
+  EXPECT_EQ(read[0].name, "BM_GenHash");
+  EXPECT_DOUBLE_EQ(read[0].median_ns, 1000);
+  EXPECT_DOUBLE_EQ(read[0].mad_ns, 0);
+  EXPECT_FALSE(read[0].tolerance);
+}
+
+TEST(BaselineTest, ReadRejectsMalformedJson) {
+  for (const char* json : {
+           "", "{", "[]", R"({"benchmarks": [}])",
+           R"({"benchmarks": [{"name": "a"}]})",
+           R"({"benchmarks": [{"median_ns": 1}]})",
+           R"({"benchmarks": [{"name": "a", "median_ns": x}]})",
+           R"({"benchmarks": []} trailing)"}) {
+    EXPECT_THROW(ReadBaseline(json), std::invalid_argument) << json;
+  }
+}
+
+TEST(CompareToBaselineTest, FlagsSlowdownsOverToleranceAndNoise) {
+  auto noisy = Stats("noisy", 100, 1);
+  noisy.tolerance = 0.5;
+  const std::vector<BenchStats> baseline = {
+      Stats("same", 100, 1), Stats("slower", 100, 1),
+      Stats("within_noise", 100, 10), noisy, Stats("faster", 100, 1),
+      Stats("gone", 100, 1)};
+  const std::vector<BenchStats> current = {
+      Stats("same", 101, 1), Stats("slower", 120, 1),
+      Stats("within_noise", 120, 10), Stats("noisy", 140, 1),
+      Stats("faster", 50, 1), Stats("added", 10, 1)};
+
+  const auto results = CompareToBaseline(baseline, current);
+  ASSERT_EQ(results.size(), 7);
+  const GateVerdict expected[] = {
+      GateVerdict::kOk, GateVerdict::kRegression, GateVerdict::kOk,
+      GateVerdict::kOk, GateVerdict::kOk, GateVerdict::kMissing,
+      GateVerdict::kNew};
+  for (std::size_t i = 0; i < results.size(); ++i)
+    EXPECT_EQ(results[i].verdict, expected[i]) << results[i].name;
+
+  EXPECT_EQ(results[1].name, "slower");
+  EXPECT_DOUBLE_EQ(*results[1].change, 0.2);
+  EXPECT_FALSE(results[5].current_ns);
+  EXPECT_EQ(results[6].name, "added");
+  EXPECT_FALSE(results[6].baseline_ns);
+  EXPECT_FALSE(results[6].change);
+}
+
+TEST(CompareToBaselineTest, ToleranceOption) {
+  const std::vector<BenchStats> baseline = {Stats("a", 100, 0)};
+  const std::vector<BenchStats> current = {Stats("a", 108, 0)};
+  EXPECT_EQ(CompareToBaseline(baseline, current)[0].verdict,
+            GateVerdict::kRegression);
+  EXPECT_EQ(CompareToBaseline(baseline, current, {.tolerance = 0.1})[0].verdict,
+            GateVerdict::kOk);
+}
+
+} // namespace
+} // namespace bcrypt
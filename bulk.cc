@@ -0,0 +1,272 @@
+#include "bulk.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bcrypt.h"
+#include "thread_pool.h"
+#include "tracing.h"
+
+namespace bcrypt {
+namespace {
+
+// Results of kVerify in the kLines format, by VerifyStatus. In the kBinary
+// format, they are the VerifyStatus itself.
+constexpr std::string_view kStatusLines[] = {"match\n", "mismatch\n",
+                                             "invalid\n"};
+
+struct Chunk {
+  std::vector<std::string> records;
+  // Set by the worker before done.
+  std::string output;
+  BulkStats stats;
+  std::exception_ptr error;
+  bool done = false;
+};
+
+// Reads the next record into record. Returns false at the end of the input.
+// record should have a capacity of kMaxRecordSize, so that it is never
+// reallocated, which would leave part of a password in freed memory.
+bool
+ReadRecord(std::istream& in, RecordFormat format, std::string* record)
+{
+  record->clear();
+  auto& buf = *in.rdbuf();
+  if (format == RecordFormat::kLines) {
+    for (;;) {
+      const auto c = buf.sbumpc();
+      // The last line may not end in '\n'.
+      if (c == std::istream::traits_type::eof()) return not record->empty();
+      if (c == '\n') return true;
+      if (record->size() == kMaxRecordSize)
+        throw std::invalid_argument("A record is larger than kMaxRecordSize.");
+      record->push_back(static_cast<char>(c));
+    }
+  }
+
+  char size_bytes[4];
+  const auto n = buf.sgetn(size_bytes, sizeof(size_bytes));
+  if (n == 0) return false;
+  if (n < 4) throw std::invalid_argument("A binary record is cut short.");
+  std::size_t size = 0;
+  for (int i = 3; i >= 0; --i)
+    size = (size << 8) | static_cast<std::uint8_t>(size_bytes[i]);
+  if (size > kMaxRecordSize)
+    throw std::invalid_argument("A record is larger than kMaxRecordSize.");
+  record->resize(size);
+  if (buf.sgetn(record->data(), static_cast<std::streamsize>(size))
+      != static_cast<std::streamsize>(size))
+    throw std::invalid_argument("A binary record is cut short.");
+  return true;
+}
+
+void
+HashChunk(
+    const BulkOptions& options,
+    const PwdHasher& pwd_hasher,
+    Executor& executor,
+    Chunk* chunk)
+{
+  const auto& records = chunk->records;
+  std::vector<std::string_view> pwds;
+  for (const auto& record : records) {
+    if (not record.empty()) pwds.push_back(record);
+  }
+  std::vector<BcryptArr> arrs(pwds.size());
+  if (not pwds.empty())
+    pwd_hasher.GenerateBatch(pwds, options.rounds, arrs, executor);
+
+  auto arr = arrs.begin();
+  for (const auto& record : records) {
+    auto& stats = chunk->stats;
+    if (record.empty()) {
+      ++stats.invalid;
+      if (options.format == RecordFormat::kLines)
+        chunk->output += "invalid\n";
+      else
+        chunk->output.append(BcryptArr{}.size(), '\0');
+      continue;
+    }
+    ++stats.ok;
+    chunk->output.append(arr->begin(), arr->end());
+    if (options.format == RecordFormat::kLines) chunk->output += '\n';
+    ++arr;
+  }
+}
+
+void
+VerifyChunk(
+    const BulkOptions& options,
+    const PwdHasher& pwd_hasher,
+    Executor& executor,
+    Chunk* chunk)
+{
+  const auto& records = chunk->records;
+  const auto n = records.size();
+  // Splits the records into hashes and passwords. Those that cannot be
+  // verified stay invalid.
+  std::vector<std::size_t> valid;
+  std::vector<std::string_view> pwds;
+  std::vector<BcryptArr> arrs;
+  const std::size_t separator = options.format == RecordFormat::kLines;
+  for (std::size_t i = 0; i < n; ++i) {
+    const std::string_view record = records[i];
+    BcryptArr arr;
+    if (record.size() <= arr.size() + separator
+        or (separator and record[arr.size()] != '\t'))
+      continue;
+    std::copy_n(record.begin(), arr.size(), arr.begin());
+    if (not DecodeBcrypt(arr)) continue;
+    valid.push_back(i);
+    pwds.push_back(record.substr(arr.size() + separator));
+    arrs.push_back(arr);
+  }
+  const auto matches = std::make_unique<bool[]>(valid.size());
+  if (not valid.empty())
+    pwd_hasher.VerifyBatch(pwds, arrs, {matches.get(), valid.size()},
+                           executor);
+
+  std::size_t next = 0;
+  for (std::size_t i = 0; i < n; ++i) {
+    auto& stats = chunk->stats;
+    const auto checked = next < valid.size() and valid[next] == i;
+    const auto status = not checked ? VerifyStatus::kInvalidHash
+        : matches[next++] ? VerifyStatus::kMatch : VerifyStatus::kMismatch;
+    if (status == VerifyStatus::kMatch)
+      ++stats.ok;
+    else if (status == VerifyStatus::kMismatch)
+      ++stats.mismatched;
+    else
+      ++stats.invalid;
+    const auto code = static_cast<std::size_t>(status);
+    if (options.format == RecordFormat::kLines)
+      chunk->output += kStatusLines[code];
+    else
+      chunk->output += static_cast<char>(code);
+  }
+}
+
+} // namespace
+
+BulkStats
+RunBulk(
+    const BulkOptions& options,
+    std::istream& in,
+    std::ostream& out,
+    Executor& executor,
+    const std::function<void(const BulkStats&)>& progress)
+{
+  if (options.chunk_size == 0)
+    throw std::invalid_argument("chunk_size should be positive.");
+  if (options.mode == BulkMode::kHash
+      and (options.rounds < 4 or options.rounds > 31))
+    throw std::invalid_argument("rounds should be in the range [4, 31].");
+  const auto max_chunks =
+      options.max_chunks ? options.max_chunks : 4 * executor.Concurrency();
+  const PwdHasher pwd_hasher;
+
+  // The chunks in the order they were read. Only this thread touches the
+  // deque; done is set by the workers.
+  std::deque<std::shared_ptr<Chunk>> chunks;
+  std::mutex mutex;
+  std::condition_variable cond;
+
+  BulkStats stats;
+  // An error reading the input ends it, but the records before it are still
+  // written. After any other error, nothing more is written, and the chunks
+  // in flight are only waited for, since they use the locals above.
+  std::exception_ptr read_error;
+  std::exception_ptr error;
+  // Records are read into this buffer, which is zeroed after each one, and
+  // copied into the chunks at their size.
+  std::string record;
+  record.reserve(kMaxRecordSize);
+  auto end = false;
+  while (not end) {
+    auto chunk = std::make_shared<Chunk>();
+    try {
+      while (chunk->records.size() < options.chunk_size
+             and ReadRecord(in, options.format, &record)) {
+        chunk->records.emplace_back(record);
+        std::fill(record.begin(), record.end(), 0);
+      }
+    } catch (const std::invalid_argument&) {
+      read_error = std::current_exception();
+    }
+    std::fill(record.begin(), record.end(), 0);
+    end = read_error or chunk->records.size() < options.chunk_size;
+
+    if (not chunk->records.empty()) {
+      chunks.push_back(chunk);
+      executor.Submit([&, chunk] {
+        const TraceSpan span("RunBulk chunk");
+        try {
+          if (options.mode == BulkMode::kHash)
+            HashChunk(options, pwd_hasher, executor, chunk.get());
+          else
+            VerifyChunk(options, pwd_hasher, executor, chunk.get());
+        } catch (...) {
+          chunk->error = std::current_exception();
+        }
+        for (auto& record : chunk->records)
+          std::fill(record.begin(), record.end(), 0);
+        // Notifies under the lock, since RunBulk may return, destroying
+        // cond, as soon as it sees the last chunk done.
+        std::lock_guard lock(mutex);
+        chunk->done = true;
+        cond.notify_all();
+      });
+    }
+
+    // Writes the chunks that are done, in order. Waits for the oldest one
+    // while too many are in flight, and for all of them at the end.
+    for (;;) {
+      {
+        std::unique_lock lock(mutex);
+        if (chunks.empty()) break;
+        if (not chunks.front()->done) {
+          if (not end and chunks.size() < max_chunks) break;
+          cond.wait(lock, [&] { return chunks.front()->done; });
+        }
+      }
+      const auto front = std::move(chunks.front());
+      chunks.pop_front();
+      if (error) continue;
+      try {
+        if (front->error) std::rethrow_exception(front->error);
+        out.write(front->output.data(),
+                  static_cast<std::streamsize>(front->output.size()));
+        if (not out) throw std::runtime_error("Writing the results failed.");
+        stats.records += front->records.size();
+        stats.ok += front->stats.ok;
+        stats.mismatched += front->stats.mismatched;
+        stats.invalid += front->stats.invalid;
+        if (progress) progress(stats);
+      } catch (...) {
+        error = std::current_exception();
+        end = true;
+      }
+    }
+  }
+
+  if (error) std::rethrow_exception(error);
+  if (not out.flush()) throw std::runtime_error("Writing the results failed.");
+  if (read_error) std::rethrow_exception(read_error);
+  return stats;
+}
+
+} // namespace bcrypt
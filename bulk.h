@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <string>
+
+#include "thread_pool.h"
+
+namespace bcrypt {
+
+enum class BulkMode {
+  // Each record is a password, and the result is its hash.
+  kHash,
+  // Each record is a hash and a password, and the result says if they match.
+  kVerify,
+};
+
+// How records and results are framed.
+//
+//   kLines    A record per line, ending in '\n'. A verify record is the 60
+//             characters of the hash, a tab, then the password. A result is
+//             a line with the hash, or with match, mismatch or invalid.
+//   kBinary   A record is a little endian u32 size, then that many bytes. A
+//             verify record is the 60 bytes of the hash, then the password.
+//             A result is the 60 bytes of the hash, or zeros if the password
+//             is empty, or one byte: 0 for a match, 1 for a mismatch and 2
+//             for an invalid hash.
+//
+// Hashing an empty password is invalid, as is verifying one.
+enum class RecordFormat {
+  kLines,
+  kBinary,
+};
+
+// Records cannot be larger than this.
+constexpr std::size_t kMaxRecordSize = 1 << 16;
+
+struct BulkOptions {
+  BulkMode mode = BulkMode::kHash;
+  RecordFormat format = RecordFormat::kLines;
+
+  // Rounds of the hashes made by kHash.
+  std::uint32_t rounds = 10;
+
+  // Records handed to a worker at a time.
+  std::size_t chunk_size = 256;
+
+  // Most chunks read but not written yet, or 4 per thread of the executor if
+  // 0. Together with chunk_size and kMaxRecordSize, this bounds the memory
+  // used.
+  std::size_t max_chunks = 0;
+};
+
+struct BulkStats {
+  // Records written so far.
+  std::uint64_t records = 0;
+
+  // Passwords hashed or matched, hashes that did not match, and records that
+  // were invalid.
+  std::uint64_t ok = 0;
+  std::uint64_t mismatched = 0;
+  std::uint64_t invalid = 0;
+};
+
+// Reads the records from in, hashes or verifies them on the executor, e.g. a
+// ThreadPool or a TenantExecutor, and writes the results to out, in the order
+// of the records. Up to max_chunks chunks are in flight, so the executor is
+// kept busy while in is read and out is written.
+// progress, if set, is called with the stats so far after each chunk is
+// written. Throws std::invalid_argument if the options are out of range or
+// the input is malformed, e.g. a record is too large or a binary record is
+// cut short, once the results of the records before it are written. Throws
+// std::runtime_error if out fails.
+BulkStats
+RunBulk(
+    const BulkOptions& options,
+    std::istream& in,
+    std::ostream& out,
+    Executor& executor,
+    const std::function<void(const BulkStats&)>& progress = {});
+
+} // namespace bcrypt
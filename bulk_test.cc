@@ -0,0 +1,183 @@
+#include "bulk.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "gmock/gmock.h"
+
+#include "bcrypt.h"
+#include "thread_pool.h"
+
+namespace bcrypt {
+namespace {
+
+using ::testing::ElementsAre;
+
+std::vector<std::string>
+Lines(const std::string& text)
+{
+  std::vector<std::string> lines;
+  std::istringstream in(text);
+  for (std::string line; std::getline(in, line);)
+    lines.push_back(line);
+  return lines;
+}
+
+std::string
+BinaryRecord(std::string_view data)
+{
+  std::string record;
+  for (int shift = 0; shift < 32; shift += 8)
+    record += static_cast<char>((data.size() >> shift) & 0xff);
+  record += data;
+  return record;
+}
+
+std::string
+ToString(const BcryptArr& arr)
+{
+  return {arr.begin(), arr.end()};
+}
+
+BulkOptions
+TestOptions(BulkMode mode, RecordFormat format)
+{
+  BulkOptions options;
+  options.mode = mode;
+  options.format = format;
+  options.rounds = 4;
+  options.chunk_size = 3;
+  options.max_chunks = 2;
+  return options;
+}
+
+TEST(BulkTest, HashesLinesInOrder) {
+  ThreadPool pool(2);
+  std::string input;
+  constexpr std::size_t kRecords = 20;
+  for (std::size_t i = 0; i < kRecords; ++i)
+    input += "password" + std::to_string(i) + "\n";
+  input += "\nlast";
+  std::istringstream in(input);
+  std::ostringstream out;
+
+  const auto stats = RunBulk(TestOptions(BulkMode::kHash, RecordFormat::kLines),
+                             in, out, pool);
+  EXPECT_EQ(stats.records, kRecords + 2);
+  EXPECT_EQ(stats.ok, kRecords + 1);
+  EXPECT_EQ(stats.invalid, 1);
+
+  const auto lines = Lines(out.str());
+  ASSERT_EQ(lines.size(), kRecords + 2);
+  const PwdHasher pwd_hasher;
+  for (std::size_t i = 0; i < kRecords; ++i) {
+    BcryptArr arr;
+    ASSERT_EQ(lines[i].size(), arr.size());
+    std::copy(lines[i].begin(), lines[i].end(), arr.begin());
+    EXPECT_TRUE(pwd_hasher.IsSamePwd("password" + std::to_string(i), arr));
+    EXPECT_EQ(DecodeBcrypt(arr)->rounds, 4);
+  }
+  EXPECT_EQ(lines[kRecords], "invalid");
+  EXPECT_EQ(lines[kRecords + 1].size(), 60);
+}
+
+TEST(BulkTest, VerifiesLines) {
+  ThreadPool pool(2);
+  const PwdHasher pwd_hasher;
+  const auto hash = ToString(pwd_hasher.Generate("pass\tword", 4));
+  const auto other = ToString(pwd_hasher.Generate("other", 5));
+  std::istringstream in(
+      hash + "\tpass\tword\n" + hash + "\twrong\n" + other + "\tother\n"
+      + hash + "\t\n" + hash + " pass\tword\n" + "short\tpass\n"
+      + std::string(60, 'x') + "\tpass\n");
+  std::ostringstream out;
+
+  const auto stats = RunBulk(
+      TestOptions(BulkMode::kVerify, RecordFormat::kLines), in, out, pool);
+  EXPECT_THAT(Lines(out.str()),
+              ElementsAre("match", "mismatch", "match", "invalid", "invalid",
+                          "invalid", "invalid"));
+  EXPECT_EQ(stats.records, 7);
+  EXPECT_EQ(stats.ok, 2);
+  EXPECT_EQ(stats.mismatched, 1);
+  EXPECT_EQ(stats.invalid, 4);
+}
+
+TEST(BulkTest, BinaryRecords) {
+  ThreadPool pool(2);
+  const std::string pwd("pass\nword\0", 10);
+  std::istringstream hash_in(BinaryRecord(pwd) + BinaryRecord(""));
+  std::ostringstream hash_out;
+  RunBulk(TestOptions(BulkMode::kHash, RecordFormat::kBinary), hash_in,
+          hash_out, pool);
+  const auto hashes = hash_out.str();
+  ASSERT_EQ(hashes.size(), 120);
+  const auto hash = hashes.substr(0, 60);
+  EXPECT_EQ(hashes.substr(60), std::string(60, '\0'));
+
+  std::istringstream verify_in(BinaryRecord(hash + pwd)
+                               + BinaryRecord(hash + "wrong")
+                               + BinaryRecord(hash));
+  std::ostringstream verify_out;
+  RunBulk(TestOptions(BulkMode::kVerify, RecordFormat::kBinary), verify_in,
+          verify_out, pool);
+  EXPECT_EQ(verify_out.str(), std::string_view("\0\1\2", 3));
+}
+
+TEST(BulkTest, MalformedInputThrowsAfterEarlierResults) {
+  ThreadPool pool(2);
+  auto options = TestOptions(BulkMode::kHash, RecordFormat::kBinary);
+  std::string input;
+  for (int i = 0; i < 7; ++i)
+    input += BinaryRecord("password");
+  input += BinaryRecord("cut short").substr(0, 8);
+  std::istringstream in(input);
+  std::ostringstream out;
+  EXPECT_THROW(RunBulk(options, in, out, pool), std::invalid_argument);
+  EXPECT_EQ(out.str().size(), 7 * 60);
+
+  options.format = RecordFormat::kLines;
+  std::istringstream long_in("password\n"
+                             + std::string(kMaxRecordSize + 1, 'x'));
+  std::ostringstream long_out;
+  EXPECT_THROW(RunBulk(options, long_in, long_out, pool),
+               std::invalid_argument);
+  EXPECT_EQ(Lines(long_out.str()).size(), 1);
+}
+
+TEST(BulkTest, ReportsProgress) {
+  ThreadPool pool(2);
+  std::istringstream in("a\nb\nc\nd\ne\nf\ng\n");
+  std::ostringstream out;
+  std::vector<std::uint64_t> records;
+  const auto stats =
+      RunBulk(TestOptions(BulkMode::kHash, RecordFormat::kLines), in, out,
+              pool, [&](const BulkStats& s) { records.push_back(s.records); });
+  EXPECT_THAT(records, ElementsAre(3, 6, 7));
+  EXPECT_EQ(stats.records, 7);
+}
+
+TEST(BulkTest, EmptyInputAndBadOptions) {
+  ThreadPool pool(1);
+  std::istringstream in("");
+  std::ostringstream out;
+  const auto stats = RunBulk({}, in, out, pool);
+  EXPECT_EQ(stats.records, 0);
+  EXPECT_EQ(out.str(), "");
+
+  BulkOptions options;
+  options.rounds = 3;
+  EXPECT_THROW(RunBulk(options, in, out, pool), std::invalid_argument);
+  options.rounds = 4;
+  options.chunk_size = 0;
+  EXPECT_THROW(RunBulk(options, in, out, pool), std::invalid_argument);
+}
+
+} // namespace
+} // namespace bcrypt
@@ -0,0 +1,143 @@
+#include "calibrate.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bcrypt.h"
+#include "kernel.h"
+
+namespace bcrypt {
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr std::uint32_t kMinRounds = 4;
+constexpr std::uint32_t kMaxRounds = 31;
+
+// Rounds of the second profile that Calibrate fits a line through.
+constexpr std::uint32_t kFitRounds = 12;
+
+// Returns the number of samples needed to see the tail at confidence, e.g.
+// 500 for p99, within limits that keep calibration to a few seconds.
+std::size_t
+SamplesFor(double confidence) noexcept
+{
+  const auto n = std::ceil(5 / std::max(1 - confidence, 1e-3));
+  return std::clamp<std::size_t>(n, 20, 500);
+}
+
+// Returns the sample that the fraction q of the sorted samples does not
+// exceed.
+std::chrono::nanoseconds
+Quantile(const std::vector<std::chrono::nanoseconds>& sorted, double q)
+{
+  const auto i = static_cast<std::size_t>(std::ceil(q * sorted.size()));
+  return sorted[std::clamp<std::size_t>(i, 1, sorted.size()) - 1];
+}
+
+void
+CheckConfidence(double confidence)
+{
+  if (not (confidence > 0 and confidence <= 1))
+    throw std::invalid_argument("confidence should be in the range (0, 1].");
+}
+} // namespace
+
+CostProfile
+ProfileCost(
+    std::uint32_t rounds,
+    std::size_t samples,
+    double confidence,
+    HashPath path)
+{
+  if (rounds < kMinRounds or rounds > kMaxRounds)
+    throw std::invalid_argument("rounds should be in the range [4, 31].");
+  if (samples == 0)
+    throw std::invalid_argument("samples should be positive.");
+  CheckConfidence(confidence);
+
+  const auto kernel = ActiveKernel();
+  const auto lanes = path == HashPath::kBatched ? KernelLanes(kernel) : 1;
+  std::vector<std::string> pwd_strs(lanes);
+  std::vector<std::string_view> pwds(lanes);
+  std::vector<Salt> salts(lanes);
+  std::vector<PwdHash> hashes(lanes);
+  for (std::size_t i = 0; i < lanes; ++i) {
+    pwd_strs[i] = "calibrate" + std::to_string(i);
+    pwds[i] = pwd_strs[i];
+    salts[i].fill(static_cast<std::uint8_t>(i));
+  }
+
+  const auto hash = [&] {
+    if (path == HashPath::kBatched)
+      GenHashWith(kernel, pwds, salts, rounds, hashes);
+    else
+      hashes[0] = GenHash(pwds[0], salts[0], rounds);
+  };
+
+  // One untimed hash warms up the caches and the clock of the core.
+  hash();
+
+  std::vector<std::chrono::nanoseconds> latencies(samples);
+  for (auto& latency : latencies) {
+    const auto start = Clock::now();
+    hash();
+    latency = Clock::now() - start;
+  }
+  std::sort(latencies.begin(), latencies.end());
+
+  CostProfile profile;
+  profile.rounds = rounds;
+  profile.path = path;
+  profile.lanes = lanes;
+  std::chrono::nanoseconds total{0};
+  for (const auto latency : latencies) total += latency;
+  profile.mean = total / samples;
+  profile.p50 = Quantile(latencies, 0.5);
+  profile.p99 = Quantile(latencies, 0.99);
+  profile.quantile = Quantile(latencies, confidence);
+  return profile;
+}
+
+std::uint32_t
+Calibrate(
+    std::chrono::nanoseconds target_latency, double confidence, HashPath path)
+{
+  CheckConfidence(confidence);
+  const auto samples = SamplesFor(confidence);
+
+  const auto low = ProfileCost(kMinRounds, samples, confidence, path);
+  if (low.quantile > target_latency)
+    throw std::runtime_error("4 rounds take longer than target_latency.");
+  const auto high = ProfileCost(kFitRounds, samples, confidence, path);
+
+  // Latency is linear in rounds: a fixed setup plus two key expansions for
+  // each round.
+  const double per_round =
+      std::max(1.0, static_cast<double>((high.quantile - low.quantile).count())
+                        / (kFitRounds - kMinRounds));
+  const double fit =
+      kMinRounds + (target_latency - low.quantile).count() / per_round;
+  auto rounds = static_cast<std::uint32_t>(
+      std::clamp<double>(std::floor(fit), kMinRounds, kMaxRounds));
+
+  // The fit is only an estimate, so the neighbours of the pick are measured.
+  const auto meets = [&](std::uint32_t r) {
+    return ProfileCost(r, samples, confidence, path).quantile
+        <= target_latency;
+  };
+  if (meets(rounds)) {
+    while (rounds < kMaxRounds and meets(rounds + 1)) ++rounds;
+  } else {
+    while (rounds > kMinRounds and not meets(--rounds)) {}
+  }
+  return rounds;
+}
+
+} // namespace bcrypt
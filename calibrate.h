@@ -0,0 +1,66 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "bcrypt.h"
+
+namespace bcrypt {
+
+// The code path that ProfileCost times.
+enum class HashPath {
+  // GenHash, one password at a time, as PwdHasher::Generate and Verify hash.
+  kSingle,
+  // Full batches of the active kernel, as GenHashN and the batch APIs hash.
+  kBatched,
+};
+
+// Latency of hashing with a given number of rounds on this host.
+struct CostProfile {
+  std::uint32_t rounds = 0;
+  HashPath path = HashPath::kSingle;
+
+  // Number of passwords hashed at once: 1, or the lanes of the active kernel
+  // for kBatched. Each of them takes the whole latency.
+  std::size_t lanes = 1;
+
+  std::chrono::nanoseconds mean{0};
+  std::chrono::nanoseconds p50{0};
+  std::chrono::nanoseconds p99{0};
+
+  // The latency that the given fraction of samples did not exceed.
+  std::chrono::nanoseconds quantile{0};
+
+  // Most hashes per second that one core can compute with these rounds.
+  double
+  HashesPerSecond() const noexcept
+  {
+    return mean.count() > 0 ? 1e9 * lanes / mean.count() : 0;
+  }
+};
+
+// Times samples hashes, or full batches for kBatched, with the given rounds.
+// The quantile is taken at confidence, in (0, 1]. Throws
+// std::invalid_argument if rounds is not in [4, 31], samples is 0 or
+// confidence is not in (0, 1].
+CostProfile
+ProfileCost(
+    std::uint32_t rounds,
+    std::size_t samples,
+    double confidence = 0.99,
+    HashPath path = HashPath::kSingle);
+
+// Returns the highest number of rounds for which the given fraction of
+// hashes on the given path take at most target_latency on this host, e.g.
+// Calibrate(250ms, 0.99) for a p99 of 250ms. The latency is modelled as
+// linear in rounds from two profiles, then the pick and its neighbours are
+// measured. Throws std::invalid_argument if confidence is not in (0, 1], and
+// std::runtime_error if even 4 rounds are too slow.
+std::uint32_t
+Calibrate(
+    std::chrono::nanoseconds target_latency,
+    double confidence = 0.99,
+    HashPath path = HashPath::kSingle);
+
+} // namespace bcrypt
@@ -0,0 +1,57 @@
+#include "calibrate.h"
+
+#include <chrono>
+#include <stdexcept>
+
+#include "bcrypt.h"
+#include "gmock/gmock.h"
+
+namespace bcrypt {
+namespace {
+
+using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
+
+TEST(ProfileCostTest, MeasuresLatency) {
+  const auto profile = ProfileCost(4, 10, 0.9);
+  EXPECT_EQ(profile.rounds, 4);
+  EXPECT_EQ(profile.path, HashPath::kSingle);
+  EXPECT_EQ(profile.lanes, 1);
+  EXPECT_GT(profile.p50, nanoseconds(0));
+  EXPECT_LE(profile.p50, profile.quantile);
+  EXPECT_LE(profile.quantile, profile.p99);
+  EXPECT_GT(profile.HashesPerSecond(), 0);
+}
+
+TEST(ProfileCostTest, MeasuresBatches) {
+  const auto profile = ProfileCost(4, 10, 0.9, HashPath::kBatched);
+  EXPECT_EQ(profile.path, HashPath::kBatched);
+  EXPECT_EQ(profile.lanes, KernelLanes(ActiveKernel()));
+  EXPECT_GT(profile.p50, nanoseconds(0));
+  EXPECT_GT(profile.HashesPerSecond(), 0);
+}
+
+TEST(ProfileCostTest, MoreRoundsTakeLonger) {
+  // 31 rounds are 63 key expansions against 9 for 4 rounds, which is more
+  // than the noise of a busy host.
+  EXPECT_LT(ProfileCost(4, 20).p50, ProfileCost(31, 20).p50);
+}
+
+TEST(ProfileCostTest, ThrowsWithBadArguments) {
+  EXPECT_THROW(ProfileCost(3, 10), std::invalid_argument);
+  EXPECT_THROW(ProfileCost(32, 10), std::invalid_argument);
+  EXPECT_THROW(ProfileCost(4, 0), std::invalid_argument);
+  EXPECT_THROW(ProfileCost(4, 10, 0), std::invalid_argument);
+}
+
+TEST(CalibrateTest, PicksMostRoundsForLooseTarget) {
+  EXPECT_EQ(Calibrate(std::chrono::hours(1), 0.5), 31);
+}
+
+TEST(CalibrateTest, ThrowsIfTargetCannotBeMet) {
+  EXPECT_THROW(Calibrate(nanoseconds(1), 0.5), std::runtime_error);
+  EXPECT_THROW(Calibrate(milliseconds(1), 1.5), std::invalid_argument);
+}
+
+} // namespace
+} // namespace bcrypt
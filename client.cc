@@ -0,0 +1,208 @@
+#include "client.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+#include "bcrypt.h"
+#include "protocol.h"
+
+namespace bcrypt {
+namespace {
+std::system_error
+SystemError(const char* what)
+{
+  return std::system_error(errno, std::generic_category(), what);
+}
+} // namespace
+
+BcryptClient::BcryptClient(const std::string& path)
+{
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (path.empty() or path.size() >= sizeof(addr.sun_path))
+    throw std::invalid_argument("The socket path is empty or too long.");
+  std::copy(path.begin(), path.end(), addr.sun_path);
+
+  fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd_ < 0) throw SystemError("socket");
+  if (::connect(fd_, reinterpret_cast<const sockaddr*>(&addr),
+                sizeof(addr)) < 0) {
+    const auto error = SystemError("connect");
+    ::close(fd_);
+    throw error;
+  }
+}
+
+BcryptClient::~BcryptClient()
+{
+  ::close(fd_);
+}
+
+BcryptArr
+BcryptClient::Generate(std::string_view pwd, std::uint32_t rounds)
+{
+  const auto response = Await(SendGenerate(pwd, rounds));
+  switch (response.status) {
+    case Status::kOk:
+      break;
+    case Status::kBadRequest:
+      throw std::invalid_argument(
+          "The password is empty or rounds is not in the range [4, 31].");
+    case Status::kOverloaded:
+      throw std::runtime_error("The server is overloaded.");
+    default:
+      throw std::runtime_error("Unexpected status for a generate request.");
+  }
+  BcryptArr arr;
+  if (response.body.size() != arr.size())
+    throw std::runtime_error("The generated hash has the wrong size.");
+  std::copy(response.body.begin(), response.body.end(), arr.begin());
+  return arr;
+}
+
+VerifyStatus
+BcryptClient::Verify(std::string_view pwd, const BcryptArr& arr)
+{
+  const auto response = Await(SendVerify(pwd, arr));
+  try {
+    return ToVerifyStatus(response.status);
+  } catch (const std::invalid_argument&) {
+    throw std::runtime_error("Unexpected status for a verify request.");
+  }
+}
+
+std::string
+BcryptClient::Stats()
+{
+  auto response = Await(SendStats());
+  if (response.status != Status::kOk)
+    throw std::runtime_error("Unexpected status for a stats request.");
+  return std::move(response.body);
+}
+
+std::uint32_t
+BcryptClient::SendGenerate(std::string_view pwd, std::uint32_t rounds)
+{
+  Request request;
+  request.op = Op::kGenerate;
+  // Rounds that do not fit the field are sent as 0, which the server
+  // rejects like any other out of range value.
+  request.rounds = rounds <= 0xff ? rounds : 0;
+  request.pwd = pwd;
+  return Send(std::move(request));
+}
+
+std::uint32_t
+BcryptClient::SendVerify(std::string_view pwd, const BcryptArr& arr)
+{
+  Request request;
+  request.op = Op::kVerify;
+  request.arr = arr;
+  request.pwd = pwd;
+  return Send(std::move(request));
+}
+
+std::uint32_t
+BcryptClient::SendStats()
+{
+  Request request;
+  request.op = Op::kStats;
+  return Send(std::move(request));
+}
+
+std::uint32_t
+BcryptClient::Send(Request request)
+{
+  request.id = next_id_++;
+  AppendRequest(request, &out_);
+  std::fill(request.pwd.begin(), request.pwd.end(), 0);
+  return request.id;
+}
+
+void
+BcryptClient::Flush()
+{
+  std::size_t written = 0;
+  while (written < out_.size()) {
+    const auto n = ::send(fd_, out_.data() + written, out_.size() - written,
+                          MSG_NOSIGNAL);
+    if (n >= 0) {
+      written += static_cast<std::size_t>(n);
+    } else if (errno != EINTR) {
+      out_.erase(0, written);
+      throw SystemError("send");
+    }
+  }
+  std::fill(out_.begin(), out_.end(), 0);
+  out_.clear();
+}
+
+Response
+BcryptClient::Receive()
+{
+  Flush();
+  if (received_.empty()) return Read();
+  auto response = std::move(received_.front());
+  received_.pop_front();
+  return response;
+}
+
+Response
+BcryptClient::Await(std::uint32_t id)
+{
+  Flush();
+  const auto it = std::find_if(received_.begin(), received_.end(),
+                               [id](const auto& r) { return r.id == id; });
+  if (it != received_.end()) {
+    auto response = std::move(*it);
+    received_.erase(it);
+    return response;
+  }
+  for (;;) {
+    auto response = Read();
+    if (response.id == id) return response;
+    received_.push_back(std::move(response));
+  }
+}
+
+Response
+BcryptClient::Read()
+{
+  Response response;
+  for (;;) {
+    std::size_t size;
+    try {
+      size = ParseResponse(in_, &response);
+    } catch (const std::invalid_argument& e) {
+      throw std::runtime_error(e.what());
+    }
+    if (size > 0) {
+      in_.erase(0, size);
+      return response;
+    }
+
+    char buf[1 << 14];
+    const auto n = ::recv(fd_, buf, sizeof(buf), 0);
+    if (n > 0) {
+      in_.append(buf, static_cast<std::size_t>(n));
+    } else if (n == 0) {
+      errno = ECONNRESET;
+      throw SystemError("recv");
+    } else if (errno != EINTR) {
+      throw SystemError("recv");
+    }
+  }
+}
+
+} // namespace bcrypt
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+
+#include "bcrypt.h"
+#include "protocol.h"
+
+namespace bcrypt {
+
+// A connection to bcryptd. Requests can be pipelined: the Send methods queue
+// a request and return its id, and Receive returns the responses as they
+// come back, in any order. The blocking methods wrap the two. A client is
+// not thread safe; threads should each have their own.
+class BcryptClient {
+public:
+  // Connects to the server listening at path. Throws std::system_error if it
+  // cannot.
+  explicit BcryptClient(const std::string& path);
+
+  ~BcryptClient();
+
+  BcryptClient(const BcryptClient&) = delete;
+  BcryptClient& operator=(const BcryptClient&) = delete;
+
+  // Like PwdHasher::Generate. Throws std::invalid_argument if the password is
+  // empty or rounds is not in the range [4, 31], and std::runtime_error if
+  // the server is overloaded.
+  BcryptArr
+  Generate(std::string_view pwd, std::uint32_t rounds = 10);
+
+  // Like PwdHasher::Verify, plus kOverloaded if the server is overloaded.
+  VerifyStatus
+  Verify(std::string_view pwd, const BcryptArr& arr);
+
+  // Returns the stats of the server and the metrics of its library, in the
+  // Prometheus text format.
+  std::string
+  Stats();
+
+  // Queue requests, which are sent by the next Flush or Receive. Throw
+  // std::invalid_argument if the password is too long for a frame.
+  std::uint32_t
+  SendGenerate(std::string_view pwd, std::uint32_t rounds = 10);
+
+  std::uint32_t
+  SendVerify(std::string_view pwd, const BcryptArr& arr);
+
+  std::uint32_t
+  SendStats();
+
+  // Sends the queued requests. Throws std::system_error if the connection
+  // fails.
+  void
+  Flush();
+
+  // Sends the queued requests and waits for the next response. Throws
+  // std::system_error if the connection fails or is closed, and
+  // std::runtime_error if the response is malformed.
+  Response
+  Receive();
+
+private:
+  std::uint32_t
+  Send(Request request);
+
+  // Sends the queued requests and receives responses until the one to the
+  // request.
+  Response
+  Await(std::uint32_t id);
+
+  // Reads the next response from the socket.
+  Response
+  Read();
+
+  int fd_ = -1;
+  std::uint32_t next_id_ = 0;
+  // Requests not sent yet, and bytes received but not parsed yet.
+  std::string out_;
+  std::string in_;
+  // Responses read by Await that were not the one it waited for.
+  std::deque<Response> received_;
+};
+
+} // namespace bcrypt
@@ -0,0 +1,140 @@
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bcrypt.h"
+#include "kernel.h"
+
+namespace bcrypt {
+namespace {
+// The kernels, from the narrowest to the widest.
+constexpr Kernel kKernels[] = {
+  Kernel::kScalar, Kernel::kInterleaved, Kernel::kAvx2, Kernel::kAvx512,
+};
+
+// Number of rounds and minimum time used to time a kernel in AutotuneKernel.
+constexpr std::uint32_t kAutotuneRounds = 4;
+constexpr auto kAutotuneTime = std::chrono::milliseconds(5);
+
+// Returns the widest kernel the CPU supports.
+Kernel
+WidestKernel() noexcept
+{
+  Kernel widest = Kernel::kScalar;
+  for (const auto kernel : kKernels) {
+    if (IsKernelSupported(kernel)) widest = kernel;
+  }
+  return widest;
+}
+
+std::atomic<Kernel>&
+ActiveKernelRef() noexcept
+{
+  static std::atomic<Kernel> kernel = WidestKernel();
+  return kernel;
+}
+
+// Returns the number of hashes per second of the kernel, hashing full groups
+// of lanes for at least kAutotuneTime.
+double
+HashRate(Kernel kernel)
+{
+  const auto lanes = KernelLanes(kernel);
+  std::vector<std::string> pwd_strs(lanes);
+  std::vector<std::string_view> pwds(lanes);
+  std::vector<Salt> salts(lanes);
+  std::vector<PwdHash> hashes(lanes);
+  for (std::size_t i = 0; i < lanes; ++i) {
+    pwd_strs[i] = "autotune" + std::to_string(i);
+    pwds[i] = pwd_strs[i];
+    salts[i].fill(static_cast<std::uint8_t>(i));
+  }
+
+  using Clock = std::chrono::steady_clock;
+  // The first run warms up the caches and is not timed.
+  GenHashWith(kernel, pwds, salts, kAutotuneRounds, hashes);
+  std::size_t num_hashes = 0;
+  const auto start = Clock::now();
+  auto elapsed = Clock::duration::zero();
+  while (elapsed < kAutotuneTime) {
+    GenHashWith(kernel, pwds, salts, kAutotuneRounds, hashes);
+    num_hashes += lanes;
+    elapsed = Clock::now() - start;
+  }
+  return num_hashes / std::chrono::duration<double>(elapsed).count();
+}
+} // namespace
+
+std::string_view
+KernelName(Kernel kernel) noexcept
+{
+  switch (kernel) {
+    case Kernel::kScalar: return "scalar";
+    case Kernel::kInterleaved: return "interleaved";
+    case Kernel::kAvx2: return "avx2";
+    case Kernel::kAvx512: return "avx512";
+  }
+  return "unknown";
+}
+
+std::size_t
+KernelLanes(Kernel kernel) noexcept
+{
+  switch (kernel) {
+    case Kernel::kScalar: return 1;
+    case Kernel::kInterleaved: return InterleavedLanes();
+    case Kernel::kAvx2: return kAvx2Lanes;
+    case Kernel::kAvx512: return kAvx512Lanes;
+  }
+  return 1;
+}
+
+bool
+IsKernelSupported(Kernel kernel) noexcept
+{
+  switch (kernel) {
+    case Kernel::kScalar: return true;
+    case Kernel::kInterleaved: return true;
+    case Kernel::kAvx2: return HasAvx2();
+    case Kernel::kAvx512: return HasAvx512();
+  }
+  return false;
+}
+
+Kernel
+ActiveKernel() noexcept
+{
+  return ActiveKernelRef().load(std::memory_order_relaxed);
+}
+
+void
+SetActiveKernel(Kernel kernel)
+{
+  if (not IsKernelSupported(kernel))
+    throw std::invalid_argument("kernel is not supported by this CPU.");
+  ActiveKernelRef().store(kernel, std::memory_order_relaxed);
+}
+
+Kernel
+AutotuneKernel()
+{
+  Kernel fastest = Kernel::kScalar;
+  double fastest_rate = 0;
+  for (const auto kernel : kKernels) {
+    if (not IsKernelSupported(kernel)) continue;
+    const auto rate = HashRate(kernel);
+    if (rate > fastest_rate) {
+      fastest = kernel;
+      fastest_rate = rate;
+    }
+  }
+  SetActiveKernel(fastest);
+  return fastest;
+}
+
+} // namespace bcrypt
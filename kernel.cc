@@ -0,0 +1,63 @@
+#include "kernel.h"
+
+#include <cstdint>
+#include <string_view>
+
+#include "blowfish.h"
+
+namespace bcrypt {
+
+const std::uint32_t kCipherWords[kNumCipherWords] = {
+  0x4f727068, 0x65616e42, 0x65686f6c, 0x64657253, 0x63727944, 0x6f756274,
+};
+
+void
+ExpandKey(std::string_view pwd, const Salt& salt, KeySchedule* ks) noexcept
+{
+  if (pwd.empty())
+    pwd = std::string_view("\0", 1);
+  else if (pwd.size() > kMaxPwdSize)
+    pwd.remove_suffix(pwd.size()-kMaxPwdSize);
+
+  const auto* key = reinterpret_cast<const std::uint8_t*>(pwd.data());
+  std::uint16_t j = 0;
+  for (auto& word : ks->pwd)
+    word = Blowfish_stream2word(key, pwd.size(), &j);
+
+  // The salt is exactly 4 words long, so its key stream never wraps.
+  for (int i = 0; i < kNumSaltWords; ++i) {
+    const auto* bytes = &salt[4 * i];
+    ks->salt[i] = (std::uint32_t{bytes[0]} << 24) | (std::uint32_t{bytes[1]} << 16)
+        | (std::uint32_t{bytes[2]} << 8) | bytes[3];
+  }
+}
+
+void
+StoreHash(const std::uint32_t* cdata, PwdHash* pwd_hash) noexcept
+{
+  auto* out = pwd_hash->data();
+  for (std::size_t i = 0; i < pwd_hash->size(); ++i)
+    out[i] = (cdata[i / 4] >> (24 - 8 * (i % 4))) & 0xff;
+}
+
+bool
+HasAvx2() noexcept
+{
+#if BCRYPT_X86
+  return __builtin_cpu_supports("avx2");
+#else
+  return false;
+#endif
+}
+
+bool
+HasAvx512() noexcept
+{
+#if BCRYPT_X86
+  return __builtin_cpu_supports("avx512f");
+#else
+  return false;
+#endif
+}
+
+} // namespace bcrypt
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <stop_token>
+#include <string_view>
+
+#include "bcrypt.h"
+#include "blowfish.h"
+
+// Internal interface to the EksBlowfish kernels. A kernel hashes a fixed
+// number of independent passwords at once, one per lane, and produces the
+// same PwdHash as GenHash for each of them.
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BCRYPT_X86 1
+#define BCRYPT_TARGET(isa) __attribute__((target(isa)))
+#else
+#define BCRYPT_X86 0
+#define BCRYPT_TARGET(isa)
+#endif
+
+namespace bcrypt {
+
+// The maximum size of the password that can be used by the algorithm.
+constexpr std::uint32_t kMaxPwdSize = 72;
+
+// Number of 32-bit words in the P-array.
+constexpr std::uint8_t kNumPWords = kNumSubkeys + 2;
+
+// Number of 32-bit words in a 16 byte salt.
+constexpr std::uint8_t kNumSaltWords = 4;
+
+// Number of 32-bit words of ciphertext, i.e. "OrpheanBeholderScryDoubt".
+constexpr std::uint8_t kNumCipherWords = 6;
+
+// Lane counts of the kernels.
+constexpr std::size_t kMaxInterleavedLanes = 4;
+constexpr std::size_t kAvx2Lanes = 8;
+constexpr std::size_t kAvx512Lanes = 16;
+
+// The key stream words of a password and its salt. Both stay the same for the
+// whole hash, so they are derived once instead of on every expansion.
+struct KeySchedule {
+  std::uint32_t pwd[kNumPWords];
+  std::uint32_t salt[kNumSaltWords];
+};
+
+// Function for Feistel Networks, see F in blowfish.cc. Inlined into the
+// interleaved kernel.
+inline std::uint32_t
+BlowfishF(const Context& c, std::uint32_t x)
+{
+  return ((c.S[0][x >> 24] + c.S[1][(x >> 16) & 0xff])
+      ^ c.S[2][(x >> 8) & 0xff]) + c.S[3][x & 0xff];
+}
+
+// Fills ks from the first 72 bytes of pwd and the salt. An empty pwd is used
+// as a single NUL byte, since the key stream needs at least one byte.
+void
+ExpandKey(std::string_view pwd, const Salt& salt, KeySchedule* ks) noexcept;
+
+// The initial ciphertext words, i.e. "OrpheanBeholderScryDoubt" in big endian.
+extern const std::uint32_t kCipherWords[kNumCipherWords];
+
+// Writes the first 23 bytes of the big endian ciphertext words to pwd_hash.
+void
+StoreHash(const std::uint32_t* cdata, PwdHash* pwd_hash) noexcept;
+
+// DecodeBcrypt without counting the failures in the metrics, for callers that
+// decode a hash that is decoded again later, e.g. to weigh a verification.
+std::optional<BcryptParams>
+DecodeParams(const BcryptArr& arr) noexcept;
+
+// Number of iterations of the cost loop between checks of a CancelCheck. An
+// iteration is two key expansions, tens of microseconds, so checking every
+// one costs next to nothing.
+constexpr std::uint32_t kCancelCheckRounds = 1;
+
+// When to abandon a hash.
+struct CancelCheck {
+  std::stop_token stop;
+  Deadline deadline = Deadline::max();
+
+  // Returns true if the hash is no longer wanted. The clock is only read if
+  // there is a deadline.
+  bool
+  Cancelled() const noexcept
+  {
+    return stop.stop_requested()
+        or (deadline != Deadline::max()
+            and std::chrono::steady_clock::now() >= deadline);
+  }
+};
+
+// The steps of GenHashScalar, for hashes that are run a piece at a time.
+// ScalarSetup initializes the state from the key schedule, ScalarIterate runs
+// one iteration of the cost loop, where salt_key is the salt words repeated
+// over kNumPWords words, and ScalarFinish encrypts the ciphertext.
+void
+ScalarSetup(const KeySchedule& ks, Context* ctx) noexcept;
+
+void
+ScalarIterate(
+    const KeySchedule& ks, const std::uint32_t* salt_key, Context* ctx) noexcept;
+
+void
+ScalarFinish(Context* ctx, PwdHash* out) noexcept;
+
+// Hashes a single password with the Blowfish functions of blowfish.cc, taking
+// the key words from ks instead of the byte stream. Used by GenHash. If
+// cancel is set, it is checked every kCancelCheckRounds iterations of the
+// cost loop, and false is returned without writing out once it is cancelled.
+// Each Blowfish round waits on the S-box loads of the last, so a single hash
+// is bound by load latency; GenHashN gets its speed from hashing several.
+bool
+GenHashScalar(
+    const KeySchedule& ks,
+    std::uint32_t rounds,
+    PwdHash* out,
+    const CancelCheck* cancel = nullptr) noexcept;
+
+// GenHashN with the given kernel, which must be supported by the CPU. The
+// spans must have the same size.
+void
+GenHashWith(
+    Kernel kernel,
+    std::span<const std::string_view> pwds,
+    std::span<const Salt> salts,
+    std::uint32_t rounds,
+    std::span<PwdHash> out) noexcept;
+
+// Returns true if the CPU can run the given kernel.
+bool
+HasAvx2() noexcept;
+bool
+HasAvx512() noexcept;
+
+// Returns the number of lanes to use with GenHashInterleaved, in the range
+// [2, kMaxInterleavedLanes]. Each lane has its own 4 KiB of S-boxes, so this
+// is the most lanes whose S-boxes still fit comfortably in the L1 data cache.
+std::size_t
+InterleavedLanes() noexcept;
+
+// Hashes num_lanes <= kMaxInterleavedLanes passwords with scalar code that
+// runs the lanes round by round. Each lane is a separate dependency chain of
+// S-box loads, so the CPU can overlap them. Runs on every CPU.
+void
+GenHashInterleaved(
+    const KeySchedule* ks,
+    std::size_t num_lanes,
+    std::uint32_t rounds,
+    PwdHash* out) noexcept;
+
+// Hashes num_lanes <= kAvx2Lanes passwords with AVX2, reading ks[i] and
+// writing out[i] for each lane. Unused lanes repeat the first one and their
+// output is discarded. Must only be called if HasAvx2() is true.
+void
+GenHashAvx2(
+    const KeySchedule* ks,
+    std::size_t num_lanes,
+    std::uint32_t rounds,
+    PwdHash* out) noexcept;
+
+// Hashes num_lanes <= kAvx512Lanes passwords with AVX-512. Must only be called
+// if HasAvx512() is true.
+void
+GenHashAvx512(
+    const KeySchedule* ks,
+    std::size_t num_lanes,
+    std::uint32_t rounds,
+    PwdHash* out) noexcept;
+
+} // namespace bcrypt
@@ -0,0 +1,191 @@
+#include "kernel.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "blowfish.h"
+
+#if BCRYPT_X86
+#include <immintrin.h>
+#endif
+
+namespace bcrypt {
+#if BCRYPT_X86
+namespace {
+constexpr std::size_t kLanes = kAvx512Lanes;
+
+// The EksBlowfish state of every lane. S-box entry k of all the lanes is kept
+// in one row, so refilling the S-boxes is a plain vector store and each
+// lookup in F is a single gather at index k * kLanes + lane.
+struct alignas(64) State {
+  __m512i P[kNumPWords];
+  __m512i S[4 * 256];
+};
+
+// GCC 12 flags the deliberately undefined vectors that the shift, and and
+// gather intrinsics use as merge sources.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#endif
+BCRYPT_TARGET("avx512f") inline __m512i
+Gather(const State& st, __m512i x, int shift, int sbox, __m512i lane)
+{
+  const auto* s = reinterpret_cast<const int*>(st.S);
+  __m512i idx = _mm512_and_si512(
+      _mm512_srli_epi32(x, shift), _mm512_set1_epi32(0xff));
+  idx = _mm512_add_epi32(
+      _mm512_slli_epi32(idx, 4),
+      _mm512_add_epi32(lane, _mm512_set1_epi32(sbox * 256 * kLanes)));
+  return _mm512_i32gather_epi32(idx, s, 4);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+// Function for Feistel Networks, see F in blowfish.cc.
+BCRYPT_TARGET("avx512f") inline __m512i
+F(const State& st, __m512i x, __m512i lane)
+{
+  const __m512i a = Gather(st, x, 24, 0, lane);
+  const __m512i b = Gather(st, x, 16, 1, lane);
+  const __m512i c = Gather(st, x, 8, 2, lane);
+  const __m512i d = Gather(st, x, 0, 3, lane);
+  return _mm512_add_epi32(
+      _mm512_xor_si512(_mm512_add_epi32(a, b), c), d);
+}
+
+BCRYPT_TARGET("avx512f") inline void
+Encipher(const State& st, __m512i* xl, __m512i* xr, __m512i lane)
+{
+  __m512i l = _mm512_xor_si512(*xl, st.P[0]);
+  __m512i r = *xr;
+  for (int i = 1; i <= kNumSubkeys; i += 2) {
+    r = _mm512_xor_si512(r, _mm512_xor_si512(F(st, l, lane), st.P[i]));
+    l = _mm512_xor_si512(l, _mm512_xor_si512(F(st, r, lane), st.P[i+1]));
+  }
+  *xl = _mm512_xor_si512(r, st.P[kNumSubkeys+1]);
+  *xr = l;
+}
+
+// Blowfish_expandstate with a 16 byte salt as the data.
+BCRYPT_TARGET("avx512f") void
+ExpandState(State* st, const __m512i* pwd, const __m512i* salt, __m512i lane)
+{
+  for (int i = 0; i < kNumPWords; ++i)
+    st->P[i] = _mm512_xor_si512(st->P[i], pwd[i]);
+
+  __m512i l = _mm512_setzero_si512();
+  __m512i r = _mm512_setzero_si512();
+  int j = 0;
+  for (int i = 0; i < kNumPWords; i += 2, j = (j + 2) % kNumSaltWords) {
+    l = _mm512_xor_si512(l, salt[j]);
+    r = _mm512_xor_si512(r, salt[j+1]);
+    Encipher(*st, &l, &r, lane);
+    st->P[i] = l;
+    st->P[i+1] = r;
+  }
+  for (int k = 0; k < 4 * 256; k += 2, j = (j + 2) % kNumSaltWords) {
+    l = _mm512_xor_si512(l, salt[j]);
+    r = _mm512_xor_si512(r, salt[j+1]);
+    Encipher(*st, &l, &r, lane);
+    st->S[k] = l;
+    st->S[k+1] = r;
+  }
+}
+
+// Blowfish_expand0state with the key stream words in key.
+BCRYPT_TARGET("avx512f") void
+Expand0State(State* st, const __m512i* key, __m512i lane)
+{
+  for (int i = 0; i < kNumPWords; ++i)
+    st->P[i] = _mm512_xor_si512(st->P[i], key[i]);
+
+  __m512i l = _mm512_setzero_si512();
+  __m512i r = _mm512_setzero_si512();
+  for (int i = 0; i < kNumPWords; i += 2) {
+    Encipher(*st, &l, &r, lane);
+    st->P[i] = l;
+    st->P[i+1] = r;
+  }
+  for (int k = 0; k < 4 * 256; k += 2) {
+    Encipher(*st, &l, &r, lane);
+    st->S[k] = l;
+    st->S[k+1] = r;
+  }
+}
+} // namespace
+
+BCRYPT_TARGET("avx512f") void
+GenHashAvx512(
+    const KeySchedule* ks,
+    std::size_t num_lanes,
+    std::uint32_t rounds,
+    PwdHash* out) noexcept
+{
+  // Transpose the key schedules so that word i of every lane is one vector.
+  alignas(64) std::uint32_t words[kLanes];
+  __m512i pwd[kNumPWords];
+  __m512i salt[kNumPWords];
+  for (int i = 0; i < kNumPWords; ++i) {
+    for (std::size_t n = 0; n < kLanes; ++n)
+      words[n] = ks[n < num_lanes ? n : 0].pwd[i];
+    pwd[i] = _mm512_load_si512(reinterpret_cast<const __m512i*>(words));
+  }
+  for (int i = 0; i < kNumSaltWords; ++i) {
+    for (std::size_t n = 0; n < kLanes; ++n)
+      words[n] = ks[n < num_lanes ? n : 0].salt[i];
+    salt[i] = _mm512_load_si512(reinterpret_cast<const __m512i*>(words));
+  }
+  // The salt is 16 bytes long, so its key stream repeats every 4 words.
+  for (int i = kNumSaltWords; i < kNumPWords; ++i)
+    salt[i] = salt[i % kNumSaltWords];
+
+  Context init;
+  Blowfish_initstate(&init);
+  State st;
+  for (int i = 0; i < kNumPWords; ++i)
+    st.P[i] = _mm512_set1_epi32(init.P[i]);
+  for (int k = 0; k < 4 * 256; ++k)
+    st.S[k] = _mm512_set1_epi32(init.S[k / 256][k % 256]);
+
+  const __m512i lane = _mm512_setr_epi32(
+      0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  ExpandState(&st, pwd, salt, lane);
+  for (std::uint32_t k = 0; k < rounds; ++k) {
+    Expand0State(&st, pwd, lane);
+    Expand0State(&st, salt, lane);
+  }
+
+  __m512i cdata[kNumCipherWords];
+  for (int i = 0; i < kNumCipherWords; ++i)
+    cdata[i] = _mm512_set1_epi32(kCipherWords[i]);
+  for (int k = 0; k < 64; ++k) {
+    for (int i = 0; i < kNumCipherWords; i += 2)
+      Encipher(st, &cdata[i], &cdata[i+1], lane);
+  }
+
+  alignas(64) std::uint32_t lanes[kNumCipherWords][kLanes];
+  for (int i = 0; i < kNumCipherWords; ++i)
+    _mm512_store_si512(reinterpret_cast<__m512i*>(lanes[i]), cdata[i]);
+  for (std::size_t n = 0; n < num_lanes; ++n) {
+    std::uint32_t lane_cdata[kNumCipherWords];
+    for (int i = 0; i < kNumCipherWords; ++i)
+      lane_cdata[i] = lanes[i][n];
+    StoreHash(lane_cdata, &out[n]);
+  }
+
+  // Clear memory.
+  std::fill_n(reinterpret_cast<char*>(&st), sizeof(st), 0);
+  std::fill_n(reinterpret_cast<char*>(pwd), sizeof(pwd), 0);
+  std::fill_n(reinterpret_cast<char*>(salt), sizeof(salt), 0);
+  std::fill_n(reinterpret_cast<char*>(lanes), sizeof(lanes), 0);
+}
+#else
+void
+GenHashAvx512(const KeySchedule*, std::size_t, std::uint32_t, PwdHash*) noexcept
+{
+}
+#endif
+} // namespace bcrypt
@@ -0,0 +1,183 @@
+#include "kernel.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include <unistd.h>
+
+#include "blowfish.h"
+
+namespace bcrypt {
+namespace {
+// Used when the L1 data cache size is not known.
+constexpr long kDefaultL1Size = 32 * 1024;
+
+// Blowfish_encipher for kLanes contexts at once. Every round is done for all
+// the lanes before moving on to the next one.
+template <std::size_t kLanes>
+inline void
+Encipher(const Context* c, std::uint32_t* xl, std::uint32_t* xr)
+{
+  std::uint32_t l[kLanes];
+  std::uint32_t r[kLanes];
+  for (std::size_t n = 0; n < kLanes; ++n) {
+    l[n] = xl[n] ^ c[n].P[0];
+    r[n] = xr[n];
+  }
+  for (int i = 1; i <= kNumSubkeys; i += 2) {
+    for (std::size_t n = 0; n < kLanes; ++n)
+      r[n] ^= BlowfishF(c[n], l[n]) ^ c[n].P[i];
+    for (std::size_t n = 0; n < kLanes; ++n)
+      l[n] ^= BlowfishF(c[n], r[n]) ^ c[n].P[i+1];
+  }
+  for (std::size_t n = 0; n < kLanes; ++n) {
+    xl[n] = r[n] ^ c[n].P[kNumSubkeys+1];
+    xr[n] = l[n];
+  }
+}
+
+// Blowfish_expandstate with a 16 byte salt as the data.
+template <std::size_t kLanes>
+void
+ExpandState(Context* c, const KeySchedule* ks)
+{
+  for (std::size_t n = 0; n < kLanes; ++n) {
+    for (int i = 0; i < kNumPWords; ++i)
+      c[n].P[i] ^= ks[n].pwd[i];
+  }
+
+  std::uint32_t l[kLanes] = {};
+  std::uint32_t r[kLanes] = {};
+  int j = 0;
+  for (int i = 0; i < kNumPWords; i += 2, j = (j + 2) % kNumSaltWords) {
+    for (std::size_t n = 0; n < kLanes; ++n) {
+      l[n] ^= ks[n].salt[j];
+      r[n] ^= ks[n].salt[j+1];
+    }
+    Encipher<kLanes>(c, l, r);
+    for (std::size_t n = 0; n < kLanes; ++n) {
+      c[n].P[i] = l[n];
+      c[n].P[i+1] = r[n];
+    }
+  }
+  for (int i = 0; i < 4; ++i) {
+    for (int k = 0; k < 256; k += 2, j = (j + 2) % kNumSaltWords) {
+      for (std::size_t n = 0; n < kLanes; ++n) {
+        l[n] ^= ks[n].salt[j];
+        r[n] ^= ks[n].salt[j+1];
+      }
+      Encipher<kLanes>(c, l, r);
+      for (std::size_t n = 0; n < kLanes; ++n) {
+        c[n].S[i][k] = l[n];
+        c[n].S[i][k+1] = r[n];
+      }
+    }
+  }
+}
+
+// Blowfish_expand0state with the key stream words of lane n at key(ks[n]).
+template <std::size_t kLanes, typename KeyFn>
+void
+Expand0State(Context* c, const KeySchedule* ks, KeyFn key)
+{
+  for (std::size_t n = 0; n < kLanes; ++n) {
+    for (int i = 0; i < kNumPWords; ++i)
+      c[n].P[i] ^= key(ks[n], i);
+  }
+
+  std::uint32_t l[kLanes] = {};
+  std::uint32_t r[kLanes] = {};
+  for (int i = 0; i < kNumPWords; i += 2) {
+    Encipher<kLanes>(c, l, r);
+    for (std::size_t n = 0; n < kLanes; ++n) {
+      c[n].P[i] = l[n];
+      c[n].P[i+1] = r[n];
+    }
+  }
+  for (int i = 0; i < 4; ++i) {
+    for (int k = 0; k < 256; k += 2) {
+      Encipher<kLanes>(c, l, r);
+      for (std::size_t n = 0; n < kLanes; ++n) {
+        c[n].S[i][k] = l[n];
+        c[n].S[i][k+1] = r[n];
+      }
+    }
+  }
+}
+
+template <std::size_t kLanes>
+void
+GenHashLanes(const KeySchedule* ks, std::uint32_t rounds, PwdHash* out)
+{
+  const auto pwd_key = [](const KeySchedule& k, int i) { return k.pwd[i]; };
+  // The salt is 16 bytes long, so its key stream repeats every 4 words.
+  const auto salt_key = [](const KeySchedule& k, int i) {
+    return k.salt[i % kNumSaltWords];
+  };
+
+  Context ctx[kLanes];
+  for (auto& c : ctx)
+    Blowfish_initstate(&c);
+  ExpandState<kLanes>(ctx, ks);
+  for (std::uint32_t k = 0; k < rounds; ++k) {
+    Expand0State<kLanes>(ctx, ks, pwd_key);
+    Expand0State<kLanes>(ctx, ks, salt_key);
+  }
+
+  std::uint32_t cdata[kLanes][kNumCipherWords];
+  for (auto& lane_cdata : cdata)
+    std::copy_n(kCipherWords, kNumCipherWords, lane_cdata);
+  for (int k = 0; k < 64; ++k) {
+    for (int i = 0; i < kNumCipherWords; i += 2) {
+      std::uint32_t l[kLanes];
+      std::uint32_t r[kLanes];
+      for (std::size_t n = 0; n < kLanes; ++n) {
+        l[n] = cdata[n][i];
+        r[n] = cdata[n][i+1];
+      }
+      Encipher<kLanes>(ctx, l, r);
+      for (std::size_t n = 0; n < kLanes; ++n) {
+        cdata[n][i] = l[n];
+        cdata[n][i+1] = r[n];
+      }
+    }
+  }
+  for (std::size_t n = 0; n < kLanes; ++n)
+    StoreHash(cdata[n], &out[n]);
+
+  // Clear memory.
+  std::fill_n(reinterpret_cast<char*>(ctx), sizeof(ctx), 0);
+  std::fill_n(reinterpret_cast<char*>(cdata), sizeof(cdata), 0);
+}
+} // namespace
+
+std::size_t
+InterleavedLanes() noexcept
+{
+  static const std::size_t lanes = [] {
+    long l1_size = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+    if (l1_size <= 0) l1_size = kDefaultL1Size;
+    // Leave a quarter of the cache for the stack and everything else.
+    const auto lanes = static_cast<std::size_t>(3 * l1_size / 4) / sizeof(Context);
+    return std::clamp<std::size_t>(lanes, 2, kMaxInterleavedLanes);
+  }();
+  return lanes;
+}
+
+void
+GenHashInterleaved(
+    const KeySchedule* ks,
+    std::size_t num_lanes,
+    std::uint32_t rounds,
+    PwdHash* out) noexcept
+{
+  switch (num_lanes) {
+    case 1: GenHashLanes<1>(ks, rounds, out); break;
+    case 2: GenHashLanes<2>(ks, rounds, out); break;
+    case 3: GenHashLanes<3>(ks, rounds, out); break;
+    case 4: GenHashLanes<4>(ks, rounds, out); break;
+  }
+}
+
+} // namespace bcrypt
@@ -0,0 +1,129 @@
+#include "kernel.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "blowfish.h"
+#include "tracing.h"
+
+namespace bcrypt {
+namespace {
+
+// Blowfish_expandstate with the key stream words of the password and the
+// salt in ks.
+void
+ExpandState(Context* c, const KeySchedule& ks)
+{
+  for (int i = 0; i < kNumPWords; ++i)
+    c->P[i] ^= ks.pwd[i];
+
+  std::uint32_t l = 0;
+  std::uint32_t r = 0;
+  int j = 0;
+  for (int i = 0; i < kNumPWords; i += 2) {
+    l ^= ks.salt[j++ % kNumSaltWords];
+    r ^= ks.salt[j++ % kNumSaltWords];
+    Blowfish_encipher(c, &l, &r);
+    c->P[i] = l;
+    c->P[i+1] = r;
+  }
+
+  auto* s = c->S[0];
+  for (int k = 0; k < 4 * 256; k += 2) {
+    l ^= ks.salt[j++ % kNumSaltWords];
+    r ^= ks.salt[j++ % kNumSaltWords];
+    Blowfish_encipher(c, &l, &r);
+    s[k] = l;
+    s[k+1] = r;
+  }
+}
+
+// Blowfish_expand0state with the 18 key stream words in key.
+void
+Expand0State(Context* c, const std::uint32_t* key)
+{
+  for (int i = 0; i < kNumPWords; ++i)
+    c->P[i] ^= key[i];
+
+  std::uint32_t l = 0;
+  std::uint32_t r = 0;
+  for (int i = 0; i < kNumPWords; i += 2) {
+    Blowfish_encipher(c, &l, &r);
+    c->P[i] = l;
+    c->P[i+1] = r;
+  }
+
+  auto* s = c->S[0];
+  for (int k = 0; k < 4 * 256; k += 2) {
+    Blowfish_encipher(c, &l, &r);
+    s[k] = l;
+    s[k+1] = r;
+  }
+}
+} // namespace
+
+void
+ScalarSetup(const KeySchedule& ks, Context* ctx) noexcept
+{
+  Blowfish_initstate(ctx);
+  ExpandState(ctx, ks);
+}
+
+void
+ScalarIterate(
+    const KeySchedule& ks, const std::uint32_t* salt_key, Context* ctx) noexcept
+{
+  Expand0State(ctx, ks.pwd);
+  Expand0State(ctx, salt_key);
+}
+
+void
+ScalarFinish(Context* ctx, PwdHash* out) noexcept
+{
+  std::uint32_t cdata[kNumCipherWords];
+  std::copy_n(kCipherWords, kNumCipherWords, cdata);
+  for (int k = 0; k < 64; ++k)
+    blf_enc(ctx, cdata, kNumCipherWords / 2);
+  StoreHash(cdata, out);
+  std::fill_n(cdata, kNumCipherWords, 0);
+}
+
+bool
+GenHashScalar(
+    const KeySchedule& ks,
+    std::uint32_t rounds,
+    PwdHash* out,
+    const CancelCheck* cancel) noexcept
+{
+  std::uint32_t salt_key[kNumPWords];
+  for (int i = 0; i < kNumPWords; ++i)
+    salt_key[i] = ks.salt[i % kNumSaltWords];
+
+  Context ctx;
+  {
+    const TraceSpan span("expandstate");
+    ScalarSetup(ks, &ctx);
+  }
+  bool cancelled = false;
+  {
+    const TraceSpan span("cost loop");
+    for (std::uint32_t k = 0; k < rounds; ++k) {
+      if (cancel and k % kCancelCheckRounds == 0 and cancel->Cancelled()) {
+        cancelled = true;
+        break;
+      }
+      ScalarIterate(ks, salt_key, &ctx);
+    }
+  }
+  if (not cancelled) {
+    const TraceSpan span("encrypt ctext");
+    ScalarFinish(&ctx, out);
+  }
+
+  // Clear memory.
+  std::fill_n(reinterpret_cast<char*>(&ctx), sizeof(ctx), 0);
+  std::fill_n(salt_key, kNumPWords, 0);
+  return not cancelled;
+}
+
+} // namespace bcrypt
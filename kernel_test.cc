@@ -0,0 +1,145 @@
+#include "kernel.h"
+
+#include <cstddef>
+#include <functional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bcrypt.h"
+#include "blowfish.h"
+#include "gmock/gmock.h"
+
+namespace bcrypt {
+namespace {
+
+// GenHash as it was written on top of the Blowfish functions.
+PwdHash
+ReferenceHash(std::string_view pwd, const Salt& salt, std::uint32_t rounds)
+{
+  if (pwd.size() > kMaxPwdSize)
+    pwd.remove_suffix(pwd.size()-kMaxPwdSize);
+  const auto* key = reinterpret_cast<const std::uint8_t*>(pwd.data());
+
+  Context ctx;
+  Blowfish_initstate(&ctx);
+  Blowfish_expandstate(&ctx, salt.data(), salt.size(), key, pwd.size());
+  for (std::uint32_t k = 0; k < rounds; ++k) {
+    Blowfish_expand0state(&ctx, key, pwd.size());
+    Blowfish_expand0state(&ctx, salt.data(), salt.size());
+  }
+
+  std::uint8_t ciphertext[] = "OrpheanBeholderScryDoubt";
+  std::uint32_t cdata[kNumCipherWords];
+  std::uint16_t j = 0;
+  for (auto& word : cdata)
+    word = Blowfish_stream2word(ciphertext, 4 * kNumCipherWords, &j);
+  for (int k = 0; k < 64; ++k)
+    blf_enc(&ctx, cdata, kNumCipherWords / 2);
+
+  PwdHash pwd_hash;
+  StoreHash(cdata, &pwd_hash);
+  return pwd_hash;
+}
+
+// Random passwords of every length in [1, 80) and random salts.
+class KernelTest : public testing::Test {
+protected:
+  void SetUp() override {
+    auto random_fn = std::bind_front(
+        std::uniform_int_distribution<std::uint8_t>(), std::mt19937(0));
+    for (int i = 1; i < 80; ++i) {
+      std::string pwd;
+      for (int j = 0; j < i; ++j)
+        pwd.push_back(random_fn());
+      pwds_.push_back(std::move(pwd));
+      Salt salt;
+      for (auto& c : salt) c = random_fn();
+      salts_.push_back(salt);
+    }
+  }
+
+  // Runs kernel_fn over all the passwords in groups of num_lanes, including a
+  // partial group at the end, and checks the hashes against GenHash.
+  template <typename KernelFn>
+  void ExpectSameAsGenHash(std::size_t num_lanes, KernelFn kernel_fn) {
+    constexpr std::uint32_t kRounds = 4;
+    std::vector<KeySchedule> ks(pwds_.size());
+    for (std::size_t i = 0; i < pwds_.size(); ++i)
+      ExpandKey(pwds_[i], salts_[i], &ks[i]);
+
+    std::vector<PwdHash> hashes(pwds_.size());
+    for (std::size_t i = 0; i < pwds_.size(); i += num_lanes)
+      kernel_fn(&ks[i], std::min(num_lanes, pwds_.size() - i), kRounds,
+                &hashes[i]);
+
+    for (std::size_t i = 0; i < pwds_.size(); ++i)
+      EXPECT_EQ(hashes[i], GenHash(pwds_[i], salts_[i], kRounds))
+        << "for password of size " << pwds_[i].size();
+  }
+
+  std::vector<std::string> pwds_;
+  std::vector<Salt> salts_;
+};
+
+TEST_F(KernelTest, GenHashIsSameAsReference) {
+  for (std::size_t i = 0; i < pwds_.size(); ++i) {
+    for (std::uint32_t rounds : {4, 5, 6}) {
+      EXPECT_EQ(GenHash(pwds_[i], salts_[i], rounds),
+                ReferenceHash(pwds_[i], salts_[i], rounds))
+        << "for password of size " << pwds_[i].size();
+    }
+  }
+}
+
+TEST_F(KernelTest, InterleavedIsSameAsGenHash) {
+  for (std::size_t lanes = 1; lanes <= kMaxInterleavedLanes; ++lanes)
+    ExpectSameAsGenHash(lanes, GenHashInterleaved);
+}
+
+TEST(InterleavedLanesTest, IsInRange) {
+  EXPECT_GE(InterleavedLanes(), 2);
+  EXPECT_LE(InterleavedLanes(), kMaxInterleavedLanes);
+}
+
+TEST_F(KernelTest, Avx2IsSameAsGenHash) {
+  if (not HasAvx2()) GTEST_SKIP() << "AVX2 is not supported.";
+  ExpectSameAsGenHash(kAvx2Lanes, GenHashAvx2);
+}
+
+TEST_F(KernelTest, Avx512IsSameAsGenHash) {
+  if (not HasAvx512()) GTEST_SKIP() << "AVX-512 is not supported.";
+  ExpectSameAsGenHash(kAvx512Lanes, GenHashAvx512);
+}
+
+TEST_F(KernelTest, GenHashWithIsSameAsGenHash) {
+  constexpr std::uint32_t kRounds = 4;
+  std::vector<std::string_view> pwds(pwds_.begin(), pwds_.end());
+  for (const auto kernel : {Kernel::kScalar, Kernel::kInterleaved,
+                            Kernel::kAvx2, Kernel::kAvx512}) {
+    if (not IsKernelSupported(kernel)) continue;
+    std::vector<PwdHash> hashes(pwds.size());
+    GenHashWith(kernel, pwds, salts_, kRounds, hashes);
+    for (std::size_t i = 0; i < pwds.size(); ++i)
+      EXPECT_EQ(hashes[i], GenHash(pwds[i], salts_[i], kRounds))
+        << "with kernel " << KernelName(kernel);
+  }
+}
+
+TEST(ActiveKernelTest, SetActiveKernelChangesActiveKernel) {
+  const auto kernel = ActiveKernel();
+  EXPECT_TRUE(IsKernelSupported(kernel));
+  SetActiveKernel(Kernel::kInterleaved);
+  EXPECT_EQ(ActiveKernel(), Kernel::kInterleaved);
+  SetActiveKernel(kernel);
+}
+
+TEST(ActiveKernelTest, AutotuneKernelActivatesSupportedKernel) {
+  const auto kernel = AutotuneKernel();
+  EXPECT_TRUE(IsKernelSupported(kernel));
+  EXPECT_EQ(ActiveKernel(), kernel);
+}
+
+} // namespace
+} // namespace bcrypt
@@ -0,0 +1,240 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <string_view>
+
+#include <fmt/core.h>
+
+#include <sched.h>
+
+#include "bcrypt.h"
+
+namespace bcrypt {
+namespace {
+
+constexpr std::string_view kOpNames[kNumHashOps] = {"generate", "verify"};
+constexpr std::string_view kStatusNames[kNumVerifyStatuses] = {
+    "match", "mismatch", "invalid_hash", "overloaded", "cancelled"};
+
+// Histogram buckets are exported at 2^k nanoseconds for k in this range.
+constexpr int kFirstExportedPower = 10;
+constexpr int kLastExportedPower = 40;
+
+#if BCRYPT_METRICS
+
+// Number of shards of the counters. Threads on different CPUs mostly update
+// different shards, so counting does not bounce a cache line between cores.
+constexpr std::size_t kShards = 16;
+
+using Counter = std::atomic<std::uint64_t>;
+
+struct alignas(64) Shard {
+  Counter hashes[kNumHashOps][32];
+  Counter verify_outcomes[kNumVerifyStatuses];
+  Counter decode_failures;
+  Counter reused_verifications;
+  Counter latency[kNumHashOps][kLatencyBuckets];
+  Counter latency_sum[kNumHashOps];
+};
+
+Shard shards[kShards];
+
+// The shard of the CPU this thread runs on, or of the thread if that is
+// unknown.
+Shard&
+LocalShard() noexcept
+{
+  static std::atomic<std::size_t> next_thread = 0;
+  thread_local const std::size_t thread_shard = next_thread++;
+  const auto cpu = sched_getcpu();
+  return shards[(cpu >= 0 ? static_cast<std::size_t>(cpu) : thread_shard)
+                % kShards];
+}
+
+void
+Add(Counter& counter, std::uint64_t n) noexcept
+{
+  counter.fetch_add(n, std::memory_order_relaxed);
+}
+
+std::uint64_t
+Load(const Counter& counter) noexcept
+{
+  return counter.load(std::memory_order_relaxed);
+}
+
+#endif // BCRYPT_METRICS
+
+} // namespace
+
+std::size_t
+LatencyBucket(std::uint64_t ns) noexcept
+{
+  if (ns < kLatencySubBuckets) return ns;
+  // The power of two of ns, and the next three bits after its top bit.
+  const auto power = static_cast<std::size_t>(std::bit_width(ns) - 1);
+  const auto sub = (ns >> (power - 3)) & (kLatencySubBuckets - 1);
+  return std::min(kLatencySubBuckets + (power - 3) * kLatencySubBuckets + sub,
+                  kLatencyBuckets - 1);
+}
+
+std::uint64_t
+LatencyBucketEnd(std::size_t bucket) noexcept
+{
+  if (bucket < kLatencySubBuckets) return bucket + 1;
+  const auto power = 3 + (bucket - kLatencySubBuckets) / kLatencySubBuckets;
+  const auto sub = (bucket - kLatencySubBuckets) % kLatencySubBuckets;
+  return (kLatencySubBuckets + sub + 1) << (power - 3);
+}
+
+std::chrono::nanoseconds
+LatencyHistogram::Quantile(double q) const noexcept
+{
+  if (count == 0) return std::chrono::nanoseconds(0);
+  const auto rank = std::max<std::uint64_t>(
+      1, static_cast<std::uint64_t>(q * count + 0.5));
+  std::uint64_t seen = 0;
+  for (std::size_t b = 0; b < kLatencyBuckets; ++b) {
+    seen += buckets[b];
+    if (seen >= rank)
+      return std::chrono::nanoseconds(LatencyBucketEnd(b));
+  }
+  return std::chrono::nanoseconds(LatencyBucketEnd(kLatencyBuckets - 1));
+}
+
+MetricsSnapshot
+SnapshotMetrics()
+{
+  MetricsSnapshot snapshot;
+#if BCRYPT_METRICS
+  for (const auto& shard : shards) {
+    for (std::size_t op = 0; op < kNumHashOps; ++op) {
+      for (std::size_t r = 0; r < 32; ++r)
+        snapshot.hashes[op][r] += Load(shard.hashes[op][r]);
+      auto& latency = snapshot.latency[op];
+      for (std::size_t b = 0; b < kLatencyBuckets; ++b) {
+        const auto n = Load(shard.latency[op][b]);
+        latency.buckets[b] += n;
+        latency.count += n;
+      }
+      latency.sum += std::chrono::nanoseconds(Load(shard.latency_sum[op]));
+    }
+    for (std::size_t s = 0; s < kNumVerifyStatuses; ++s)
+      snapshot.verify_outcomes[s] += Load(shard.verify_outcomes[s]);
+    snapshot.decode_failures += Load(shard.decode_failures);
+    snapshot.reused_verifications += Load(shard.reused_verifications);
+  }
+#endif
+  return snapshot;
+}
+
+std::string
+PrometheusText(const MetricsSnapshot& snapshot)
+{
+  std::string text;
+  auto out = std::back_inserter(text);
+
+  text += "# HELP bcrypt_hashes_total Passwords hashed, by operation and "
+          "cost.\n# TYPE bcrypt_hashes_total counter\n";
+  for (std::size_t op = 0; op < kNumHashOps; ++op) {
+    for (std::uint32_t r = 0; r < 32; ++r) {
+      if (const auto n = snapshot.hashes[op][r])
+        fmt::format_to(out, "bcrypt_hashes_total{{op=\"{}\",cost=\"{}\"}} {}\n",
+                       kOpNames[op], r, n);
+    }
+  }
+
+  text += "# HELP bcrypt_verifications_total Verifications, by outcome.\n"
+          "# TYPE bcrypt_verifications_total counter\n";
+  for (std::size_t s = 0; s < kNumVerifyStatuses; ++s)
+    fmt::format_to(out, "bcrypt_verifications_total{{outcome=\"{}\"}} {}\n",
+                   kStatusNames[s], snapshot.verify_outcomes[s]);
+
+  text += "# HELP bcrypt_decode_failures_total Hashes that could not be "
+          "decoded.\n# TYPE bcrypt_decode_failures_total counter\n";
+  fmt::format_to(out, "bcrypt_decode_failures_total {}\n",
+                 snapshot.decode_failures);
+
+  text += "# HELP bcrypt_reused_verifications_total Verifications answered "
+          "without hashing.\n# TYPE bcrypt_reused_verifications_total "
+          "counter\n";
+  fmt::format_to(out, "bcrypt_reused_verifications_total {}\n",
+                 snapshot.reused_verifications);
+
+  text += "# HELP bcrypt_hash_duration_seconds Latency of Generate and "
+          "Verify.\n# TYPE bcrypt_hash_duration_seconds histogram\n";
+  for (std::size_t op = 0; op < kNumHashOps; ++op) {
+    const auto& latency = snapshot.latency[op];
+    const auto name = kOpNames[op];
+    std::uint64_t cumulative = 0;
+    std::size_t b = 0;
+    for (int power = kFirstExportedPower; power <= kLastExportedPower;
+         ++power) {
+      const auto end = std::uint64_t{1} << power;
+      for (; b < kLatencyBuckets and LatencyBucketEnd(b) <= end; ++b)
+        cumulative += latency.buckets[b];
+      fmt::format_to(
+          out, "bcrypt_hash_duration_seconds_bucket{{op=\"{}\",le=\"{}\"}} {}\n",
+          name, end / 1e9, cumulative);
+    }
+    fmt::format_to(
+        out, "bcrypt_hash_duration_seconds_bucket{{op=\"{}\",le=\"+Inf\"}} {}\n",
+        name, latency.count);
+    fmt::format_to(out, "bcrypt_hash_duration_seconds_sum{{op=\"{}\"}} {}\n",
+                   name, std::chrono::duration<double>(latency.sum).count());
+    fmt::format_to(out, "bcrypt_hash_duration_seconds_count{{op=\"{}\"}} {}\n",
+                   name, latency.count);
+  }
+  return text;
+}
+
+#if BCRYPT_METRICS
+
+void
+RecordHashes(HashOp op, std::uint32_t rounds, std::uint64_t count) noexcept
+{
+  Add(LocalShard().hashes[static_cast<std::size_t>(op)][rounds % 32], count);
+}
+
+void
+RecordVerify(VerifyStatus status) noexcept
+{
+  Add(LocalShard().verify_outcomes[static_cast<std::size_t>(status)], 1);
+}
+
+void
+RecordDecodeFailure() noexcept
+{
+  Add(LocalShard().decode_failures, 1);
+}
+
+void
+RecordReusedVerify() noexcept
+{
+  Add(LocalShard().reused_verifications, 1);
+}
+
+HashTimer::~HashTimer()
+{
+  if (cancelled_) return;
+  const auto elapsed = std::chrono::steady_clock::now() - start_;
+  const auto ns = static_cast<std::uint64_t>(std::max<std::int64_t>(
+      0, std::chrono::nanoseconds(elapsed).count()));
+  const auto op = static_cast<std::size_t>(op_);
+  auto& shard = LocalShard();
+  Add(shard.hashes[op][rounds_ % 32], 1);
+  Add(shard.latency[op][LatencyBucket(ns)], 1);
+  Add(shard.latency_sum[op], ns);
+}
+
+#endif // BCRYPT_METRICS
+
+} // namespace bcrypt
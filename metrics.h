@@ -0,0 +1,177 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "bcrypt.h"
+
+// Set to 0 to compile the metrics out. Recording then does nothing, and
+// snapshots are all zeros.
+#ifndef BCRYPT_METRICS
+#define BCRYPT_METRICS 1
+#endif
+
+namespace bcrypt {
+
+constexpr bool kMetricsEnabled = BCRYPT_METRICS;
+
+// Operations that hash a password.
+enum class HashOp {
+  kGenerate,
+  kVerify,
+};
+
+// Number of HashOp and VerifyStatus values.
+constexpr std::size_t kNumHashOps = 2;
+constexpr std::size_t kNumVerifyStatuses = 5;
+
+// Latency histograms have 8 buckets per power of two, so a bucket is at most
+// 12.5% wider than its lower bound, from 1ns up to 2^41ns, about 37 minutes.
+// Slower hashes go in the last bucket.
+constexpr std::size_t kLatencySubBuckets = 8;
+constexpr std::size_t kLatencyBuckets = 8 + 38 * kLatencySubBuckets;
+
+// Returns the bucket of a latency of ns nanoseconds.
+std::size_t
+LatencyBucket(std::uint64_t ns) noexcept;
+
+// Returns the smallest latency, in nanoseconds, that is past the bucket.
+std::uint64_t
+LatencyBucketEnd(std::size_t bucket) noexcept;
+
+struct LatencyHistogram {
+  std::array<std::uint64_t, kLatencyBuckets> buckets{};
+  std::uint64_t count = 0;
+  std::chrono::nanoseconds sum{0};
+
+  // Returns the end of the bucket that holds the given fraction of the
+  // latencies, in (0, 1], or 0 if the histogram is empty.
+  std::chrono::nanoseconds
+  Quantile(double q) const noexcept;
+};
+
+// Totals since the process started.
+struct MetricsSnapshot {
+  // Hashes computed, by operation and rounds. Batches count each password.
+  std::array<std::array<std::uint64_t, 32>, kNumHashOps> hashes{};
+
+  // Outcomes of verifications, by VerifyStatus.
+  std::array<std::uint64_t, kNumVerifyStatuses> verify_outcomes{};
+
+  // Hashes that DecodeBcrypt could not decode.
+  std::uint64_t decode_failures = 0;
+
+  // Verifications answered without a hash of their own: VerifyCache hits
+  // and SingleFlight calls that waited for another call's hash. They are
+  // also counted in verify_outcomes.
+  std::uint64_t reused_verifications = 0;
+
+  // Latency of PwdHasher::Generate and PwdHasher::Verify, by operation.
+  // Batches are not included.
+  std::array<LatencyHistogram, kNumHashOps> latency;
+
+  std::uint64_t
+  Hashes(HashOp op, std::uint32_t rounds) const noexcept
+  {
+    return hashes[static_cast<std::size_t>(op)][rounds];
+  }
+
+  std::uint64_t
+  Outcomes(VerifyStatus status) const noexcept
+  {
+    return verify_outcomes[static_cast<std::size_t>(status)];
+  }
+
+  const LatencyHistogram&
+  Latency(HashOp op) const noexcept
+  {
+    return latency[static_cast<std::size_t>(op)];
+  }
+};
+
+// Returns the metrics of the library. Counters are sharded per CPU, so a
+// snapshot sums the shards and is not atomic across counters.
+MetricsSnapshot
+SnapshotMetrics();
+
+// Returns the snapshot in the Prometheus text exposition format, e.g.
+//
+//   bcrypt_hashes_total{op="verify",cost="10"} 42
+//   bcrypt_verifications_total{outcome="mismatch"} 3
+//   bcrypt_decode_failures_total 1
+//   bcrypt_reused_verifications_total 5
+//   bcrypt_hash_duration_seconds_bucket{op="verify",le="0.001048576"} 40
+//
+// Histogram buckets are reported at powers of two nanoseconds from 1us.
+std::string
+PrometheusText(const MetricsSnapshot& snapshot);
+
+#if BCRYPT_METRICS
+
+// Records hashes computed without timing them, e.g. by a batch.
+void
+RecordHashes(HashOp op, std::uint32_t rounds, std::uint64_t count) noexcept;
+
+void
+RecordVerify(VerifyStatus status) noexcept;
+
+void
+RecordDecodeFailure() noexcept;
+
+// Records a verification answered without hashing. Its outcome is recorded
+// with RecordVerify.
+void
+RecordReusedVerify() noexcept;
+
+// Records a hash and its latency when destroyed.
+class HashTimer {
+public:
+  HashTimer(HashOp op, std::uint32_t rounds) noexcept
+    : op_(op), rounds_(rounds), start_(std::chrono::steady_clock::now())
+  {}
+
+  ~HashTimer();
+
+  HashTimer(const HashTimer&) = delete;
+  HashTimer& operator=(const HashTimer&) = delete;
+
+  // Records nothing when destroyed, e.g. because the hash was cancelled.
+  void
+  Cancel() noexcept { cancelled_ = true; }
+
+private:
+  const HashOp op_;
+  const std::uint32_t rounds_;
+  const std::chrono::steady_clock::time_point start_;
+  bool cancelled_ = false;
+};
+
+#else
+
+inline void
+RecordHashes(HashOp, std::uint32_t, std::uint64_t) noexcept {}
+
+inline void
+RecordVerify(VerifyStatus) noexcept {}
+
+inline void
+RecordDecodeFailure() noexcept {}
+
+inline void
+RecordReusedVerify() noexcept {}
+
+class HashTimer {
+public:
+  HashTimer(HashOp, std::uint32_t) noexcept {}
+
+  void
+  Cancel() noexcept {}
+};
+
+#endif // BCRYPT_METRICS
+
+} // namespace bcrypt
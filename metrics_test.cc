@@ -0,0 +1,265 @@
+#include "metrics.h"
+
+#include <chrono>
+#include <cstdint>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gmock/gmock.h"
+
+#include "async.h"
+#include "batcher.h"
+#include "bcrypt.h"
+#include "single_flight.h"
+#include "thread_pool.h"
+#include "verify_cache.h"
+
+namespace bcrypt {
+namespace {
+
+using ::testing::HasSubstr;
+using ::testing::Not;
+
+TEST(LatencyBucketTest, BucketsAreOrderedAndNarrow) {
+  for (std::uint64_t ns = 0; ns < 8; ++ns) {
+    EXPECT_EQ(LatencyBucket(ns), ns);
+    EXPECT_EQ(LatencyBucketEnd(ns), ns + 1);
+  }
+  std::size_t last = 0;
+  for (std::uint64_t ns = 8; ns < (std::uint64_t{1} << 41); ns += ns / 7 + 1) {
+    const auto bucket = LatencyBucket(ns);
+    ASSERT_GE(bucket, last);
+    ASSERT_LT(ns, LatencyBucketEnd(bucket));
+    // The bucket starts where the one before it ends, at most 12.5% below.
+    ASSERT_GE(ns, LatencyBucketEnd(bucket - 1));
+    ASSERT_LE(LatencyBucketEnd(bucket) - LatencyBucketEnd(bucket - 1),
+              LatencyBucketEnd(bucket - 1) / 8);
+    last = bucket;
+  }
+  EXPECT_EQ(LatencyBucket(~std::uint64_t{0}), kLatencyBuckets - 1);
+}
+
+TEST(LatencyHistogramTest, Quantile) {
+  LatencyHistogram histogram;
+  EXPECT_EQ(histogram.Quantile(0.5), std::chrono::nanoseconds(0));
+  for (std::uint64_t ns : {1000, 1000, 1000, 2000, 1000000}) {
+    ++histogram.buckets[LatencyBucket(ns)];
+    ++histogram.count;
+  }
+  EXPECT_EQ(histogram.Quantile(0.5).count(),
+            LatencyBucketEnd(LatencyBucket(1000)));
+  EXPECT_EQ(histogram.Quantile(0.8).count(),
+            LatencyBucketEnd(LatencyBucket(2000)));
+  EXPECT_EQ(histogram.Quantile(1).count(),
+            LatencyBucketEnd(LatencyBucket(1000000)));
+}
+
+TEST(MetricsTest, CountsHashesOutcomesAndFailures) {
+  if (not kMetricsEnabled) GTEST_SKIP() << "metrics are compiled out";
+  const PwdHasher pwd_hasher;
+  const auto before = SnapshotMetrics();
+
+  const auto arr = pwd_hasher.Generate("password", 5);
+  EXPECT_TRUE(pwd_hasher.IsSamePwd("password", arr));
+  EXPECT_FALSE(pwd_hasher.IsSamePwd("wrong", arr));
+  EXPECT_FALSE(pwd_hasher.IsSamePwd("password", BcryptArr{}));
+
+  const auto after = SnapshotMetrics();
+  EXPECT_EQ(after.Hashes(HashOp::kGenerate, 5)
+            - before.Hashes(HashOp::kGenerate, 5), 1);
+  EXPECT_EQ(after.Hashes(HashOp::kVerify, 5)
+            - before.Hashes(HashOp::kVerify, 5), 2);
+  EXPECT_EQ(after.Outcomes(VerifyStatus::kMatch)
+            - before.Outcomes(VerifyStatus::kMatch), 1);
+  EXPECT_EQ(after.Outcomes(VerifyStatus::kMismatch)
+            - before.Outcomes(VerifyStatus::kMismatch), 1);
+  EXPECT_EQ(after.Outcomes(VerifyStatus::kInvalidHash)
+            - before.Outcomes(VerifyStatus::kInvalidHash), 1);
+  EXPECT_EQ(after.decode_failures - before.decode_failures, 1);
+
+  const auto& latency = after.Latency(HashOp::kVerify);
+  EXPECT_EQ(latency.count - before.Latency(HashOp::kVerify).count, 2);
+  EXPECT_GT(latency.sum, before.Latency(HashOp::kVerify).sum);
+  EXPECT_GT(latency.Quantile(1), std::chrono::nanoseconds(0));
+}
+
+TEST(MetricsTest, CountsBatchedHashes) {
+  if (not kMetricsEnabled) GTEST_SKIP() << "metrics are compiled out";
+  ThreadPool pool(1);
+  const auto before = SnapshotMetrics();
+  {
+    MicroBatcher batcher(PwdHasher(), pool);
+    const auto arr = batcher.Generate("password", 6).get();
+    EXPECT_TRUE(batcher.IsSamePwd("password", arr).get());
+    EXPECT_FALSE(batcher.IsSamePwd("wrong", arr).get());
+    EXPECT_FALSE(batcher.IsSamePwd("password", BcryptArr{}).get());
+  }
+
+  const auto after = SnapshotMetrics();
+  EXPECT_EQ(after.Hashes(HashOp::kGenerate, 6)
+            - before.Hashes(HashOp::kGenerate, 6), 1);
+  EXPECT_EQ(after.Hashes(HashOp::kVerify, 6)
+            - before.Hashes(HashOp::kVerify, 6), 2);
+  EXPECT_EQ(after.Outcomes(VerifyStatus::kMatch)
+            - before.Outcomes(VerifyStatus::kMatch), 1);
+  EXPECT_EQ(after.Outcomes(VerifyStatus::kMismatch)
+            - before.Outcomes(VerifyStatus::kMismatch), 1);
+  EXPECT_EQ(after.Outcomes(VerifyStatus::kInvalidHash)
+            - before.Outcomes(VerifyStatus::kInvalidHash), 1);
+}
+
+TEST(MetricsTest, CountsEachFailureOnce) {
+  if (not kMetricsEnabled) GTEST_SKIP() << "metrics are compiled out";
+  ThreadPool pool(1);
+  const AsyncPwdHasher async_hasher(PwdHasher(), pool);
+  const auto before = SnapshotMetrics();
+  EXPECT_FALSE(async_hasher.IsSamePwd("password", BcryptArr{}).get());
+  EXPECT_EQ(SnapshotMetrics().decode_failures - before.decode_failures, 1);
+}
+
+TEST(MetricsTest, VerifyCacheCountsInvalidHashes) {
+  if (not kMetricsEnabled) GTEST_SKIP() << "metrics are compiled out";
+  LruVerifyCache cache;
+  const PwdHasher pwd_hasher;
+  const auto before = SnapshotMetrics();
+  EXPECT_EQ(cache.Verify(pwd_hasher, "password", BcryptArr{}),
+            VerifyStatus::kInvalidHash);
+  EXPECT_EQ(cache.Verify(pwd_hasher, "", pwd_hasher.Generate("password", 4)),
+            VerifyStatus::kInvalidHash);
+  EXPECT_EQ(SnapshotMetrics().Outcomes(VerifyStatus::kInvalidHash)
+            - before.Outcomes(VerifyStatus::kInvalidHash), 2);
+}
+
+TEST(MetricsTest, VerifyCacheCountsHits) {
+  if (not kMetricsEnabled) GTEST_SKIP() << "metrics are compiled out";
+  LruVerifyCache cache;
+  const PwdHasher pwd_hasher;
+  const auto arr = pwd_hasher.Generate("password", 4);
+  const auto before = SnapshotMetrics();
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_EQ(cache.Verify(pwd_hasher, "password", arr), VerifyStatus::kMatch);
+    EXPECT_EQ(cache.Verify(pwd_hasher, "wrong", arr), VerifyStatus::kMismatch);
+  }
+  const auto after = SnapshotMetrics();
+  EXPECT_EQ(after.Outcomes(VerifyStatus::kMatch)
+            - before.Outcomes(VerifyStatus::kMatch), 2);
+  EXPECT_EQ(after.Outcomes(VerifyStatus::kMismatch)
+            - before.Outcomes(VerifyStatus::kMismatch), 2);
+  EXPECT_EQ(after.reused_verifications - before.reused_verifications, 2);
+}
+
+TEST(MetricsTest, SingleFlightCountsInvalidHashes) {
+  if (not kMetricsEnabled) GTEST_SKIP() << "metrics are compiled out";
+  SingleFlight single_flight;
+  const auto before = SnapshotMetrics();
+  EXPECT_EQ(single_flight.Verify("password", BcryptArr{}),
+            VerifyStatus::kInvalidHash);
+  EXPECT_EQ(SnapshotMetrics().Outcomes(VerifyStatus::kInvalidHash)
+            - before.Outcomes(VerifyStatus::kInvalidHash), 1);
+}
+
+TEST(MetricsTest, SingleFlightCountsCoalescedCalls) {
+  if (not kMetricsEnabled) GTEST_SKIP() << "metrics are compiled out";
+  // Enough rounds that the hash is still running when the other calls come.
+  const auto arr = PwdHasher().Generate("password", 31);
+  SingleFlight single_flight;
+  const auto before = SnapshotMetrics();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 8; ++i) {
+    threads.emplace_back([&] {
+      EXPECT_EQ(single_flight.Verify("password", arr), VerifyStatus::kMatch);
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  const auto after = SnapshotMetrics();
+  EXPECT_EQ(after.Outcomes(VerifyStatus::kMatch)
+            - before.Outcomes(VerifyStatus::kMatch), 8);
+  EXPECT_EQ(after.reused_verifications - before.reused_verifications,
+            single_flight.Stats().coalesced);
+}
+
+TEST(MetricsTest, CancelledHashesAreNotTimed) {
+  if (not kMetricsEnabled) GTEST_SKIP() << "metrics are compiled out";
+  const PwdHasher pwd_hasher;
+  const auto arr = pwd_hasher.Generate("password", 7);
+  std::stop_source stop;
+  stop.request_stop();
+  const auto before = SnapshotMetrics();
+  EXPECT_EQ(pwd_hasher.Verify("password", arr, stop.get_token()),
+            VerifyStatus::kCancelled);
+
+  const auto after = SnapshotMetrics();
+  EXPECT_EQ(after.Hashes(HashOp::kVerify, 7)
+            - before.Hashes(HashOp::kVerify, 7), 0);
+  EXPECT_EQ(after.Latency(HashOp::kVerify).count
+            - before.Latency(HashOp::kVerify).count, 0);
+  EXPECT_EQ(after.Outcomes(VerifyStatus::kCancelled)
+            - before.Outcomes(VerifyStatus::kCancelled), 1);
+}
+
+TEST(MetricsTest, CountsFromManyThreads) {
+  if (not kMetricsEnabled) GTEST_SKIP() << "metrics are compiled out";
+  constexpr int kThreads = 4;
+  constexpr int kFailures = 1000;
+  const auto before = SnapshotMetrics();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([] {
+      for (int i = 0; i < kFailures; ++i)
+        DecodeBcrypt(BcryptArr{});
+    });
+  }
+  for (auto& thread : threads)
+    thread.join();
+  EXPECT_EQ(SnapshotMetrics().decode_failures - before.decode_failures,
+            kThreads * kFailures);
+}
+
+TEST(MetricsTest, PrometheusText) {
+  MetricsSnapshot snapshot;
+  snapshot.hashes[static_cast<std::size_t>(HashOp::kVerify)][10] = 42;
+  snapshot.verify_outcomes[static_cast<std::size_t>(VerifyStatus::kMismatch)]
+      = 3;
+  snapshot.decode_failures = 1;
+  snapshot.reused_verifications = 5;
+  auto& latency = snapshot.latency[static_cast<std::size_t>(HashOp::kVerify)];
+  latency.buckets[LatencyBucket(1000)] = 40;
+  latency.buckets[LatencyBucket(3000000)] = 2;
+  latency.count = 42;
+  latency.sum = std::chrono::milliseconds(6);
+
+  const auto text = PrometheusText(snapshot);
+  EXPECT_THAT(text, HasSubstr("# TYPE bcrypt_hashes_total counter\n"));
+  EXPECT_THAT(text, HasSubstr(
+      "bcrypt_hashes_total{op=\"verify\",cost=\"10\"} 42\n"));
+  EXPECT_THAT(text, Not(HasSubstr("op=\"generate\",cost=")));
+  EXPECT_THAT(text, HasSubstr(
+      "bcrypt_verifications_total{outcome=\"mismatch\"} 3\n"));
+  EXPECT_THAT(text, HasSubstr(
+      "bcrypt_verifications_total{outcome=\"match\"} 0\n"));
+  EXPECT_THAT(text, HasSubstr("bcrypt_decode_failures_total 1\n"));
+  EXPECT_THAT(text, HasSubstr("bcrypt_reused_verifications_total 5\n"));
+  EXPECT_THAT(text, HasSubstr("# TYPE bcrypt_hash_duration_seconds "
+                              "histogram\n"));
+  EXPECT_THAT(text, HasSubstr(
+      "bcrypt_hash_duration_seconds_bucket{op=\"verify\",le=\"1.024e-06\"} "
+      "40\n"));
+  EXPECT_THAT(text, HasSubstr(
+      "bcrypt_hash_duration_seconds_bucket{op=\"verify\",le=\"0.002097152\"} "
+      "40\n"));
+  EXPECT_THAT(text, HasSubstr(
+      "bcrypt_hash_duration_seconds_bucket{op=\"verify\",le=\"0.004194304\"} "
+      "42\n"));
+  EXPECT_THAT(text, HasSubstr(
+      "bcrypt_hash_duration_seconds_bucket{op=\"verify\",le=\"+Inf\"} 42\n"));
+  EXPECT_THAT(text, HasSubstr(
+      "bcrypt_hash_duration_seconds_sum{op=\"verify\"} 0.006\n"));
+  EXPECT_THAT(text, HasSubstr(
+      "bcrypt_hash_duration_seconds_count{op=\"generate\"} 0\n"));
+}
+
+} // namespace
+} // namespace bcrypt
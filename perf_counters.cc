@@ -0,0 +1,171 @@
+#include "perf_counters.h"
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace bcrypt {
+namespace {
+// Event type and config of each PerfEvent.
+struct EventConfig {
+  std::uint32_t type;
+  std::uint64_t config;
+};
+
+constexpr EventConfig kEventConfigs[kNumPerfEvents] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+         | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+int
+OpenEvent(const EventConfig& event, int group_fd) noexcept
+{
+  perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = event.type;
+  attr.config = event.config;
+  attr.disabled = group_fd < 0;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format =
+      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+// Returns the count of fd scaled to the time it was enabled, or nothing if it
+// never ran.
+std::optional<double>
+ReadEvent(int fd) noexcept
+{
+  std::uint64_t values[3];
+  if (read(fd, values, sizeof(values)) != sizeof(values) or values[2] == 0)
+    return std::nullopt;
+  return static_cast<double>(values[0]) * values[1] / values[2];
+}
+} // namespace
+
+std::string_view
+PerfEventName(PerfEvent event) noexcept
+{
+  switch (event) {
+    case PerfEvent::kCycles: return "cycles";
+    case PerfEvent::kInstructions: return "instructions";
+    case PerfEvent::kL1dMisses: return "L1D misses";
+    case PerfEvent::kBranchMisses: return "branch misses";
+  }
+  return "unknown";
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// PerfSample
+///////////////////////////////////////////////////////////////////////////////
+
+std::optional<double>
+PerfSample::Ipc() const noexcept
+{
+  const auto cycles = Count(PerfEvent::kCycles);
+  const auto instructions = Count(PerfEvent::kInstructions);
+  if (not cycles or not instructions or *cycles == 0) return std::nullopt;
+  return *instructions / *cycles;
+}
+
+PerfSample
+PerfSample::Per(double n) const noexcept
+{
+  PerfSample sample;
+  sample.time = std::chrono::nanoseconds(
+      static_cast<std::int64_t>(time.count() / n));
+  for (std::size_t i = 0; i < kNumPerfEvents; ++i) {
+    if (counts[i]) sample.counts[i] = *counts[i] / n;
+  }
+  return sample;
+}
+
+PerfSample
+PerfSample::operator-(const PerfSample& other) const noexcept
+{
+  PerfSample sample;
+  sample.time = time - other.time;
+  for (std::size_t i = 0; i < kNumPerfEvents; ++i) {
+    if (counts[i] and other.counts[i])
+      sample.counts[i] = *counts[i] - *other.counts[i];
+  }
+  return sample;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// PerfCounters
+///////////////////////////////////////////////////////////////////////////////
+
+PerfCounters::PerfCounters() noexcept
+{
+  fds_.fill(-1);
+  for (std::size_t i = 0; i < kNumPerfEvents; ++i) {
+    fds_[i] = OpenEvent(kEventConfigs[i], leader_);
+    if (fds_[i] < 0) {
+      if (errno_ == 0) errno_ = errno;
+      continue;
+    }
+    if (leader_ < 0) leader_ = fds_[i];
+  }
+}
+
+PerfCounters::~PerfCounters()
+{
+  for (const auto fd : fds_) {
+    if (fd >= 0) close(fd);
+  }
+}
+
+bool
+PerfCounters::Available() const noexcept
+{
+  return leader_ >= 0;
+}
+
+std::string
+PerfCounters::Error() const
+{
+  return errno_ ? std::strerror(errno_) : "";
+}
+
+void
+PerfCounters::Start() noexcept
+{
+  if (leader_ >= 0) {
+    ioctl(leader_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+  start_ = Clock::now();
+}
+
+PerfSample
+PerfCounters::Stop() noexcept
+{
+  PerfSample sample;
+  sample.time = Clock::now() - start_;
+  if (leader_ < 0) return sample;
+
+  ioctl(leader_, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+  for (std::size_t i = 0; i < kNumPerfEvents; ++i) {
+    if (fds_[i] >= 0) sample.counts[i] = ReadEvent(fds_[i]);
+  }
+  return sample;
+}
+
+} // namespace bcrypt
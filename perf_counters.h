@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace bcrypt {
+
+// Hardware events that PerfCounters counts.
+enum class PerfEvent {
+  kCycles,
+  kInstructions,
+  kL1dMisses,
+  kBranchMisses,
+};
+
+// Number of PerfEvent values.
+constexpr std::size_t kNumPerfEvents = 4;
+
+// Returns the name of the event, e.g. "cycles".
+std::string_view
+PerfEventName(PerfEvent event) noexcept;
+
+// Counts between PerfCounters::Start and Stop. Events that could not be
+// counted are unset. If the kernel had to multiplex the counters, the counts
+// are scaled to the whole interval.
+struct PerfSample {
+  std::chrono::nanoseconds time{0};
+  std::array<std::optional<double>, kNumPerfEvents> counts;
+
+  std::optional<double>
+  Count(PerfEvent event) const noexcept
+  {
+    return counts[static_cast<std::size_t>(event)];
+  }
+
+  // Returns instructions per cycle, if both were counted.
+  std::optional<double>
+  Ipc() const noexcept;
+
+  // Returns the sample with every count and the time divided by n, e.g. to
+  // get the counts of one iteration.
+  PerfSample
+  Per(double n) const noexcept;
+
+  // Returns the counts of this sample minus the counts of other. An event is
+  // only set if it is set in both.
+  PerfSample
+  operator-(const PerfSample& other) const noexcept;
+};
+
+// Counts hardware events of the calling thread in user space with
+// perf_event_open. Events the CPU, kernel or container do not expose are
+// left out, so the counters can always be used: without any, a sample only
+// has the time.
+class PerfCounters {
+public:
+  PerfCounters() noexcept;
+
+  ~PerfCounters();
+
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  // Returns true if the event can be counted.
+  bool
+  Has(PerfEvent event) const noexcept
+  {
+    return fds_[static_cast<std::size_t>(event)] >= 0;
+  }
+
+  // Returns true if any event can be counted.
+  bool
+  Available() const noexcept;
+
+  // Returns why events cannot be counted, e.g. "No such file or directory",
+  // or an empty string if they all can.
+  std::string
+  Error() const;
+
+  // Resets and starts the counters.
+  void
+  Start() noexcept;
+
+  // Stops the counters and returns the counts since Start.
+  PerfSample
+  Stop() noexcept;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  // The file descriptor of each event, or -1 if it cannot be counted. The
+  // first open one leads the group, so that the events are counted over the
+  // same cycles.
+  std::array<int, kNumPerfEvents> fds_;
+  int leader_ = -1;
+  // The errno of the first event that could not be opened, or 0.
+  int errno_ = 0;
+  Clock::time_point start_;
+};
+
+} // namespace bcrypt
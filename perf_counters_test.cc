@@ -0,0 +1,51 @@
+#include "perf_counters.h"
+
+#include <chrono>
+#include <cstdint>
+
+#include "gmock/gmock.h"
+
+namespace bcrypt {
+namespace {
+
+TEST(PerfCountersTest, SampleHasTimeWithOrWithoutCounters) {
+  PerfCounters counters;
+  counters.Start();
+  volatile std::uint64_t x = 0;
+  for (int i = 0; i < 100000; ++i) x = x + i;
+  const auto sample = counters.Stop();
+
+  EXPECT_GT(sample.time, std::chrono::nanoseconds(0));
+  for (std::size_t i = 0; i < kNumPerfEvents; ++i) {
+    const auto event = static_cast<PerfEvent>(i);
+    if (not counters.Has(event))
+      EXPECT_FALSE(sample.Count(event)) << PerfEventName(event);
+  }
+  if (counters.Has(PerfEvent::kInstructions))
+    EXPECT_GT(*sample.Count(PerfEvent::kInstructions), 100000);
+  bool any = false;
+  for (std::size_t i = 0; i < kNumPerfEvents; ++i)
+    any = any or counters.Has(static_cast<PerfEvent>(i));
+  EXPECT_EQ(counters.Available(), any);
+  if (not counters.Available()) EXPECT_FALSE(counters.Error().empty());
+}
+
+TEST(PerfSampleTest, PerAndDifference) {
+  PerfSample a;
+  a.time = std::chrono::nanoseconds(1000);
+  a.counts[static_cast<std::size_t>(PerfEvent::kCycles)] = 400;
+  a.counts[static_cast<std::size_t>(PerfEvent::kInstructions)] = 800;
+  PerfSample b;
+  b.time = std::chrono::nanoseconds(200);
+  b.counts[static_cast<std::size_t>(PerfEvent::kCycles)] = 100;
+
+  const auto diff = (a - b).Per(10);
+  EXPECT_EQ(diff.time, std::chrono::nanoseconds(80));
+  EXPECT_DOUBLE_EQ(*diff.Count(PerfEvent::kCycles), 30);
+  EXPECT_FALSE(diff.Count(PerfEvent::kInstructions));
+  EXPECT_DOUBLE_EQ(*a.Ipc(), 2);
+  EXPECT_FALSE(b.Ipc());
+}
+
+} // namespace
+} // namespace bcrypt
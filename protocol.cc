@@ -0,0 +1,176 @@
+#include "protocol.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "bcrypt.h"
+
+namespace bcrypt {
+namespace {
+
+// The size field, id and op/status of a frame.
+constexpr std::size_t kFrameHeaderSize = 9;
+
+void
+AppendU32(std::uint32_t n, std::string* out)
+{
+  for (int shift = 0; shift < 32; shift += 8)
+    out->push_back(static_cast<char>((n >> shift) & 0xff));
+}
+
+std::uint32_t
+ReadU32(std::string_view data) noexcept
+{
+  std::uint32_t n = 0;
+  for (int i = 3; i >= 0; --i)
+    n = (n << 8) | static_cast<std::uint8_t>(data[i]);
+  return n;
+}
+
+// Appends the header of a frame with a body of body_size bytes.
+void
+AppendHeader(
+    std::uint32_t id,
+    std::uint8_t code,
+    std::size_t body_size,
+    std::string* out)
+{
+  if (kFrameHeaderSize + body_size > kMaxFrameSize)
+    throw std::invalid_argument("The message is too large for a frame.");
+  AppendU32(static_cast<std::uint32_t>(kFrameHeaderSize - 4 + body_size), out);
+  AppendU32(id, out);
+  out->push_back(static_cast<char>(code));
+}
+
+// Returns the size of the frame at the start of data, or 0 if it is not all
+// there yet. Throws std::invalid_argument if the size is out of range.
+std::size_t
+FrameSize(std::string_view data)
+{
+  if (data.size() < 4) return 0;
+  const std::size_t size = ReadU32(data) + std::size_t{4};
+  if (size < kFrameHeaderSize or size > kMaxFrameSize)
+    throw std::invalid_argument("The frame size is out of range.");
+  return data.size() < size ? 0 : size;
+}
+
+} // namespace
+
+void
+AppendRequest(const Request& request, std::string* out)
+{
+  switch (request.op) {
+    case Op::kGenerate:
+      AppendHeader(request.id, static_cast<std::uint8_t>(request.op),
+                   1 + request.pwd.size(), out);
+      out->push_back(static_cast<char>(request.rounds));
+      *out += request.pwd;
+      return;
+    case Op::kVerify:
+      AppendHeader(request.id, static_cast<std::uint8_t>(request.op),
+                   request.arr.size() + request.pwd.size(), out);
+      out->append(request.arr.begin(), request.arr.end());
+      *out += request.pwd;
+      return;
+    case Op::kStats:
+      AppendHeader(request.id, static_cast<std::uint8_t>(request.op), 0, out);
+      return;
+  }
+  throw std::invalid_argument("Unknown op.");
+}
+
+void
+AppendResponse(const Response& response, std::string* out)
+{
+  AppendHeader(response.id, static_cast<std::uint8_t>(response.status),
+               response.body.size(), out);
+  *out += response.body;
+}
+
+std::size_t
+ParseRequest(std::string_view data, Request* request)
+{
+  const auto size = FrameSize(data);
+  if (size == 0) return 0;
+  request->id = ReadU32(data.substr(4));
+  request->op = static_cast<Op>(data[8]);
+  auto body = data.substr(kFrameHeaderSize, size - kFrameHeaderSize);
+  switch (request->op) {
+    case Op::kGenerate:
+      if (body.empty())
+        throw std::invalid_argument("A generate request has no rounds.");
+      request->rounds = static_cast<std::uint8_t>(body[0]);
+      body.remove_prefix(1);
+      break;
+    case Op::kVerify:
+      if (body.size() < request->arr.size())
+        throw std::invalid_argument("A verify request has no hash.");
+      std::copy_n(body.begin(), request->arr.size(), request->arr.begin());
+      body.remove_prefix(request->arr.size());
+      break;
+    case Op::kStats:
+      if (not body.empty())
+        throw std::invalid_argument("A stats request has a body.");
+      break;
+    default:
+      throw std::invalid_argument("Unknown op.");
+  }
+  request->pwd.assign(body);
+  return size;
+}
+
+std::size_t
+ParseResponse(std::string_view data, Response* response)
+{
+  const auto size = FrameSize(data);
+  if (size == 0) return 0;
+  response->id = ReadU32(data.substr(4));
+  const auto status = static_cast<std::uint8_t>(data[8]);
+  if (status > static_cast<std::uint8_t>(Status::kBadRequest))
+    throw std::invalid_argument("Unknown status.");
+  response->status = static_cast<Status>(status);
+  response->body.assign(data.substr(kFrameHeaderSize, size - kFrameHeaderSize));
+  return size;
+}
+
+Status
+ToStatus(VerifyStatus status) noexcept
+{
+  switch (status) {
+    case VerifyStatus::kMatch:
+      return Status::kMatch;
+    case VerifyStatus::kMismatch:
+      return Status::kMismatch;
+    case VerifyStatus::kInvalidHash:
+      return Status::kInvalidHash;
+    case VerifyStatus::kOverloaded:
+    case VerifyStatus::kCancelled:
+      break;
+  }
+  return Status::kOverloaded;
+}
+
+VerifyStatus
+ToVerifyStatus(Status status)
+{
+  switch (status) {
+    case Status::kMatch:
+      return VerifyStatus::kMatch;
+    case Status::kMismatch:
+      return VerifyStatus::kMismatch;
+    case Status::kInvalidHash:
+      return VerifyStatus::kInvalidHash;
+    case Status::kOverloaded:
+      return VerifyStatus::kOverloaded;
+    case Status::kOk:
+    case Status::kBadRequest:
+      break;
+  }
+  throw std::invalid_argument("The status is not one of a verification.");
+}
+
+} // namespace bcrypt
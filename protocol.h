@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "bcrypt.h"
+
+namespace bcrypt {
+
+// The binary protocol of bcryptd. Each message is a frame:
+//
+//   u32 size       Number of bytes after this field.
+//   u32 id         Chosen by the client, and copied to the response.
+//   u8  op/status  Op of a request, Status of a response.
+//   ...            The body, which takes the rest of the frame.
+//
+// Integers are little endian. The bodies are
+//
+//   kGenerate request   u8 rounds, then the password.
+//   kVerify request     The 60 bytes of the BcryptArr, then the password.
+//   kStats request      Empty.
+//   Response            The BcryptArr of a generated hash, the text of the
+//                       stats, or empty.
+//
+// A client may send any number of requests without waiting for their
+// responses, which can come back in any order.
+
+enum class Op : std::uint8_t {
+  kGenerate = 1,
+  kVerify = 2,
+  kStats = 3,
+};
+
+enum class Status : std::uint8_t {
+  kOk = 0,
+  kMatch = 1,
+  kMismatch = 2,
+  kInvalidHash = 3,
+  kOverloaded = 4,
+  // The request was well formed, but e.g. the password was empty or the
+  // rounds were not in the range [4, 31].
+  kBadRequest = 5,
+};
+
+// Frames cannot be larger than this, including the size field. Responses to
+// kStats are the largest frames.
+constexpr std::size_t kMaxFrameSize = 1 << 16;
+
+struct Request {
+  std::uint32_t id = 0;
+  Op op = Op::kStats;
+  // Set for kGenerate.
+  std::uint32_t rounds = 0;
+  // Set for kVerify.
+  BcryptArr arr{};
+  std::string pwd;
+};
+
+struct Response {
+  std::uint32_t id = 0;
+  Status status = Status::kOk;
+  std::string body;
+};
+
+// Appends the frame of the message to out. Throws std::invalid_argument if
+// it would be larger than kMaxFrameSize.
+void
+AppendRequest(const Request& request, std::string* out);
+
+void
+AppendResponse(const Response& response, std::string* out);
+
+// Parses the frame at the start of data. Returns the size of the frame, or 0
+// if data does not hold all of it yet. Throws std::invalid_argument if the
+// frame is malformed, after which the stream cannot be parsed any further.
+std::size_t
+ParseRequest(std::string_view data, Request* request);
+
+std::size_t
+ParseResponse(std::string_view data, Response* response);
+
+// Maps between the verification statuses of the library and the protocol. A
+// cancelled verification is reported as overloaded, since the hash was not
+// checked and the client may try again.
+Status
+ToStatus(VerifyStatus status) noexcept;
+
+// Throws std::invalid_argument if the status is not one of a verification.
+VerifyStatus
+ToVerifyStatus(Status status);
+
+} // namespace bcrypt
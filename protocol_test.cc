@@ -0,0 +1,148 @@
+#include "protocol.h"
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "gmock/gmock.h"
+
+#include "bcrypt.h"
+
+namespace bcrypt {
+namespace {
+
+BcryptArr
+TestArr()
+{
+  const std::string_view hash =
+      "$2b$04$abcdefghijklmnopqrstuu0123456789012345678901234567890";
+  BcryptArr arr{};
+  std::copy(hash.begin(), hash.end(), arr.begin());
+  return arr;
+}
+
+TEST(ProtocolTest, RequestsRoundTrip) {
+  Request generate;
+  generate.id = 7;
+  generate.op = Op::kGenerate;
+  generate.rounds = 12;
+  generate.pwd = "password";
+  Request verify;
+  verify.id = 0xfffffffe;
+  verify.op = Op::kVerify;
+  verify.arr = TestArr();
+  verify.pwd = std::string("pass\0word", 9);
+  Request stats;
+  stats.id = 9;
+  stats.op = Op::kStats;
+
+  std::string data;
+  AppendRequest(generate, &data);
+  AppendRequest(verify, &data);
+  AppendRequest(stats, &data);
+  EXPECT_EQ(data.size(), 3 * 9 + 1 + 8 + 60 + 9);
+
+  std::string_view rest = data;
+  Request request;
+  auto size = ParseRequest(rest, &request);
+  EXPECT_EQ(size, 9 + 1 + 8);
+  EXPECT_EQ(request.id, 7);
+  EXPECT_EQ(request.op, Op::kGenerate);
+  EXPECT_EQ(request.rounds, 12);
+  EXPECT_EQ(request.pwd, "password");
+
+  rest.remove_prefix(size);
+  size = ParseRequest(rest, &request);
+  EXPECT_EQ(size, 9 + 60 + 9);
+  EXPECT_EQ(request.id, 0xfffffffe);
+  EXPECT_EQ(request.op, Op::kVerify);
+  EXPECT_EQ(request.arr, TestArr());
+  EXPECT_EQ(request.pwd, verify.pwd);
+
+  rest.remove_prefix(size);
+  size = ParseRequest(rest, &request);
+  EXPECT_EQ(size, rest.size());
+  EXPECT_EQ(request.id, 9);
+  EXPECT_EQ(request.op, Op::kStats);
+  EXPECT_EQ(request.pwd, "");
+}
+
+TEST(ProtocolTest, FramesAreLittleEndian) {
+  Request request;
+  request.id = 0x04030201;
+  request.op = Op::kStats;
+  std::string data;
+  AppendRequest(request, &data);
+  EXPECT_EQ(data, std::string_view("\x05\0\0\0\x01\x02\x03\x04\x03", 9));
+}
+
+TEST(ProtocolTest, ResponsesRoundTrip) {
+  std::string data;
+  AppendResponse({3, Status::kMismatch, {}}, &data);
+  AppendResponse({4, Status::kOk, "body"}, &data);
+
+  Response response;
+  const auto size = ParseResponse(data, &response);
+  EXPECT_EQ(size, 9);
+  EXPECT_EQ(response.id, 3);
+  EXPECT_EQ(response.status, Status::kMismatch);
+  EXPECT_EQ(response.body, "");
+  EXPECT_EQ(ParseResponse(std::string_view(data).substr(size), &response), 13);
+  EXPECT_EQ(response.id, 4);
+  EXPECT_EQ(response.status, Status::kOk);
+  EXPECT_EQ(response.body, "body");
+}
+
+TEST(ProtocolTest, PartialFramesNeedMoreData) {
+  Request request;
+  request.op = Op::kGenerate;
+  request.rounds = 10;
+  request.pwd = "password";
+  std::string data;
+  AppendRequest(request, &data);
+  for (std::size_t n = 0; n < data.size(); ++n)
+    EXPECT_EQ(ParseRequest(std::string_view(data).substr(0, n), &request), 0);
+  EXPECT_EQ(ParseRequest(data, &request), data.size());
+}
+
+TEST(ProtocolTest, MalformedFramesThrow) {
+  Request request;
+  // Sizes too small for the header, or larger than kMaxFrameSize.
+  EXPECT_THROW(ParseRequest(std::string_view("\x04\0\0\0\0\0\0\0", 8),
+                            &request), std::invalid_argument);
+  EXPECT_THROW(ParseRequest(std::string_view("\xff\xff\0\0", 4), &request),
+               std::invalid_argument);
+  // An unknown op, a generate request without rounds, a verify request
+  // without a hash and a stats request with a body.
+  EXPECT_THROW(ParseRequest(std::string_view("\x05\0\0\0\0\0\0\0\x09", 9),
+                            &request), std::invalid_argument);
+  EXPECT_THROW(ParseRequest(std::string_view("\x05\0\0\0\0\0\0\0\x01", 9),
+                            &request), std::invalid_argument);
+  EXPECT_THROW(ParseRequest(std::string_view("\x06\0\0\0\0\0\0\0\x02x", 10),
+                            &request), std::invalid_argument);
+  EXPECT_THROW(ParseRequest(std::string_view("\x06\0\0\0\0\0\0\0\x03x", 10),
+                            &request), std::invalid_argument);
+
+  Response response;
+  EXPECT_THROW(ParseResponse(std::string_view("\x05\0\0\0\0\0\0\0\x06", 9),
+                             &response), std::invalid_argument);
+
+  request.op = Op::kVerify;
+  request.pwd.assign(kMaxFrameSize, 'x');
+  std::string data;
+  EXPECT_THROW(AppendRequest(request, &data), std::invalid_argument);
+}
+
+TEST(ProtocolTest, VerifyStatuses) {
+  for (const auto status : {VerifyStatus::kMatch, VerifyStatus::kMismatch,
+                            VerifyStatus::kInvalidHash,
+                            VerifyStatus::kOverloaded})
+    EXPECT_EQ(ToVerifyStatus(ToStatus(status)), status);
+  EXPECT_EQ(ToStatus(VerifyStatus::kCancelled), Status::kOverloaded);
+  EXPECT_THROW(ToVerifyStatus(Status::kOk), std::invalid_argument);
+  EXPECT_THROW(ToVerifyStatus(Status::kBadRequest), std::invalid_argument);
+}
+
+} // namespace
+} // namespace bcrypt
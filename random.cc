@@ -0,0 +1,171 @@
+#include "random.h"
+
+#include <pthread.h>
+#include <sys/random.h>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <span>
+
+#include "bcrypt.h"
+
+namespace bcrypt {
+namespace {
+// Number of bytes in a ChaCha20 block.
+constexpr std::size_t kBlockSize = 64;
+
+// Number of blocks a generator produces before it draws a new key. Each
+// block also overwrites the key, see Generator::Refill.
+constexpr std::uint32_t kBlocksPerSeed = 1 << 20;
+
+// Incremented in the child after a fork, so that the generators of the
+// parent's threads, which the child inherits, are seeded again instead of
+// repeating the parent's output.
+std::atomic<std::uint64_t> fork_generation = 0;
+
+void
+OnFork() noexcept
+{
+  fork_generation.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline void
+QuarterRound(std::uint32_t* x, int a, int b, int c, int d) noexcept
+{
+  x[a] += x[b]; x[d] = std::rotl(x[d] ^ x[a], 16);
+  x[c] += x[d]; x[b] = std::rotl(x[b] ^ x[c], 12);
+  x[a] += x[b]; x[d] = std::rotl(x[d] ^ x[a], 8);
+  x[c] += x[d]; x[b] = std::rotl(x[b] ^ x[c], 7);
+}
+
+// Fills out from getrandom, which blocks only until the kernel's pool is
+// initialized at boot.
+void
+Seed(std::span<std::uint8_t> out) noexcept
+{
+  while (not out.empty()) {
+    const auto n = getrandom(out.data(), out.size(), 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      std::abort();
+    }
+    out = out.subspan(n);
+  }
+}
+
+// A ChaCha20 generator with fast key erasure: the first 32 bytes of every
+// block become the next key and are never output, so the state of a thread
+// does not reveal the salts it made before.
+class Generator {
+public:
+  void
+  Fill(std::span<std::uint8_t> out) noexcept
+  {
+    // After a fork, the rest of the block is also the parent's.
+    const auto generation = fork_generation.load(std::memory_order_relaxed);
+    if (generation != generation_) {
+      Seed({reinterpret_cast<std::uint8_t*>(key_.data()), sizeof(key_)});
+      generation_ = generation;
+      blocks_ = 0;
+      pos_ = kBlockSize;
+    }
+    while (not out.empty()) {
+      if (pos_ == kBlockSize) Refill();
+      const auto n = std::min(out.size(), kBlockSize - pos_);
+      std::copy_n(block_ + pos_, n, out.begin());
+      std::fill_n(block_ + pos_, n, 0);
+      pos_ += n;
+      out = out.subspan(n);
+    }
+  }
+
+private:
+  void
+  Refill() noexcept
+  {
+    if (not seeded_ or blocks_ >= kBlocksPerSeed) {
+      Seed({reinterpret_cast<std::uint8_t*>(key_.data()), sizeof(key_)});
+      seeded_ = true;
+      blocks_ = 0;
+    }
+    ChaCha20Block(key_, blocks_++, {}, block_);
+    std::memcpy(key_.data(), block_, sizeof(key_));
+    std::fill_n(block_, sizeof(key_), 0);
+    pos_ = sizeof(key_);
+  }
+
+  ChaChaKey key_{};
+  std::uint8_t block_[kBlockSize] = {};
+  std::size_t pos_ = kBlockSize;
+  bool seeded_ = false;
+  std::uint32_t blocks_ = 0;
+  std::uint64_t generation_ = 0;
+};
+
+thread_local Generator generator;
+} // namespace
+
+void
+ChaCha20Block(
+    const ChaChaKey& key,
+    std::uint32_t counter,
+    const ChaChaNonce& nonce,
+    std::uint8_t* out) noexcept
+{
+  std::uint32_t state[16] = {
+      0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+      key[0], key[1], key[2], key[3], key[4], key[5], key[6], key[7],
+      counter, nonce[0], nonce[1], nonce[2]};
+  std::uint32_t x[16];
+  std::copy_n(state, 16, x);
+  for (int i = 0; i < 10; ++i) {
+    QuarterRound(x, 0, 4, 8, 12);
+    QuarterRound(x, 1, 5, 9, 13);
+    QuarterRound(x, 2, 6, 10, 14);
+    QuarterRound(x, 3, 7, 11, 15);
+    QuarterRound(x, 0, 5, 10, 15);
+    QuarterRound(x, 1, 6, 11, 12);
+    QuarterRound(x, 2, 7, 8, 13);
+    QuarterRound(x, 3, 4, 9, 14);
+  }
+  for (int i = 0; i < 16; ++i) {
+    const auto word = x[i] + state[i];
+    for (int b = 0; b < 4; ++b)
+      out[4*i + b] = static_cast<std::uint8_t>(word >> (8 * b));
+  }
+
+  // Clear memory.
+  std::fill_n(x, 16, 0);
+  std::fill_n(state, 16, 0);
+}
+
+void
+RandomBytes(std::span<std::uint8_t> out) noexcept
+{
+  static std::once_flag at_fork;
+  std::call_once(at_fork, [] { pthread_atfork(nullptr, nullptr, OnFork); });
+  generator.Fill(out);
+}
+
+Salt
+RandomSalt() noexcept
+{
+  Salt salt;
+  RandomBytes(salt);
+  return salt;
+}
+
+void
+RandomSalts(std::span<Salt> out) noexcept
+{
+  RandomBytes({reinterpret_cast<std::uint8_t*>(out.data()), out.size_bytes()});
+}
+
+} // namespace bcrypt
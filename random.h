@@ -0,0 +1,41 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <span>
+
+#include "bcrypt.h"
+
+namespace bcrypt {
+
+// 256-bit ChaCha20 key.
+using ChaChaKey = std::array<std::uint32_t, 8>;
+
+// 96-bit ChaCha20 nonce.
+using ChaChaNonce = std::array<std::uint32_t, 3>;
+
+// Writes the 64 byte ChaCha20 block for the key, block counter and nonce to
+// out, as in RFC 8439.
+void
+ChaCha20Block(
+    const ChaChaKey& key,
+    std::uint32_t counter,
+    const ChaChaNonce& nonce,
+    std::uint8_t* out) noexcept;
+
+// Fills out with cryptographically secure random bytes. Every thread has its
+// own ChaCha20 generator, seeded from getrandom on first use and again in
+// the child after a fork, so calls from any number of threads neither lock
+// nor race. Aborts if the kernel cannot provide a seed.
+void
+RandomBytes(std::span<std::uint8_t> out) noexcept;
+
+// Returns a random salt from RandomBytes.
+Salt
+RandomSalt() noexcept;
+
+// Fills out with random salts from RandomBytes.
+void
+RandomSalts(std::span<Salt> out) noexcept;
+
+} // namespace bcrypt
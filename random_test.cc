@@ -0,0 +1,115 @@
+#include "random.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <future>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "bcrypt.h"
+#include "gmock/gmock.h"
+
+namespace bcrypt {
+namespace {
+
+TEST(ChaCha20BlockTest, MatchesRfc8439) {
+  // Test vector of section 2.3.2.
+  ChaChaKey key;
+  for (int i = 0; i < 8; ++i) {
+    const auto b = 4 * i;
+    key[i] = b | (b + 1) << 8 | (b + 2) << 16 | (b + 3) << 24;
+  }
+  const ChaChaNonce nonce = {0x09000000, 0x4a000000, 0x00000000};
+  std::uint8_t block[64];
+  ChaCha20Block(key, 1, nonce, block);
+
+  const std::uint8_t expected[] = {
+      0x10, 0xf1, 0xe7, 0xe4, 0xd1, 0x3b, 0x59, 0x15,
+      0x50, 0x0f, 0xdd, 0x1f, 0xa3, 0x20, 0x71, 0xc4,
+      0xc7, 0xd1, 0xf4, 0xc7, 0x33, 0xc0, 0x68, 0x03,
+      0x04, 0x22, 0xaa, 0x9a, 0xc3, 0xd4, 0x6c, 0x4e,
+      0xd2, 0x82, 0x64, 0x46, 0x07, 0x9f, 0xaa, 0x09,
+      0x14, 0xc2, 0xd7, 0x05, 0xd9, 0x8b, 0x02, 0xa2,
+      0xb5, 0x12, 0x9c, 0xd1, 0xde, 0x16, 0x4e, 0xb9,
+      0xcb, 0xd0, 0x83, 0xe8, 0xa2, 0x50, 0x3c, 0x4e};
+  EXPECT_THAT(block, testing::ElementsAreArray(expected));
+}
+
+TEST(RandomSaltsTest, AreDistinct) {
+  std::vector<Salt> salts(1000);
+  RandomSalts(salts);
+  salts.push_back(RandomSalt());
+  std::sort(salts.begin(), salts.end());
+  EXPECT_EQ(std::adjacent_find(salts.begin(), salts.end()), salts.end());
+}
+
+TEST(RandomSaltsTest, ForkedChildDoesNotRepeatParent) {
+  RandomSalt();
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  const auto pid = fork();
+  if (pid == 0) {
+    const auto salt = RandomSalt();
+    _exit(write(fds[1], salt.data(), salt.size()) == salt.size() ? 0 : 1);
+  }
+  const auto salt = RandomSalt();
+  Salt child_salt;
+  ASSERT_EQ(read(fds[0], child_salt.data(), child_salt.size()),
+            child_salt.size());
+  waitpid(pid, nullptr, 0);
+  close(fds[0]);
+  close(fds[1]);
+  EXPECT_NE(salt, child_salt);
+}
+
+// Shares one PwdHasher between threads, as the servers do. Run under
+// ThreadSanitizer (BCRYPT_TSAN=ON) to check that nothing races.
+TEST(PwdHasherStressTest, SharedHasherMakesDistinctSalts) {
+  constexpr int kThreads = 8;
+  constexpr int kSaltsPerThread = 2000;
+  const PwdHasher pwd_hasher;
+
+  std::vector<std::future<std::vector<Salt>>> results;
+  for (int t = 0; t < kThreads; ++t) {
+    results.push_back(std::async(std::launch::async, [&, t] {
+      std::vector<Salt> salts(kSaltsPerThread);
+      if (t % 2) {
+        pwd_hasher.GenSalts(salts);
+      } else {
+        for (auto& salt : salts) salt = pwd_hasher.GenSalt();
+      }
+      return salts;
+    }));
+  }
+
+  std::set<Salt> all;
+  for (auto& result : results) {
+    for (const auto& salt : result.get())
+      all.insert(salt);
+  }
+  EXPECT_EQ(all.size(), kThreads * kSaltsPerThread);
+}
+
+TEST(PwdHasherStressTest, SharedHasherGeneratesFromManyThreads) {
+  const PwdHasher pwd_hasher;
+  std::vector<std::future<bool>> results;
+  for (int t = 0; t < 4; ++t) {
+    results.push_back(std::async(std::launch::async, [&] {
+      bool ok = true;
+      for (int i = 0; i < 5; ++i) {
+        const auto arr = pwd_hasher.Generate("password", 4);
+        ok &= pwd_hasher.IsSamePwd("password", arr);
+      }
+      return ok;
+    }));
+  }
+  for (auto& result : results)
+    EXPECT_TRUE(result.get());
+}
+
+} // namespace
+} // namespace bcrypt
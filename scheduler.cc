@@ -0,0 +1,169 @@
+#include "scheduler.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+namespace bcrypt {
+namespace {
+// The scheduler and queue of the worker running on this thread, if any.
+thread_local const Scheduler* tls_scheduler = nullptr;
+thread_local std::size_t tls_worker = 0;
+// The queue the worker last tried to steal from.
+thread_local std::size_t tls_victim = 0;
+
+// The smallest cost a job can have, so that every job advances virtual time.
+constexpr double kMinCost = 1e-3;
+} // namespace
+
+Scheduler::Scheduler(std::size_t num_threads)
+{
+  if (num_threads == 0)
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  for (std::size_t i = 0; i < num_threads; ++i)
+    queues_.push_back(std::make_unique<Queue>());
+  workers_.reserve(num_threads);
+  for (std::size_t i = 0; i < num_threads; ++i)
+    workers_.emplace_back([this, i] { Work(i); });
+}
+
+Scheduler::~Scheduler()
+{
+  {
+    std::lock_guard lock(idle_mutex_);
+    stop_ = true;
+  }
+  cond_.notify_all();
+  for (auto& worker : workers_)
+    worker.join();
+}
+
+void
+Scheduler::SetTenantWeight(TenantId tenant, double weight)
+{
+  if (not (weight > 0))
+    throw std::invalid_argument("weight should be positive.");
+  std::lock_guard lock(tenants_mutex_);
+  tenants_[tenant].weight = weight;
+}
+
+void
+Scheduler::Submit(std::function<void()> task)
+{
+  Submit(std::move(task), JobSpec());
+}
+
+void
+Scheduler::SubmitWithCost(std::function<void()> task, double cost)
+{
+  Submit(std::move(task), {.cost = cost});
+}
+
+void
+Scheduler::Submit(std::function<void()> task, const JobSpec& spec)
+{
+  const auto cls = static_cast<std::size_t>(spec.priority);
+  Job job{{spec.priority}, spec.tenant, std::max(spec.cost, kMinCost),
+          std::move(task)};
+  {
+    std::lock_guard lock(tenants_mutex_);
+    auto& tenant = tenants_[spec.tenant];
+    job.key.start = std::max(vtime_[cls], tenant.finish[cls]);
+    job.key.seq = seq_++;
+    tenant.finish[cls] = job.key.start + job.cost / tenant.weight;
+  }
+
+  // Workers keep what they submit, everyone else spreads jobs round robin.
+  const auto worker = tls_scheduler == this
+      ? tls_worker : next_queue_++ % queues_.size();
+  // Counted before it is queued, so pending_ never drops below the number of
+  // queued jobs.
+  ++pending_;
+  ++waiting_[cls];
+  {
+    auto& queue = *queues_[worker];
+    std::lock_guard lock(queue.mutex);
+    queue.jobs.insert(std::move(job));
+  }
+
+  {
+    std::lock_guard lock(idle_mutex_);
+  }
+  cond_.notify_one();
+}
+
+double
+Scheduler::CompletedCost(TenantId tenant) const
+{
+  std::lock_guard lock(tenants_mutex_);
+  const auto it = tenants_.find(tenant);
+  return it == tenants_.end() ? 0 : it->second.completed;
+}
+
+bool
+Scheduler::Pop(std::size_t worker, Job* job)
+{
+  // Classes are tried from the highest, so a worker never runs its own
+  // lower-class jobs while another queue holds a higher-class one. Victims
+  // are tried from the one after the last, so steals are spread over the
+  // queues. A job that is counted but not queued yet may be missed, in which
+  // case the next class is tried.
+  auto found = false;
+  for (std::size_t cls = 0; cls < kNumPriorities and not found; ++cls) {
+    if (waiting_[cls] == 0) continue;
+    found = Take(worker, cls, job);
+    for (std::size_t n = 0; n < queues_.size() and not found; ++n) {
+      tls_victim = (tls_victim + 1) % queues_.size();
+      found = tls_victim != worker and Take(tls_victim, cls, job);
+    }
+  }
+  if (not found) return false;
+  --pending_;
+  --waiting_[static_cast<std::size_t>(job->key.priority)];
+
+  std::lock_guard lock(tenants_mutex_);
+  auto& vtime = vtime_[static_cast<std::size_t>(job->key.priority)];
+  vtime = std::max(vtime, job->key.start);
+  return true;
+}
+
+bool
+Scheduler::Take(std::size_t queue, std::size_t cls, Job* job)
+{
+  auto& q = *queues_[queue];
+  std::unique_lock lock(q.mutex);
+  if (q.jobs.empty()
+      or static_cast<std::size_t>(q.jobs.begin()->key.priority) > cls)
+    return false;
+  auto node = q.jobs.extract(q.jobs.begin());
+  lock.unlock();
+  *job = std::move(node.value());
+  return true;
+}
+
+void
+Scheduler::Work(std::size_t worker)
+{
+  tls_scheduler = this;
+  tls_worker = worker;
+  for (;;) {
+    Job job;
+    if (Pop(worker, &job)) {
+      job.task();
+      std::lock_guard lock(tenants_mutex_);
+      tenants_[job.tenant].completed += job.cost;
+      continue;
+    }
+    std::unique_lock lock(idle_mutex_);
+    cond_.wait(lock, [this] { return stop_ or pending_ > 0; });
+    if (stop_ and pending_ == 0) return;
+  }
+}
+
+} // namespace bcrypt
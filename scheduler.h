@@ -0,0 +1,190 @@
+#pragma once
+
+#include <atomic>
+#include <compare>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "thread_pool.h"
+
+namespace bcrypt {
+
+// Priority classes of the Scheduler. A job only runs when no job of a higher
+// class is waiting.
+enum class Priority : std::uint8_t {
+  // E.g. logins that a user is waiting on.
+  kInteractive,
+  kNormal,
+  // E.g. rehash migrations and bulk provisioning.
+  kBackground,
+};
+
+// Number of priority classes.
+constexpr std::size_t kNumPriorities = 3;
+
+using TenantId = std::uint32_t;
+
+// How a job is scheduled.
+struct JobSpec {
+  Priority priority = Priority::kNormal;
+  TenantId tenant = 0;
+  // Estimate of the work in the job, in HashCost units.
+  double cost = 1;
+};
+
+// A work-stealing executor for hashing jobs with priority classes and weighted
+// fair sharing between tenants.
+//
+// Within a priority class, jobs are ordered by start-time fair queuing: each
+// job gets a virtual start time, and a tenant's virtual time advances by the
+// job's cost over the tenant's weight. A tenant with weight 2 thus gets twice
+// the CPU of a tenant with weight 1 when both are backlogged, and a cost-12
+// job counts for more than a cost-10 one. Every worker has its own queue and
+// takes its best job, unless another queue holds a job of a higher class, in
+// which case it steals that job; an idle worker steals the best job of
+// another queue, trying the others round robin. Priority classes are thus
+// honored across all queues, while the fair queuing order is exact within a
+// queue and approximate across queues.
+class Scheduler : public Executor {
+public:
+  // Starts num_threads workers, or one per core if num_threads is 0.
+  explicit Scheduler(std::size_t num_threads = 0);
+
+  // Runs the jobs that are still queued, then joins the workers.
+  ~Scheduler() override;
+
+  Scheduler(const Scheduler&) = delete;
+  Scheduler& operator=(const Scheduler&) = delete;
+
+  // Returns the number of workers.
+  std::size_t
+  Size() const noexcept { return workers_.size(); }
+
+  std::size_t
+  Concurrency() const noexcept override { return Size(); }
+
+  // Sets the share of the tenant relative to the others. The default weight
+  // is 1. Throws std::invalid_argument if weight is not positive.
+  void
+  SetTenantWeight(TenantId tenant, double weight);
+
+  // Submits the task with the default JobSpec.
+  void
+  Submit(std::function<void()> task) override;
+
+  // Submits the task with the default JobSpec and the given cost.
+  void
+  SubmitWithCost(std::function<void()> task, double cost) override;
+
+  void
+  Submit(std::function<void()> task, const JobSpec& spec);
+
+  // Returns the total cost of the tenant's jobs that have run.
+  double
+  CompletedCost(TenantId tenant) const;
+
+private:
+  // Jobs run in the order of their keys: by priority class, then by virtual
+  // start time, then in the order they were submitted.
+  struct JobKey {
+    Priority priority = Priority::kNormal;
+    double start = 0;
+    std::uint64_t seq = 0;
+
+    auto operator<=>(const JobKey&) const = default;
+  };
+
+  struct Job {
+    JobKey key;
+    TenantId tenant = 0;
+    double cost = 0;
+    std::function<void()> task;
+
+    bool
+    operator<(const Job& other) const noexcept { return key < other.key; }
+  };
+
+  struct Queue {
+    std::mutex mutex;
+    std::multiset<Job> jobs;
+  };
+
+  struct Tenant {
+    double weight = 1;
+    // Virtual finish time of the tenant's last job, per priority class.
+    double finish[kNumPriorities] = {};
+    double completed = 0;
+  };
+
+  // Takes the best job of the highest class that has a job waiting, from the
+  // worker's queue if it has one, else from the first other queue that does.
+  bool
+  Pop(std::size_t worker, Job* job);
+
+  // Takes the best job of the queue if it is of class cls or higher.
+  bool
+  Take(std::size_t queue, std::size_t cls, Job* job);
+
+  void
+  Work(std::size_t worker);
+
+  std::vector<std::unique_ptr<Queue>> queues_;
+
+  // Fair queuing state, per tenant and per priority class.
+  mutable std::mutex tenants_mutex_;
+  std::map<TenantId, Tenant> tenants_;
+  double vtime_[kNumPriorities] = {};
+  std::uint64_t seq_ = 0;
+
+  // Idle workers sleep on cond_ until a job is submitted.
+  std::mutex idle_mutex_;
+  std::condition_variable cond_;
+  std::atomic<std::size_t> pending_ = 0;
+  // Number of queued jobs per priority class.
+  std::atomic<std::size_t> waiting_[kNumPriorities] = {};
+  bool stop_ = false;
+
+  std::atomic<std::size_t> next_queue_ = 0;
+  std::vector<std::thread> workers_;
+};
+
+// An Executor that submits to a Scheduler with a fixed priority class and
+// tenant, e.g. to give to AsyncPwdHasher or MicroBatcher.
+class TenantExecutor : public Executor {
+public:
+  TenantExecutor(Scheduler& scheduler, Priority priority, TenantId tenant)
+    : scheduler_(scheduler), priority_(priority), tenant_(tenant)
+  {}
+
+  void
+  Submit(std::function<void()> task) override
+  {
+    SubmitWithCost(std::move(task), 1);
+  }
+
+  void
+  SubmitWithCost(std::function<void()> task, double cost) override
+  {
+    scheduler_.Submit(std::move(task), {priority_, tenant_, cost});
+  }
+
+  std::size_t
+  Concurrency() const noexcept override { return scheduler_.Size(); }
+
+private:
+  Scheduler& scheduler_;
+  const Priority priority_;
+  const TenantId tenant_;
+};
+
+} // namespace bcrypt
@@ -0,0 +1,214 @@
+#include "scheduler.h"
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <latch>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "async.h"
+#include "bcrypt.h"
+#include "gmock/gmock.h"
+
+namespace bcrypt {
+namespace {
+
+// Keeps the only worker of a scheduler busy until Release is called, so that
+// the jobs submitted meanwhile queue up.
+class Blocker {
+public:
+  explicit Blocker(Scheduler& scheduler)
+  {
+    std::promise<void> started;
+    scheduler.Submit([&, release = release_.get_future().share()] {
+      started.set_value();
+      release.wait();
+    }, {.priority = Priority::kInteractive});
+    started.get_future().wait();
+  }
+
+  void
+  Release() { release_.set_value(); }
+
+private:
+  std::promise<void> release_;
+};
+
+// Records the order in which jobs run.
+class Recorder {
+public:
+  std::function<void()>
+  Job(int id)
+  {
+    return [this, id] {
+      std::lock_guard lock(mutex_);
+      order_.push_back(id);
+    };
+  }
+
+  std::vector<int>
+  Order()
+  {
+    std::lock_guard lock(mutex_);
+    return order_;
+  }
+
+private:
+  std::mutex mutex_;
+  std::vector<int> order_;
+};
+
+// Returns the completed cost of the tenant once it reaches cost, or after a
+// few seconds. Jobs are counted after they return, so right after a job has
+// signalled its caller, its cost may not be counted yet.
+double
+WaitForCost(const Scheduler& scheduler, TenantId tenant, double cost)
+{
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (scheduler.CompletedCost(tenant) < cost
+         and std::chrono::steady_clock::now() < deadline)
+    std::this_thread::yield();
+  return scheduler.CompletedCost(tenant);
+}
+
+TEST(SchedulerTest, RunsAllJobs) {
+  std::atomic<int> count = 0;
+  {
+    Scheduler scheduler(3);
+    for (int i = 0; i < 100; ++i)
+      scheduler.Submit([&] { ++count; });
+  }
+  EXPECT_EQ(count, 100);
+}
+
+TEST(SchedulerTest, HigherPriorityRunsFirst) {
+  Scheduler scheduler(1);
+  Recorder recorder;
+  Blocker blocker(scheduler);
+  scheduler.Submit(recorder.Job(0), {.priority = Priority::kBackground});
+  scheduler.Submit(recorder.Job(1), {.priority = Priority::kNormal});
+  scheduler.Submit(recorder.Job(2), {.priority = Priority::kInteractive});
+  blocker.Release();
+  while (recorder.Order().size() < 3) std::this_thread::yield();
+  EXPECT_THAT(recorder.Order(), testing::ElementsAre(2, 1, 0));
+}
+
+TEST(SchedulerTest, TenantsShareByWeight) {
+  Scheduler scheduler(1);
+  scheduler.SetTenantWeight(1, 2);
+  Recorder recorder;
+  Blocker blocker(scheduler);
+  for (int i = 0; i < 30; ++i) {
+    scheduler.Submit(recorder.Job(1), {.tenant = 1});
+    scheduler.Submit(recorder.Job(2), {.tenant = 2});
+  }
+  blocker.Release();
+  while (recorder.Order().size() < 60) std::this_thread::yield();
+
+  const auto order = recorder.Order();
+  const auto first = std::count(order.begin(), order.begin() + 30, 1);
+  EXPECT_NEAR(first, 20, 1);
+}
+
+TEST(SchedulerTest, TenantsShareByCost) {
+  Scheduler scheduler(1);
+  Recorder recorder;
+  Blocker blocker(scheduler);
+  for (int i = 0; i < 40; ++i) {
+    scheduler.Submit(recorder.Job(1), {.tenant = 1, .cost = HashCost(12)});
+    scheduler.Submit(recorder.Job(2), {.tenant = 2, .cost = HashCost(4)});
+  }
+  blocker.Release();
+  while (recorder.Order().size() < 80) std::this_thread::yield();
+
+  // Tenant 1 jobs cost 25 and tenant 2 jobs cost 9, so tenant 2 runs about
+  // 25/9 jobs for each job of tenant 1 while both have work.
+  const auto order = recorder.Order();
+  const auto first = std::count(order.begin(), order.begin() + 34, 2);
+  EXPECT_NEAR(first, 25, 1);
+  EXPECT_DOUBLE_EQ(WaitForCost(scheduler, 1, 40 * HashCost(12)),
+                   40 * HashCost(12));
+}
+
+TEST(SchedulerTest, SetTenantWeightThrowsIfNotPositive) {
+  Scheduler scheduler(1);
+  EXPECT_THROW(scheduler.SetTenantWeight(1, 0), std::invalid_argument);
+}
+
+TEST(SchedulerTest, IdleWorkerStealsJobsSubmittedByBusyWorker) {
+  Scheduler scheduler(2);
+  std::promise<void> stolen;
+  std::promise<void> done;
+  // The job submitted from the worker goes to its own queue, so it can only
+  // run on the other worker while this one waits for it.
+  scheduler.Submit([&] {
+    scheduler.Submit([&] { stolen.set_value(); });
+    stolen.get_future().wait();
+    done.set_value();
+  });
+  done.get_future().wait();
+}
+
+TEST(SchedulerTest, HigherPriorityRunsFirstAcrossQueues) {
+  Scheduler scheduler(2);
+  Recorder recorder;
+  std::latch running(2);
+  std::promise<void> queued;
+  std::promise<void> ran;
+  // Both jobs wait until the other runs, so they run on different workers.
+  // One worker queues background jobs on its own queue and goes idle, while
+  // the other queues an interactive job on its own queue and stays busy until
+  // it has run, so the idle worker has to steal it before its own jobs.
+  scheduler.Submit([&] {
+    running.arrive_and_wait();
+    for (int i = 0; i < 10; ++i)
+      scheduler.Submit(recorder.Job(0), {.priority = Priority::kBackground});
+    queued.get_future().wait();
+  });
+  scheduler.Submit([&] {
+    running.arrive_and_wait();
+    scheduler.Submit([&] {
+      recorder.Job(1)();
+      ran.set_value();
+    }, {.priority = Priority::kInteractive});
+    queued.set_value();
+    ran.get_future().wait();
+  });
+  while (recorder.Order().size() < 11) std::this_thread::yield();
+  EXPECT_EQ(recorder.Order().front(), 1);
+}
+
+TEST(SchedulerTest, AsyncPwdHasherCanUseTenantExecutor) {
+  Scheduler scheduler(2);
+  TenantExecutor executor(scheduler, Priority::kInteractive, 7);
+  AsyncPwdHasher async_hasher(PwdHasher(), executor);
+  const auto arr = PwdHasher().Generate("password", 4);
+  EXPECT_TRUE(async_hasher.IsSamePwd("password", arr).get());
+  EXPECT_DOUBLE_EQ(WaitForCost(scheduler, 7, HashCost(4)), HashCost(4));
+}
+
+TEST(SchedulerTest, BatchApisCanUseTenantExecutor) {
+  Scheduler scheduler(2);
+  TenantExecutor executor(scheduler, Priority::kBackground, 3);
+  const PwdHasher hasher;
+  // Enough passwords for more than one chunk, so helpers are submitted.
+  const std::vector<std::string> owned(4 * KernelLanes(ActiveKernel()), "pwd");
+  const std::vector<std::string_view> pwds(owned.begin(), owned.end());
+  std::vector<BcryptArr> arrs(pwds.size());
+  hasher.GenerateBatch(pwds, 4, arrs, executor);
+
+  std::unique_ptr<bool[]> results(new bool[pwds.size()]);
+  hasher.VerifyBatch(pwds, arrs, {results.get(), pwds.size()}, executor);
+  for (std::size_t i = 0; i < pwds.size(); ++i) EXPECT_TRUE(results[i]);
+  // Each helper is charged for a chunk of rounds 4 hashes.
+  EXPECT_GT(WaitForCost(scheduler, 3, HashCost(4)), 0);
+}
+
+} // namespace
+} // namespace bcrypt
@@ -0,0 +1,570 @@
+#include "server.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "bcrypt.h"
+#include "metrics.h"
+#include "protocol.h"
+#include "tracing.h"
+
+namespace bcrypt {
+namespace {
+
+// epoll data of the listening socket and the wake eventfd. Connections are
+// numbered after them.
+constexpr std::uint64_t kListenId = 0;
+constexpr std::uint64_t kWakeId = 1;
+
+std::system_error
+SystemError(const char* what)
+{
+  return std::system_error(errno, std::generic_category(), what);
+}
+
+void
+CloseFd(int* fd) noexcept
+{
+  if (*fd >= 0) ::close(*fd);
+  *fd = -1;
+}
+
+// Zeroes the whole buffer of s, including the bytes past its size, e.g. what
+// is left of a password after it was moved out of the small string buffer,
+// and empties s.
+void
+Wipe(std::string* s)
+{
+  s->resize(s->capacity());
+  std::fill(s->begin(), s->end(), 0);
+  s->clear();
+}
+
+// Appends data to s. If s has to grow, its old buffer is zeroed before it is
+// freed.
+void
+Append(std::string* s, std::string_view data)
+{
+  if (s->size() + data.size() > s->capacity()) {
+    std::string grown;
+    grown.reserve(std::max(2 * s->capacity(), s->size() + data.size()));
+    grown.append(*s);
+    Wipe(s);
+    s->swap(grown);
+  }
+  s->append(data);
+}
+
+// Removes the first n bytes of s and zeroes the bytes freed at its end.
+void
+Consume(std::string* s, std::size_t n)
+{
+  const auto size = s->size() - n;
+  std::copy(s->begin() + n, s->end(), s->begin());
+  std::fill(s->begin() + size, s->end(), 0);
+  s->resize(size);
+}
+
+// Appends the job to jobs, and zeroes the passwords that are left behind by
+// the move, including those of a buffer that jobs outgrows.
+template <typename Job>
+void
+PushJob(std::vector<Job>* jobs, Job* job)
+{
+  if (jobs->size() == jobs->capacity()) {
+    std::vector<Job> grown;
+    grown.reserve(std::max<std::size_t>(16, 2 * jobs->capacity()));
+    for (auto& old : *jobs) {
+      grown.push_back(std::move(old));
+      Wipe(&old.request.pwd);
+    }
+    jobs->swap(grown);
+  }
+  jobs->push_back(std::move(*job));
+  Wipe(&job->request.pwd);
+}
+
+void
+Watch(int epoll_fd, int op, int fd, std::uint32_t events, std::uint64_t id)
+{
+  epoll_event event{};
+  event.events = events;
+  event.data.u64 = id;
+  if (::epoll_ctl(epoll_fd, op, fd, &event) < 0)
+    throw SystemError("epoll_ctl");
+}
+
+} // namespace
+
+std::string
+PrometheusText(const ServerStats& stats)
+{
+  std::string text;
+  auto out = std::back_inserter(text);
+  const auto metric = [&](std::string_view name, std::string_view type,
+                          std::string_view help, std::uint64_t value) {
+    fmt::format_to(out, "# HELP bcryptd_{} {}\n# TYPE bcryptd_{} {}\n"
+                        "bcryptd_{} {}\n",
+                   name, help, name, type, name, value);
+  };
+  metric("connections", "gauge", "Connections open.", stats.connections);
+  metric("connections_total", "counter", "Connections accepted.",
+         stats.accepted);
+  metric("requests_total", "counter", "Requests received.", stats.requests);
+  metric("overloaded_total", "counter",
+         "Requests rejected because too many hashes were pending.",
+         stats.overloaded);
+  metric("bad_requests_total", "counter",
+         "Requests with an empty password or rounds out of range.",
+         stats.bad_requests);
+  metric("protocol_errors_total", "counter",
+         "Connections closed after a malformed frame.", stats.protocol_errors);
+  metric("output_overflows_total", "counter",
+         "Connections closed with more than max_output bytes unread.",
+         stats.output_overflows);
+  metric("batches_total", "counter", "Batches of hashes run by the workers.",
+         stats.batches);
+  metric("hashes_total", "counter", "Passwords hashed by the workers.",
+         stats.hashes);
+  metric("pending", "gauge", "Hashes queued or running.", stats.pending);
+  return text;
+}
+
+BcryptServer::BcryptServer(std::string path, ServerOptions options)
+  : path_(std::move(path)),
+    max_pending_(options.max_pending),
+    max_output_(options.max_output),
+    batch_size_(options.batch_size ? options.batch_size
+                                   : KernelLanes(ActiveKernel()))
+{
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (path_.empty() or path_.size() >= sizeof(addr.sun_path))
+    throw std::invalid_argument("The socket path is empty or too long.");
+  std::copy(path_.begin(), path_.end(), addr.sun_path);
+
+  try {
+    listen_fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                          0);
+    if (listen_fd_ < 0) throw SystemError("socket");
+    ::unlink(path_.c_str());
+    if (::bind(listen_fd_, reinterpret_cast<const sockaddr*>(&addr),
+               sizeof(addr)) < 0)
+      throw SystemError("bind");
+    if (::listen(listen_fd_, SOMAXCONN) < 0) throw SystemError("listen");
+
+    epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) throw SystemError("epoll_create1");
+    wake_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd_ < 0) throw SystemError("eventfd");
+    Watch(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, EPOLLIN, kListenId);
+    Watch(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, EPOLLIN, kWakeId);
+  } catch (...) {
+    CloseFd(&wake_fd_);
+    CloseFd(&epoll_fd_);
+    CloseFd(&listen_fd_);
+    throw;
+  }
+
+  next_conn_ = kWakeId + 1;
+  if (options.executor) {
+    executor_ = options.executor;
+  } else {
+    pool_.emplace(options.threads);
+    executor_ = &*pool_;
+  }
+  loop_ = std::thread([this] { Run(); });
+}
+
+BcryptServer::~BcryptServer()
+{
+  stop_ = true;
+  const std::uint64_t one = 1;
+  [[maybe_unused]] const auto n = ::write(wake_fd_, &one, sizeof(one));
+  loop_.join();
+  // Tasks that did not start see stop_ and return without hashing.
+  {
+    std::unique_lock lock(tasks_mutex_);
+    tasks_cond_.wait(lock, [this] { return tasks_ == 0; });
+  }
+  pool_.reset();
+
+  for (auto& [id, conn] : connections_) {
+    CloseFd(&conn.fd);
+    Wipe(&conn.in);
+  }
+  CloseFd(&wake_fd_);
+  CloseFd(&epoll_fd_);
+  CloseFd(&listen_fd_);
+  ::unlink(path_.c_str());
+}
+
+ServerStats
+BcryptServer::Stats() const noexcept
+{
+  ServerStats stats;
+  stats.connections = connections_open_.load(std::memory_order_relaxed);
+  stats.accepted = accepted_.load(std::memory_order_relaxed);
+  stats.requests = requests_.load(std::memory_order_relaxed);
+  stats.overloaded = overloaded_.load(std::memory_order_relaxed);
+  stats.bad_requests = bad_requests_.load(std::memory_order_relaxed);
+  stats.protocol_errors = protocol_errors_.load(std::memory_order_relaxed);
+  stats.output_overflows = output_overflows_.load(std::memory_order_relaxed);
+  stats.batches = batches_.load(std::memory_order_relaxed);
+  stats.hashes = hashes_.load(std::memory_order_relaxed);
+  stats.pending = pending_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+std::error_code
+BcryptServer::Error() const noexcept
+{
+  const auto error = error_.load();
+  if (error == 0) return {};
+  return {error, std::generic_category()};
+}
+
+void
+BcryptServer::Run()
+{
+  constexpr int kMaxEvents = 64;
+  epoll_event events[kMaxEvents];
+  std::vector<Job> jobs;
+  while (not stop_) {
+    const auto n = ::epoll_wait(epoll_fd_, events, kMaxEvents, -1);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      // Nothing can be served without epoll, so the loop stops and leaves
+      // the error for Error.
+      error_ = errno;
+      return;
+    }
+    for (int i = 0; i < n; ++i) {
+      const auto id = events[i].data.u64;
+      if (id == kListenId) {
+        Accept();
+        continue;
+      }
+      if (id == kWakeId) {
+        std::uint64_t count;
+        [[maybe_unused]] const auto r =
+            ::read(wake_fd_, &count, sizeof(count));
+        Deliver();
+        continue;
+      }
+      const auto it = connections_.find(id);
+      if (it == connections_.end()) continue;
+      auto& conn = it->second;
+      auto open = true;
+      if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        open = Read(id, conn, &jobs);
+      if (open and (events[i].events & EPOLLOUT)) open = Flush(id, conn);
+      if (not open) Close(id);
+    }
+    if (not jobs.empty()) Dispatch(std::exchange(jobs, {}));
+    FlushReplies();
+  }
+}
+
+void
+BcryptServer::Accept()
+{
+  for (;;) {
+    const auto fd = ::accept4(listen_fd_, nullptr, nullptr,
+                              SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR) continue;
+      // EAGAIN once the backlog is empty. Other errors, e.g. running out of
+      // descriptors, are retried on the next wakeup.
+      return;
+    }
+    const auto id = next_conn_++;
+    try {
+      Watch(epoll_fd_, EPOLL_CTL_ADD, fd, EPOLLIN | EPOLLRDHUP, id);
+    } catch (const std::system_error&) {
+      ::close(fd);
+      continue;
+    }
+    connections_[id].fd = fd;
+    ++accepted_;
+    ++connections_open_;
+  }
+}
+
+bool
+BcryptServer::Read(std::uint64_t id, Connection& conn, std::vector<Job>* jobs)
+{
+  // The socket is level triggered, so a connection with more to read than
+  // the buffer is read again on the next pass, after the others.
+  auto& buf = read_buf_;
+  auto n = ::read(conn.fd, buf.data(), buf.size());
+  while (n < 0 and errno == EINTR)
+    n = ::read(conn.fd, buf.data(), buf.size());
+  const auto open = n > 0 or (n < 0 and errno == EAGAIN);
+  if (n > 0) {
+    const auto size = static_cast<std::size_t>(n);
+    Append(&conn.in, std::string_view(buf.data(), size));
+    std::fill_n(buf.begin(), size, 0);
+  }
+
+  std::size_t offset = 0;
+  try {
+    for (;;) {
+      Job job;
+      job.conn = id;
+      const auto size =
+          ParseRequest(std::string_view(conn.in).substr(offset), &job.request);
+      if (size == 0) break;
+      offset += size;
+      ++requests_;
+      PushJob(jobs, &job);
+    }
+  } catch (const std::invalid_argument&) {
+    // The connection is closed, which wipes conn.in.
+    ++protocol_errors_;
+    return false;
+  }
+  Consume(&conn.in, offset);
+  return open;
+}
+
+bool
+BcryptServer::Flush(std::uint64_t id, Connection& conn)
+{
+  std::size_t written = 0;
+  while (written < conn.out.size()) {
+    const auto n = ::send(conn.fd, conn.out.data() + written,
+                          conn.out.size() - written, MSG_NOSIGNAL);
+    if (n >= 0) {
+      written += static_cast<std::size_t>(n);
+      continue;
+    }
+    if (errno == EINTR) continue;
+    if (errno == EAGAIN) break;
+    return false;
+  }
+  conn.out.erase(0, written);
+  if (conn.out.size() > max_output_) {
+    ++output_overflows_;
+    return false;
+  }
+
+  // Waits for the socket to drain only while there is something left to
+  // write, since a writable socket would otherwise wake the loop every time.
+  const auto want_write = not conn.out.empty();
+  if (want_write != conn.want_write) {
+    try {
+      std::uint32_t events = EPOLLIN | EPOLLRDHUP;
+      if (want_write) events |= EPOLLOUT;
+      Watch(epoll_fd_, EPOLL_CTL_MOD, conn.fd, events, id);
+    } catch (const std::system_error&) {
+      return false;
+    }
+    conn.want_write = want_write;
+  }
+  return true;
+}
+
+void
+BcryptServer::Close(std::uint64_t id)
+{
+  const auto it = connections_.find(id);
+  if (it == connections_.end()) return;
+  ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, it->second.fd, nullptr);
+  CloseFd(&it->second.fd);
+  Wipe(&it->second.in);
+  connections_.erase(it);
+  --connections_open_;
+}
+
+void
+BcryptServer::Dispatch(std::vector<Job> jobs)
+{
+  const TraceSpan span("BcryptServer::Dispatch");
+  // Jobs that need hashing, by op and rounds. They stay in jobs until they
+  // are moved into their batch, so no copy of a password is left behind by a
+  // growing group.
+  std::map<std::pair<Op, std::uint32_t>, std::vector<Job*>> groups;
+  for (auto& job : jobs) {
+    const auto& request = job.request;
+    switch (request.op) {
+      case Op::kStats:
+        Reply(job.conn, {request.id, Status::kOk,
+                         PrometheusText(Stats())
+                         + PrometheusText(SnapshotMetrics())});
+        continue;
+      case Op::kGenerate:
+        if (request.pwd.empty() or request.rounds < 4 or request.rounds > 31) {
+          ++bad_requests_;
+          Reply(job.conn, {request.id, Status::kBadRequest, {}});
+          continue;
+        }
+        job.params.rounds = request.rounds;
+        break;
+      case Op::kVerify: {
+        // Like PwdHasher::Verify, an empty password is an invalid hash.
+        const auto params =
+            request.pwd.empty() ? std::nullopt : DecodeBcrypt(request.arr);
+        if (not params) {
+          RecordVerify(VerifyStatus::kInvalidHash);
+          Reply(job.conn, {request.id, Status::kInvalidHash, {}});
+          continue;
+        }
+        job.params = *params;
+        break;
+      }
+    }
+    if (pending_ >= max_pending_) {
+      ++overloaded_;
+      if (request.op == Op::kVerify) RecordVerify(VerifyStatus::kOverloaded);
+      Reply(job.conn, {request.id, Status::kOverloaded, {}});
+      continue;
+    }
+    ++pending_;
+    groups[{request.op, job.params.rounds}].push_back(&job);
+  }
+
+  for (auto& [key, group] : groups) {
+    for (std::size_t first = 0; first < group.size(); first += batch_size_) {
+      const auto last = std::min(group.size(), first + batch_size_);
+      std::vector<Job> batch;
+      batch.reserve(last - first);
+      for (auto i = first; i < last; ++i)
+        batch.push_back(std::move(*group[i]));
+      ++batches_;
+      const auto cost = HashCost(key.second) * batch.size();
+      {
+        std::lock_guard lock(tasks_mutex_);
+        ++tasks_;
+      }
+      executor_->SubmitWithCost(
+          [this, batch = std::move(batch),
+           queued = TraceStart()]() mutable {
+            TraceEnd("bcryptd queue", queued);
+            Hash(std::move(batch));
+            // Notifies under the lock, since the destructor may return as
+            // soon as it sees the last task done.
+            std::lock_guard lock(tasks_mutex_);
+            if (--tasks_ == 0) tasks_cond_.notify_all();
+          },
+          cost);
+    }
+  }
+
+  // Clears the passwords of the rejected jobs, and what the moves left of
+  // the others.
+  for (auto& job : jobs)
+    Wipe(&job.request.pwd);
+}
+
+void
+BcryptServer::Hash(std::vector<Job> jobs) noexcept
+{
+  const auto n = jobs.size();
+  std::vector<std::pair<std::uint64_t, Response>> responses;
+  if (not stop_) {
+    const TraceSpan span("BcryptServer::Hash");
+    const auto op = jobs.front().request.op;
+    const auto rounds = jobs.front().params.rounds;
+    std::vector<std::string_view> pwds(n);
+    std::vector<Salt> salts(n);
+    std::vector<PwdHash> hashes(n);
+    for (std::size_t i = 0; i < n; ++i) {
+      pwds[i] = jobs[i].request.pwd;
+      salts[i] = jobs[i].params.salt;
+    }
+    if (op == Op::kGenerate) pwd_hasher_.GenSalts(salts);
+    GenHashN(pwds, salts, rounds, hashes);
+
+    const auto hash_op = op == Op::kGenerate ? HashOp::kGenerate
+                                             : HashOp::kVerify;
+    RecordHashes(hash_op, rounds, n);
+    responses.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) {
+      Response response{jobs[i].request.id, Status::kOk, {}};
+      if (op == Op::kGenerate) {
+        const auto arr = EncodeBcrypt(hashes[i], salts[i], rounds);
+        response.body.assign(arr.begin(), arr.end());
+      } else {
+        const auto status = jobs[i].params.pwd_hash == hashes[i]
+            ? VerifyStatus::kMatch : VerifyStatus::kMismatch;
+        RecordVerify(status);
+        response.status = ToStatus(status);
+      }
+      responses.emplace_back(jobs[i].conn, std::move(response));
+    }
+    hashes_ += n;
+  }
+  // Clears the passwords before releasing them.
+  for (auto& job : jobs)
+    Wipe(&job.request.pwd);
+  pending_ -= n;
+  Complete(std::move(responses));
+}
+
+void
+BcryptServer::Complete(
+    std::vector<std::pair<std::uint64_t, Response>> responses)
+{
+  if (responses.empty()) return;
+  {
+    std::lock_guard lock(completed_mutex_);
+    completed_.insert(completed_.end(),
+                      std::make_move_iterator(responses.begin()),
+                      std::make_move_iterator(responses.end()));
+  }
+  const std::uint64_t one = 1;
+  [[maybe_unused]] const auto r = ::write(wake_fd_, &one, sizeof(one));
+}
+
+void
+BcryptServer::Deliver()
+{
+  std::vector<std::pair<std::uint64_t, Response>> completed;
+  {
+    std::lock_guard lock(completed_mutex_);
+    completed.swap(completed_);
+  }
+  for (const auto& [conn, response] : completed)
+    Reply(conn, response);
+}
+
+void
+BcryptServer::Reply(std::uint64_t conn, const Response& response)
+{
+  // The connection may have closed while the request was hashing.
+  const auto it = connections_.find(conn);
+  if (it == connections_.end()) return;
+  if (it->second.out.empty()) replied_.push_back(conn);
+  AppendResponse(response, &it->second.out);
+}
+
+void
+BcryptServer::FlushReplies()
+{
+  for (const auto id : replied_) {
+    const auto it = connections_.find(id);
+    if (it != connections_.end() and not Flush(id, it->second)) Close(id);
+  }
+  replied_.clear();
+}
+
+} // namespace bcrypt
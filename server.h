@@ -0,0 +1,218 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "bcrypt.h"
+#include "protocol.h"
+#include "thread_pool.h"
+
+namespace bcrypt {
+
+struct ServerOptions {
+  // Number of workers that hash, or one per core if 0.
+  std::size_t threads = 0;
+
+  // If set, the hashing runs on this executor, e.g. a TenantExecutor of a
+  // Scheduler shared with other work, instead of on workers of the server's
+  // own, and threads is ignored. It must outlive the server.
+  Executor* executor = nullptr;
+
+  // Most hashes queued or running at once. Requests past it are answered
+  // with Status::kOverloaded right away.
+  std::size_t max_pending = 4096;
+
+  // Most bytes of responses that a connection can leave unread. A connection
+  // past it is closed, so a client that never reads cannot grow the memory of
+  // the server without bound.
+  std::size_t max_output = 1 << 20;
+
+  // Most passwords hashed by one task, or the lanes of the active kernel if
+  // 0.
+  std::size_t batch_size = 0;
+};
+
+struct ServerStats {
+  // Connections open now, and accepted so far.
+  std::uint64_t connections = 0;
+  std::uint64_t accepted = 0;
+
+  // Requests received, and those answered with kOverloaded or kBadRequest.
+  std::uint64_t requests = 0;
+  std::uint64_t overloaded = 0;
+  std::uint64_t bad_requests = 0;
+
+  // Connections closed because they sent a malformed frame, or because they
+  // left more than max_output bytes of responses unread.
+  std::uint64_t protocol_errors = 0;
+  std::uint64_t output_overflows = 0;
+
+  // Tasks handed to the workers, and the passwords they hashed.
+  std::uint64_t batches = 0;
+  std::uint64_t hashes = 0;
+
+  // Hashes queued or running now.
+  std::uint64_t pending = 0;
+};
+
+// Returns the stats in the Prometheus text format, e.g.
+//
+//   bcryptd_requests_total 1200
+//   bcryptd_batches_total 150
+std::string
+PrometheusText(const ServerStats& stats);
+
+// Serves Generate and Verify requests of the bcryptd protocol on a Unix
+// domain socket. One thread runs an epoll loop that reads the requests of
+// every connection and writes back their responses; the hashing runs on a
+// pool of workers. The requests read in one pass of the loop are grouped by
+// operation and rounds, and each group is split into tasks of batch_size
+// passwords that go through GenHashN together, so pipelined and concurrent
+// requests fill the lanes of the hash kernel without waiting for each other.
+class BcryptServer {
+public:
+  // Listens on the socket at path, replacing any file already there, and
+  // starts serving. Throws std::system_error if the socket cannot be set up.
+  explicit BcryptServer(std::string path, ServerOptions options = {});
+
+  // Stops serving, closes the connections and removes the socket. Requests
+  // that are still hashing are dropped.
+  ~BcryptServer();
+
+  BcryptServer(const BcryptServer&) = delete;
+  BcryptServer& operator=(const BcryptServer&) = delete;
+
+  const std::string&
+  Path() const noexcept { return path_; }
+
+  ServerStats
+  Stats() const noexcept;
+
+  // Returns the error that stopped the event loop, e.g. from epoll_wait, or
+  // an empty error code while it runs. Once the loop stops, no request is
+  // served and the server should be destroyed.
+  std::error_code
+  Error() const noexcept;
+
+private:
+  struct Connection {
+    int fd = -1;
+    // Bytes read but not parsed yet, and responses not written yet. The
+    // passwords in `in` are zeroed once they are parsed or the connection is
+    // closed.
+    std::string in;
+    std::string out;
+    bool want_write = false;
+  };
+
+  // A request waiting for a worker, and the connection it came from.
+  struct Job {
+    std::uint64_t conn = 0;
+    Request request;
+    BcryptParams params;
+  };
+
+  void
+  Run();
+
+  void
+  Accept();
+
+  // Reads from the connection and parses its requests into jobs. Returns
+  // false if the connection should be closed.
+  bool
+  Read(std::uint64_t id, Connection& conn, std::vector<Job>* jobs);
+
+  // Writes as much of the responses of the connection as the socket takes.
+  // Returns false if the connection should be closed.
+  bool
+  Flush(std::uint64_t id, Connection& conn);
+
+  void
+  Close(std::uint64_t id);
+
+  // Answers what can be answered right away, and hands the rest of the jobs
+  // to the workers in batches.
+  void
+  Dispatch(std::vector<Job> jobs);
+
+  // Hashes a batch of jobs with the same op and rounds, on a worker.
+  void
+  Hash(std::vector<Job> jobs) noexcept;
+
+  // Queues a response to the connection. Called by any thread.
+  void
+  Complete(std::vector<std::pair<std::uint64_t, Response>> responses);
+
+  // Moves the completed responses to their connections.
+  void
+  Deliver();
+
+  // Queues a response from the loop thread. It is written by FlushReplies.
+  void
+  Reply(std::uint64_t conn, const Response& response);
+
+  void
+  FlushReplies();
+
+  const std::string path_;
+  const std::size_t max_pending_;
+  const std::size_t max_output_;
+  const std::size_t batch_size_;
+  PwdHasher pwd_hasher_;
+
+  int listen_fd_ = -1;
+  int epoll_fd_ = -1;
+  // Wakes the loop when responses are completed, or to stop it.
+  int wake_fd_ = -1;
+  std::atomic<bool> stop_ = false;
+  // The errno that stopped the loop, or 0.
+  std::atomic<int> error_ = 0;
+
+  // Owned by the loop thread.
+  std::unordered_map<std::uint64_t, Connection> connections_;
+  std::uint64_t next_conn_ = 0;
+  // Read buffer of the loop. It is a member rather than a local, so that
+  // zeroing it after each read is not optimized away.
+  std::array<char, 1 << 14> read_buf_;
+  // Connections with replies queued since the last FlushReplies.
+  std::vector<std::uint64_t> replied_;
+
+  std::mutex completed_mutex_;
+  std::vector<std::pair<std::uint64_t, Response>> completed_;
+
+  std::atomic<std::uint64_t> accepted_ = 0;
+  std::atomic<std::uint64_t> connections_open_ = 0;
+  std::atomic<std::uint64_t> requests_ = 0;
+  std::atomic<std::uint64_t> overloaded_ = 0;
+  std::atomic<std::uint64_t> bad_requests_ = 0;
+  std::atomic<std::uint64_t> protocol_errors_ = 0;
+  std::atomic<std::uint64_t> output_overflows_ = 0;
+  std::atomic<std::uint64_t> batches_ = 0;
+  std::atomic<std::uint64_t> hashes_ = 0;
+  std::atomic<std::uint64_t> pending_ = 0;
+
+  // The server's own workers, unless an executor was given.
+  std::optional<ThreadPool> pool_;
+  Executor* executor_ = nullptr;
+  // Tasks submitted to executor_ that have not returned. The destructor
+  // waits for them before the sockets are closed, so no task is left to
+  // write to them.
+  std::mutex tasks_mutex_;
+  std::condition_variable tasks_cond_;
+  std::size_t tasks_ = 0;
+  std::thread loop_;
+};
+
+} // namespace bcrypt
@@ -0,0 +1,228 @@
+#include "server.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "gmock/gmock.h"
+
+#include "bcrypt.h"
+#include "client.h"
+#include "protocol.h"
+#include "thread_pool.h"
+
+namespace bcrypt {
+namespace {
+
+using ::testing::HasSubstr;
+
+std::string
+SocketPath()
+{
+  return ::testing::TempDir() + "bcryptd_test_" + std::to_string(::getpid())
+         + ".sock";
+}
+
+ServerOptions
+TestOptions()
+{
+  ServerOptions options;
+  options.threads = 2;
+  return options;
+}
+
+TEST(ServerTest, GeneratesAndVerifies) {
+  const BcryptServer server(SocketPath(), TestOptions());
+  BcryptClient client(server.Path());
+
+  const auto arr = client.Generate("password", 4);
+  EXPECT_TRUE(PwdHasher().IsSamePwd("password", arr));
+  EXPECT_EQ(client.Verify("password", arr), VerifyStatus::kMatch);
+  EXPECT_EQ(client.Verify("wrong", arr), VerifyStatus::kMismatch);
+  EXPECT_EQ(client.Verify("password", BcryptArr{}),
+            VerifyStatus::kInvalidHash);
+  EXPECT_EQ(client.Verify("", arr), VerifyStatus::kInvalidHash);
+
+  const auto local = PwdHasher().Generate("local", 5);
+  EXPECT_EQ(client.Verify("local", local), VerifyStatus::kMatch);
+}
+
+TEST(ServerTest, CanHashOnAnExecutor) {
+  ThreadPool pool(1);
+  ServerOptions options;
+  options.executor = &pool;
+  const BcryptServer server(SocketPath(), options);
+  BcryptClient client(server.Path());
+
+  const auto arr = client.Generate("password", 4);
+  EXPECT_EQ(client.Verify("password", arr), VerifyStatus::kMatch);
+}
+
+TEST(ServerTest, RejectsBadGenerateRequests) {
+  const BcryptServer server(SocketPath(), TestOptions());
+  BcryptClient client(server.Path());
+  EXPECT_THROW(client.Generate("password", 3), std::invalid_argument);
+  EXPECT_THROW(client.Generate("password", 32), std::invalid_argument);
+  EXPECT_THROW(client.Generate("password", 1000), std::invalid_argument);
+  EXPECT_THROW(client.Generate("", 4), std::invalid_argument);
+  // The connection is still usable.
+  EXPECT_EQ(client.Verify("password", client.Generate("password", 4)),
+            VerifyStatus::kMatch);
+  EXPECT_EQ(server.Stats().bad_requests, 4);
+}
+
+TEST(ServerTest, PipelinedRequestsAreBatched) {
+  const BcryptServer server(SocketPath(), TestOptions());
+  BcryptClient client(server.Path());
+  const auto arr = client.Generate("password", 4);
+
+  constexpr std::size_t kRequests = 64;
+  std::map<std::uint32_t, Status> expected;
+  for (std::size_t i = 0; i < kRequests; ++i) {
+    const auto match = i % 3 == 0;
+    expected[client.SendVerify(match ? "password" : "wrong", arr)] =
+        match ? Status::kMatch : Status::kMismatch;
+  }
+  for (std::size_t i = 0; i < kRequests; ++i) {
+    const auto response = client.Receive();
+    ASSERT_EQ(expected.count(response.id), 1);
+    EXPECT_EQ(response.status, expected[response.id]);
+    expected.erase(response.id);
+  }
+
+  const auto stats = server.Stats();
+  EXPECT_EQ(stats.requests, kRequests + 1);
+  EXPECT_EQ(stats.hashes, kRequests + 1);
+  EXPECT_LE(stats.batches, kRequests + 1);
+  EXPECT_EQ(stats.pending, 0);
+}
+
+TEST(ServerTest, ServesManyConnections) {
+  const BcryptServer server(SocketPath(), TestOptions());
+  const auto arr = PwdHasher().Generate("password", 4);
+  constexpr int kThreads = 4;
+  constexpr int kRequests = 8;
+  std::vector<int> matches(kThreads);
+  {
+    std::vector<std::jthread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+      threads.emplace_back([&, t] {
+        BcryptClient client(server.Path());
+        for (int i = 0; i < kRequests; ++i)
+          matches[t] += client.Verify("password", arr) == VerifyStatus::kMatch;
+      });
+    }
+  }
+  for (const auto n : matches)
+    EXPECT_EQ(n, kRequests);
+  EXPECT_EQ(server.Stats().accepted, kThreads);
+}
+
+TEST(ServerTest, ShedsLoadPastMaxPending) {
+  auto options = TestOptions();
+  options.max_pending = 1;
+  const BcryptServer server(SocketPath(), options);
+  BcryptClient client(server.Path());
+  const auto arr = PwdHasher().Generate("password", 4);
+
+  constexpr std::size_t kRequests = 16;
+  for (std::size_t i = 0; i < kRequests; ++i)
+    client.SendVerify("password", arr);
+  std::size_t overloaded = 0;
+  for (std::size_t i = 0; i < kRequests; ++i) {
+    const auto status = client.Receive().status;
+    EXPECT_THAT(status, ::testing::AnyOf(Status::kMatch, Status::kOverloaded));
+    overloaded += status == Status::kOverloaded;
+  }
+  EXPECT_GT(overloaded, 0);
+  EXPECT_EQ(server.Stats().overloaded, overloaded);
+}
+
+TEST(ServerTest, ReportsStats) {
+  const BcryptServer server(SocketPath(), TestOptions());
+  BcryptClient client(server.Path());
+  client.Verify("password", client.Generate("password", 4));
+  const auto text = client.Stats();
+  EXPECT_THAT(text, HasSubstr("bcryptd_requests_total 3\n"));
+  EXPECT_THAT(text, HasSubstr("bcryptd_connections 1\n"));
+  EXPECT_THAT(text, HasSubstr("bcryptd_hashes_total 2\n"));
+  EXPECT_THAT(text, HasSubstr("# TYPE bcrypt_verifications_total counter\n"));
+}
+
+TEST(ServerTest, ClosesConnectionsOnMalformedFrames) {
+  const BcryptServer server(SocketPath(), TestOptions());
+  const auto fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  ASSERT_GE(fd, 0);
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  std::copy(server.Path().begin(), server.Path().end(), addr.sun_path);
+  ASSERT_EQ(::connect(fd, reinterpret_cast<const sockaddr*>(&addr),
+                      sizeof(addr)), 0);
+  // A frame with an unknown op.
+  const char frame[] = "\x05\0\0\0\0\0\0\0\x09";
+  ASSERT_EQ(::send(fd, frame, 9, 0), 9);
+  char buf[16];
+  EXPECT_EQ(::recv(fd, buf, sizeof(buf), 0), 0);
+  ::close(fd);
+  EXPECT_EQ(server.Stats().protocol_errors, 1);
+
+  // Other connections are not affected.
+  BcryptClient client(server.Path());
+  EXPECT_THAT(client.Stats(), HasSubstr("bcryptd_protocol_errors_total 1\n"));
+}
+
+TEST(ServerTest, ClosesConnectionsThatDoNotRead) {
+  auto options = TestOptions();
+  options.max_output = 1 << 12;
+  const BcryptServer server(SocketPath(), options);
+  const auto fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  ASSERT_GE(fd, 0);
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  std::copy(server.Path().begin(), server.Path().end(), addr.sun_path);
+  ASSERT_EQ(::connect(fd, reinterpret_cast<const sockaddr*>(&addr),
+                      sizeof(addr)), 0);
+  // Stats requests are answered right away, so their responses pile up until
+  // the socket buffers are full and the server closes the connection.
+  std::string frames;
+  for (int i = 0; i < 64; ++i)
+    AppendRequest({.op = Op::kStats}, &frames);
+  for (int i = 0; i < 10000; ++i) {
+    if (::send(fd, frames.data(), frames.size(), MSG_NOSIGNAL) < 0) break;
+  }
+  ::close(fd);
+  for (int i = 0; i < 500 and server.Stats().output_overflows == 0; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  EXPECT_EQ(server.Stats().output_overflows, 1);
+  EXPECT_EQ(server.Error(), std::error_code());
+
+  // Other connections are not affected.
+  BcryptClient client(server.Path());
+  EXPECT_THAT(client.Stats(), HasSubstr("bcryptd_output_overflows_total 1\n"));
+}
+
+TEST(ServerTest, StopsWithOpenConnections) {
+  const auto path = SocketPath();
+  auto server = std::make_unique<BcryptServer>(path, TestOptions());
+  BcryptClient client(path);
+  EXPECT_NO_THROW(client.Stats());
+  server.reset();
+  EXPECT_THROW(client.Stats(), std::system_error);
+  EXPECT_NE(::access(path.c_str(), F_OK), 0);
+  EXPECT_THROW(BcryptClient{path}, std::system_error);
+}
+
+} // namespace
+} // namespace bcrypt
@@ -0,0 +1,343 @@
+#include "shm_cache.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+
+#include "bcrypt.h"
+#include "siphash.h"
+#include "verify_cache.h"
+
+namespace bcrypt {
+namespace {
+using Clock = std::chrono::steady_clock;
+
+// Identifies an initialized segment.
+constexpr std::uint64_t kMagic = 0x6263727970743031; // "bcrypt01"
+
+// Number of entries after the home entry of a key where it may be stored.
+constexpr std::size_t kMaxProbes = 8;
+
+// The segment is shared between processes, so its atomics must not hide a
+// lock in the process.
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+
+std::system_error
+SystemError(const char* what)
+{
+  return std::system_error(errno, std::generic_category(), what);
+}
+
+// Returns the current time as stored in entries. CLOCK_MONOTONIC is the same
+// for all processes.
+std::uint64_t
+Now() noexcept
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      Clock::now().time_since_epoch()).count();
+}
+
+std::uint64_t
+Load(const std::uint8_t* p) noexcept
+{
+  std::uint64_t x;
+  std::memcpy(&x, p, sizeof(x));
+  return x;
+}
+
+// Returns the start time of the process in clock ticks after boot, field 22
+// of /proc/<pid>/stat, or std::nullopt if it cannot be read.
+std::optional<std::uint64_t>
+StartTime(pid_t pid) noexcept
+{
+  char path[32];
+  std::snprintf(path, sizeof(path), "/proc/%d/stat", static_cast<int>(pid));
+  const int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return std::nullopt;
+  char buf[1024];
+  const auto n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0) return std::nullopt;
+  buf[n] = 0;
+
+  // The command name in field 2 may hold spaces and parentheses, so the
+  // fields are counted from the last ')'. Field 3 follows it.
+  const char* p = std::strrchr(buf, ')');
+  if (p == nullptr) return std::nullopt;
+  ++p;
+  for (int field = 3; field < 22; ++field) {
+    p = std::strchr(p + 1, ' ');
+    if (p == nullptr) return std::nullopt;
+  }
+  char* end;
+  const auto start = std::strtoull(p + 1, &end, 10);
+  if (end == p + 1) return std::nullopt;
+  return start;
+}
+
+// Packs the pid and the low 32 bits of the start time into an owner token.
+std::uint64_t
+MakeToken(pid_t pid, std::uint64_t start) noexcept
+{
+  return (start << 32) | static_cast<std::uint32_t>(pid);
+}
+} // namespace
+
+namespace shm_internal {
+
+std::uint64_t
+ProcessToken() noexcept
+{
+  // Cached per process, and computed again in a forked child.
+  static std::atomic<std::uint64_t> token = 0;
+  const auto pid = getpid();
+  auto cached = token.load(std::memory_order_relaxed);
+  if (static_cast<pid_t>(cached & 0xffffffff) != pid) {
+    cached = MakeToken(pid, StartTime(pid).value_or(0));
+    token.store(cached, std::memory_order_relaxed);
+  }
+  return cached;
+}
+
+bool
+IsAlive(std::uint64_t token) noexcept
+{
+  const auto pid = static_cast<pid_t>(token & 0xffffffff);
+  if (const auto start = StartTime(pid))
+    return MakeToken(pid, *start) == token;
+  // Without /proc, e.g. when it hides the processes of other users, only
+  // the pid can be checked.
+  return kill(pid, 0) == 0 or errno != ESRCH;
+}
+
+} // namespace shm_internal
+
+struct ShmVerifyCache::Header {
+  // kMagic once the segment is initialized, or else the ProcessToken of the
+  // process initializing it, or 0. A token never equals kMagic, since its
+  // pid would be above the kernel's limit.
+  std::atomic<std::uint64_t> state;
+  std::uint64_t capacity;
+  SipKey mac_key;
+  std::atomic<std::uint64_t> evictions;
+};
+
+// The fields are atomics since they are read while they may be written.
+struct ShmVerifyCache::Entry {
+  // ProcessToken of the process writing the entry, or 0.
+  std::atomic<std::uint64_t> owner;
+  // Odd while the entry is written.
+  std::atomic<std::uint64_t> seq;
+  std::atomic<std::uint64_t> key[2];
+  // Expiry time in nanoseconds shifted left by one, ORed with the outcome. 0
+  // if the entry is empty.
+  std::atomic<std::uint64_t> meta;
+};
+
+ShmVerifyCache::ShmVerifyCache(ShmVerifyCacheOptions options)
+  : capacity_(options.capacity),
+    positive_ttl_(options.positive_ttl),
+    negative_ttl_(options.negative_ttl)
+{
+  const int fd = memfd_create("bcrypt-cache", MFD_CLOEXEC);
+  if (fd < 0) throw SystemError("memfd_create");
+  Map(fd);
+}
+
+ShmVerifyCache::ShmVerifyCache(
+    const std::string& name, ShmVerifyCacheOptions options)
+  : capacity_(options.capacity),
+    positive_ttl_(options.positive_ttl),
+    negative_ttl_(options.negative_ttl)
+{
+  const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0) throw SystemError("shm_open");
+  Map(fd);
+}
+
+ShmVerifyCache::~ShmVerifyCache()
+{
+  munmap(segment_, size_);
+}
+
+void
+ShmVerifyCache::Unlink(const std::string& name) noexcept
+{
+  shm_unlink(name.c_str());
+}
+
+void
+ShmVerifyCache::Map(int fd)
+{
+  if (capacity_ == 0) {
+    close(fd);
+    throw std::invalid_argument("capacity should be positive.");
+  }
+  size_ = sizeof(Header) + capacity_ * sizeof(Entry);
+
+  // Growing the object to the same size in every process is harmless, and a
+  // new object reads as zeros.
+  struct stat st;
+  if (fstat(fd, &st) != 0 or (static_cast<std::size_t>(st.st_size) < size_
+                              and ftruncate(fd, size_) != 0)) {
+    const auto error = SystemError("ftruncate");
+    close(fd);
+    throw error;
+  }
+  segment_ = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (segment_ == MAP_FAILED) throw SystemError("mmap");
+  header_ = static_cast<Header*>(segment_);
+  entries_ = reinterpret_cast<Entry*>(header_ + 1);
+
+  // Initialize the segment unless another process did. If the process that
+  // started to died before it was done, take over, as Insert does for
+  // entries. A live one takes microseconds, so if it takes a second, it is
+  // stuck.
+  const auto token = shm_internal::ProcessToken();
+  const auto deadline = Clock::now() + std::chrono::seconds(1);
+  auto state = header_->state.load(std::memory_order_acquire);
+  while (state != kMagic) {
+    if (state == 0 or not shm_internal::IsAlive(state)) {
+      // On failure, state is reloaded and checked again.
+      if (header_->state.compare_exchange_strong(
+              state, token, std::memory_order_acquire)) {
+        header_->mac_key = RandomSipKey();
+        header_->capacity = capacity_;
+        header_->state.store(kMagic, std::memory_order_release);
+        break;
+      }
+      continue;
+    }
+    if (Clock::now() > deadline) {
+      munmap(segment_, size_);
+      throw std::runtime_error(
+          "The segment is still being initialized by another process. If "
+          "that process is stuck, remove the segment with "
+          "ShmVerifyCache::Unlink.");
+    }
+    std::this_thread::yield();
+    state = header_->state.load(std::memory_order_acquire);
+  }
+  if (header_->capacity != capacity_) {
+    munmap(segment_, size_);
+    throw std::invalid_argument("capacity does not match the segment.");
+  }
+}
+
+std::optional<bool>
+ShmVerifyCache::Lookup(std::string_view pwd, const BcryptArr& arr)
+{
+  const auto key = VerifyKey(header_->mac_key, pwd, arr);
+  const auto k0 = Load(key.data());
+  const auto k1 = Load(key.data() + 8);
+  const auto now = Now();
+  for (std::size_t n = 0; n < std::min(kMaxProbes, capacity_); ++n) {
+    auto& entry = entries_[(k0 + n) % capacity_];
+    const auto seq = entry.seq.load(std::memory_order_acquire);
+    if (seq & 1) continue;
+    const auto e0 = entry.key[0].load(std::memory_order_relaxed);
+    const auto e1 = entry.key[1].load(std::memory_order_relaxed);
+    const auto meta = entry.meta.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (entry.seq.load(std::memory_order_relaxed) != seq) continue;
+
+    if (e0 == k0 and e1 == k1 and meta != 0) {
+      if ((meta >> 1) <= now) return std::nullopt;
+      return meta & 1;
+    }
+  }
+  return std::nullopt;
+}
+
+void
+ShmVerifyCache::Insert(std::string_view pwd, const BcryptArr& arr, bool same)
+{
+  const auto key = VerifyKey(header_->mac_key, pwd, arr);
+  const auto k0 = Load(key.data());
+  const auto k1 = Load(key.data() + 8);
+  const auto now = Now();
+  const auto ttl = same ? positive_ttl_ : negative_ttl_;
+  const auto meta = ((now + ttl.count()) << 1) | same;
+
+  // Take the entry with the key if there is one, or else the first empty or
+  // expired one, or else the one that expires first.
+  Entry* victim = nullptr;
+  std::uint64_t victim_expires = UINT64_MAX;
+  for (std::size_t n = 0; n < std::min(kMaxProbes, capacity_); ++n) {
+    auto& entry = entries_[(k0 + n) % capacity_];
+    if (entry.key[0].load(std::memory_order_relaxed) == k0
+        and entry.key[1].load(std::memory_order_relaxed) == k1) {
+      victim = &entry;
+      victim_expires = 0;
+      break;
+    }
+    const auto expires = entry.meta.load(std::memory_order_relaxed) >> 1;
+    if (expires < victim_expires) {
+      victim = &entry;
+      victim_expires = expires;
+    }
+  }
+  const bool evicts = victim_expires > now;
+
+  // Lock the entry. If the owner died while writing, take it over; if it is
+  // alive, another process is writing the entry and this insert is dropped.
+  const auto token = shm_internal::ProcessToken();
+  auto owner = victim->owner.load(std::memory_order_relaxed);
+  if (owner != 0 and shm_internal::IsAlive(owner)) return;
+  if (not victim->owner.compare_exchange_strong(
+          owner, token, std::memory_order_acquire))
+    return;
+
+  // If a dead writer left seq odd, it is moved on by two so that readers who
+  // saw the old value notice the change.
+  const auto seq = victim->seq.load(std::memory_order_relaxed);
+  const auto writing = (seq & 1) ? seq + 2 : seq + 1;
+  victim->seq.store(writing, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  victim->key[0].store(k0, std::memory_order_relaxed);
+  victim->key[1].store(k1, std::memory_order_relaxed);
+  victim->meta.store(meta, std::memory_order_relaxed);
+  victim->seq.store(writing + 1, std::memory_order_release);
+  victim->owner.store(0, std::memory_order_release);
+
+  if (evicts) header_->evictions.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::size_t
+ShmVerifyCache::Size() const
+{
+  const auto now = Now();
+  std::size_t size = 0;
+  for (std::size_t i = 0; i < capacity_; ++i) {
+    const auto meta = entries_[i].meta.load(std::memory_order_relaxed);
+    if (meta != 0 and (meta >> 1) > now) ++size;
+  }
+  return size;
+}
+
+std::uint64_t
+ShmVerifyCache::Evictions() const
+{
+  return header_->evictions.load(std::memory_order_relaxed);
+}
+
+} // namespace bcrypt
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "bcrypt.h"
+#include "siphash.h"
+#include "verify_cache.h"
+
+namespace bcrypt {
+
+namespace shm_internal {
+// Returns the token that identifies the calling process as the owner of an
+// entry: its pid, and its start time from /proc.
+std::uint64_t
+ProcessToken() noexcept;
+
+// Returns true if the process of the token may still be running, i.e. its
+// pid exists and did not start at another time.
+bool
+IsAlive(std::uint64_t token) noexcept;
+} // namespace shm_internal
+
+struct ShmVerifyCacheOptions {
+  // Number of entries in the segment.
+  std::size_t capacity = 1 << 16;
+
+  // How long matches and mismatches are remembered, as in LruVerifyCache.
+  std::chrono::milliseconds positive_ttl = std::chrono::minutes(1);
+  std::chrono::milliseconds negative_ttl = std::chrono::seconds(10);
+};
+
+// A VerifyCache in a shared memory segment, so the worker processes of a
+// prefork server share their outcomes. The segment is an open addressing
+// table of fixed size entries with the same MAC keys as LruVerifyCache; the
+// MAC key is drawn by the process that creates the segment and stored in it.
+//
+// Readers never lock: each entry has a sequence number that is odd while the
+// entry is written, and a read that overlaps a write is a miss. Writers lock
+// an entry by storing their pid and process start time in it. If a worker
+// dies while it holds the lock, the next writer that finds the process gone,
+// or its pid reused by a process that started later, takes the entry over,
+// so a crash loses at most the entry that was being written. The segment is
+// initialized the same way: if its initializer dies, the next process to
+// open it initializes it. If the initializer is alive but stuck, opening the
+// segment throws std::runtime_error, and the segment has to be removed with
+// Unlink.
+class ShmVerifyCache : public VerifyCache {
+public:
+  // Maps an anonymous segment (memfd). Processes forked after this share it.
+  explicit ShmVerifyCache(ShmVerifyCacheOptions options = {});
+
+  // Maps the POSIX shared memory object with the given name, e.g.
+  // "/bcrypt-cache", and creates it if it does not exist yet, so unrelated
+  // processes can share it. The capacity must match the one the object was
+  // made with, or std::invalid_argument is thrown. Throws std::runtime_error
+  // if another process started to initialize the object a second ago and is
+  // still alive; remove the object with Unlink in that case.
+  ShmVerifyCache(const std::string& name, ShmVerifyCacheOptions options = {});
+
+  // Unmaps the segment. A named object stays until it is removed with Unlink.
+  ~ShmVerifyCache() override;
+
+  ShmVerifyCache(const ShmVerifyCache&) = delete;
+  ShmVerifyCache& operator=(const ShmVerifyCache&) = delete;
+
+  // Removes the shared memory object with the given name.
+  static void
+  Unlink(const std::string& name) noexcept;
+
+protected:
+  std::optional<bool>
+  Lookup(std::string_view pwd, const BcryptArr& arr) override;
+
+  void
+  Insert(std::string_view pwd, const BcryptArr& arr, bool same) override;
+
+  std::size_t
+  Size() const override;
+
+  std::uint64_t
+  Evictions() const override;
+
+private:
+  struct Header;
+  struct Entry;
+
+  // Maps the segment of fd and initializes it unless another process did.
+  void
+  Map(int fd);
+
+  const std::size_t capacity_;
+  const std::chrono::nanoseconds positive_ttl_;
+  const std::chrono::nanoseconds negative_ttl_;
+  std::size_t size_ = 0;
+  void* segment_ = nullptr;
+  Header* header_ = nullptr;
+  Entry* entries_ = nullptr;
+};
+
+} // namespace bcrypt
@@ -0,0 +1,192 @@
+#include "shm_cache.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "bcrypt.h"
+#include "gmock/gmock.h"
+
+namespace bcrypt {
+namespace {
+
+// Gives the tests direct access to the table.
+class TestCache : public ShmVerifyCache {
+public:
+  using ShmVerifyCache::ShmVerifyCache;
+  using ShmVerifyCache::Insert;
+  using ShmVerifyCache::Lookup;
+};
+
+// Runs fn in a child process and returns its exit status.
+template <typename Fn>
+int
+RunInChild(Fn fn)
+{
+  const auto pid = fork();
+  if (pid == 0) _exit(fn());
+  int status = 0;
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+class ShmVerifyCacheTest : public testing::Test {
+protected:
+  ShmVerifyCacheTest()
+    : arr_(pwd_hasher_.Generate("password", 4))
+  {}
+
+  PwdHasher pwd_hasher_;
+  BcryptArr arr_;
+};
+
+TEST_F(ShmVerifyCacheTest, HitsAfterFirstVerify) {
+  ShmVerifyCache cache({.capacity = 64});
+  EXPECT_EQ(cache.Verify(pwd_hasher_, "password", arr_), VerifyStatus::kMatch);
+  EXPECT_EQ(cache.Verify(pwd_hasher_, "password", arr_), VerifyStatus::kMatch);
+  EXPECT_EQ(cache.Verify(pwd_hasher_, "wrong", arr_), VerifyStatus::kMismatch);
+  EXPECT_EQ(cache.Verify(pwd_hasher_, "wrong", arr_), VerifyStatus::kMismatch);
+
+  const auto stats = cache.Stats();
+  EXPECT_EQ(stats.hits, 2);
+  EXPECT_EQ(stats.misses, 2);
+  EXPECT_EQ(stats.entries, 2);
+}
+
+TEST_F(ShmVerifyCacheTest, IsSharedWithForkedProcesses) {
+  ShmVerifyCache cache({.capacity = 64});
+  const auto status = RunInChild([&] {
+    return cache.Verify(pwd_hasher_, "password", arr_) == VerifyStatus::kMatch
+        ? 0 : 1;
+  });
+  ASSERT_EQ(status, 0);
+
+  EXPECT_EQ(cache.Verify(pwd_hasher_, "password", arr_), VerifyStatus::kMatch);
+  EXPECT_EQ(cache.Stats().hits, 1);
+}
+
+TEST_F(ShmVerifyCacheTest, NamedSegmentIsShared) {
+  const std::string name = "/bcrypt-test-" + std::to_string(getpid());
+  {
+    ShmVerifyCache first(name, {.capacity = 64});
+    ShmVerifyCache second(name, {.capacity = 64});
+    first.Verify(pwd_hasher_, "password", arr_);
+    second.Verify(pwd_hasher_, "password", arr_);
+    EXPECT_EQ(second.Stats().hits, 1);
+    EXPECT_THROW(ShmVerifyCache(name, {.capacity = 32}),
+                 std::invalid_argument);
+  }
+  ShmVerifyCache::Unlink(name);
+}
+
+TEST_F(ShmVerifyCacheTest, EntriesExpire) {
+  ShmVerifyCache cache({.capacity = 64,
+                        .positive_ttl = std::chrono::milliseconds(1)});
+  cache.Verify(pwd_hasher_, "password", arr_);
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  cache.Verify(pwd_hasher_, "password", arr_);
+  EXPECT_EQ(cache.Stats().hits, 0);
+}
+
+TEST_F(ShmVerifyCacheTest, EvictsWhenFull) {
+  TestCache cache({.capacity = 4});
+  for (int i = 0; i < 8; ++i)
+    cache.Insert(std::to_string(i), arr_, true);
+  EXPECT_EQ(cache.Stats().entries, 4);
+  EXPECT_EQ(cache.Stats().evictions, 4);
+  EXPECT_EQ(cache.Lookup("7", arr_), true);
+}
+
+TEST_F(ShmVerifyCacheTest, SurvivesWritersKilledMidWrite) {
+  TestCache cache({.capacity = 8});
+  for (int round = 0; round < 20; ++round) {
+    const auto pid = fork();
+    if (pid == 0) {
+      for (int i = 0;; ++i)
+        cache.Insert(std::to_string(i), arr_, i % 2);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+  }
+
+  // Every entry can still be written and read, whatever the killed writers
+  // left behind.
+  for (int i = 0; i < 64; ++i) {
+    const auto pwd = "after" + std::to_string(i);
+    cache.Insert(pwd, arr_, true);
+    EXPECT_EQ(cache.Lookup(pwd, arr_), true) << pwd;
+  }
+}
+
+// Creates the named object with its state, the first word of the header, set
+// to the ProcessToken of a child process, as if the child had died while it
+// initialized the object. If alive is true, the token of this process is
+// stored instead.
+void
+LeaveUninitialized(const std::string& name, bool alive)
+{
+  const auto write_token = [&] {
+    const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0600);
+    if (fd < 0) return 1;
+    const auto token = shm_internal::ProcessToken();
+    const auto n = pwrite(fd, &token, sizeof(token), 0);
+    close(fd);
+    return n == sizeof(token) ? 0 : 1;
+  };
+  ASSERT_EQ(alive ? write_token() : RunInChild(write_token), 0);
+}
+
+TEST_F(ShmVerifyCacheTest, RecoversFromInitializerThatDied) {
+  const std::string name = "/bcrypt-test-init-" + std::to_string(getpid());
+  LeaveUninitialized(name, false);
+  {
+    ShmVerifyCache cache(name, {.capacity = 64});
+    cache.Verify(pwd_hasher_, "password", arr_);
+    cache.Verify(pwd_hasher_, "password", arr_);
+    EXPECT_EQ(cache.Stats().hits, 1);
+  }
+  ShmVerifyCache::Unlink(name);
+}
+
+TEST_F(ShmVerifyCacheTest, ThrowsIfInitializerIsStuck) {
+  const std::string name = "/bcrypt-test-stuck-" + std::to_string(getpid());
+  LeaveUninitialized(name, true);
+  try {
+    ShmVerifyCache cache(name, {.capacity = 64});
+    ADD_FAILURE() << "expected std::runtime_error";
+  } catch (const std::runtime_error& e) {
+    EXPECT_THAT(e.what(), testing::HasSubstr("ShmVerifyCache::Unlink"));
+  }
+  ShmVerifyCache::Unlink(name);
+}
+
+TEST(ShmOwnerTest, ReusedPidIsNotAlive) {
+  const auto token = shm_internal::ProcessToken();
+  EXPECT_EQ(token & 0xffffffff, static_cast<std::uint64_t>(getpid()));
+  EXPECT_TRUE(shm_internal::IsAlive(token));
+  // The same pid with another start time is a process that exited, and
+  // whose pid was given to this one.
+  EXPECT_FALSE(shm_internal::IsAlive(token + (std::uint64_t{1} << 32)));
+
+  // A process that exited is not alive, whatever its start time.
+  const auto pid = fork();
+  if (pid == 0) _exit(0);
+  waitpid(pid, nullptr, 0);
+  EXPECT_FALSE(shm_internal::IsAlive(static_cast<std::uint32_t>(pid)));
+}
+
+TEST(ShmVerifyCacheCtorTest, ThrowsWithoutCapacity) {
+  EXPECT_THROW(ShmVerifyCache(ShmVerifyCacheOptions{.capacity = 0}), std::invalid_argument);
+}
+
+} // namespace
+} // namespace bcrypt
@@ -0,0 +1,68 @@
+#include "single_flight.h"
+
+#include <algorithm>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <utility>
+
+#include "bcrypt.h"
+#include "metrics.h"
+#include "siphash.h"
+#include "verify_cache.h"
+
+namespace bcrypt {
+
+SingleFlight::SingleFlight(PwdHasher pwd_hasher)
+  : pwd_hasher_(std::move(pwd_hasher)), mac_key_(RandomSipKey())
+{}
+
+SingleFlight::~SingleFlight()
+{
+  std::fill(mac_key_.begin(), mac_key_.end(), 0);
+}
+
+VerifyStatus
+SingleFlight::Verify(std::string_view pwd, const BcryptArr& arr)
+{
+  if (pwd.empty() or not DecodeBcrypt(arr)) {
+    RecordVerify(VerifyStatus::kInvalidHash);
+    return VerifyStatus::kInvalidHash;
+  }
+
+  const auto key = VerifyKey(mac_key_, pwd, arr);
+  std::promise<VerifyStatus> promise;
+  {
+    std::unique_lock lock(mutex_);
+    ++stats_.calls;
+    if (const auto it = inflight_.find(key); it != inflight_.end()) {
+      ++stats_.coalesced;
+      auto outcome = it->second;
+      lock.unlock();
+      const auto status = outcome.get();
+      RecordVerify(status);
+      RecordReusedVerify();
+      return status;
+    }
+    ++stats_.computations;
+    inflight_.emplace(key, promise.get_future().share());
+  }
+
+  const auto status = pwd_hasher_.Verify(pwd, arr);
+  {
+    std::lock_guard lock(mutex_);
+    inflight_.erase(key);
+  }
+  promise.set_value(status);
+  return status;
+}
+
+SingleFlightStats
+SingleFlight::Stats() const
+{
+  std::lock_guard lock(mutex_);
+  return stats_;
+}
+
+} // namespace bcrypt
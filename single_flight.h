@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <future>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+
+#include "bcrypt.h"
+#include "siphash.h"
+
+namespace bcrypt {
+
+struct SingleFlightStats {
+  // Number of calls to Verify with a valid password and hash.
+  std::uint64_t calls = 0;
+
+  // Number of hashes computed, and of calls that waited for the hash of
+  // another call instead.
+  std::uint64_t computations = 0;
+  std::uint64_t coalesced = 0;
+};
+
+// Coalesces concurrent verifications of the same password against the same
+// stored hash, e.g. during a retry storm: the first call computes the hash
+// and the calls that arrive while it runs wait for it and get its outcome.
+// Nothing is kept once the outcome is delivered, so unlike VerifyCache, a
+// later call computes the hash again. Calls are keyed by VerifyKey under a
+// random key, so the password is not kept either.
+class SingleFlight {
+public:
+  explicit SingleFlight(PwdHasher pwd_hasher = PwdHasher());
+
+  // Clears the MAC key.
+  ~SingleFlight();
+
+  SingleFlight(const SingleFlight&) = delete;
+  SingleFlight& operator=(const SingleFlight&) = delete;
+
+  // Returns PwdHasher::Verify(pwd, arr), computed by this call or by a
+  // concurrent call with the same password and hash.
+  VerifyStatus
+  Verify(std::string_view pwd, const BcryptArr& arr);
+
+  SingleFlightStats
+  Stats() const;
+
+private:
+  PwdHasher pwd_hasher_;
+  SipKey mac_key_;
+
+  mutable std::mutex mutex_;
+  // The outcomes of the hashes being computed.
+  std::unordered_map<SipDigest, std::shared_future<VerifyStatus>,
+                     SipDigestHash> inflight_;
+  SingleFlightStats stats_;
+};
+
+} // namespace bcrypt
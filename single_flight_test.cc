@@ -0,0 +1,76 @@
+#include "single_flight.h"
+
+#include <future>
+#include <thread>
+#include <vector>
+
+#include "bcrypt.h"
+#include "gmock/gmock.h"
+
+namespace bcrypt {
+namespace {
+
+class SingleFlightTest : public testing::Test {
+protected:
+  SingleFlightTest()
+    : arr_(PwdHasher().Generate("password", 4))
+  {}
+
+  BcryptArr arr_;
+};
+
+TEST_F(SingleFlightTest, VerifiesPasswords) {
+  SingleFlight single_flight;
+  EXPECT_EQ(single_flight.Verify("password", arr_), VerifyStatus::kMatch);
+  EXPECT_EQ(single_flight.Verify("wrong", arr_), VerifyStatus::kMismatch);
+  EXPECT_EQ(single_flight.Verify("", arr_), VerifyStatus::kInvalidHash);
+  EXPECT_EQ(single_flight.Verify("password", BcryptArr{}),
+            VerifyStatus::kInvalidHash);
+}
+
+TEST_F(SingleFlightTest, SequentialCallsAreNotCoalesced) {
+  SingleFlight single_flight;
+  single_flight.Verify("password", arr_);
+  single_flight.Verify("password", arr_);
+
+  const auto stats = single_flight.Stats();
+  EXPECT_EQ(stats.calls, 2);
+  EXPECT_EQ(stats.computations, 2);
+  EXPECT_EQ(stats.coalesced, 0);
+}
+
+TEST_F(SingleFlightTest, ConcurrentCallsShareOneHash) {
+  // Enough rounds that the hash is still running when the other calls come.
+  const auto arr = PwdHasher().Generate("password", 31);
+  SingleFlight single_flight;
+  std::vector<std::future<VerifyStatus>> results;
+  for (int i = 0; i < 8; ++i) {
+    results.push_back(std::async(std::launch::async, [&] {
+      return single_flight.Verify("password", arr);
+    }));
+  }
+  for (auto& result : results)
+    EXPECT_EQ(result.get(), VerifyStatus::kMatch);
+
+  const auto stats = single_flight.Stats();
+  EXPECT_EQ(stats.calls, 8);
+  EXPECT_EQ(stats.computations + stats.coalesced, 8);
+  EXPECT_LT(stats.computations, 8);
+}
+
+TEST_F(SingleFlightTest, DifferentPasswordsAreNotCoalesced) {
+  const auto arr = PwdHasher().Generate("password", 31);
+  SingleFlight single_flight;
+  auto right = std::async(std::launch::async, [&] {
+    return single_flight.Verify("password", arr);
+  });
+  auto wrong = std::async(std::launch::async, [&] {
+    return single_flight.Verify("wrong", arr);
+  });
+  EXPECT_EQ(right.get(), VerifyStatus::kMatch);
+  EXPECT_EQ(wrong.get(), VerifyStatus::kMismatch);
+  EXPECT_EQ(single_flight.Stats().computations, 2);
+}
+
+} // namespace
+} // namespace bcrypt
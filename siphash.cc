@@ -0,0 +1,119 @@
+#include "siphash.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+#include "random.h"
+
+namespace bcrypt {
+namespace {
+std::uint64_t
+LoadLe64(const std::uint8_t* p) noexcept
+{
+  std::uint64_t x = 0;
+  for (int i = 7; i >= 0; --i)
+    x = (x << 8) | p[i];
+  return x;
+}
+
+void
+StoreLe64(std::uint64_t x, std::uint8_t* p) noexcept
+{
+  for (int i = 0; i < 8; ++i, x >>= 8)
+    p[i] = static_cast<std::uint8_t>(x);
+}
+} // namespace
+
+SipKey
+RandomSipKey()
+{
+  SipKey key;
+  RandomBytes(key);
+  return key;
+}
+
+std::size_t
+SipDigestHash::operator()(const SipDigest& digest) const noexcept
+{
+  // The digest is already uniform, so any 8 bytes of it will do.
+  std::size_t h;
+  std::memcpy(&h, digest.data() + 8, sizeof(h));
+  return h;
+}
+
+SipHasher::SipHasher(const SipKey& key) noexcept
+{
+  const auto k0 = LoadLe64(key.data());
+  const auto k1 = LoadLe64(key.data() + 8);
+  v_[0] = k0 ^ 0x736f6d6570736575;
+  // The 128-bit variant flips a bit of v1.
+  v_[1] = k1 ^ 0x646f72616e646f6d ^ 0xee;
+  v_[2] = k0 ^ 0x6c7967656e657261;
+  v_[3] = k1 ^ 0x7465646279746573;
+}
+
+void
+SipHasher::Round() noexcept
+{
+  v_[0] += v_[1]; v_[1] = std::rotl(v_[1], 13); v_[1] ^= v_[0];
+  v_[0] = std::rotl(v_[0], 32);
+  v_[2] += v_[3]; v_[3] = std::rotl(v_[3], 16); v_[3] ^= v_[2];
+  v_[0] += v_[3]; v_[3] = std::rotl(v_[3], 21); v_[3] ^= v_[0];
+  v_[2] += v_[1]; v_[1] = std::rotl(v_[1], 17); v_[1] ^= v_[2];
+  v_[2] = std::rotl(v_[2], 32);
+}
+
+void
+SipHasher::Compress(std::uint64_t m) noexcept
+{
+  v_[3] ^= m;
+  Round();
+  Round();
+  v_[0] ^= m;
+}
+
+void
+SipHasher::Update(std::span<const std::uint8_t> data) noexcept
+{
+  size_ += data.size();
+  if (tail_size_ > 0) {
+    const auto n = std::min(data.size(), 8 - tail_size_);
+    std::copy_n(data.begin(), n, tail_ + tail_size_);
+    tail_size_ += n;
+    data = data.subspan(n);
+    if (tail_size_ < 8) return;
+    Compress(LoadLe64(tail_));
+    tail_size_ = 0;
+  }
+  for (; data.size() >= 8; data = data.subspan(8))
+    Compress(LoadLe64(data.data()));
+  std::copy(data.begin(), data.end(), tail_);
+  tail_size_ = data.size();
+}
+
+SipDigest
+SipHasher::Finish() noexcept
+{
+  std::fill(tail_ + tail_size_, tail_ + 8, 0);
+  tail_[7] = static_cast<std::uint8_t>(size_);
+  Compress(LoadLe64(tail_));
+
+  SipDigest digest;
+  v_[2] ^= 0xee;
+  for (int i = 0; i < 4; ++i) Round();
+  StoreLe64(v_[0] ^ v_[1] ^ v_[2] ^ v_[3], digest.data());
+  v_[1] ^= 0xdd;
+  for (int i = 0; i < 4; ++i) Round();
+  StoreLe64(v_[0] ^ v_[1] ^ v_[2] ^ v_[3], digest.data() + 8);
+
+  // Clear memory.
+  std::fill_n(v_, 4, 0);
+  std::fill_n(tail_, 8, 0);
+  return digest;
+}
+
+} // namespace bcrypt
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace bcrypt {
+
+// 128-bit SipHash key.
+using SipKey = std::array<std::uint8_t, 16>;
+
+// 128-bit SipHash output.
+using SipDigest = std::array<std::uint8_t, 16>;
+
+// Incremental SipHash-2-4 with 128-bit output, a keyed MAC that is fast on
+// short inputs. Without the key, its outputs cannot be computed or inverted,
+// so they can stand in for secrets in memory.
+class SipHasher {
+public:
+  explicit SipHasher(const SipKey& key) noexcept;
+
+  // Hashes more bytes of the message.
+  void
+  Update(std::span<const std::uint8_t> data) noexcept;
+
+  // Returns the MAC of the message. The hasher cannot be used after.
+  SipDigest
+  Finish() noexcept;
+
+private:
+  void
+  Compress(std::uint64_t m) noexcept;
+
+  void
+  Round() noexcept;
+
+  std::uint64_t v_[4];
+  std::uint8_t tail_[8] = {};
+  std::size_t tail_size_ = 0;
+  std::uint64_t size_ = 0;
+};
+
+// Returns a key from RandomBytes.
+SipKey
+RandomSipKey();
+
+// Hash for unordered containers keyed by SipDigest.
+struct SipDigestHash {
+  std::size_t
+  operator()(const SipDigest& digest) const noexcept;
+};
+
+} // namespace bcrypt
@@ -0,0 +1,52 @@
+#include "siphash.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "gmock/gmock.h"
+
+namespace bcrypt {
+namespace {
+
+// Key 00 01 .. 0f, as in the reference test vectors.
+SipKey
+TestKey()
+{
+  SipKey key;
+  for (int i = 0; i < 16; ++i) key[i] = i;
+  return key;
+}
+
+// Returns the MAC of the message 00 01 .. size-1.
+SipDigest
+Mac(std::size_t size)
+{
+  std::vector<std::uint8_t> msg(size);
+  for (std::size_t i = 0; i < size; ++i) msg[i] = i;
+  SipHasher hasher(TestKey());
+  hasher.Update(msg);
+  return hasher.Finish();
+}
+
+TEST(SipHasherTest, MatchesReferenceVectors) {
+  EXPECT_EQ(Mac(0), (SipDigest{0xa3, 0x81, 0x7f, 0x04, 0xba, 0x25, 0xa8, 0xe6,
+                               0x6d, 0xf6, 0x72, 0x14, 0xc7, 0x55, 0x02, 0x93}));
+  EXPECT_EQ(Mac(1), (SipDigest{0xda, 0x87, 0xc1, 0xd8, 0x6b, 0x99, 0xaf, 0x44,
+                               0x34, 0x76, 0x59, 0x11, 0x9b, 0x22, 0xfc, 0x45}));
+  EXPECT_EQ(Mac(63), (SipDigest{0x51, 0x50, 0xd1, 0x77, 0x2f, 0x50, 0x83, 0x4a,
+                                0x50, 0x3e, 0x06, 0x9a, 0x97, 0x3f, 0xbd, 0x7c}));
+}
+
+TEST(SipHasherTest, UpdatesCanBeSplitAnywhere) {
+  std::vector<std::uint8_t> msg(40);
+  for (std::size_t i = 0; i < msg.size(); ++i) msg[i] = i;
+  for (std::size_t split : {1, 3, 8, 13, 39}) {
+    SipHasher hasher(TestKey());
+    hasher.Update(std::span(msg).first(split));
+    hasher.Update(std::span(msg).subspan(split));
+    EXPECT_EQ(hasher.Finish(), Mac(msg.size())) << "split " << split;
+  }
+}
+
+} // namespace
+} // namespace bcrypt
@@ -0,0 +1,61 @@
+#include "stepper.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+
+#include "bcrypt.h"
+#include "blowfish.h"
+#include "kernel.h"
+
+namespace bcrypt {
+
+struct HashStepper::State {
+  KeySchedule ks;
+  std::uint32_t salt_key[kNumPWords];
+  Context ctx;
+};
+
+HashStepper::HashStepper(
+    std::string_view pwd, const Salt& salt, std::uint32_t rounds)
+  : state_(std::make_unique<State>()),
+    rounds_(rounds)
+{
+  ExpandKey(pwd, salt, &state_->ks);
+  for (int i = 0; i < kNumPWords; ++i)
+    state_->salt_key[i] = state_->ks.salt[i % kNumSaltWords];
+}
+
+HashStepper::~HashStepper()
+{
+  // Clear memory.
+  std::fill_n(reinterpret_cast<char*>(state_.get()), sizeof(State), 0);
+}
+
+bool
+HashStepper::Step(std::uint32_t max_iterations) noexcept
+{
+  for (std::uint32_t n = 0; n < max_iterations and not done_; ++n) {
+    if (iterations_ == 0)
+      ScalarSetup(state_->ks, &state_->ctx);
+    else
+      ScalarIterate(state_->ks, state_->salt_key, &state_->ctx);
+    if (++iterations_ == rounds_ + 1) {
+      ScalarFinish(&state_->ctx, &result_);
+      done_ = true;
+    }
+  }
+  return done_;
+}
+
+const PwdHash&
+HashStepper::Result() const
+{
+  if (not done_)
+    throw std::logic_error("The hash is not done.");
+  return result_;
+}
+
+} // namespace bcrypt
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+#include "bcrypt.h"
+
+namespace bcrypt {
+
+// A bcrypt hash that runs a few iterations of the cost loop at a time, so a
+// single-threaded event loop can interleave many hashes with its other work
+// and bound the time of each slice. The result is the same as GenHash.
+//
+// Setting up the state counts as one iteration, and the final encryption is
+// done by the Step that runs the last iteration. A stepper allocates about 4KB
+// of state, which is cleared when it is destroyed.
+class HashStepper {
+public:
+  // Prepares to hash the first 72 bytes of pwd. An empty pwd is hashed as a
+  // single NUL byte, like GenHash does. Nothing is hashed until Step is
+  // called.
+  HashStepper(std::string_view pwd, const Salt& salt, std::uint32_t rounds);
+
+  ~HashStepper();
+
+  HashStepper(const HashStepper&) = delete;
+  HashStepper& operator=(const HashStepper&) = delete;
+
+  // Runs up to max_iterations iterations and returns true if the hash is
+  // done.
+  bool
+  Step(std::uint32_t max_iterations = 1) noexcept;
+
+  bool
+  Done() const noexcept { return done_; }
+
+  // Returns the number of iterations that Step still has to run.
+  std::uint32_t
+  Remaining() const noexcept { return rounds_ + 1 - iterations_; }
+
+  // Returns the hash. Throws std::logic_error if it is not done.
+  const PwdHash&
+  Result() const;
+
+private:
+  // The key schedule and Blowfish state, defined in stepper.cc so that this
+  // header does not expose the kernel interface.
+  struct State;
+
+  std::unique_ptr<State> state_;
+  const std::uint32_t rounds_;
+  // Iterations run so far, including the setup.
+  std::uint32_t iterations_ = 0;
+  bool done_ = false;
+  PwdHash result_{};
+};
+
+} // namespace bcrypt
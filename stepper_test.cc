@@ -0,0 +1,74 @@
+#include "stepper.h"
+
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "bcrypt.h"
+#include "gmock/gmock.h"
+
+namespace bcrypt {
+namespace {
+
+TEST(HashStepperTest, IsSameAsGenHash) {
+  const Salt salt{9, 8, 7, 6, 5, 4, 3, 2, 1};
+  for (std::uint32_t rounds : {4, 5, 9}) {
+    for (std::uint32_t step : {1, 2, 3, 100}) {
+      HashStepper stepper("password", salt, rounds);
+      while (not stepper.Step(step)) {}
+      EXPECT_EQ(stepper.Result(), GenHash("password", salt, rounds))
+          << "rounds " << rounds << ", step " << step;
+    }
+  }
+}
+
+TEST(HashStepperTest, HashesEmptyPasswordAsGenHash) {
+  HashStepper stepper("", Salt{}, 4);
+  while (not stepper.Step(2)) {}
+  EXPECT_EQ(stepper.Result(), GenHash("", Salt{}, 4));
+}
+
+TEST(HashStepperTest, CountsIterations) {
+  HashStepper stepper("password", Salt{}, 4);
+  EXPECT_EQ(stepper.Remaining(), 5);
+  EXPECT_FALSE(stepper.Step(2));
+  EXPECT_EQ(stepper.Remaining(), 3);
+  EXPECT_FALSE(stepper.Done());
+  EXPECT_TRUE(stepper.Step(10));
+  EXPECT_EQ(stepper.Remaining(), 0);
+  EXPECT_TRUE(stepper.Done());
+  EXPECT_TRUE(stepper.Step());
+}
+
+TEST(HashStepperTest, ResultThrowsIfNotDone) {
+  HashStepper stepper("password", Salt{}, 4);
+  stepper.Step();
+  EXPECT_THROW(stepper.Result(), std::logic_error);
+}
+
+TEST(HashStepperTest, InterleavedHashesAreIndependent) {
+  std::vector<std::string> pwds = {"a", "password", "hunter2", "correct horse"};
+  std::vector<std::unique_ptr<HashStepper>> steppers;
+  for (std::size_t i = 0; i < pwds.size(); ++i) {
+    const Salt salt{static_cast<std::uint8_t>(i)};
+    steppers.push_back(
+        std::make_unique<HashStepper>(pwds[i], salt, 4 + i));
+  }
+
+  // Round robin, like an event loop giving each hash a slice.
+  for (bool busy = true; busy;) {
+    busy = false;
+    for (auto& stepper : steppers)
+      busy |= not stepper->Step();
+  }
+
+  for (std::size_t i = 0; i < pwds.size(); ++i) {
+    const Salt salt{static_cast<std::uint8_t>(i)};
+    EXPECT_EQ(steppers[i]->Result(), GenHash(pwds[i], salt, 4 + i));
+  }
+}
+
+} // namespace
+} // namespace bcrypt
@@ -0,0 +1,101 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace bcrypt {
+
+void
+ParallelFor(
+    Executor& executor,
+    std::size_t n,
+    double cost,
+    const std::function<void(std::size_t)>& fn)
+{
+  struct State {
+    std::atomic<std::size_t> next = 0;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::size_t active = 0;
+    bool done = false;
+  };
+  auto state = std::make_shared<State>();
+  const auto run = [n, &fn](State& st) {
+    for (auto i = st.next++; i < n; i = st.next++)
+      fn(i);
+  };
+
+  const auto num_helpers = std::min(executor.Concurrency(), n > 0 ? n - 1 : 0);
+  for (std::size_t i = 0; i < num_helpers; ++i) {
+    executor.SubmitWithCost([state, run] {
+      {
+        std::lock_guard lock(state->mutex);
+        if (state->done) return;
+        ++state->active;
+      }
+      run(*state);
+      std::lock_guard lock(state->mutex);
+      if (--state->active == 0) state->cond.notify_one();
+    }, cost);
+  }
+
+  run(*state);
+  std::unique_lock lock(state->mutex);
+  state->done = true;
+  state->cond.wait(lock, [&] { return state->active == 0; });
+}
+
+ThreadPool::ThreadPool(std::size_t num_threads)
+{
+  if (num_threads == 0)
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  workers_.reserve(num_threads);
+  for (std::size_t i = 0; i < num_threads; ++i)
+    workers_.emplace_back([this] { Work(); });
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_all();
+  for (auto& worker : workers_)
+    worker.join();
+}
+
+void
+ThreadPool::Submit(std::function<void()> task)
+{
+  {
+    std::lock_guard lock(mutex_);
+    tasks_.push_back(std::move(task));
+  }
+  cond_.notify_one();
+}
+
+void
+ThreadPool::Work()
+{
+  for (;;) {
+    std::function<void()> task;
+    {
+      std::unique_lock lock(mutex_);
+      cond_.wait(lock, [this] { return stop_ or not tasks_.empty(); });
+      if (tasks_.empty()) return;
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+    task();
+  }
+}
+
+} // namespace bcrypt
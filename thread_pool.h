@@ -0,0 +1,96 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace bcrypt {
+
+// Something that runs tasks, e.g. a pool of threads.
+class Executor {
+public:
+  virtual ~Executor() = default;
+
+  // Schedules the task to run on one of the executor's threads.
+  virtual void
+  Submit(std::function<void()> task) = 0;
+
+  // Like Submit, with an estimate of the work in the task in HashCost units.
+  // Executors that do not schedule by cost ignore it.
+  virtual void
+  SubmitWithCost(std::function<void()> task, double /*cost*/)
+  {
+    Submit(std::move(task));
+  }
+
+  // Returns the number of tasks that the executor runs at once. By default,
+  // the number of cores.
+  virtual std::size_t
+  Concurrency() const noexcept
+  {
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+};
+
+// Calls fn(i) for every i in [0, n) and returns once all the calls are done.
+// The calls are spread over the calling thread and helper tasks submitted to
+// the executor, one per thread it runs, each with the given cost, e.g. the
+// HashCost of the hashes it runs. Helpers that have not started by the time
+// the caller is done do nothing, so a ParallelFor called from a busy task of
+// the executor cannot wait on itself.
+void
+ParallelFor(
+    Executor& executor,
+    std::size_t n,
+    double cost,
+    const std::function<void(std::size_t)>& fn);
+
+// A fixed set of worker threads that run tasks in the order they are
+// submitted. The pool can be shared by any number of callers and batches.
+class ThreadPool : public Executor {
+public:
+  // Starts num_threads workers, or one per core if num_threads is 0.
+  explicit ThreadPool(std::size_t num_threads = 0);
+
+  // Runs the tasks that are still queued, then joins the workers.
+  ~ThreadPool() override;
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Returns the number of workers.
+  std::size_t
+  Size() const noexcept { return workers_.size(); }
+
+  std::size_t
+  Concurrency() const noexcept override { return Size(); }
+
+  void
+  Submit(std::function<void()> task) override;
+
+  // Calls fn(i) for every i in [0, n) and returns once all the calls are done.
+  // The calls are spread over the workers and the calling thread.
+  void
+  ParallelFor(std::size_t n, const std::function<void(std::size_t)>& fn)
+  {
+    bcrypt::ParallelFor(*this, n, 1, fn);
+  }
+
+private:
+  void
+  Work();
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::deque<std::function<void()>> tasks_;
+  bool stop_ = false;
+  std::vector<std::thread> workers_;
+};
+
+} // namespace bcrypt
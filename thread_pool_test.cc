@@ -0,0 +1,57 @@
+#include "thread_pool.h"
+
+#include <atomic>
+#include <cstddef>
+#include <future>
+#include <vector>
+
+#include "gmock/gmock.h"
+
+namespace bcrypt {
+namespace {
+
+TEST(ThreadPoolTest, DefaultSizeIsAtLeastOne) {
+  ThreadPool pool;
+  EXPECT_GE(pool.Size(), 1);
+}
+
+TEST(ThreadPoolTest, SubmitRunsTask) {
+  ThreadPool pool(2);
+  std::promise<int> promise;
+  pool.Submit([&] { promise.set_value(42); });
+  EXPECT_EQ(promise.get_future().get(), 42);
+}
+
+TEST(ThreadPoolTest, DestructorRunsQueuedTasks) {
+  std::atomic<int> count = 0;
+  {
+    ThreadPool pool(1);
+    for (int i = 0; i < 100; ++i)
+      pool.Submit([&] { ++count; });
+  }
+  EXPECT_EQ(count, 100);
+}
+
+TEST(ThreadPoolTest, ParallelForCallsEveryIndexOnce) {
+  ThreadPool pool(4);
+  for (std::size_t n : {0, 1, 3, 1000}) {
+    std::vector<std::atomic<int>> calls(n);
+    pool.ParallelFor(n, [&](std::size_t i) { ++calls[i]; });
+    for (std::size_t i = 0; i < n; ++i)
+      EXPECT_EQ(calls[i], 1) << "for index " << i << " of " << n;
+  }
+}
+
+TEST(ThreadPoolTest, ParallelForFromWorkerDoesNotDeadlock) {
+  ThreadPool pool(1);
+  std::promise<int> promise;
+  pool.Submit([&] {
+    std::atomic<int> sum = 0;
+    pool.ParallelFor(10, [&](std::size_t i) { sum += i; });
+    promise.set_value(sum);
+  });
+  EXPECT_EQ(promise.get_future().get(), 45);
+}
+
+} // namespace
+} // namespace bcrypt
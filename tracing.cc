@@ -0,0 +1,222 @@
+#include "tracing.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace bcrypt {
+namespace {
+
+// The spans of one thread. The thread is the only writer. Readers copy the
+// spans out like a seqlock: a span is only kept if it was not overwritten
+// while it was read.
+class Ring {
+public:
+  Ring() : tid_(static_cast<int>(::syscall(SYS_gettid))) {}
+
+  // Hands the ring over to the calling thread, dropping the spans of the
+  // thread that exited. Called with rings_mutex held, before the thread
+  // records a span.
+  void
+  Reuse() noexcept
+  {
+    tid_ = static_cast<int>(::syscall(SYS_gettid));
+    Clear();
+  }
+
+  void
+  Push(const char* name, std::uint64_t start, std::uint64_t end) noexcept
+  {
+    const auto n = head_.load(std::memory_order_relaxed);
+    writing_.store(n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    auto& event = events_[n % kTraceEventsPerThread];
+    event.name.store(name, std::memory_order_relaxed);
+    event.start.store(start, std::memory_order_relaxed);
+    event.end.store(end, std::memory_order_relaxed);
+    head_.store(n + 1, std::memory_order_release);
+  }
+
+  void
+  Clear() noexcept
+  {
+    first_.store(head_.load(std::memory_order_acquire),
+                 std::memory_order_relaxed);
+  }
+
+  // Appends the spans to the JSON array.
+  void
+  AppendJson(std::string* json, bool* first_event) const
+  {
+    const auto head = head_.load(std::memory_order_acquire);
+    const auto first = std::max(
+        first_.load(std::memory_order_relaxed),
+        head > kTraceEventsPerThread ? head - kTraceEventsPerThread : 0);
+    struct Span {
+      const char* name;
+      std::uint64_t start;
+      std::uint64_t end;
+    };
+    std::vector<Span> spans;
+    spans.reserve(head - first);
+    for (auto i = first; i < head; ++i) {
+      const auto& event = events_[i % kTraceEventsPerThread];
+      spans.push_back({event.name.load(std::memory_order_relaxed),
+                       event.start.load(std::memory_order_relaxed),
+                       event.end.load(std::memory_order_relaxed)});
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // The span being written when the copy ended overwrote the slot of index
+    // writing - 1 - kTraceEventsPerThread, and every span before it.
+    const auto writing = writing_.load(std::memory_order_relaxed);
+    const auto valid = writing > kTraceEventsPerThread
+        ? writing - kTraceEventsPerThread : 0;
+
+    auto out = std::back_inserter(*json);
+    for (auto i = std::max(first, valid); i < head; ++i) {
+      const auto& span = spans[i - first];
+      fmt::format_to(out,
+                     "{}\n{{\"name\":\"{}\",\"cat\":\"bcrypt\",\"ph\":\"X\","
+                     "\"ts\":{:.3f},\"dur\":{:.3f},\"pid\":{},\"tid\":{}}}",
+                     *first_event ? "" : ",", span.name, span.start / 1e3,
+                     (span.end - span.start) / 1e3, ::getpid(), tid_);
+      *first_event = false;
+    }
+  }
+
+private:
+  struct Event {
+    std::atomic<const char*> name = nullptr;
+    std::atomic<std::uint64_t> start = 0;
+    std::atomic<std::uint64_t> end = 0;
+  };
+
+  int tid_;
+  // Number of spans written, and started.
+  std::atomic<std::uint64_t> head_ = 0;
+  std::atomic<std::uint64_t> writing_ = 0;
+  // Index of the first span since the last Clear.
+  std::atomic<std::uint64_t> first_ = 0;
+  Event events_[kTraceEventsPerThread];
+};
+
+// The rings of every thread that recorded a span. When a thread exits, its
+// ring goes to the back of free_rings, and keeps its spans until the next
+// thread that records a span takes the oldest free ring. There are thus only
+// as many rings as threads that recorded spans at the same time.
+std::mutex rings_mutex;
+std::vector<std::unique_ptr<Ring>> rings;
+std::deque<Ring*> free_rings;
+
+// The ring of a thread, which it hands back when it exits.
+class LocalRingOwner {
+public:
+  LocalRingOwner()
+  {
+    std::lock_guard lock(rings_mutex);
+    if (free_rings.empty()) {
+      rings.push_back(std::make_unique<Ring>());
+      ring_ = rings.back().get();
+    } else {
+      ring_ = free_rings.front();
+      free_rings.pop_front();
+      ring_->Reuse();
+    }
+  }
+
+  ~LocalRingOwner()
+  {
+    std::lock_guard lock(rings_mutex);
+    free_rings.push_back(ring_);
+  }
+
+  LocalRingOwner(const LocalRingOwner&) = delete;
+  LocalRingOwner& operator=(const LocalRingOwner&) = delete;
+
+  Ring&
+  Get() noexcept { return *ring_; }
+
+private:
+  Ring* ring_ = nullptr;
+};
+
+Ring&
+LocalRing()
+{
+  thread_local LocalRingOwner owner;
+  return owner.Get();
+}
+
+} // namespace
+
+namespace trace_internal {
+
+std::uint64_t
+Now() noexcept
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void
+Record(const char* name, std::uint64_t start, std::uint64_t end) noexcept
+{
+  // Allocating the ring the first time can throw, in which case the span is
+  // dropped.
+  try {
+    LocalRing().Push(name, start, end);
+  } catch (...) {
+  }
+}
+
+std::size_t
+NumRings() noexcept
+{
+  std::lock_guard lock(rings_mutex);
+  return rings.size();
+}
+
+} // namespace trace_internal
+
+void
+SetTracing(bool on) noexcept
+{
+  trace_internal::enabled.store(on, std::memory_order_relaxed);
+}
+
+void
+ClearTrace() noexcept
+{
+  std::lock_guard lock(rings_mutex);
+  for (const auto& ring : rings)
+    ring->Clear();
+}
+
+std::string
+TraceJson()
+{
+  std::string json = "{\"traceEvents\":[";
+  bool first_event = true;
+  {
+    std::lock_guard lock(rings_mutex);
+    for (const auto& ring : rings)
+      ring->AppendJson(&json, &first_event);
+  }
+  json += "\n],\"displayTimeUnit\":\"ns\"}\n";
+  return json;
+}
+
+} // namespace bcrypt
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace bcrypt {
+
+namespace trace_internal {
+inline std::atomic<bool> enabled = false;
+
+// Returns the steady clock in nanoseconds.
+std::uint64_t
+Now() noexcept;
+
+// Appends the span to the ring buffer of the calling thread.
+void
+Record(const char* name, std::uint64_t start, std::uint64_t end) noexcept;
+
+// Returns the number of ring buffers allocated so far, for tests.
+std::size_t
+NumRings() noexcept;
+} // namespace trace_internal
+
+// Turns tracing on or off. It is off by default.
+void
+SetTracing(bool on) noexcept;
+
+inline bool
+TracingEnabled() noexcept
+{
+  return trace_internal::enabled.load(std::memory_order_relaxed);
+}
+
+// Drops the spans recorded so far.
+void
+ClearTrace() noexcept;
+
+// Returns the spans recorded since the last ClearTrace in the Chrome trace
+// event format, which Perfetto and chrome://tracing open. Each thread keeps
+// its last kTraceEventsPerThread spans. The ring buffer of a thread that
+// exits is reused by the next new thread that records a span, so the spans
+// of an exited thread are kept until then. Spans are taken while other
+// threads keep recording, without stopping them.
+std::string
+TraceJson();
+
+constexpr std::size_t kTraceEventsPerThread = 1 << 14;
+
+// Records a span from its construction to its destruction, if tracing is on
+// when it is constructed. name must outlive the trace, e.g. a literal. With
+// tracing off, a span costs a relaxed load and a branch.
+class TraceSpan {
+public:
+  explicit TraceSpan(const char* name) noexcept
+    : name_(name), start_(TracingEnabled() ? trace_internal::Now() : 0)
+  {}
+
+  ~TraceSpan()
+  {
+    if (start_) trace_internal::Record(name_, start_, trace_internal::Now());
+  }
+
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+  const char* const name_;
+  const std::uint64_t start_;
+};
+
+// For spans that start on one thread and end on another, e.g. the time a job
+// waits in a queue: returns the start of the span, or 0 if tracing is off.
+inline std::uint64_t
+TraceStart() noexcept
+{
+  return TracingEnabled() ? trace_internal::Now() : 0;
+}
+
+// Records the span from start, as returned by TraceStart, to now on the
+// calling thread. Does nothing if start is 0.
+inline void
+TraceEnd(const char* name, std::uint64_t start) noexcept
+{
+  if (start) trace_internal::Record(name, start, trace_internal::Now());
+}
+
+} // namespace bcrypt
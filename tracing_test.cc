@@ -0,0 +1,130 @@
+#include "tracing.h"
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "gmock/gmock.h"
+
+#include "async.h"
+#include "bcrypt.h"
+#include "thread_pool.h"
+
+namespace bcrypt {
+namespace {
+
+using ::testing::HasSubstr;
+using ::testing::StartsWith;
+
+// Returns the number of spans with the given name in the trace.
+std::size_t
+CountSpans(const std::string& json, std::string_view name)
+{
+  const auto needle = "\"name\":\"" + std::string(name) + "\"";
+  std::size_t count = 0;
+  for (auto pos = json.find(needle); pos != std::string::npos;
+       pos = json.find(needle, pos + 1))
+    ++count;
+  return count;
+}
+
+class TracingTest : public ::testing::Test {
+protected:
+  void
+  SetUp() override
+  {
+    SetTracing(true);
+    ClearTrace();
+  }
+
+  void
+  TearDown() override
+  {
+    SetTracing(false);
+    ClearTrace();
+  }
+};
+
+TEST_F(TracingTest, OffRecordsNothing) {
+  SetTracing(false);
+  EXPECT_EQ(TraceStart(), 0);
+  PwdHasher().Generate("password", 4);
+  EXPECT_EQ(CountSpans(TraceJson(), "GenHash"), 0);
+}
+
+TEST_F(TracingTest, PhasesOfGenerateAndVerify) {
+  const PwdHasher pwd_hasher;
+  const auto arr = pwd_hasher.Generate("password", 4);
+  EXPECT_TRUE(pwd_hasher.IsSamePwd("password", arr));
+
+  const auto json = TraceJson();
+  EXPECT_THAT(json, StartsWith("{\"traceEvents\":["));
+  EXPECT_THAT(json, HasSubstr("\"ph\":\"X\""));
+  EXPECT_EQ(CountSpans(json, "PwdHasher::Generate"), 1);
+  EXPECT_EQ(CountSpans(json, "GenSalt"), 1);
+  EXPECT_EQ(CountSpans(json, "EncodeBcrypt"), 1);
+  EXPECT_EQ(CountSpans(json, "PwdHasher::Verify"), 1);
+  EXPECT_EQ(CountSpans(json, "GenHash"), 2);
+  EXPECT_EQ(CountSpans(json, "expandstate"), 2);
+  EXPECT_EQ(CountSpans(json, "cost loop"), 2);
+  EXPECT_EQ(CountSpans(json, "encrypt ctext"), 2);
+
+  ClearTrace();
+  EXPECT_EQ(CountSpans(TraceJson(), "GenHash"), 0);
+}
+
+TEST_F(TracingTest, QueueTimeOfAsyncCalls) {
+  ThreadPool pool(1);
+  const AsyncPwdHasher async_hasher(PwdHasher(), pool);
+  const auto arr = PwdHasher().Generate("password", 4);
+  EXPECT_TRUE(async_hasher.IsSamePwd("password", arr).get());
+  EXPECT_EQ(CountSpans(TraceJson(), "queue"), 1);
+}
+
+TEST_F(TracingTest, KeepsTheLastSpansOfEachThread) {
+  for (std::size_t i = 0; i < kTraceEventsPerThread + 10; ++i)
+    const TraceSpan span("span");
+  std::thread([] { const TraceSpan span("other thread"); }).join();
+
+  const auto json = TraceJson();
+  EXPECT_EQ(CountSpans(json, "span"), kTraceEventsPerThread);
+  EXPECT_EQ(CountSpans(json, "other thread"), 1);
+}
+
+TEST_F(TracingTest, ReusesTheRingsOfExitedThreads) {
+  std::thread([] { const TraceSpan span("first"); }).join();
+  const auto num_rings = trace_internal::NumRings();
+  for (int i = 0; i < 100; ++i)
+    std::thread([] { const TraceSpan span("next"); }).join();
+  EXPECT_EQ(trace_internal::NumRings(), num_rings);
+
+  // The spans of an exited thread are dropped once its ring is reused.
+  const auto json = TraceJson();
+  EXPECT_EQ(CountSpans(json, "first"), 0);
+  EXPECT_GE(CountSpans(json, "next"), 1);
+}
+
+TEST_F(TracingTest, DumpWhileRecording) {
+  std::atomic<bool> stop = false;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 2; ++t) {
+    threads.emplace_back([&] {
+      while (not stop)
+        const TraceSpan span("busy");
+    });
+  }
+  for (int i = 0; i < 20; ++i) {
+    const auto json = TraceJson();
+    EXPECT_THAT(json, HasSubstr("]"));
+    EXPECT_LE(CountSpans(json, "busy"), 2 * kTraceEventsPerThread);
+  }
+  stop = true;
+  for (auto& thread : threads)
+    thread.join();
+}
+
+} // namespace
+} // namespace bcrypt
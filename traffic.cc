@@ -0,0 +1,154 @@
+#include "traffic.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "kernel.h"
+
+namespace bcrypt {
+namespace {
+
+bool
+IsFraction(double x) noexcept
+{
+  return x >= 0 and x <= 1;
+}
+
+// Checks that the mix is not empty and its weights are not negative, with a
+// positive sum.
+template <typename T>
+void
+CheckMix(const std::vector<std::pair<T, double>>& mix, const char* name)
+{
+  double sum = 0;
+  for (const auto& [value, weight] : mix) {
+    if (not (weight >= 0))
+      throw std::invalid_argument(std::string(name) + " has a bad weight.");
+    sum += weight;
+  }
+  if (not (sum > 0))
+    throw std::invalid_argument(std::string(name) + " has no weight.");
+}
+
+// Picks a value of the mix with the probability of its weight.
+template <typename T>
+T
+Pick(const std::vector<std::pair<T, double>>& mix, std::mt19937_64& rng)
+{
+  std::vector<double> weights;
+  weights.reserve(mix.size());
+  for (const auto& [value, weight] : mix)
+    weights.push_back(weight);
+  std::discrete_distribution<std::size_t> dist(weights.begin(), weights.end());
+  return mix[dist(rng)].first;
+}
+
+double
+Exponential(double rate, std::mt19937_64& rng)
+{
+  return std::exponential_distribution<double>(rate)(rng);
+}
+
+} // namespace
+
+TrafficModel::TrafficModel(TrafficOptions options)
+  : options_(std::move(options)),
+    rng_(options_.seed)
+{
+  if (not (options_.rate > 0))
+    throw std::invalid_argument("rate should be positive.");
+  if (not (options_.burst_factor >= 1))
+    throw std::invalid_argument("burst_factor should be at least 1.");
+  if (options_.arrivals == Arrivals::kBursty
+      and options_.burst_length.count() <= 0)
+    throw std::invalid_argument("burst_length should be positive.");
+  if (options_.users == 0)
+    throw std::invalid_argument("users should be positive.");
+  if (not (options_.zipf_s >= 0))
+    throw std::invalid_argument("zipf_s cannot be negative.");
+  CheckMix(options_.rounds, "rounds");
+  CheckMix(options_.pwd_sizes, "pwd_sizes");
+  for (const auto& [rounds, weight] : options_.rounds) {
+    if (rounds < 4 or rounds > 31)
+      throw std::invalid_argument("rounds should be in the range [4, 31].");
+  }
+  for (const auto& [size, weight] : options_.pwd_sizes) {
+    if (size == 0 or size > kMaxPwdSize)
+      throw std::invalid_argument("pwd_sizes should be in [1, 72].");
+  }
+  if (not IsFraction(options_.generate_fraction)
+      or not IsFraction(options_.wrong_fraction))
+    throw std::invalid_argument("fractions should be in [0, 1].");
+
+  users_.resize(options_.users);
+  user_cdf_.resize(options_.users);
+  double sum = 0;
+  for (std::size_t i = 0; i < options_.users; ++i) {
+    users_[i].rounds = Pick(options_.rounds, rng_);
+    users_[i].pwd_size = Pick(options_.pwd_sizes, rng_);
+    sum += std::pow(static_cast<double>(i + 1), -options_.zipf_s);
+    user_cdf_[i] = sum;
+  }
+}
+
+TrafficRequest
+TrafficModel::Next()
+{
+  TrafficRequest request;
+  now_ = NextArrival();
+  request.at = std::chrono::nanoseconds(static_cast<std::int64_t>(now_ * 1e9));
+
+  const auto x = std::uniform_real_distribution<double>(
+      0, user_cdf_.back())(rng_);
+  request.user = std::min<std::size_t>(
+      std::upper_bound(user_cdf_.begin(), user_cdf_.end(), x)
+          - user_cdf_.begin(),
+      users_.size() - 1);
+
+  std::uniform_real_distribution<double> unit(0, 1);
+  request.generate = unit(rng_) < options_.generate_fraction;
+  request.wrong = not request.generate
+      and unit(rng_) < options_.wrong_fraction;
+  return request;
+}
+
+double
+TrafficModel::NextArrival()
+{
+  if (options_.arrivals == Arrivals::kPoisson)
+    return now_ + Exponential(options_.rate, rng_);
+
+  // Arrivals only come during bursts, at burst_factor times the mean rate.
+  // Bursts then take 1 / burst_factor of the time, so quiet periods are
+  // burst_factor - 1 times as long as bursts.
+  const auto burst_rate = options_.rate * options_.burst_factor;
+  const auto burst_length =
+      std::chrono::duration<double>(options_.burst_length).count();
+  const auto quiet_length = burst_length * (options_.burst_factor - 1);
+  auto t = now_;
+  for (;;) {
+    if (not in_burst_) {
+      t = period_end_;
+      in_burst_ = true;
+      period_end_ = t + Exponential(1 / burst_length, rng_);
+    }
+    // Arrivals are memoryless, so the draw past the end of the burst can be
+    // dropped.
+    t += Exponential(burst_rate, rng_);
+    if (t <= period_end_) return t;
+    t = period_end_;
+    in_burst_ = false;
+    period_end_ = quiet_length > 0
+        ? t + Exponential(1 / quiet_length, rng_) : t;
+  }
+}
+
+} // namespace bcrypt
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace bcrypt {
+
+// How requests arrive over time.
+enum class Arrivals {
+  // Independent arrivals at a constant rate.
+  kPoisson,
+  // Poisson arrivals during bursts, with quiet periods in between, at the
+  // same mean rate as kPoisson.
+  kBursty,
+};
+
+// A model of login traffic, for load testing.
+struct TrafficOptions {
+  // Mean requests per second.
+  double rate = 100;
+
+  Arrivals arrivals = Arrivals::kPoisson;
+
+  // For kBursty, the rate during a burst over the mean rate, at least 1, and
+  // the mean length of a burst. Bursts and quiet periods have exponentially
+  // distributed lengths.
+  double burst_factor = 10;
+  std::chrono::milliseconds burst_length{100};
+
+  // Number of distinct users, and the exponent of the Zipf distribution of
+  // their requests: user k is picked with weight 1 / (k + 1)^zipf_s, so 0
+  // picks them uniformly and 1 makes a few users account for most requests.
+  std::size_t users = 10000;
+  double zipf_s = 1;
+
+  // Weighted mixes of the rounds and the password sizes of the users, e.g.
+  // {{10, 0.9}, {12, 0.1}}. Each user keeps the rounds and size it is given.
+  std::vector<std::pair<std::uint32_t, double>> rounds = {{10, 1}};
+  std::vector<std::pair<std::size_t, double>> pwd_sizes = {{12, 1}};
+
+  // Fraction of requests that hash a new password, e.g. sign-ups, rather than
+  // verify one.
+  double generate_fraction = 0;
+
+  // Fraction of verifications with a wrong password.
+  double wrong_fraction = 0.1;
+
+  std::uint64_t seed = 1;
+};
+
+// A user of the traffic.
+struct TrafficUser {
+  std::uint32_t rounds = 0;
+  std::size_t pwd_size = 0;
+};
+
+struct TrafficRequest {
+  // Time of the arrival since the start of the traffic.
+  std::chrono::nanoseconds at{0};
+  std::size_t user = 0;
+  // Whether to hash a new password for the user rather than verify one.
+  bool generate = false;
+  // Whether the password to verify is wrong.
+  bool wrong = false;
+};
+
+// Draws the requests of the traffic in the order they arrive. The sequence
+// only depends on the options, so runs are repeatable with the same seed.
+class TrafficModel {
+public:
+  // Throws std::invalid_argument if the rate is not positive, burst_factor is
+  // below 1, there are no users, a mix is empty or has no positive weight, a
+  // password size is 0 or over kMaxPwdSize, rounds are not in [4, 31], or a
+  // fraction is not in [0, 1].
+  explicit TrafficModel(TrafficOptions options);
+
+  const std::vector<TrafficUser>&
+  Users() const noexcept { return users_; }
+
+  TrafficRequest
+  Next();
+
+private:
+  // Returns the seconds since the start of the traffic at which the next
+  // request arrives.
+  double
+  NextArrival();
+
+  const TrafficOptions options_;
+  std::mt19937_64 rng_;
+  std::vector<TrafficUser> users_;
+  // Cumulative weights of the users.
+  std::vector<double> user_cdf_;
+  // Seconds since the start of the traffic of the last arrival, and of the
+  // end of the current burst or quiet period.
+  double now_ = 0;
+  double period_end_ = 0;
+  bool in_burst_ = false;
+};
+
+} // namespace bcrypt
@@ -0,0 +1,158 @@
+#include "traffic.h"
+
+#include <chrono>
+#include <cstddef>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+#include "gmock/gmock.h"
+
+namespace bcrypt {
+namespace {
+
+using ::testing::DoubleNear;
+
+constexpr std::size_t kRequests = 20000;
+
+std::vector<TrafficRequest>
+Draw(const TrafficOptions& options, std::size_t n = kRequests)
+{
+  TrafficModel model(options);
+  std::vector<TrafficRequest> requests;
+  for (std::size_t i = 0; i < n; ++i)
+    requests.push_back(model.Next());
+  return requests;
+}
+
+double
+Rate(const std::vector<TrafficRequest>& requests)
+{
+  const std::chrono::duration<double> span = requests.back().at;
+  return requests.size() / span.count();
+}
+
+TEST(TrafficModelTest, SameSeedSameTraffic) {
+  TrafficOptions options;
+  options.arrivals = Arrivals::kBursty;
+  const auto a = Draw(options, 100);
+  const auto b = Draw(options, 100);
+  for (std::size_t i = 0; i < a.size(); ++i) {
+    EXPECT_EQ(a[i].at, b[i].at);
+    EXPECT_EQ(a[i].user, b[i].user);
+    EXPECT_EQ(a[i].wrong, b[i].wrong);
+  }
+  options.seed = 2;
+  EXPECT_NE(Draw(options, 100).back().at, a.back().at);
+}
+
+TEST(TrafficModelTest, ArrivalsKeepTheMeanRate) {
+  TrafficOptions options;
+  options.rate = 500;
+  const auto poisson = Draw(options);
+  EXPECT_THAT(Rate(poisson), DoubleNear(500, 25));
+  for (std::size_t i = 1; i < poisson.size(); ++i)
+    ASSERT_GE(poisson[i].at, poisson[i - 1].at);
+
+  options.arrivals = Arrivals::kBursty;
+  options.burst_factor = 4;
+  options.burst_length = std::chrono::milliseconds(50);
+  const auto bursty = Draw(options, 5 * kRequests);
+  EXPECT_THAT(Rate(bursty), DoubleNear(500, 75));
+  for (std::size_t i = 1; i < bursty.size(); ++i)
+    ASSERT_GE(bursty[i].at, bursty[i - 1].at);
+}
+
+TEST(TrafficModelTest, BurstsAreBurstierThanPoisson) {
+  // Counts arrivals per 10ms window, whose variance over mean is 1 for
+  // Poisson arrivals and much more for bursts.
+  const auto dispersion = [](const std::vector<TrafficRequest>& requests) {
+    std::map<long, double> counts;
+    for (const auto& r : requests)
+      ++counts[r.at / std::chrono::milliseconds(10)];
+    const auto windows = static_cast<double>(
+        requests.back().at / std::chrono::milliseconds(10) + 1);
+    const auto mean = requests.size() / windows;
+    double var = (windows - counts.size()) * mean * mean;
+    for (const auto& [window, count] : counts)
+      var += (count - mean) * (count - mean);
+    return var / windows / mean;
+  };
+  TrafficOptions options;
+  options.rate = 1000;
+  EXPECT_LT(dispersion(Draw(options)), 1.5);
+  options.arrivals = Arrivals::kBursty;
+  EXPECT_GT(dispersion(Draw(options)), 3);
+}
+
+TEST(TrafficModelTest, ZipfFavorsTheFirstUsers) {
+  TrafficOptions options;
+  options.users = 100;
+  std::vector<double> counts(options.users);
+  for (const auto& r : Draw(options)) {
+    ASSERT_LT(r.user, options.users);
+    ++counts[r.user];
+  }
+  // With s = 1, user k is picked k + 1 times less often than user 0.
+  EXPECT_THAT(counts[0] / counts[1], DoubleNear(2, 0.3));
+  EXPECT_THAT(counts[0] / counts[9], DoubleNear(10, 3));
+
+  options.zipf_s = 0;
+  std::fill(counts.begin(), counts.end(), 0);
+  for (const auto& r : Draw(options))
+    ++counts[r.user];
+  EXPECT_THAT(counts[0] / counts[99], DoubleNear(1, 0.5));
+}
+
+TEST(TrafficModelTest, MixesAndFractions) {
+  TrafficOptions options;
+  options.users = 1000;
+  options.rounds = {{4, 3}, {6, 1}};
+  options.pwd_sizes = {{8, 1}, {72, 1}, {16, 0}};
+  options.generate_fraction = 0.2;
+  options.wrong_fraction = 0.5;
+  TrafficModel model(options);
+
+  std::map<std::uint32_t, double> rounds;
+  std::map<std::size_t, double> sizes;
+  for (const auto& user : model.Users()) {
+    ++rounds[user.rounds];
+    ++sizes[user.pwd_size];
+  }
+  EXPECT_THAT(rounds[4] / 1000, DoubleNear(0.75, 0.05));
+  EXPECT_THAT(sizes[8] / 1000, DoubleNear(0.5, 0.05));
+  EXPECT_EQ(sizes[16], 0);
+
+  double generated = 0;
+  double wrong = 0;
+  for (std::size_t i = 0; i < kRequests; ++i) {
+    const auto r = model.Next();
+    EXPECT_FALSE(r.generate and r.wrong);
+    generated += r.generate;
+    wrong += r.wrong;
+  }
+  EXPECT_THAT(generated / kRequests, DoubleNear(0.2, 0.02));
+  EXPECT_THAT(wrong / (kRequests - generated), DoubleNear(0.5, 0.02));
+}
+
+TEST(TrafficModelTest, InvalidOptions) {
+  const auto invalid = [](auto change) {
+    TrafficOptions options;
+    change(options);
+    EXPECT_THROW(TrafficModel{options}, std::invalid_argument);
+  };
+  invalid([](auto& o) { o.rate = 0; });
+  invalid([](auto& o) { o.burst_factor = 0.5; });
+  invalid([](auto& o) { o.users = 0; });
+  invalid([](auto& o) { o.zipf_s = -1; });
+  invalid([](auto& o) { o.rounds = {}; });
+  invalid([](auto& o) { o.rounds = {{3, 1}}; });
+  invalid([](auto& o) { o.rounds = {{10, 0}}; });
+  invalid([](auto& o) { o.pwd_sizes = {{73, 1}}; });
+  invalid([](auto& o) { o.pwd_sizes = {{0, 1}}; });
+  invalid([](auto& o) { o.wrong_fraction = 1.5; });
+  invalid([](auto& o) { o.generate_fraction = -0.1; });
+}
+
+} // namespace
+} // namespace bcrypt
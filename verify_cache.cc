@@ -0,0 +1,171 @@
+#include "verify_cache.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+
+#include "bcrypt.h"
+#include "metrics.h"
+#include "siphash.h"
+
+namespace bcrypt {
+
+SipDigest
+VerifyKey(
+    const SipKey& key, std::string_view pwd, const BcryptArr& arr) noexcept
+{
+  // The hash has a fixed size, so pwd followed by arr is unambiguous.
+  SipHasher mac(key);
+  mac.Update({reinterpret_cast<const std::uint8_t*>(pwd.data()), pwd.size()});
+  mac.Update(arr);
+  return mac.Finish();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// VerifyCache
+///////////////////////////////////////////////////////////////////////////////
+
+VerifyStatus
+VerifyCache::Verify(
+    const PwdHasher& pwd_hasher, std::string_view pwd, const BcryptArr& arr)
+{
+  const auto params = pwd.empty() ? std::nullopt : DecodeBcrypt(arr);
+  if (not params) {
+    RecordVerify(VerifyStatus::kInvalidHash);
+    return VerifyStatus::kInvalidHash;
+  }
+
+  if (const auto same = Lookup(pwd, arr)) {
+    ++hits_;
+    saved_cost_ += HashCost(params->rounds);
+    const auto status = *same ? VerifyStatus::kMatch : VerifyStatus::kMismatch;
+    RecordVerify(status);
+    RecordReusedVerify();
+    return status;
+  }
+  ++misses_;
+
+  const auto status = pwd_hasher.Verify(pwd, arr);
+  Insert(pwd, arr, status == VerifyStatus::kMatch);
+  return status;
+}
+
+VerifyCacheStats
+VerifyCache::Stats() const
+{
+  VerifyCacheStats stats;
+  stats.hits = hits_;
+  stats.misses = misses_;
+  stats.evictions = Evictions();
+  stats.entries = Size();
+  stats.saved_cost = saved_cost_;
+  return stats;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// LruVerifyCache
+///////////////////////////////////////////////////////////////////////////////
+
+LruVerifyCache::LruVerifyCache(LruVerifyCacheOptions options)
+  : LruVerifyCache(options, RandomSipKey())
+{}
+
+LruVerifyCache::LruVerifyCache(
+    LruVerifyCacheOptions options, const SipKey& key)
+  : mac_key_(key),
+    shard_capacity_(options.shards
+        ? std::max<std::size_t>(1, options.capacity / options.shards) : 0),
+    positive_ttl_(options.positive_ttl),
+    negative_ttl_(options.negative_ttl)
+{
+  if (options.shards == 0)
+    throw std::invalid_argument("shards should be positive.");
+  for (std::size_t i = 0; i < options.shards; ++i)
+    shards_.push_back(std::make_unique<Shard>());
+}
+
+LruVerifyCache::~LruVerifyCache()
+{
+  std::fill(mac_key_.begin(), mac_key_.end(), 0);
+}
+
+std::optional<bool>
+LruVerifyCache::Lookup(std::string_view pwd, const BcryptArr& arr)
+{
+  const auto key = VerifyKey(mac_key_, pwd, arr);
+  auto& shard = ShardOf(key);
+  std::lock_guard lock(shard.mutex);
+  const auto it = shard.index.find(key);
+  if (it == shard.index.end()) return std::nullopt;
+
+  const auto entry = it->second;
+  if (Clock::now() >= entry->expires) {
+    shard.entries.erase(entry);
+    shard.index.erase(it);
+    return std::nullopt;
+  }
+  shard.entries.splice(shard.entries.begin(), shard.entries, entry);
+  return entry->same;
+}
+
+void
+LruVerifyCache::Insert(std::string_view pwd, const BcryptArr& arr, bool same)
+{
+  const auto key = VerifyKey(mac_key_, pwd, arr);
+  const auto expires = Clock::now() + (same ? positive_ttl_ : negative_ttl_);
+  auto& shard = ShardOf(key);
+  std::lock_guard lock(shard.mutex);
+  if (const auto it = shard.index.find(key); it != shard.index.end()) {
+    const auto entry = it->second;
+    entry->same = same;
+    entry->expires = expires;
+    shard.entries.splice(shard.entries.begin(), shard.entries, entry);
+    return;
+  }
+
+  if (shard.entries.size() >= shard_capacity_) {
+    shard.index.erase(shard.entries.back().key);
+    shard.entries.pop_back();
+    ++shard.evictions;
+  }
+  shard.entries.push_front({key, same, expires});
+  shard.index.emplace(key, shard.entries.begin());
+}
+
+std::size_t
+LruVerifyCache::Size() const
+{
+  std::size_t size = 0;
+  for (const auto& shard : shards_) {
+    std::lock_guard lock(shard->mutex);
+    size += shard->entries.size();
+  }
+  return size;
+}
+
+std::uint64_t
+LruVerifyCache::Evictions() const
+{
+  std::uint64_t evictions = 0;
+  for (const auto& shard : shards_) {
+    std::lock_guard lock(shard->mutex);
+    evictions += shard->evictions;
+  }
+  return evictions;
+}
+
+LruVerifyCache::Shard&
+LruVerifyCache::ShardOf(const SipDigest& key) noexcept
+{
+  std::uint32_t h;
+  std::memcpy(&h, key.data(), sizeof(h));
+  return *shards_[h % shards_.size()];
+}
+
+} // namespace bcrypt
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "bcrypt.h"
+#include "siphash.h"
+
+namespace bcrypt {
+
+struct VerifyCacheStats {
+  std::uint64_t hits = 0;
+  std::uint64_t misses = 0;
+  std::uint64_t evictions = 0;
+
+  // Number of entries in the cache.
+  std::size_t entries = 0;
+
+  // Sum of the HashCost of the hashes that hits did not have to compute.
+  double saved_cost = 0;
+};
+
+// Returns the MAC of pwd and the stored hash arr under key, which identifies
+// a verification without keeping the password.
+SipDigest
+VerifyKey(
+    const SipKey& key, std::string_view pwd, const BcryptArr& arr) noexcept;
+
+// Remembers recent outcomes of verifying a password against a bcrypt hash, so
+// a client that authenticates with the same credential over and over only
+// pays for one hash. Entries are keyed by a keyed MAC of the password and
+// the stored hash, so no plaintext is kept, and an entry stops matching as
+// soon as the stored hash changes, e.g. after a password reset.
+class VerifyCache {
+public:
+  virtual ~VerifyCache() = default;
+
+  // Returns the cached outcome if there is one, and otherwise verifies with
+  // pwd_hasher and caches the outcome. Passwords and hashes that are not
+  // valid are not cached.
+  VerifyStatus
+  Verify(const PwdHasher& pwd_hasher, std::string_view pwd,
+         const BcryptArr& arr);
+
+  VerifyCacheStats
+  Stats() const;
+
+protected:
+  // Returns true or false if the outcome of verifying pwd against arr is
+  // cached.
+  virtual std::optional<bool>
+  Lookup(std::string_view pwd, const BcryptArr& arr) = 0;
+
+  virtual void
+  Insert(std::string_view pwd, const BcryptArr& arr, bool same) = 0;
+
+  virtual std::size_t
+  Size() const = 0;
+
+  virtual std::uint64_t
+  Evictions() const = 0;
+
+private:
+  std::atomic<std::uint64_t> hits_ = 0;
+  std::atomic<std::uint64_t> misses_ = 0;
+  std::atomic<double> saved_cost_ = 0;
+};
+
+struct LruVerifyCacheOptions {
+  // Most entries in the cache. Each shard holds an equal part.
+  std::size_t capacity = 1 << 16;
+
+  // Number of independently locked parts of the cache.
+  std::size_t shards = 16;
+
+  // How long matches and mismatches are remembered. Mismatches are kept for
+  // less time, so a user who mistypes and then fixes the stored hash out of
+  // band is not stuck, and guesses are not cheap to replay.
+  std::chrono::milliseconds positive_ttl = std::chrono::minutes(1);
+  std::chrono::milliseconds negative_ttl = std::chrono::seconds(10);
+};
+
+// A VerifyCache in the memory of the process. Each shard evicts its least
+// recently used entry when it is full, and entries expire after their TTL.
+// The MAC key is drawn at random when the cache is made, so the keys cannot
+// be computed, or used to guess passwords, outside of the process.
+class LruVerifyCache : public VerifyCache {
+public:
+  explicit LruVerifyCache(LruVerifyCacheOptions options = {});
+
+  // Uses the given MAC key instead of a random one.
+  LruVerifyCache(LruVerifyCacheOptions options, const SipKey& key);
+
+  ~LruVerifyCache() override;
+
+  LruVerifyCache(const LruVerifyCache&) = delete;
+  LruVerifyCache& operator=(const LruVerifyCache&) = delete;
+
+protected:
+  std::optional<bool>
+  Lookup(std::string_view pwd, const BcryptArr& arr) override;
+
+  void
+  Insert(std::string_view pwd, const BcryptArr& arr, bool same) override;
+
+  std::size_t
+  Size() const override;
+
+  std::uint64_t
+  Evictions() const override;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Entry {
+    SipDigest key;
+    bool same;
+    Clock::time_point expires;
+  };
+
+  struct Shard {
+    mutable std::mutex mutex;
+    // Most recently used first.
+    std::list<Entry> entries;
+    std::unordered_map<SipDigest, std::list<Entry>::iterator, SipDigestHash>
+        index;
+    std::uint64_t evictions = 0;
+  };
+
+  Shard&
+  ShardOf(const SipDigest& key) noexcept;
+
+  SipKey mac_key_;
+  const std::size_t shard_capacity_;
+  const Clock::duration positive_ttl_;
+  const Clock::duration negative_ttl_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+} // namespace bcrypt
@@ -0,0 +1,103 @@
+#include "verify_cache.h"
+
+#include <chrono>
+#include <thread>
+
+#include "bcrypt.h"
+#include "gmock/gmock.h"
+
+namespace bcrypt {
+namespace {
+
+using std::chrono::milliseconds;
+
+class LruVerifyCacheTest : public testing::Test {
+protected:
+  LruVerifyCacheTest()
+    : arr_(pwd_hasher_.Generate("password", 4))
+  {}
+
+  PwdHasher pwd_hasher_;
+  BcryptArr arr_;
+};
+
+TEST_F(LruVerifyCacheTest, HitsAfterFirstVerify) {
+  LruVerifyCache cache;
+  EXPECT_EQ(cache.Verify(pwd_hasher_, "password", arr_), VerifyStatus::kMatch);
+  EXPECT_EQ(cache.Verify(pwd_hasher_, "password", arr_), VerifyStatus::kMatch);
+  EXPECT_EQ(cache.Verify(pwd_hasher_, "wrong", arr_), VerifyStatus::kMismatch);
+  EXPECT_EQ(cache.Verify(pwd_hasher_, "wrong", arr_), VerifyStatus::kMismatch);
+
+  const auto stats = cache.Stats();
+  EXPECT_EQ(stats.hits, 2);
+  EXPECT_EQ(stats.misses, 2);
+  EXPECT_EQ(stats.entries, 2);
+  EXPECT_DOUBLE_EQ(stats.saved_cost, 2 * HashCost(4));
+}
+
+TEST_F(LruVerifyCacheTest, NewHashMisses) {
+  LruVerifyCache cache;
+  EXPECT_EQ(cache.Verify(pwd_hasher_, "password", arr_), VerifyStatus::kMatch);
+  // After a password change, the old password no longer matches.
+  const auto changed = pwd_hasher_.Generate("changed", 4);
+  EXPECT_EQ(cache.Verify(pwd_hasher_, "password", changed),
+            VerifyStatus::kMismatch);
+  EXPECT_EQ(cache.Stats().hits, 0);
+}
+
+TEST_F(LruVerifyCacheTest, InvalidHashIsNotCached) {
+  LruVerifyCache cache;
+  EXPECT_EQ(cache.Verify(pwd_hasher_, "password", BcryptArr{}),
+            VerifyStatus::kInvalidHash);
+  EXPECT_EQ(cache.Verify(pwd_hasher_, "", arr_), VerifyStatus::kInvalidHash);
+  EXPECT_EQ(cache.Stats().entries, 0);
+  EXPECT_EQ(cache.Stats().misses, 0);
+}
+
+TEST_F(LruVerifyCacheTest, EvictsLeastRecentlyUsed) {
+  LruVerifyCache cache({.capacity = 2, .shards = 1});
+  const auto other = pwd_hasher_.Generate("other", 4);
+  const auto third = pwd_hasher_.Generate("third", 4);
+  cache.Verify(pwd_hasher_, "password", arr_);
+  cache.Verify(pwd_hasher_, "other", other);
+  cache.Verify(pwd_hasher_, "password", arr_);
+  cache.Verify(pwd_hasher_, "third", third);
+
+  auto stats = cache.Stats();
+  EXPECT_EQ(stats.entries, 2);
+  EXPECT_EQ(stats.evictions, 1);
+
+  // "other" was evicted, "password" was not.
+  cache.Verify(pwd_hasher_, "password", arr_);
+  EXPECT_EQ(cache.Stats().hits, stats.hits + 1);
+  cache.Verify(pwd_hasher_, "other", other);
+  EXPECT_EQ(cache.Stats().misses, stats.misses + 1);
+}
+
+TEST_F(LruVerifyCacheTest, EntriesExpire) {
+  LruVerifyCache cache(
+      {.positive_ttl = milliseconds(1), .negative_ttl = milliseconds(1)});
+  cache.Verify(pwd_hasher_, "password", arr_);
+  std::this_thread::sleep_for(milliseconds(5));
+  cache.Verify(pwd_hasher_, "password", arr_);
+  EXPECT_EQ(cache.Stats().hits, 0);
+  EXPECT_EQ(cache.Stats().misses, 2);
+}
+
+TEST_F(LruVerifyCacheTest, MismatchesExpireFirst) {
+  LruVerifyCache cache(
+      {.positive_ttl = std::chrono::hours(1), .negative_ttl = milliseconds(1)});
+  cache.Verify(pwd_hasher_, "password", arr_);
+  cache.Verify(pwd_hasher_, "wrong", arr_);
+  std::this_thread::sleep_for(milliseconds(5));
+  cache.Verify(pwd_hasher_, "password", arr_);
+  cache.Verify(pwd_hasher_, "wrong", arr_);
+  EXPECT_EQ(cache.Stats().hits, 1);
+}
+
+TEST(LruVerifyCacheCtorTest, ThrowsWithoutShards) {
+  EXPECT_THROW(LruVerifyCache({.shards = 0}), std::invalid_argument);
+}
+
+} // namespace
+} // namespace bcrypt